@@ -0,0 +1,45 @@
+/*
+ * A/B image slots in the QSPI flash and the boot control record qspiboot starts from
+ *
+ * Each slot holds an XIP image linked for it (make XIP=1 SLOT=a|b). The in-application update (update.h) writes the
+ * slot that is not running and switches the record once the image CRC matches; qspiloader writes slot A and points
+ * the record to it.
+ *
+ * The record has two copies in two sectors at the end of the first 16MB. A write goes to the copy that is not the
+ * current one with a higher sequence number, a power loss mid-write leaves the previous record valid. No valid copy
+ * (blank flash, an image written before the slots existed) means slot A.
+ */
+#ifndef __BOOTCTL_H__
+#define __BOOTCTL_H__
+
+#include <sfud.h>
+#include <stdint.h>
+
+#define BOOTCTL_SLOT_SIZE 0x7F0000
+#define BOOTCTL_SLOT_B 0x800000 /* slot A starts at 0 */
+#define BOOTCTL_RECORD 0xFF0000 /* two 4K sectors */
+#define BOOTCTL_SECTOR 4096
+#define BOOTCTL_MAGIC 0x4C544342 /* "BCTL" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;        /* the highest valid one wins */
+    uint32_t slot;       /* 0 (A) or 1 (B) */
+    uint32_t image_size;
+    uint32_t image_crc;  /* CRC-32 of the image, checked before the record was written */
+    uint32_t crc;        /* CRC-32 of the fields above */
+} bootctl_t;
+
+/* flash offset of a slot */
+static inline uint32_t bootctl_slot_base(uint32_t slot) { return slot ? BOOTCTL_SLOT_B : 0; }
+
+/* current record through a memory-mapped lease, -1 when no copy is valid (*rec then selects slot A) */
+int bootctl_read(bootctl_t *rec);
+
+/* slot of the current record, 0 without one */
+uint32_t bootctl_active(void);
+
+/* make slot the one qspiboot starts */
+sfud_err bootctl_write(sfud_flash *flash, uint32_t slot, uint32_t image_size, uint32_t image_crc);
+
+#endif /* __BOOTCTL_H__ */
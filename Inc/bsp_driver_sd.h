@@ -63,6 +63,9 @@ uint8_t BSP_SD_WriteBlocks(uint32_t *pData, uint32_t WriteAddr, uint32_t NumOfBl
 uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint32_t ReadAddr, uint32_t NumOfBlocks);
 uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint32_t WriteAddr, uint32_t NumOfBlocks);
 uint8_t BSP_SD_Erase(uint32_t StartAddr, uint32_t EndAddr);
+uint8_t BSP_SD_Abort(void);
+uint8_t BSP_SD_WriteBlocksPreErased_DMA(uint32_t *pData, uint32_t WriteAddr, uint32_t NumOfBlocks);
+uint32_t BSP_SD_GetEraseUnit(void);
 uint8_t BSP_SD_GetCardState(void);
 void BSP_SD_GetCardInfo(BSP_SD_CardInfo *CardInfo);
 uint8_t BSP_SD_IsDetected(void);
@@ -72,6 +75,7 @@ uint8_t BSP_SD_IsDetected(void);
 void BSP_SD_AbortCallback(void);
 void BSP_SD_WriteCpltCallback(void);
 void BSP_SD_ReadCpltCallback(void);
+void BSP_SD_ErrorCallback(void);
 /* USER CODE END BSP_H_CODE */
 
 #ifdef __cplusplus
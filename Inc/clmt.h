@@ -0,0 +1,44 @@
+/*
+ * Cluster link map tables for random reads of large files (FatFs fast seek)
+ *
+ * f_lseek follows the FAT chain from the start of the file, or from the current cluster when seeking forward: a seek
+ * into a multi-GB capture walks thousands of FAT entries. clmt_open() opens a file for reading with a cluster link map
+ * table attached, one (length, start) pair per fragment, and f_lseek then finds a cluster in the few fragments of the
+ * file without touching the FAT.
+ *
+ * The tables live in a CLMT_POOL_WORDS pool and stay there after clmt_close(), found again by volume mount, start
+ * cluster and size, so opening the same file again costs no FAT walk. A table that does not fit evicts the least
+ * recently used ones not attached to an open file. A file that changed without a change of its size or start cluster
+ * keeps a stale table: whoever rewrites files in place calls clmt_invalidate().
+ *
+ * An exFAT file stored contiguously (no FAT chain) gets its one fragment table without any walk.
+ */
+#ifndef __CLMT_H__
+#define __CLMT_H__
+
+#include "ff.h"
+
+#include <stdint.h>
+
+#define CLMT_POOL_WORDS 2048 /* 8K, a file of n fragments takes 2n + 2 */
+#define CLMT_TABLES 16
+
+typedef struct {
+    uint32_t opens;
+    uint32_t hits;      /* table found in the pool */
+    uint32_t built;     /* FAT walks */
+    uint32_t evictions;
+    uint32_t too_big;   /* opened without a table, it did not fit in the pool */
+    uint32_t used;      /* pool words in use */
+    uint32_t tables;
+} clmt_stats_t;
+
+/* read only, with fast seek when the table fits */
+FRESULT clmt_open(FIL *fp, const TCHAR *path);
+FRESULT clmt_close(FIL *fp);
+
+void clmt_invalidate(void);
+
+void clmt_stats(clmt_stats_t *stats);
+
+#endif /* __CLMT_H__ */
@@ -0,0 +1,17 @@
+/*
+ * CRC-32 (IEEE 802.3, same value as zlib crc32()) computed by the CRC unit
+ *
+ * The unit is shared: every call programs it from scratch, so calls must not be interleaved between an interrupt and
+ * thread code. Chain calls by passing the previous result, start with 0.
+ */
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+
+static inline uint32_t crc32(const void *data, size_t size) { return crc32_update(0, data, size); }
+
+#endif /* __CRC32_H__ */
@@ -0,0 +1,18 @@
+/*
+ * DWT->CYCCNT extended to 64 bits
+ *
+ * The counter wraps every 8.9 s at 480 MHz. SysTick_Handler() folds it into the 64-bit count every millisecond, so a
+ * reader gets the right time however long it went without looking. Only interrupts masked for a whole wrap lose time.
+ */
+#ifndef __CYCLES_H__
+#define __CYCLES_H__
+
+#include <stdint.h>
+
+/* from SysTick_Handler() */
+void cycles_tick(void);
+
+/* core clock cycles since the counter was enabled, from any context */
+uint64_t cycles_now(void);
+
+#endif /* __CYCLES_H__ */
@@ -0,0 +1,88 @@
+/*
+ * Contiguous data logger on the SD card
+ *
+ * Producers (capture interrupts, the main loop) append records with datalog_write(), which neither blocks nor takes a
+ * lock: a record reserves its space in the current buffer with a compare-and-swap on the stream position, is copied
+ * and then commits its length. datalog_poll() in the main loop sends each full buffer straight to the sectors of a file
+ * allocated in one run with f_expand, with no FAT or directory update on the way. The directory entry holds the
+ * preallocated size until the file is closed with its real one. Files rotate when full or after a time limit. When
+ * the card falls behind by all the buffers, records are dropped and counted.
+ *
+ * A file is a sequence of DATALOG_BUFFER_SIZE blocks, each one a datalog_block_t header, DATALOG_PAYLOAD bytes of
+ * 8-byte aligned records closed by a pad record and a trailer of DATALOG_INDEX datalog_index_t entries, the time and
+ * payload offset of a record every DATALOG_PAYLOAD / DATALOG_INDEX bytes. The header and trailer are filled when the
+ * buffer goes to the card: a reader finds a time by bisecting the block headers of a file, then starts at the trailer
+ * entry before it (see logcat.h).
+ */
+#ifndef __DATALOG_H__
+#define __DATALOG_H__
+
+#include <stdint.h>
+
+#define DATALOG_BUFFERS 4
+#define DATALOG_BUFFER_SIZE (32 * 1024)
+#define DATALOG_MAX_DATA 2048
+#define DATALOG_INDEX 64
+#define DATALOG_MAGIC 0x31424c44 /* "DLB1" */
+
+enum { DATALOG_PAD, DATALOG_RS485, DATALOG_CAN, DATALOG_ETH, DATALOG_USER };
+
+typedef struct __attribute__((packed)) {
+    uint16_t size;  /* header and data, the next record starts 8-byte aligned */
+    uint8_t source; /* DATALOG_* */
+    uint8_t flags;
+    uint32_t time;  /* HAL_GetTick() */
+} datalog_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;      /* DATALOG_MAGIC */
+    uint32_t seq;        /* blocks since datalog_start(), across the files */
+    uint32_t first_time; /* of the first and last data records */
+    uint32_t last_time;
+    uint16_t records;    /* data records, the pads are not counted */
+    uint16_t entries;    /* trailer entries in use */
+    uint32_t used;       /* payload bytes before the closing pad */
+    uint32_t crc;        /* CRC-32 of the payload and the trailer */
+    uint32_t reserved;
+} datalog_block_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time;
+    uint32_t offset; /* of the record in the payload */
+} datalog_index_t;
+
+#define DATALOG_PAYLOAD (DATALOG_BUFFER_SIZE - sizeof(datalog_block_t) - DATALOG_INDEX * sizeof(datalog_index_t))
+
+typedef struct {
+    const char *prefix; /* files are <prefix>NNNNN.log in the root directory */
+    uint32_t file_size; /* preallocated bytes, a multiple of DATALOG_BUFFER_SIZE */
+    uint32_t rotate_ms; /* 0: rotate when full only */
+} datalog_config_t;
+
+typedef struct {
+    uint32_t records;
+    uint32_t bytes;        /* record data accepted */
+    uint32_t dropped;      /* records lost to full buffers */
+    uint32_t written;      /* buffers sent to the card */
+    uint32_t files;
+    uint32_t max_write_ms; /* slowest buffer write */
+    uint32_t max_open_ms;  /* slowest rotation */
+    int error;             /* FRESULT that stopped the logger */
+} datalog_stats_t;
+
+int datalog_start(const datalog_config_t *config);
+int datalog_stop(void);
+int datalog_running(void);
+
+/* from any context, 0 or -1 when the record was dropped */
+int datalog_write(uint8_t source, const void *data, uint32_t size);
+
+/* from the main loop */
+void datalog_poll(void);
+
+void datalog_stats(datalog_stats_t *stats);
+
+/* the file being written (locked to f_open), its first sector and the bytes on the card: NULL when none is open */
+const char *datalog_file(uint32_t *lba, uint32_t *bytes);
+
+#endif /* __DATALOG_H__ */
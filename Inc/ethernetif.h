@@ -25,7 +25,67 @@
 
 /* Within 'USER CODE' section, code will be kept by default at each generation */
 /* USER CODE BEGIN 0 */
+#include <stdint.h>
 
+/*
+ * Receive: the RX complete interrupt only flags the interface, ethernetif_input() then hands up to the budget of
+ * frames to the stack in one call and leaves the flag set when frames are left, so a burst drains in a few main loop
+ * turns and the loop is not held by a flood.
+ */
+#define ETH_RX_BUDGET 16
+
+/*
+ * RX buffers in D2 SRAM, more than the RX descriptors: a descriptor that receives a frame gets a free buffer at once
+ * and the frame stays in its own until the stack releases the pbuf. A burst is absorbed while the application holds
+ * pbufs; only with the pool empty are frames dropped (rx_nomem).
+ */
+#define ETH_RX_BUFFER_CNT 32
+
+/*
+ * Transmit: low_level_output() queues the frame on the TX ring and returns, its pbuf is referenced until the DMA is
+ * done with it, so several frames are on their way while the stack builds the next ones. A descriptor takes two
+ * buffers of a chain. A chain of more than ETH_TX_MAX_SEGMENTS buffers, or with data in DTCM where the DMA does not
+ * reach, is copied into one of ETH_TX_BOUNCE_CNT buffers in D2 SRAM. With the ring full the output waits for the DMA.
+ */
+#define ETH_TX_MAX_SEGMENTS 8
+#define ETH_TX_BOUNCE_CNT 4
+
+/*
+ * Checksums: the MAC inserts the IPv4 header and TCP/UDP/ICMP checksums of the frames it sends and checks those of
+ * the frames it receives, the frames with a bad one are dropped here. It cannot do the payload of a fragment: the
+ * stack checks a reassembled datagram and fills in the checksum of an ICMP reply sent in fragments. A UDP datagram
+ * sent in fragments goes without a checksum (0, allowed over IPv4).
+ */
+
+typedef struct {
+  uint32_t rx_frames;
+  uint32_t rx_polls;       /* ethernetif_input() calls with the interrupt flag set */
+  uint32_t rx_budget_hits; /* polls stopped by the budget */
+  uint32_t rx_max_batch;
+  uint32_t rx_nomem;       /* frames dropped without a custom pbuf */
+  uint32_t rx_oversize;    /* frames dropped over several descriptors, longer than the MTU */
+  uint32_t rx_overruns;    /* frames lost to a full MTL RX FIFO */
+  uint32_t rx_missed;      /* frames the DMA dropped */
+  uint32_t rx_starved;     /* receive buffer unavailable: no descriptor owned by the DMA */
+  uint32_t dma_errors;
+  uint32_t rx_pool_free;   /* RX buffers neither in a descriptor nor held by the stack */
+  uint32_t rx_pool_min;    /* lowest rx_pool_free seen */
+  uint32_t tx_frames;
+  uint32_t tx_bounced;     /* copied into a bounce buffer */
+  uint32_t tx_waits;       /* frames that waited for room on the ring */
+  uint32_t tx_dropped;     /* no room after the wait, or refused by the HAL */
+  uint32_t tx_inflight;    /* frames on the ring */
+  uint32_t tx_max_inflight;
+  uint32_t rx_csum_hw;     /* IPv4 frames whose checksums the MAC checked */
+  uint32_t rx_csum_sw;     /* left to the stack: fragments, payloads the MAC does not parse */
+  uint32_t rx_csum_errors; /* dropped on a bad IP header or payload checksum */
+  uint32_t tx_csum_hw;     /* IPv4 frames with the payload checksum inserted by the MAC */
+  uint32_t tx_csum_sw;     /* IP header only: fragments, payload checksum filled in by the stack */
+  uint32_t rx_crc_errors;  /* with rx_align_errors and tx_collisions: the signs of a duplex mismatch */
+  uint32_t rx_align_errors;
+  uint32_t tx_collisions;  /* frames aborted on a late or 16th collision (half duplex) */
+  uint32_t tx_carrier_errors;
+} ethernetif_stats_t;
 /* USER CODE END 0 */
 
 /* Exported functions ------------------------------------------------------- */
@@ -38,7 +98,15 @@ u32_t sys_jiffies(void);
 u32_t sys_now(void);
 
 /* USER CODE BEGIN 1 */
+/* frames per ethernetif_input() call, 1 to 255 */
+void ethernetif_set_budget(uint32_t budget);
+uint32_t ethernetif_budget(void);
+
+/* the mode the MAC runs at, 0 when it was not read from a PHY */
+int ethernetif_link(uint32_t *speed, int *full);
 
+void ethernetif_stats(ethernetif_stats_t *stats);
+void ethernetif_reset_stats(void);
 /* USER CODE END 1 */
 #endif
 
@@ -0,0 +1,38 @@
+/*
+ * Files sent to a transport from the FatFs sector buffer (f_forward)
+ *
+ * f_read copies a file into a caller buffer that the transport then copies again. fstream_send() lets FatFs read each
+ * sector into the buffer of the FIL and hands that window to the sink, which moves it once into the transport: the
+ * UART sends it as it is, USB CDC sends it and waits for the endpoint, TCP copies it into its segments. A window is
+ * only valid during the call, so the TCP data is copied and not referenced, its release would wait for an ACK while
+ * FatFs already reads the next sector into the same buffer.
+ *
+ * A sink that is busy stops the transfer at a sector boundary, fstream_send() runs the poll callback (the network
+ * stack, a cancel key) until it takes data again.
+ */
+#ifndef __FSTREAM_H__
+#define __FSTREAM_H__
+
+#include "ff.h"
+
+#include <stdint.h>
+
+#define FSTREAM_TCP_PORT 5556
+
+typedef struct {
+    UINT (*room)(void *ctx);                             /* bytes write() takes now, 0 when busy */
+    UINT (*write)(void *ctx, const BYTE *data, UINT n);  /* all n bytes or 0 on a failure */
+    void (*flush)(void *ctx);                            /* after the last window of a complete send, can be NULL */
+} fstream_sink_t;
+
+extern const fstream_sink_t fstream_uart; /* ctx: UART_HandleTypeDef */
+extern const fstream_sink_t fstream_usb;  /* ctx: NULL, the CDC port */
+extern const fstream_sink_t fstream_tcp;  /* ctx: struct tcp_pcb */
+
+/* size bytes from the file position, poll returns nonzero to give up, *sent is what the sink took */
+FRESULT fstream_send(FIL *fp, const fstream_sink_t *sink, void *ctx, FSIZE_t size, FSIZE_t *sent, int (*poll)(void));
+
+/* the whole file to the first client on a TCP port, 0 or -1 */
+int fstream_serve_tcp(FIL *fp, uint16_t port, int (*cancel)(void));
+
+#endif /* __FSTREAM_H__ */
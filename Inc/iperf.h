@@ -0,0 +1,81 @@
+/*
+ * Throughput test compatible with iperf 2 (TCP and UDP, server and client)
+ *
+ * The raw lwIP API, one server and one client at a time. They can run together (a server kept listening while a
+ * client measures another path). iperf_poll() from the main loop paces the UDP client, moves the TCP client's data
+ * and hands out the reports. A report covers each interval_ms of a test, and a final one covers all of it.
+ *
+ * The wire format is the one of iperf 2.0.x, so the board pairs with `iperf -s` or `iperf -c <board>` on a host:
+ *   TCP   the client opens with a 24-byte client header, flags 0 (no dual or tradeoff test), then sends data until
+ *         the time is up. The server counts whatever arrives, the header included.
+ *   UDP   each datagram starts with {id, tv_sec, tv_usec}, the id counting from 0. The client ends with negative ids
+ *         and waits for the server report: a datagram holding the server's byte count, lost, out-of-order and jitter
+ *         (RFC 1889 over the sender timestamps). The server resends that report for every negative id it gets.
+ *
+ * The TCP client sends from a static pattern without a copy. The UDP client chains that pattern after a pbuf that
+ * holds each datagram's header, so neither one copies the payload: the measure is the network path, not memcpy.
+ */
+#ifndef __IPERF_H__
+#define __IPERF_H__
+
+#include "lwip/ip_addr.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define IPERF_PORT 5001
+#define IPERF_LEN_TCP 1460      /* bytes per write, default */
+#define IPERF_LEN_UDP 1470      /* datagram payload, default */
+#define IPERF_LEN_MAX 1472      /* payload of a datagram that is not fragmented at a 1500 MTU */
+#define IPERF_RATE 1000000      /* UDP client, bit/s, default */
+#define IPERF_FIN_MS 250        /* UDP client: the last datagram is resent until the server reports */
+#define IPERF_FIN_TRIES 10
+#define IPERF_UDP_IDLE_MS 3000  /* UDP server: a test without datagrams for that long ends without its last ones */
+#define IPERF_DRAIN_MS 5000     /* TCP client: waiting for the ACK of the data sent before the time was up */
+
+typedef struct {
+    bool server;
+    bool udp;
+    ip_addr_t remote;     /* client */
+    uint16_t port;
+    uint32_t duration_ms; /* client */
+    uint32_t interval_ms; /* 0: final report only */
+    uint32_t rate;        /* UDP client, bit/s */
+    uint32_t len;         /* client, bytes per write or datagram */
+} iperf_config_t;
+
+typedef struct {
+    bool server;
+    bool udp;
+    bool final;
+    bool aborted;            /* final: the connection was refused or reset, or UDP data stopped without the last id */
+    uint32_t from_ms, to_ms; /* since the start of the test */
+    uint64_t bytes;          /* received by a server, acknowledged (TCP) or sent (UDP) by a client */
+    /* UDP: a server's own counters, or the server report in the final report of a client */
+    bool remote;             /* a client got the server report */
+    uint64_t remote_bytes;
+    uint32_t datagrams;      /* sent by a client, the highest id seen + 1 by a server */
+    uint32_t lost;
+    uint32_t out_of_order;
+    uint32_t jitter_us;
+    uint32_t errors;         /* client: datagrams or segments the stack refused (no memory), sent again later */
+} iperf_report_t;
+
+/* called from iperf_poll(), and from iperf_stop() for the final reports */
+typedef void (*iperf_report_fn)(const iperf_report_t *report);
+
+/* 0, -1 when the slot is taken or the stack is out of PCBs. A client connects or starts sending right away */
+int iperf_start(const iperf_config_t *config, iperf_report_fn report);
+
+/* the server, the client or both (server < 0), with the final report of a test under way */
+void iperf_stop(int server);
+
+bool iperf_running(bool server);
+
+void iperf_poll(void);
+
+/* a report as one line like iperf prints it, without the line end */
+void iperf_format(const iperf_report_t *report, char *buf, size_t size);
+
+#endif /* __IPERF_H__ */
@@ -0,0 +1,38 @@
+/*
+ * Time window reads of datalog files
+ *
+ * The blocks of a datalog file carry the time of their first and last records, so the block holding a time is found
+ * by bisecting the block headers: one sector read per step, log2(blocks) steps. Inside that block the trailer index
+ * gives the record to start from within DATALOG_PAYLOAD / DATALOG_INDEX bytes, then the records are read in order up
+ * to the end of the window. With a prefix the files <prefix>NNNNN.log are bisected first on the time of their first
+ * block, so a day of capture costs a few dozen sector reads before the first record of the window.
+ *
+ * Times are HAL_GetTick() of the logging session: a prefix holds one session, the logger numbers the files of a new
+ * one after the old ones and its times start again. A file ends at its first block with a bad magic or out of
+ * sequence, where the logger stopped without closing it. The file the logger is writing is read too, up to its last
+ * buffer on the card.
+ */
+#ifndef __LOGCAT_H__
+#define __LOGCAT_H__
+
+#include "datalog.h"
+#include "ff.h"
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t files;   /* opened */
+    uint32_t headers; /* block headers read while bisecting */
+    uint32_t blocks;  /* read for their records */
+    uint32_t records; /* in the window */
+    uint32_t bad;     /* blocks skipped on a CRC error */
+} logcat_stats_t;
+
+/* a record in the window, its data follows the header, nonzero stops the read */
+typedef int (*logcat_fn)(const datalog_record_t *record, void *ctx);
+
+/* name: a file ending in .log or a prefix, from <= time <= to, verify: check the block CRC (reads whole blocks) */
+FRESULT logcat(const char *name, uint32_t from, uint32_t to, int verify, logcat_fn fn, void *ctx,
+               logcat_stats_t *stats);
+
+#endif /* __LOGCAT_H__ */
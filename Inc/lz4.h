@@ -0,0 +1,13 @@
+/*
+ * LZ4 block decoder (no frame format, no dictionary)
+ */
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* decode one block, number of bytes written to dst or -1 when the block is corrupt or does not fit */
+int lz4_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+
+#endif /* __LZ4_H__ */
@@ -0,0 +1,60 @@
+/*
+ * RMII PHY on the MDIO bus: autonegotiation and link monitoring
+ *
+ * phy_init() finds the PHY (first address answering with an ID), resets it and starts autonegotiation of 10/100 half
+ * and full duplex. phy_poll(), every PHY_CHECK_MS from the main loop, reads the link and, once it is up, the mode it
+ * runs at: the speed indication register on the LAN8742A/LAN8720A and KSZ8081, the common abilities of both ends
+ * otherwise. ethernetif applies that mode to the MAC.
+ *
+ * A partner that does not autonegotiate (a port forced to 100 full) is only detected by its speed and the PHY runs
+ * half duplex: the link works, slowly, with late collisions here and CRC errors there. status.negotiated tells it.
+ *
+ * The link status bit latches low: a drop between two polls is counted even when the link is back at the next one.
+ */
+#ifndef __PHY_H__
+#define __PHY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PHY_CHECK_MS 100
+#define PHY_RESET_MS 500
+
+typedef struct {
+    bool found;
+    uint8_t addr;       /* MDIO address */
+    uint32_t id;        /* ID1 << 16 | ID2 */
+    const char *name;   /* NULL for a PHY without a speed indication register here */
+    bool link;
+    uint32_t speed;     /* Mb/s, with the link up */
+    bool full;
+    bool negotiated;    /* false: partner without autonegotiation (or forced here), see above */
+    uint16_t partner;   /* its abilities (ANLPAR) */
+} phy_status_t;
+
+typedef struct {
+    uint32_t polls;
+    uint32_t link_ups;
+    uint32_t link_downs;    /* with the drops seen only through the latch */
+    uint32_t parallel;      /* links up without autonegotiation */
+    uint32_t faults;        /* parallel detection faults: no single technology detected */
+    uint32_t remote_faults;
+    uint32_t jabbers;
+    uint32_t symbol_errors; /* counted by the PHY, when it has a counter */
+    uint32_t mdio_errors;
+} phy_stats_t;
+
+/* 0, -1 without a PHY on the bus */
+int phy_init(void);
+
+/* nonzero when the link went up or down, or came back in another mode, since the last call */
+int phy_poll(void);
+
+/* autonegotiation again, the link drops meanwhile */
+int phy_restart(void);
+
+void phy_status(phy_status_t *status);
+void phy_stats(phy_stats_t *stats);
+void phy_reset_stats(void);
+
+#endif /* __PHY_H__ */
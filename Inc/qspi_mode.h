@@ -0,0 +1,63 @@
+/*
+ * QSPI memory-mapped/indirect mode arbitration
+ *
+ * The QUADSPI controller is either memory-mapped (the flash reads like memory at QSPI_BASE) or in indirect mode
+ * (commands issued by the SFUD port: program, erase, register access). Code reading the mapped window takes a lease
+ * with qspi_mmap_acquire(); the controller stays memory-mapped while at least one lease is held.
+ *
+ * Indirect operations are bracketed by qspi_indirect_begin()/qspi_indirect_end(), the SFUD port does it from its
+ * lock and transfer hooks. The first begin aborts the memory-mapped mode (HAL_QSPI_Abort, no controller re-init) and
+ * the last end maps the flash again when leases are held, so readers only see the window vanish while a command runs.
+ * Brackets nest, a whole sfud_erase_write() costs a single switch. A caller starting an erase it does not wait for
+ * (sfud_erase_start()) keeps a bracket open until sfud_busy() reports the end, the flash is not mapped meanwhile.
+ *
+ * The mapped device is the one at SFUD_W25_DEVICE_INDEX, it must be initialized by sfud_init() before the first lease.
+ */
+#ifndef __QSPI_MODE_H__
+#define __QSPI_MODE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t leases;           /* memory-mapped readers holding the mode */
+    uint32_t enters;           /* switches to memory-mapped mode */
+    uint32_t aborts;           /* switches out of memory-mapped mode */
+    uint32_t failures;         /* switches refused by the controller */
+    uint64_t enter_cycles;     /* CPU cycles spent entering memory-mapped mode */
+    uint64_t abort_cycles;     /* CPU cycles spent aborting it */
+    uint64_t mapped_cycles;    /* CPU cycles with the flash memory-mapped */
+    uint64_t suspended_cycles; /* CPU cycles leases waited for indirect operations */
+    uint32_t suspended_max;    /* longest single wait, in CPU cycles */
+} qspi_mode_stats_t;
+
+/* take a memory-mapped lease, 0 when the flash is mapped on return, -1 while an indirect operation is outstanding */
+int qspi_mmap_acquire(void);
+
+/* drop a lease, the controller goes back to indirect mode with the last one */
+void qspi_mmap_release(void);
+
+/* true while the flash can be read at QSPI_BASE */
+bool qspi_mmap_active(void);
+
+/*
+ * The application executes in place from the mapped flash (make XIP=1): take a lease that is never dropped. Indirect
+ * operations are then only allowed with interrupts masked around them, the code they run must be in ITCM (the SFUD
+ * and QSPI HAL objects listed in itcm_qspi.ld); unmasked ones are refused, the HAL sees a memory-mapped controller
+ * and fails the command.
+ */
+void qspi_mode_adopt_xip(void);
+bool qspi_mode_is_xip(void);
+
+/* bracket an indirect operation, may be nested and called with interrupts disabled */
+void qspi_indirect_begin(void);
+void qspi_indirect_end(void);
+
+/*
+ * Copy of the counters. Cycle totals come from DWT->CYCCNT and are folded at every switch and every call here, a
+ * single period in one mode must stay below the counter wrap (about 8.9 s at 480MHz) to be accounted exactly.
+ */
+void qspi_mode_stats(qspi_mode_stats_t *stats);
+void qspi_mode_stats_reset(void);
+
+#endif /* __QSPI_MODE_H__ */
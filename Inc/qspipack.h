@@ -0,0 +1,40 @@
+/*
+ * Packed QSPI image, written by tools/qspipack/qspipack.py
+ *
+ * The image is cut in chunks of 1 << chunk_log2 bytes (the last one may be shorter). The file holds the header, the
+ * chunk table and the stored bytes of every chunk in order:
+ *
+ *   RAW  chunk bytes as is
+ *   LZ4  one LZ4 block (no frame) of the chunk
+ *   FILL nothing, the chunk is a run of the fill byte (erased areas and padding)
+ *   SKIP nothing, the flash already holds the chunk (delta image built against the flash hashes)
+ *
+ * All fields are little-endian. header_crc covers the header, with header_crc as zero, and the chunk table.
+ */
+#ifndef __QSPIPACK_H__
+#define __QSPIPACK_H__
+
+#include <stdint.h>
+
+#define QSPIPACK_MAGIC 0x314B5051 /* "QPK1" */
+
+enum { QSPIPACK_RAW = 0, QSPIPACK_LZ4 = 1, QSPIPACK_FILL = 2, QSPIPACK_SKIP = 3 };
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t image_size;  /* unpacked size */
+    uint32_t image_crc;   /* CRC-32 of the unpacked image */
+    uint16_t chunk_log2;  /* chunk size */
+    uint16_t chunk_count;
+    uint32_t header_crc;
+} qspipack_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;         /* QSPIPACK_RAW, QSPIPACK_LZ4, QSPIPACK_FILL or QSPIPACK_SKIP */
+    uint8_t fill;         /* QSPIPACK_FILL byte */
+    uint16_t reserved;
+    uint32_t stored_size; /* bytes in the file */
+    uint32_t crc;         /* CRC-32 of the unpacked chunk */
+} qspipack_chunk_t;
+
+#endif /* __QSPIPACK_H__ */
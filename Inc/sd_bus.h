@@ -0,0 +1,37 @@
+/*
+ * SDMMC1 bus width and clock, negotiated with the card after HAL_SD_Init()
+ *
+ * The card is switched to high speed (CMD6) when it supports it and clocked at the fastest rate the SDMMC kernel
+ * clock gives under the mode limit (25MHz default speed, 50MHz high speed). Above 25MHz the receive clock goes
+ * through the delay block, its phase is tuned on test reads. A CRC error steps the clock down and the transfer is
+ * retried.
+ */
+#ifndef __SD_BUS_H__
+#define __SD_BUS_H__
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t width;      /* data lines */
+    uint32_t clock_hz;   /* card clock */
+    uint32_t kernel_hz;  /* SDMMC kernel clock */
+    uint32_t max_hz;     /* manual limit, 0 when negotiated */
+    int high_speed;      /* card switched with CMD6 */
+    int phase;           /* delay block receive phase, -1 when bypassed */
+    uint32_t crc_errors;
+    uint32_t fallbacks;  /* clock steps down after CRC errors */
+} sd_bus_t;
+
+/* widest bus and fastest clock the card and the board take, 0 or -1 when the card fails even at the slowest */
+int sd_bus_negotiate(void);
+
+/* bring-up overrides, max_hz 0 negotiates again, both are kept over a card init */
+int sd_bus_set_width(uint32_t width);
+int sd_bus_set_clock(uint32_t max_hz);
+
+/* after a failed transfer: 0 when it was a CRC error and the clock went down, retry it */
+int sd_bus_recover(void);
+
+void sd_bus_info(sd_bus_t *info);
+
+#endif /* __SD_BUS_H__ */
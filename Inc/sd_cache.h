@@ -0,0 +1,41 @@
+/*
+ * Write-back sector cache between FatFs and SD_Driver
+ *
+ * Small writes (FAT, directory entries, partial clusters) land in the cache and go to the card on CTRL_SYNC
+ * (f_sync, f_close) or when a dirty sector has to be evicted: the dirty sectors are sorted and adjacent ones written
+ * with one multi-block command. Small reads of a sequential stream read ahead. Transfers of SD_CACHE_BYPASS sectors
+ * or more go straight to the card.
+ */
+#ifndef __SD_CACHE_H__
+#define __SD_CACHE_H__
+
+#include "ff_gen_drv.h"
+
+#include <stdint.h>
+
+#define SD_CACHE_SECTORS 64
+#define SD_CACHE_BYPASS 8
+
+typedef struct {
+    uint32_t read_hits;
+    uint32_t read_misses;
+    uint32_t read_ahead;   /* sectors read before they were asked for */
+    uint32_t writes;       /* sectors written into the cache */
+    uint32_t write_hits;   /* of them, rewrites of a sector still dirty */
+    uint32_t syncs;
+    uint32_t evictions;    /* flushes forced by a full cache */
+    uint32_t flush_writes; /* write commands issued by flushes */
+    uint32_t flushed;      /* sectors they carried */
+    uint32_t bypassed;     /* sectors transferred around the cache */
+    uint32_t dirty;        /* sectors not on the card yet */
+} sd_cache_stats_t;
+
+extern const Diskio_drvTypeDef SD_Cache_Driver;
+
+void sd_cache_stats(sd_cache_stats_t *stats);
+void sd_cache_reset_stats(void);
+
+/* forget every sector, dirty ones included (card removed) */
+void sd_cache_invalidate(void);
+
+#endif /* __SD_CACHE_H__ */
@@ -0,0 +1,33 @@
+/*
+ * FAT format of the SD card laid out on its erase blocks
+ *
+ * The MBR partition starts and ends on an erase block (the allocation unit from the SD status, GET_BLOCK_SIZE) and
+ * f_mkfs moves the FAT so the data area starts on one as well: a cluster never straddles two allocation units and a
+ * sequential file fills them whole, the case the card's write speed class is specified for.
+ */
+#ifndef __SD_FORMAT_H__
+#define __SD_FORMAT_H__
+
+#include "ff.h"
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t erase_block; /* sectors */
+    uint32_t volume_start;
+    uint32_t volume_size;
+    uint32_t fat_start;
+    uint32_t fat_size;
+    uint32_t data_start;
+    uint32_t cluster; /* sectors */
+    uint32_t clusters;
+    uint8_t fs_type;  /* FS_FAT12, FS_FAT16, FS_FAT32 or FS_EXFAT */
+} sd_format_layout_t;
+
+/* new partition table and FAT volume, cluster_bytes 0 picks the FatFs default for the size */
+FRESULT sd_format(uint32_t cluster_bytes);
+
+/* layout of the volume on the card, mounted for the call */
+FRESULT sd_format_layout(sd_format_layout_t *layout);
+
+#endif /* __SD_FORMAT_H__ */
@@ -0,0 +1,30 @@
+/*
+ * SD card benchmark for card qualification
+ *
+ * Raw tests go through SD_Driver (the IDMA path, no sector cache) on the last SDBENCH_RAW_AREA bytes of the card:
+ * sequential and random transfers over several block counts. File tests write and read a file through FatFs over
+ * several chunk sizes, with the clusters allocated up front or on the way. Every operation is timed: the report has
+ * throughput, IOPS and latency percentiles per test, the worst write stall, then the same rows as CSV.
+ *
+ * The seek test reads random sectors of an existing file after a plain f_lseek, which follows the FAT chain, and then
+ * with the cluster link map table of clmt.h, including the cost of building the table and of finding it again.
+ */
+#ifndef __SDBENCH_H__
+#define __SDBENCH_H__
+
+#include <stdint.h>
+
+#define SDBENCH_RAW_AREA (64 * 1024 * 1024)
+
+typedef struct {
+    int raw;            /* raw block tests */
+    int raw_write;      /* with writes: the data in the raw area is lost */
+    int file;           /* FatFs tests */
+    uint32_t file_size; /* bytes per file test */
+} sdbench_opts_t;
+
+int sdbench(const sdbench_opts_t *opts);
+
+int sdbench_seek(const char *path, uint32_t seeks);
+
+#endif /* __SDBENCH_H__ */
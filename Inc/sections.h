@@ -0,0 +1,18 @@
+#ifndef __SECTIONS_H__
+#define __SECTIONS_H__
+
+/*
+ * Code copied to ITCM by the startup code (zero wait state, no QSPI or flash fetch).
+ *
+ * Use it for code that must not run from the memory-mapped QSPI in XIP builds, or that is hot and not listed in
+ * itcm_hot.ld. Calls between ITCM and QSPI are out of BL range and go through linker veneers.
+ */
+#define ITCM_FUNC __attribute__((section(".itcm"), noinline))
+
+/*
+ * Buffers too large for DTCM, in AXI SRAM (RAM_D1). Not cleared at startup. The D-cache covers them: clean or
+ * invalidate around DMA, CPU-only users need nothing.
+ */
+#define AXISRAM_BSS __attribute__((section(".axisram"), aligned(32)))
+
+#endif /* __SECTIONS_H__ */
@@ -191,8 +191,9 @@ extern "C" {
 #define USE_HAL_WWDG_REGISTER_CALLBACKS 0U    /* WWDG register callback disabled    */
 
 /* ########################### Ethernet Configuration ######################### */
-#define ETH_TX_DESC_CNT 4 /* number of Ethernet Tx DMA descriptors */
-#define ETH_RX_DESC_CNT 4 /* number of Ethernet Rx DMA descriptors */
+/* the RX buffers are a pool of their own, ETH_RX_BUFFER_CNT in ethernetif.h */
+#define ETH_TX_DESC_CNT 16 /* number of Ethernet Tx DMA descriptors */
+#define ETH_RX_DESC_CNT 16 /* number of Ethernet Rx DMA descriptors */
 
 #define ETH_MAC_ADDR0 ((uint8_t)0x02)
 #define ETH_MAC_ADDR1 ((uint8_t)0x00)
@@ -0,0 +1,59 @@
+/*
+ * In-application update of the QSPI flash, into the A/B slot that is not running (bootctl.h)
+ *
+ * The stream is an update_header_t followed by the plain binary of an XIP image linked for that slot (make XIP=1
+ * SLOT=a|b, tools/qspiupdate sends it). A transport hands the bytes over with update_feed() as update_space() allows
+ * and calls update_poll() from its loop. The flash work is cut in short steps so the transport keeps running:
+ *
+ *   two 64K buffers, one fills from the transport while the other is programmed
+ *   the flash erases ahead of the data whenever it has nothing to program, so a full buffer finds its block erased;
+ *   an XIP image cannot run while the flash erases: it erases a block per poll with interrupts masked instead and
+ *   the transport stalls for each erase (stall_ms)
+ *   the transport is held back (TCP window, USB NAK) only while both buffers are full
+ *   at the end the slot is read back through the memory-mapped window and checked against image_crc, then the boot
+ *   control record switches to it
+ */
+#ifndef __UPDATE_H__
+#define __UPDATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UPDATE_MAGIC 0x44505551 /* "QUPD" */
+#define UPDATE_TCP_PORT 5555
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t image_size;
+    uint32_t image_crc; /* CRC-32 (zlib) of the image */
+} update_header_t;
+
+enum { UPDATE_FAILED = -1, UPDATE_DONE = 0, UPDATE_RUNNING = 1 };
+
+typedef struct {
+    uint32_t slot;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t total_ms;      /* header to switched record */
+    uint32_t receive_ms;    /* first to last image byte */
+    uint32_t erase_ms;      /* flash busy erasing */
+    uint32_t program_ms;    /* flash programming */
+    uint32_t verify_ms;     /* read back and CRC */
+    uint32_t erase_wait_ms; /* data ready, its block not erased yet */
+    uint32_t full_ms;       /* both buffers full, transport held back */
+    uint32_t stall_ms;      /* XIP: erases waited for with interrupts masked, nothing else ran */
+} update_stats_t;
+
+/* start an update of the slot that is not running, the flash must be initialized */
+int update_begin(void);
+size_t update_space(void);
+size_t update_feed(const void *data, size_t size);
+int update_poll(void);
+void update_abort(void);
+void update_stats(update_stats_t *stats);
+
+/* run a whole update over a transport until done, failed or cancel() returns true */
+int update_tcp(uint16_t port, int (*cancel)(void));
+int update_usb(int (*cancel)(void));
+
+#endif /* __UPDATE_H__ */
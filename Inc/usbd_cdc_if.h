@@ -106,6 +106,13 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t *Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+/*
+ * Packet mode: received packets are handed over as is and the OUT endpoint is only re-armed by CDC_releasePacket(),
+ * the host is NAKed meanwhile (flow control for bulk streams). CDC_getByte() sees nothing while it is on.
+ */
+void CDC_setPacketMode(int on);
+int CDC_getPacket(uint8_t **buf, uint32_t *len);
+void CDC_releasePacket(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
@@ -0,0 +1,56 @@
+/*
+ * FatFs volumes mounted once and kept mounted
+ *
+ * volume_mount() initializes the drive and mounts the volume on first use only, later calls return at once with the
+ * mounted FATFS, its free cluster count (FSINFO on FAT32, a FAT scan once otherwise) and the FatFs window still valid.
+ * volume_poll() watches each drive from the main loop every VOLUME_CHECK_MS: its card detect when it has one, else
+ * the card status (CMD13) of an initialized drive. A card gone is unmounted, its cached sectors dropped and the drive
+ * initialized again on the next volume_mount(). With card detect a card put in is initialized at once, without it the
+ * next volume_mount() picks the new card up.
+ *
+ * Volumes are the FatFs logical drives, "0:" ... up to _VOLUMES, each registered with its FATFS object.
+ */
+#ifndef __VOLUME_H__
+#define __VOLUME_H__
+
+#include "ff.h"
+
+#include <stdint.h>
+
+#define VOLUME_CHECK_MS 500
+#define VOLUME_MISSES 2 /* status checks failed in a row before the card counts as removed */
+
+enum { VOLUME_EMPTY, VOLUME_READY, VOLUME_MOUNTED };
+
+typedef struct {
+    uint8_t state;          /* VOLUME_*: no card seen, drive initialized, mounted */
+    uint8_t fs_type;        /* FS_* when mounted */
+    uint32_t mounts;        /* real mounts, each one reads the boot sector and FSINFO */
+    uint32_t removals;
+    uint32_t insertions;    /* seen by card detect */
+    DWORD free_clusters;    /* 0xFFFFFFFF until known */
+    DWORD cluster_sectors;
+    uint32_t mount_ms;      /* duration of the last mount */
+    int error;              /* FRESULT of the last mount */
+} volume_info_t;
+
+/* detected: card detect, nonzero when a card is in, NULL without one */
+int volume_register(const char *path, FATFS *fs, uint8_t (*detected)(void));
+
+/* drive initialized, for raw access and card information: 0 or -1 */
+int volume_card(const char *path);
+
+FRESULT volume_mount(const char *path);
+
+/* unmounts after the volume changed under FatFs (format, raw writes), the next volume_mount() reads it again */
+void volume_release(const char *path);
+
+/* free clusters, counted once per mount and then kept up to date by FatFs */
+FRESULT volume_free(const char *path, DWORD *clusters);
+
+/* from the main loop */
+void volume_poll(void);
+
+int volume_info(const char *path, volume_info_t *info);
+
+#endif /* __VOLUME_H__ */
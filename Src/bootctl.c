@@ -0,0 +1,60 @@
+#include <bootctl.h>
+
+#include <crc32.h>
+#include <qspi_mode.h>
+#include <stm32h7xx_hal.h>
+
+#include <stddef.h>
+#include <string.h>
+
+static int valid(const bootctl_t *r)
+{
+    return r->magic == BOOTCTL_MAGIC && r->slot < 2 && r->crc == crc32(r, offsetof(bootctl_t, crc));
+}
+
+/* copy index of the current record, -1 without one */
+static int read_copies(bootctl_t *rec)
+{
+    bootctl_t copy[2];
+    int current = -1;
+
+    if (qspi_mmap_acquire() != 0)
+        return -1;
+    memcpy(&copy[0], (const void *)(QSPI_BASE + BOOTCTL_RECORD), sizeof(copy[0]));
+    memcpy(&copy[1], (const void *)(QSPI_BASE + BOOTCTL_RECORD + BOOTCTL_SECTOR), sizeof(copy[1]));
+    qspi_mmap_release();
+
+    for (int i = 0; i < 2; i++)
+        if (valid(&copy[i]) && (current < 0 || (int32_t)(copy[i].seq - copy[current].seq) > 0))
+            current = i;
+    if (current >= 0)
+        *rec = copy[current];
+    return current;
+}
+
+int bootctl_read(bootctl_t *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    return read_copies(rec) < 0 ? -1 : 0;
+}
+
+uint32_t bootctl_active(void)
+{
+    bootctl_t rec;
+    return bootctl_read(&rec) == 0 ? rec.slot : 0;
+}
+
+sfud_err bootctl_write(sfud_flash *flash, uint32_t slot, uint32_t image_size, uint32_t image_crc)
+{
+    bootctl_t rec = {0};
+    int current = read_copies(&rec);
+    uint32_t addr = BOOTCTL_RECORD + (current == 0 ? BOOTCTL_SECTOR : 0);
+
+    rec.magic = BOOTCTL_MAGIC;
+    rec.seq = current < 0 ? 1 : rec.seq + 1;
+    rec.slot = slot;
+    rec.image_size = image_size;
+    rec.image_crc = image_crc;
+    rec.crc = crc32(&rec, offsetof(bootctl_t, crc));
+    return sfud_erase_write(flash, addr, sizeof(rec), (const uint8_t *)&rec);
+}
@@ -18,9 +18,11 @@
 
 /* USER CODE BEGIN FirstSection */
 /* can be used to modify / undefine following code or add new definitions */
+#include "main.h"
 /* USER CODE END FirstSection */
 /* Includes ------------------------------------------------------------------*/
 #include "bsp_driver_sd.h"
+#include "sd_bus.h"
 
 /* Extern variables ---------------------------------------------------------*/ 
   
@@ -43,6 +45,11 @@ uint8_t BSP_SD_Init(void)
   }
   /* HAL SD initialization */
   sd_state = HAL_SD_Init(&hsd1);
+  /* Bus width and clock */
+  if (sd_state == MSD_OK && sd_bus_negotiate() != 0)
+  {
+    sd_state = MSD_ERROR;
+  }
 
   return sd_state;
 }
@@ -234,6 +241,16 @@ void HAL_SD_RxCpltCallback(SD_HandleTypeDef *hsd)
   BSP_SD_ReadCpltCallback();
 }
 
+/**
+  * @brief SD error callback
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+  BSP_SD_ErrorCallback();
+}
+
 /* USER CODE BEGIN CallBacksSection_C */
 /**
   * @brief BSP SD Abort callback
@@ -260,6 +277,15 @@ __weak void BSP_SD_WriteCpltCallback(void)
 __weak void BSP_SD_ReadCpltCallback(void)
 {
 
+}
+
+/**
+  * @brief BSP SD transfer error callback
+  * @retval None
+  */
+__weak void BSP_SD_ErrorCallback(void)
+{
+
 }
 /* USER CODE END CallBacksSection_C */
 
@@ -273,14 +299,163 @@ uint8_t BSP_SD_IsDetected(void)
   __IO uint8_t status = SD_PRESENT;
 
   /* USER CODE BEGIN IsDetectedSection */
-  /* user code can be inserted here */
+  /* the slot switch pulls SDMMC_CD (PC10) low with a card in, the pull-up set in MX_SDMMC1_SD_Init() otherwise */
+  if (HAL_GPIO_ReadPin(SDMMC_CD_GPIO_Port, SDMMC_CD_Pin) != GPIO_PIN_RESET)
+  {
+    status = SD_NOT_PRESENT;
+  }
   /* USER CODE END IsDetectedSection */
 
   return status;
 }
 
 /* USER CODE BEGIN AdditionalCode */
-/* user code can be inserted here */
+/* R1 response of the last command, SDMMC_GetCmdResp1() is private to the LL driver */
+static uint8_t BSP_SD_GetResp1(uint8_t CmdIndex)
+{
+  uint32_t tickstart = HAL_GetTick();
+  uint32_t sta;
+
+  do
+  {
+    if (HAL_GetTick() - tickstart >= SDMMC_CMDTIMEOUT)
+    {
+      return MSD_ERROR;
+    }
+    sta = hsd1.Instance->STA;
+  } while (!(sta & (SDMMC_FLAG_CCRCFAIL | SDMMC_FLAG_CMDREND | SDMMC_FLAG_CTIMEOUT)) || (sta & SDMMC_FLAG_CMDACT));
+  __HAL_SD_CLEAR_FLAG(&hsd1, SDMMC_STATIC_CMD_FLAGS);
+
+  if (!(sta & SDMMC_FLAG_CMDREND) || SDMMC_GetCommandResponse(hsd1.Instance) != CmdIndex)
+  {
+    return MSD_ERROR;
+  }
+  return (SDMMC_GetResponse(hsd1.Instance, SDMMC_RESP1) & SDMMC_OCR_ERRORBITS) ? MSD_ERROR : MSD_OK;
+}
+
+/**
+  * @brief  Writes block(s) in DMA transfer mode, the count announced with
+  *         ACMD23 right before the CMD25 so the card erases the blocks ahead
+  *         of the data. HAL_SD_WriteBlocks_DMA() sends CMD16 in between, this
+  *         is its multiple block path with CMD16 moved first.
+  * @param  pData: Pointer to the buffer that will contain the data to transmit
+  * @param  WriteAddr: Address from where data is to be written
+  * @param  NumOfBlocks: Number of SD blocks to write, more than one
+  * @retval SD status
+  */
+uint8_t BSP_SD_WriteBlocksPreErased_DMA(uint32_t *pData, uint32_t WriteAddr, uint32_t NumOfBlocks)
+{
+  SDMMC_DataInitTypeDef config;
+  SDMMC_CmdInitTypeDef cmd;
+  uint32_t add = WriteAddr;
+  uint32_t errorstate;
+
+  if (hsd1.State != HAL_SD_STATE_READY || WriteAddr + NumOfBlocks > hsd1.SdCard.LogBlockNbr)
+  {
+    return MSD_ERROR;
+  }
+  hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+  hsd1.State = HAL_SD_STATE_BUSY;
+  hsd1.Instance->DCTRL = 0U;
+  hsd1.pTxBuffPtr = (uint8_t *)pData;
+  hsd1.TxXferSize = BLOCKSIZE * NumOfBlocks;
+  if (hsd1.SdCard.CardType != CARD_SDHC_SDXC)
+  {
+    add *= BLOCKSIZE;
+  }
+
+  errorstate = SDMMC_CmdBlockLength(hsd1.Instance, BLOCKSIZE);
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    errorstate = SDMMC_CmdAppCommand(hsd1.Instance, (uint32_t)hsd1.SdCard.RelCardAdd << 16);
+  }
+  if (errorstate == HAL_SD_ERROR_NONE)
+  {
+    cmd.Argument = NumOfBlocks & 0x7FFFFF;
+    cmd.CmdIndex = SDMMC_CMD_SET_BLOCK_COUNT;
+    cmd.Response = SDMMC_RESPONSE_SHORT;
+    cmd.WaitForInterrupt = SDMMC_WAIT_NO;
+    cmd.CPSM = SDMMC_CPSM_ENABLE;
+    (void)SDMMC_SendCommand(hsd1.Instance, &cmd);
+    if (BSP_SD_GetResp1(SDMMC_CMD_SET_BLOCK_COUNT) != MSD_OK)
+    {
+      errorstate = HAL_SD_ERROR_GENERAL_UNKNOWN_ERR;
+    }
+  }
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    __HAL_SD_CLEAR_FLAG(&hsd1, SDMMC_STATIC_FLAGS);
+    hsd1.ErrorCode |= errorstate;
+    hsd1.State = HAL_SD_STATE_READY;
+    return MSD_ERROR;
+  }
+
+  config.DataTimeOut = SDMMC_DATATIMEOUT;
+  config.DataLength = BLOCKSIZE * NumOfBlocks;
+  config.DataBlockSize = SDMMC_DATABLOCK_SIZE_512B;
+  config.TransferDir = SDMMC_TRANSFER_DIR_TO_CARD;
+  config.TransferMode = SDMMC_TRANSFER_MODE_BLOCK;
+  config.DPSM = SDMMC_DPSM_DISABLE;
+  (void)SDMMC_ConfigData(hsd1.Instance, &config);
+  __HAL_SD_ENABLE_IT(&hsd1, (SDMMC_IT_DCRCFAIL | SDMMC_IT_DTIMEOUT | SDMMC_IT_TXUNDERR | SDMMC_IT_DATAEND));
+  __SDMMC_CMDTRANS_ENABLE(hsd1.Instance);
+  hsd1.Instance->IDMABASE0 = (uint32_t)pData;
+  hsd1.Instance->IDMACTRL = SDMMC_ENABLE_IDMA_SINGLE_BUFF;
+
+  /* HAL_SD_IRQHandler() finishes it: CMD12 on DATAEND, then BSP_SD_WriteCpltCallback() */
+  hsd1.Context = SD_CONTEXT_WRITE_MULTIPLE_BLOCK | SD_CONTEXT_DMA;
+  errorstate = SDMMC_CmdWriteMultiBlock(hsd1.Instance, add);
+  if (errorstate != HAL_SD_ERROR_NONE)
+  {
+    __HAL_SD_CLEAR_FLAG(&hsd1, SDMMC_STATIC_FLAGS);
+    __HAL_SD_DISABLE_IT(&hsd1, (SDMMC_IT_DCRCFAIL | SDMMC_IT_DTIMEOUT | SDMMC_IT_TXUNDERR | SDMMC_IT_DATAEND));
+    hsd1.ErrorCode |= errorstate;
+    hsd1.State = HAL_SD_STATE_READY;
+    hsd1.Context = SD_CONTEXT_NONE;
+    return MSD_ERROR;
+  }
+  return MSD_OK;
+}
+
+/**
+  * @brief  Aborts an ongoing DMA transfer.
+  * @retval SD status
+  */
+uint8_t BSP_SD_Abort(void)
+{
+  return HAL_SD_Abort(&hsd1) == HAL_OK ? MSD_OK : MSD_ERROR;
+}
+
+/**
+  * @brief  Gets the erase unit of the card: the allocation unit (AU_SIZE) of the
+  *         SD status, or the erase sector of the CSD on a standard capacity card
+  *         that reports none.
+  * @retval Erase unit in SD blocks, 0 when unknown
+  */
+uint32_t BSP_SD_GetEraseUnit(void)
+{
+  /* AU_SIZE 1h..Ah double from 16KB, then 12, 16, 24, 32 and 64MB */
+  static const uint32_t au_blocks[16] = {
+    0, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 24576, 32768, 49152, 65536, 131072,
+  };
+  HAL_SD_CardStatusTypeDef status;
+  HAL_SD_CardCSDTypeDef csd;
+
+  if (HAL_SD_GetCardStatus(&hsd1, &status) == HAL_OK && status.AllocationUnitSize != 0)
+  {
+    return au_blocks[status.AllocationUnitSize];
+  }
+  if (HAL_SD_GetCardCSD(&hsd1, &csd) != HAL_OK || csd.CSDStruct != 0)
+  {
+    return 0;
+  }
+  /* ERASE_BLK_EN: any block erases alone, else SECTOR_SIZE + 1 write blocks at once */
+  if (csd.EraseGrSize)
+  {
+    return 1;
+  }
+  return ((uint32_t)(csd.EraseGrMul + 1) << csd.MaxWrBlockLen) / BLOCKSIZE;
+}
 /* USER CODE END AdditionalCode */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
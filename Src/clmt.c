@@ -0,0 +1,198 @@
+#include <clmt.h>
+
+#include <string.h>
+
+#define SECTOR 512
+
+typedef struct {
+    FATFS *fs;
+    WORD id;        /* mount */
+    DWORD sclust;
+    FSIZE_t size;
+    uint32_t offset; /* in the pool */
+    uint32_t words;  /* 0: free */
+    uint32_t used;   /* LRU stamp */
+    FIL *fp;         /* attached to */
+} table_t;
+
+static DWORD pool[CLMT_POOL_WORDS];
+static table_t tables[CLMT_TABLES];
+static uint32_t top; /* tables are packed from the start of the pool */
+static uint32_t stamp;
+static clmt_stats_t stats;
+
+static table_t *lookup(const FIL *fp)
+{
+    for (int i = 0; i < CLMT_TABLES; i++) {
+        table_t *t = &tables[i];
+        if (t->words && !t->fp && t->fs == fp->obj.fs && t->id == fp->obj.id && t->sclust == fp->obj.sclust &&
+            t->size == fp->obj.objsize)
+            return t;
+    }
+    return NULL;
+}
+
+static table_t *oldest_idle(void)
+{
+    table_t *lru = NULL;
+
+    for (int i = 0; i < CLMT_TABLES; i++) {
+        table_t *t = &tables[i];
+        if (t->words && !t->fp && (!lru || t->used < lru->used))
+            lru = t;
+    }
+    return lru;
+}
+
+/* moves the tables down over the holes, the open files follow theirs */
+static void compact(void)
+{
+    uint32_t at = 0;
+
+    for (;;) {
+        table_t *next = NULL;
+        for (int i = 0; i < CLMT_TABLES; i++) {
+            table_t *t = &tables[i];
+            if (t->words && t->offset >= at && (!next || t->offset < next->offset))
+                next = t;
+        }
+        if (!next)
+            break;
+        if (next->offset != at) {
+            memmove(&pool[at], &pool[next->offset], next->words * sizeof(DWORD));
+            next->offset = at;
+            if (next->fp)
+                next->fp->cltbl = &pool[at];
+        }
+        at += next->words;
+    }
+    top = at;
+}
+
+static void evict(table_t *t)
+{
+    t->words = 0;
+    stats.evictions++;
+}
+
+static table_t *free_entry(void)
+{
+    table_t *t;
+
+    for (int i = 0; i < CLMT_TABLES; i++)
+        if (!tables[i].words)
+            return &tables[i];
+    t = oldest_idle();
+    if (t) {
+        evict(t);
+        compact();
+    }
+    return t;
+}
+
+/* the map in the free end of the pool, idle tables are evicted when it is short */
+static FRESULT build(FIL *fp)
+{
+    DWORD *tbl = &pool[top];
+    FRESULT res;
+
+#if _FS_EXFAT
+    /* no FAT chain, one fragment (stat is only kept up to date on exFAT) */
+    if (fp->obj.fs->fs_type == FS_EXFAT && fp->obj.stat == 2 && CLMT_POOL_WORDS - top >= 4) {
+        DWORD cluster = (DWORD)fp->obj.fs->csize * SECTOR;
+        tbl[0] = 4;
+        tbl[1] = (fp->obj.objsize + cluster - 1) / cluster;
+        tbl[2] = fp->obj.sclust;
+        tbl[3] = 0;
+        fp->cltbl = tbl;
+        return FR_OK;
+    }
+#endif
+    tbl[0] = CLMT_POOL_WORDS - top;
+    fp->cltbl = tbl;
+    res = f_lseek(fp, CREATE_LINKMAP);
+    stats.built++;
+    if (res == FR_NOT_ENOUGH_CORE) {
+        DWORD need = tbl[0];
+        table_t *t;
+        while (CLMT_POOL_WORDS - top < need && (t = oldest_idle()) != NULL) {
+            evict(t);
+            compact();
+        }
+        tbl = &pool[top];
+        tbl[0] = CLMT_POOL_WORDS - top;
+        fp->cltbl = tbl;
+        res = need <= tbl[0] ? f_lseek(fp, CREATE_LINKMAP) : FR_NOT_ENOUGH_CORE;
+    }
+    if (res != FR_OK)
+        fp->cltbl = NULL;
+    if (res == FR_NOT_ENOUGH_CORE)
+        stats.too_big++;
+    return res;
+}
+
+FRESULT clmt_open(FIL *fp, const TCHAR *path)
+{
+    FRESULT res = f_open(fp, path, FA_READ);
+    table_t *t;
+
+    if (res != FR_OK)
+        return res;
+    stats.opens++;
+    /* an empty file has no cluster to find */
+    if (!fp->obj.sclust)
+        return FR_OK;
+
+    t = lookup(fp);
+    if (t) {
+        stats.hits++;
+    } else {
+        t = free_entry();
+        if (!t)
+            return FR_OK;
+        res = build(fp);
+        /* too fragmented for the pool, it seeks through the FAT */
+        if (res == FR_NOT_ENOUGH_CORE)
+            return FR_OK;
+        if (res != FR_OK) {
+            f_close(fp);
+            return res;
+        }
+        t->fs = fp->obj.fs;
+        t->id = fp->obj.id;
+        t->sclust = fp->obj.sclust;
+        t->size = fp->obj.objsize;
+        t->offset = fp->cltbl - pool;
+        t->words = fp->cltbl[0];
+        top += t->words;
+    }
+    t->fp = fp;
+    t->used = ++stamp;
+    fp->cltbl = &pool[t->offset];
+    return FR_OK;
+}
+
+FRESULT clmt_close(FIL *fp)
+{
+    for (int i = 0; i < CLMT_TABLES; i++)
+        if (tables[i].words && tables[i].fp == fp)
+            tables[i].fp = NULL;
+    return f_close(fp);
+}
+
+void clmt_invalidate(void)
+{
+    for (int i = 0; i < CLMT_TABLES; i++)
+        if (tables[i].words && !tables[i].fp)
+            tables[i].words = 0;
+    compact();
+}
+
+void clmt_stats(clmt_stats_t *st)
+{
+    *st = stats;
+    st->used = top;
+    st->tables = 0;
+    for (int i = 0; i < CLMT_TABLES; i++)
+        st->tables += tables[i].words != 0;
+}
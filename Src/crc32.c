@@ -0,0 +1,30 @@
+#include <crc32.h>
+
+#include <stm32h7xx_hal.h>
+
+/*
+ * CRC unit set for the reflected CRC-32: default polynomial, input reversed by byte, output reversed. Words are fed
+ * byte swapped so the first byte in memory is the first one processed, as the HAL does for byte streams.
+ *
+ * The unit keeps its state in the non-reflected domain: DR reads back the reflected value and INIT takes the
+ * non-reflected one, hence the __RBIT() to resume from a previous result.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    __HAL_RCC_CRC_CLK_ENABLE();
+    CRC->POL = 0x04C11DB7;
+    CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+    CRC->INIT = __RBIT(~crc);
+    CRC->CR |= CRC_CR_RESET;
+
+    for (; size > 0 && ((uintptr_t)p & 3); size--)
+        *(__IO uint8_t *)&CRC->DR = *p++;
+    for (; size >= 4; size -= 4, p += 4)
+        CRC->DR = __REV(*(const uint32_t *)p);
+    for (; size > 0; size--)
+        *(__IO uint8_t *)&CRC->DR = *p++;
+
+    return ~CRC->DR;
+}
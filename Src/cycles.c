@@ -0,0 +1,26 @@
+#include <cycles.h>
+
+#include <stm32h7xx_hal.h>
+
+static volatile uint64_t folded; /* cycles up to the last fold */
+static volatile uint32_t last;   /* CYCCNT at the last fold */
+
+void cycles_tick(void)
+{
+    uint32_t now = DWT->CYCCNT;
+
+    folded += now - last;
+    last = now;
+}
+
+uint64_t cycles_now(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint64_t now;
+
+    /* the 64-bit count and its CYCCNT from the same fold */
+    __disable_irq();
+    now = folded + (uint32_t)(DWT->CYCCNT - last);
+    __set_PRIMASK(primask);
+    return now;
+}
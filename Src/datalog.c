@@ -0,0 +1,390 @@
+#include <datalog.h>
+
+#include <crc32.h>
+#include <diskio.h>
+#include <fatfs.h>
+#include <sections.h>
+#include <stm32h7xx_hal.h>
+#include <volume.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTOR 512
+#define ALIGN 8
+#define MAX_INDEX 100000
+#define DIGITS 5 /* <prefix>NNNNN.log */
+#define FLUSH_TIMEOUT 5000
+
+/* in AXI SRAM, the SD driver sends them with the IDMA as they are */
+static uint8_t buffers[DATALOG_BUFFERS][DATALOG_BUFFER_SIZE] AXISRAM_BSS;
+static volatile uint32_t committed[DATALOG_BUFFERS]; /* record bytes copied in, DATALOG_PAYLOAD when full */
+static volatile uint32_t reserved;                   /* stream position of the next record */
+static volatile uint32_t consumed;                   /* stream position on the card, at a buffer boundary */
+static volatile int running;
+
+static datalog_config_t config;
+static char prefix[16];
+static char path[32];
+static FIL file;
+static int file_open;
+static uint32_t file_index;
+static uint32_t file_pos;   /* bytes written */
+static DWORD file_lba;      /* first sector, the clusters are contiguous */
+static uint32_t opened;     /* tick */
+static int rotate_pending;
+static uint32_t rotate_at;  /* stream position the rotation waits for */
+static uint32_t block_seq;
+static datalog_stats_t stats;
+
+/* a stream position counts DATALOG_BUFFER_SIZE per buffer, only the first DATALOG_PAYLOAD bytes of each one hold
+ * records: the header and the trailer are left out and the position wraps with the buffers */
+static uint8_t *at(uint32_t pos)
+{
+    return &buffers[pos / DATALOG_BUFFER_SIZE % DATALOG_BUFFERS][sizeof(datalog_block_t) + pos % DATALOG_BUFFER_SIZE];
+}
+
+static void commit(uint32_t pos, uint32_t size)
+{
+    __atomic_fetch_add(&committed[pos / DATALOG_BUFFER_SIZE % DATALOG_BUFFERS], size, __ATOMIC_RELEASE);
+}
+
+static uint32_t next_buffer(uint32_t pos)
+{
+    return pos - pos % DATALOG_BUFFER_SIZE + DATALOG_BUFFER_SIZE;
+}
+
+/* space for size bytes in one buffer, the rest of the current one (*pad bytes at *pad_pos) is padding when they do
+ * not fit */
+static int reserve(uint32_t size, uint32_t *pos, uint32_t *pad_pos, uint32_t *pad)
+{
+    uint32_t old = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+    uint32_t start, end;
+
+    do {
+        uint32_t room = DATALOG_PAYLOAD - old % DATALOG_BUFFER_SIZE;
+        *pad = size > room ? room : 0;
+        start = size > room ? next_buffer(old) : old;
+        end = start + size;
+        if (!running || end - consumed > DATALOG_BUFFERS * DATALOG_BUFFER_SIZE)
+            return -1;
+    } while (!__atomic_compare_exchange_n(&reserved, &old, end, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    *pos = start;
+    *pad_pos = old;
+    return 0;
+}
+
+static void put_pad(uint32_t pos, uint32_t size)
+{
+    datalog_record_t *r = (datalog_record_t *)at(pos);
+
+    r->size = size;
+    r->source = DATALOG_PAD;
+    r->flags = 0;
+    r->time = HAL_GetTick();
+    commit(pos, size);
+}
+
+int datalog_write(uint8_t source, const void *data, uint32_t size)
+{
+    uint32_t need = (sizeof(datalog_record_t) + size + ALIGN - 1) & ~(ALIGN - 1);
+    uint32_t pos, pad_pos, pad;
+
+    if (size > DATALOG_MAX_DATA || reserve(need, &pos, &pad_pos, &pad) != 0) {
+        __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    if (pad)
+        put_pad(pad_pos, pad);
+
+    datalog_record_t *r = (datalog_record_t *)at(pos);
+    r->size = sizeof(*r) + size;
+    r->source = source;
+    r->flags = 0;
+    r->time = HAL_GetTick();
+    memcpy(r + 1, data, size);
+    memset((uint8_t *)(r + 1) + size, 0, need - sizeof(*r) - size);
+    commit(pos, need);
+    __atomic_fetch_add(&stats.records, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.bytes, size, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* pads the buffer being filled so it can go to the card, returns the stream position after it */
+static uint32_t close_buffer(void)
+{
+    uint32_t old = __atomic_load_n(&reserved, __ATOMIC_RELAXED);
+    uint32_t room;
+
+    do {
+        room = DATALOG_PAYLOAD - old % DATALOG_BUFFER_SIZE;
+        if (room == DATALOG_PAYLOAD)
+            return old;
+    } while (!__atomic_compare_exchange_n(&reserved, &old, next_buffer(old), 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    /* records can end right at the payload end */
+    if (room)
+        put_pad(old, room);
+    return next_buffer(old);
+}
+
+static int buffer_full(void)
+{
+    return __atomic_load_n(&committed[consumed / DATALOG_BUFFER_SIZE % DATALOG_BUFFERS], __ATOMIC_ACQUIRE) ==
+           DATALOG_PAYLOAD;
+}
+
+/* header and trailer index of a full buffer, from its records */
+static void seal(uint8_t *buf)
+{
+    datalog_block_t *b = (datalog_block_t *)buf;
+    uint8_t *payload = buf + sizeof(*b);
+    datalog_index_t *index = (datalog_index_t *)(payload + DATALOG_PAYLOAD);
+    uint32_t off = 0;
+    uint32_t mark = 0;
+
+    memset(b, 0, sizeof(*b));
+    memset(index, 0, DATALOG_INDEX * sizeof(*index));
+    b->magic = DATALOG_MAGIC;
+    b->seq = block_seq++;
+    while (off < DATALOG_PAYLOAD) {
+        const datalog_record_t *r = (const datalog_record_t *)(payload + off);
+        if (r->source == DATALOG_PAD)
+            break;
+        if (!b->records)
+            b->first_time = r->time;
+        b->last_time = r->time;
+        b->records++;
+        if (off >= mark && b->entries < DATALOG_INDEX) {
+            index[b->entries].time = r->time;
+            index[b->entries].offset = off;
+            b->entries++;
+            mark = off + DATALOG_PAYLOAD / DATALOG_INDEX;
+        }
+        off += (r->size + ALIGN - 1) & ~(ALIGN - 1);
+    }
+    b->used = off;
+    b->crc = crc32(payload, DATALOG_PAYLOAD + DATALOG_INDEX * sizeof(*index));
+}
+
+static FRESULT open_file(void)
+{
+    uint32_t start = HAL_GetTick();
+    FRESULT res;
+
+    snprintf(path, sizeof(path), "%s%s%0*" PRIu32 ".log", SDPath, prefix, DIGITS, file_index++ % MAX_INDEX);
+    res = f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK)
+        return res;
+    /* one run of clusters, then the directory entry and the allocation on the card: after a power loss the file is
+     * there with its preallocated size */
+    res = f_expand(&file, config.file_size, 1);
+    if (res == FR_OK)
+        res = f_sync(&file);
+    if (res != FR_OK) {
+        f_close(&file);
+        f_unlink(path);
+        return res;
+    }
+    file_lba = SDFatFS.database + (file.obj.sclust - 2) * SDFatFS.csize;
+    file_pos = 0;
+    file_open = 1;
+    opened = HAL_GetTick();
+    stats.files++;
+    if (opened - start > stats.max_open_ms)
+        stats.max_open_ms = opened - start;
+    return FR_OK;
+}
+
+/* the real size in the directory entry, the clusters past it are freed */
+static FRESULT close_file(void)
+{
+    FRESULT res, closed;
+
+    if (!file_open)
+        return FR_OK;
+    file_open = 0;
+    res = f_lseek(&file, file_pos);
+    if (res == FR_OK)
+        res = f_truncate(&file);
+    closed = f_close(&file);
+    if (res == FR_OK && closed == FR_OK && file_pos == 0)
+        f_unlink(path);
+    return res != FR_OK ? res : closed;
+}
+
+/* the volume the file was opened on is still mounted: a card pulled out is unmounted by volume_poll() and the one put
+ * in next mounts with another id, the raw writes must not land on it */
+static int same_volume(void)
+{
+    volume_info_t info;
+
+    return volume_info(SDPath, &info) == 0 && info.state == VOLUME_MOUNTED && SDFatFS.fs_type &&
+           file.obj.fs == &SDFatFS && file.obj.id == SDFatFS.id;
+}
+
+static FRESULT write_buffer(void)
+{
+    uint8_t *buf = buffers[consumed / DATALOG_BUFFER_SIZE % DATALOG_BUFFERS];
+    uint32_t start;
+
+    if (!same_volume())
+        return FR_NOT_READY;
+    seal(buf);
+    start = HAL_GetTick();
+    if (disk_write(SDFatFS.drv, buf, file_lba + file_pos / SECTOR, DATALOG_BUFFER_SIZE / SECTOR) != RES_OK)
+        return FR_DISK_ERR;
+    if (HAL_GetTick() - start > stats.max_write_ms)
+        stats.max_write_ms = HAL_GetTick() - start;
+    file_pos += DATALOG_BUFFER_SIZE;
+    stats.written++;
+    /* the buffer is empty before its space is given back to the producers */
+    __atomic_store_n(&committed[consumed / DATALOG_BUFFER_SIZE % DATALOG_BUFFERS], 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&consumed, consumed + DATALOG_BUFFER_SIZE, __ATOMIC_RELEASE);
+    return FR_OK;
+}
+
+static void fail(FRESULT res)
+{
+    running = 0;
+    stats.error = res;
+    close_file();
+}
+
+/* full buffers to the card, a new file when the current one is full or its time is up */
+static FRESULT drain(void)
+{
+    FRESULT res;
+
+    for (;;) {
+        int rotate = rotate_pending && consumed == rotate_at;
+        if (rotate || file_pos == config.file_size) {
+            rotate_pending &= !rotate;
+            res = close_file();
+            if (res == FR_OK)
+                res = open_file();
+            if (res != FR_OK)
+                return res;
+        }
+        if (!buffer_full())
+            return FR_OK;
+        res = write_buffer();
+        if (res != FR_OK)
+            return res;
+    }
+}
+
+void datalog_poll(void)
+{
+    FRESULT res;
+
+    if (!running)
+        return;
+    if (config.rotate_ms && !rotate_pending && HAL_GetTick() - opened >= config.rotate_ms &&
+        (file_pos || reserved != consumed)) {
+        rotate_at = close_buffer();
+        rotate_pending = 1;
+    }
+    res = drain();
+    if (res != FR_OK)
+        fail(res);
+}
+
+/* one past the highest <prefix>NNNNN.log on the card, files deleted below it leave gaps the next run must not fill */
+static FRESULT next_index(uint32_t *next)
+{
+    static DIR dir;
+    static FILINFO info;
+    size_t len = strlen(prefix);
+    FRESULT res = f_opendir(&dir, SDPath);
+
+    *next = 0;
+    while (res == FR_OK) {
+        res = f_readdir(&dir, &info);
+        if (res != FR_OK || info.fname[0] == 0)
+            break;
+        const char *s = info.fname;
+        if (strlen(s) != len + DIGITS + 4 || strncmp(s, prefix, len) != 0 || strcmp(s + len + DIGITS, ".log") != 0)
+            continue;
+        char *end;
+        uint32_t index = strtoul(s + len, &end, 10);
+        if (end == s + len + DIGITS && index >= *next)
+            *next = index + 1;
+    }
+    f_closedir(&dir);
+    return res;
+}
+
+int datalog_start(const datalog_config_t *cfg)
+{
+    FRESULT res;
+
+    if (running || cfg->file_size == 0 || cfg->file_size % DATALOG_BUFFER_SIZE)
+        return -1;
+    config = *cfg;
+    snprintf(prefix, sizeof(prefix), "%s", cfg->prefix ? cfg->prefix : "log");
+    config.prefix = prefix;
+    memset(&stats, 0, sizeof(stats));
+    memset((void *)committed, 0, sizeof(committed));
+    reserved = consumed = 0;
+    rotate_pending = 0;
+    block_seq = 0;
+
+    res = volume_mount(SDPath);
+    if (res == FR_OK)
+        res = next_index(&file_index);
+    if (res == FR_OK)
+        res = open_file();
+    if (res != FR_OK) {
+        stats.error = res;
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+int datalog_stop(void)
+{
+    uint32_t start = HAL_GetTick();
+    uint32_t end;
+    FRESULT res = FR_OK;
+
+    if (!running)
+        return -1;
+    /* no record gets in past the pad closing the last buffer */
+    running = 0;
+    end = close_buffer();
+    rotate_pending = 0;
+    while (res == FR_OK && consumed != end) {
+        if (HAL_GetTick() - start >= FLUSH_TIMEOUT) {
+            res = FR_TIMEOUT;
+            break;
+        }
+        res = drain();
+    }
+    if (res == FR_OK)
+        res = close_file();
+    if (res != FR_OK)
+        fail(res);
+    return res == FR_OK ? 0 : -1;
+}
+
+int datalog_running(void)
+{
+    return running;
+}
+
+void datalog_stats(datalog_stats_t *st)
+{
+    *st = stats;
+}
+
+const char *datalog_file(uint32_t *lba, uint32_t *bytes)
+{
+    if (!file_open)
+        return NULL;
+    *lba = file_lba;
+    *bytes = file_pos;
+    return path;
+}
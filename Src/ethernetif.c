@@ -28,7 +28,10 @@
 #include "lwip/ethip6.h"
 #include "ethernetif.h"
 /* USER CODE BEGIN Include for User BSP */
-#include <stdio.h>
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "phy.h"
+#include <stddef.h>
 /* USER CODE END Include for User BSP */
 #include <string.h>
 
@@ -48,64 +51,84 @@
 #define ETH_DMA_TRANSMIT_TIMEOUT               ( 20U )
 
 /* USER CODE BEGIN 1 */
+#define ETH_TX_BOUNCE_SIZE                     ( 1536UL )
 
+/* the checksums the stack computes: none, or those of a frame the MAC could not check */
+#define CHECKSUM_OFFLOAD  NETIF_CHECKSUM_DISABLE_ALL
+#define CHECKSUM_SOFTWARE (NETIF_CHECKSUM_CHECK_IP | NETIF_CHECKSUM_CHECK_UDP | NETIF_CHECKSUM_CHECK_TCP | \
+                           NETIF_CHECKSUM_CHECK_ICMP | NETIF_CHECKSUM_GEN_ICMP)
 /* USER CODE END 1 */
 
 /* Private variables ---------------------------------------------------------*/
 /* 
 @Note: This interface is implemented to operate in zero-copy mode only:
-        - Rx buffers are allocated statically and passed directly to the LwIP stack
-          they will return back to DMA after been processed by the stack.
-        - Tx Buffers will be allocated from LwIP stack memory heap, 
-          then passed to ETH HAL driver.
+        - Rx buffers come from a pool in D2 SRAM and are passed directly to the LwIP stack,
+          they return to the pool when the stack releases them.
+        - Tx Buffers are the pbufs of the stack (heap and pools in AXI SRAM), referenced
+          until the DMA has sent them, or a bounce buffer in D2 SRAM they are copied into.
 
 @Notes: 
-  1.a. ETH DMA Rx descriptors must be contiguous, the default count is 4, 
-       to customize it please redefine ETH_RX_DESC_CNT in ETH GUI (Rx Descriptor Length)
-       so that updated value will be generated in stm32xxxx_hal_conf.h
-  1.b. ETH DMA Tx descriptors must be contiguous, the default count is 4, 
-       to customize it please redefine ETH_TX_DESC_CNT in ETH GUI (Tx Descriptor Length)
-       so that updated value will be generated in stm32xxxx_hal_conf.h
-
-  2.a. Rx Buffers number must be between ETH_RX_DESC_CNT and 2*ETH_RX_DESC_CNT
+  1.a. ETH DMA Rx descriptors must be contiguous, ETH_RX_DESC_CNT in stm32xxxx_hal_conf.h
+  1.b. ETH DMA Tx descriptors must be contiguous, ETH_TX_DESC_CNT in stm32xxxx_hal_conf.h
+  1.c. The descriptors are in the D2 SRAM region MPU_Config() (main.c) makes non-cacheable,
+       the linker script places them at its start (.eth_desc)
+
+  2.a. ETH_RX_BUFFER_CNT Rx Buffers (ethernetif.h), more than ETH_RX_DESC_CNT: a descriptor
+       gets a free buffer as soon as it hands its frame to the stack
   2.b. Rx Buffers must have the same size: ETH_RX_BUFFER_SIZE, this value must
        passed to ETH DMA in the init field (heth.Init.RxBuffLen)
 */
 
-#if defined ( __ICCARM__ ) /*!< IAR Compiler */
-
-#pragma location=0x30040000
-ETH_DMADescTypeDef  DMARxDscrTab[ETH_RX_DESC_CNT]; /* Ethernet Rx DMA Descriptors */
-#pragma location=0x30040060
-ETH_DMADescTypeDef  DMATxDscrTab[ETH_TX_DESC_CNT]; /* Ethernet Tx DMA Descriptors */
-#pragma location=0x30040200
-uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE]; /* Ethernet Receive Buffers */
-
-#elif defined ( __CC_ARM )  /* MDK ARM Compiler */
+#if ETH_RX_BUFFER_CNT <= ETH_RX_DESC_CNT
+#error "ETH_RX_BUFFER_CNT must leave free buffers for the RX descriptors"
+#endif
 
-__attribute__((at(0x30040000))) ETH_DMADescTypeDef  DMARxDscrTab[ETH_RX_DESC_CNT]; /* Ethernet Rx DMA Descriptors */
-__attribute__((at(0x30040060))) ETH_DMADescTypeDef  DMATxDscrTab[ETH_TX_DESC_CNT]; /* Ethernet Tx DMA Descriptors */
-__attribute__((at(0x30040200))) uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE]; /* Ethernet Receive Buffer */
+#if (ETH_TX_MAX_SEGMENTS + 1) / 2 >= ETH_TX_DESC_CNT
+#error "ETH_TX_MAX_SEGMENTS must fit in the TX descriptors"
+#endif
 
-#elif defined ( __GNUC__ ) /* GNU Compiler */ 
+/* an RX buffer with the custom pbuf the stack sees it through */
+typedef struct rx_buffer
+{
+  struct pbuf_custom pbuf;
+  struct rx_buffer *next;  /* in the free list */
+  uint8_t data[ETH_RX_BUFFER_SIZE] __attribute__((aligned(32))); /* whole cache lines of its own */
+} rx_buffer_t;
 
 ETH_DMADescTypeDef DMARxDscrTab[ETH_RX_DESC_CNT] __attribute__((section(".RxDecripSection"))); /* Ethernet Rx DMA Descriptors */
 ETH_DMADescTypeDef DMATxDscrTab[ETH_TX_DESC_CNT] __attribute__((section(".TxDecripSection")));   /* Ethernet Tx DMA Descriptors */
-uint8_t Rx_Buff[ETH_RX_DESC_CNT][ETH_RX_BUFFER_SIZE] __attribute__((section(".RxArraySection"))); /* Ethernet Receive Buffers */
-
-#endif
+static rx_buffer_t rx_pool[ETH_RX_BUFFER_CNT] __attribute__((section(".RxArraySection")));      /* Ethernet Receive Buffers */
+static uint8_t tx_bounce[ETH_TX_BOUNCE_CNT][ETH_TX_BOUNCE_SIZE] __attribute__((section(".TxArraySection"), aligned(32)));
 
 /* USER CODE BEGIN 2 */
-
+static volatile uint8_t rx_pending = 1; /* frames may be waiting, set by the RX interrupt */
+static uint32_t rx_budget = ETH_RX_BUDGET;
+static ethernetif_stats_t stats;
+static rx_buffer_t *rx_free; /* the stack releases pbufs from the main loop only, no lock */
+static uint8_t rx_software;  /* the frame low_level_input() returned needs its checksums checked by the stack */
+
+/* a frame on the TX ring */
+typedef struct
+{
+  struct pbuf *p;  /* referenced, NULL when bounced */
+  int8_t bounce;   /* bounce buffer, -1 for none */
+  uint8_t descs;
+  uint8_t last;    /* descriptor of its last buffer */
+} tx_frame_t;
+
+static volatile uint8_t tx_pending; /* a frame went out, set by the TX interrupt */
+static tx_frame_t tx_frames[ETH_TX_DESC_CNT];
+static uint32_t tx_head;  /* oldest frame on the ring */
+static uint32_t tx_descs; /* descriptors held by the frames on the ring */
+static uint32_t tx_bounce_free = (1U << ETH_TX_BOUNCE_CNT) - 1;
+
+static uint8_t phy_found; /* else the link is taken as up at the MAC defaults, 100 full duplex */
 /* USER CODE END 2 */
 
 /* Global Ethernet handle */
 ETH_HandleTypeDef heth;
 ETH_TxPacketConfig TxConfig;
 
-/* Memory Pool Declaration */
-LWIP_MEMPOOL_DECLARE(RX_POOL, 10, sizeof(struct pbuf_custom), "Zero-copy RX PBUF pool");
-
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN Private function prototypes for User BSP */
 
@@ -125,7 +148,10 @@ void HAL_ETH_MspInit(ETH_HandleTypeDef* ethHandle)
   if(ethHandle->Instance==ETH)
   {
   /* USER CODE BEGIN ETH_MspInit 0 */
-
+    /* descriptors and RX buffers */
+    __HAL_RCC_D2SRAM1_CLK_ENABLE();
+    __HAL_RCC_D2SRAM2_CLK_ENABLE();
+    __HAL_RCC_D2SRAM3_CLK_ENABLE();
   /* USER CODE END ETH_MspInit 0 */
     /* Enable Peripheral clock */
     __HAL_RCC_ETH1MAC_CLK_ENABLE();
@@ -167,8 +193,11 @@ void HAL_ETH_MspInit(ETH_HandleTypeDef* ethHandle)
     GPIO_InitStruct.Alternate = GPIO_AF11_ETH;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+    /* Peripheral interrupt init */
+    HAL_NVIC_SetPriority(ETH_IRQn, 2, 0);
+    HAL_NVIC_EnableIRQ(ETH_IRQn);
   /* USER CODE BEGIN ETH_MspInit 1 */
-
+    /* ETH_IRQn priority 2 in the .ioc: below the SD card and USB */
   /* USER CODE END ETH_MspInit 1 */
   }
 }
@@ -202,6 +231,9 @@ void HAL_ETH_MspDeInit(ETH_HandleTypeDef* ethHandle)
 
     HAL_GPIO_DeInit(GPIOB, GPIO_PIN_11|GPIO_PIN_12|GPIO_PIN_13);
 
+    /* Peripheral interrupt Deinit*/
+    HAL_NVIC_DisableIRQ(ETH_IRQn);
+
   /* USER CODE BEGIN ETH_MspDeInit 1 */
 
   /* USER CODE END ETH_MspDeInit 1 */
@@ -209,7 +241,238 @@ void HAL_ETH_MspDeInit(ETH_HandleTypeDef* ethHandle)
 }
 
 /* USER CODE BEGIN 4 */
+void HAL_ETH_RxCpltCallback(ETH_HandleTypeDef *heth)
+{
+  rx_pending = 1;
+}
+
+void HAL_ETH_DMAErrorCallback(ETH_HandleTypeDef *heth)
+{
+  /* the DMA waits for the tail pointer, written when the next frame is taken */
+  if (heth->DMAErrorCode & ETH_DMACSR_RBU)
+  {
+    stats.rx_starved++;
+    rx_pending = 1;
+  }
+  else
+  {
+    stats.dma_errors++;
+  }
+}
+
+void HAL_ETH_TxCpltCallback(ETH_HandleTypeDef *heth)
+{
+  tx_pending = 1;
+}
+
+static rx_buffer_t *rx_buffer_get(void)
+{
+  rx_buffer_t *b = rx_free;
+
+  if (b != NULL)
+  {
+    rx_free = b->next;
+    if (--stats.rx_pool_free < stats.rx_pool_min)
+      stats.rx_pool_min = stats.rx_pool_free;
+  }
+  return b;
+}
+
+static void rx_buffer_put(rx_buffer_t *b)
+{
+  b->next = rx_free;
+  rx_free = b;
+  stats.rx_pool_free++;
+}
+
+static void rx_pool_init(void)
+{
+  rx_free = NULL;
+  stats.rx_pool_free = 0;
+  for (uint32_t i = 0; i < ETH_RX_BUFFER_CNT; i++)
+    rx_buffer_put(&rx_pool[i]);
+  stats.rx_pool_min = stats.rx_pool_free;
+}
+
+/* the MTL and DMA drop counters clear on read, so do the MMC ones (reset on read set by low_level_init) */
+static void rx_drop_counters(void)
+{
+  uint32_t mtl = heth.Instance->MTLRQMPOCR;
+
+  stats.rx_overruns += (mtl & ETH_MTLRQMPOCR_OVFPKTCNT) >> ETH_MTLRQMPOCR_OVFPKTCNT_Pos;
+  stats.rx_missed += (mtl & ETH_MTLRQMPOCR_MISPKTCNT) >> ETH_MTLRQMPOCR_MISPKTCNT_Pos;
+  stats.rx_missed += heth.Instance->DMACMFCR & ETH_DMACMFCR_MFC;
+  stats.rx_crc_errors += heth.Instance->MMCRCRCEPR;
+  stats.rx_align_errors += heth.Instance->MMCRAEPR;
+}
+
+/* the MAC checks the received checksums and lets the frames with a bad one reach low_level_input() to be counted,
+ * the stack checks none */
+static void checksum_init(struct netif *netif)
+{
+  ETH_MACConfigTypeDef macconf;
+
+  HAL_ETH_GetMACConfig(&heth, &macconf);
+  macconf.ChecksumOffload = ENABLE;
+  macconf.DropTCPIPChecksumErrorPacket = DISABLE;
+  HAL_ETH_SetMACConfig(&heth, &macconf);
+  NETIF_SET_CHECKSUM_CTRL(netif, CHECKSUM_OFFLOAD);
+}
+
+/* what the MAC made of the checksums of the frame in frame: 0 checked (or none to check), 1 left to the stack, -1 bad.
+ * The payload of a fragment is checked once the datagram is reassembled */
+static int rx_checksum(const uint8_t *frame, uint32_t len)
+{
+  const struct ip_hdr *ip = (const struct ip_hdr *)(frame + SIZEOF_ETH_HDR);
+  ETH_RxPacketInfo info;
+
+  memset(&info, 0, sizeof(info));
+  HAL_ETH_GetRxDataInfo(&heth, &info);
+  if (!(info.HeaderType & ETH_IP_HEADER_IPV4) || len < SIZEOF_ETH_HDR + IP_HLEN)
+    return 0;
+  if (info.Checksum & ETH_CHECKSUM_IP_HEADER_ERROR)
+  {
+    stats.rx_csum_errors++;
+    return -1;
+  }
+  if ((IPH_OFFSET(ip) & PP_HTONS(IP_MF | IP_OFFMASK)) || (info.Checksum & ETH_CHECKSUM_BYPASSED) ||
+      info.PayloadType == ETH_IP_PAYLOAD_UNKNOWN)
+  {
+    stats.rx_csum_sw++;
+    return 1;
+  }
+  if (info.Checksum & ETH_CHECKSUM_IP_PAYLOAD_ERROR)
+  {
+    stats.rx_csum_errors++;
+    return -1;
+  }
+  stats.rx_csum_hw++;
+  return 0;
+}
+
+/* checksum insertion for a frame: the MAC computes a payload checksum over the whole datagram, a fragment only gets
+ * its IP header one, and so does a payload whose checksum the stack filled in */
+static uint32_t tx_checksum(struct pbuf *p)
+{
+  struct ip_hdr ip;
+  u16_t type, chksum, off;
+
+  if (pbuf_copy_partial(p, &type, sizeof(type), SIZEOF_ETH_HDR - 2) != sizeof(type) || type != PP_HTONS(ETHTYPE_IP) ||
+      pbuf_copy_partial(p, &ip, IP_HLEN, SIZEOF_ETH_HDR) != IP_HLEN)
+    return ETH_CHECKSUM_DISABLE;
+  /* the payload checksum */
+  off = SIZEOF_ETH_HDR + IPH_HL(&ip) * 4;
+  switch (IPH_PROTO(&ip))
+  {
+  case IP_PROTO_TCP:
+    off += 16;
+    break;
+  case IP_PROTO_UDP:
+    off += 6;
+    break;
+  case IP_PROTO_ICMP:
+    off += 2;
+    break;
+  default:
+    off = 0;
+    break;
+  }
+  if (off == 0 || (IPH_OFFSET(&ip) & PP_HTONS(IP_MF | IP_OFFMASK)) ||
+      pbuf_copy_partial(p, &chksum, sizeof(chksum), off) != sizeof(chksum) || chksum != 0)
+  {
+    stats.tx_csum_sw++;
+    return ETH_CHECKSUM_IPHDR_INSERT;
+  }
+  stats.tx_csum_hw++;
+  return ETH_CHECKSUM_IPHDR_PAYLOAD_INSERT_PHDR_CALC;
+}
+
+/* the DMA reads neither TCM */
+static int tx_reachable(const void *data)
+{
+  uint32_t addr = (uint32_t)data;
+
+  return addr >= FLASH_BANK1_BASE && !(addr >= D1_DTCMRAM_BASE && addr < D1_AXISRAM_BASE);
+}
+
+/* SRAM behind the D-cache to memory, flash and QSPI have no dirty lines */
+static void tx_clean(const void *data, uint32_t len)
+{
+  uint32_t addr = (uint32_t)data;
+
+#if !defined(DUAL_CORE) || defined(CORE_CM7)
+  if (addr >= D1_AXISRAM_BASE && addr < PERIPH_BASE)
+    SCB_CleanDCache_by_Addr((uint32_t *)(addr & ~31U), (int32_t)(len + (addr & 31U)));
+#endif
+}
+
+/* frames the DMA is done with, the pbufs are released from the main loop: the stack is not interrupt safe. The DMA
+ * clears the OWN bits in ring order, the oldest frame goes first */
+static void tx_reclaim(void)
+{
+  tx_pending = 0;
+  while (stats.tx_inflight > 0)
+  {
+    tx_frame_t *f = &tx_frames[tx_head];
+    ETH_DMADescTypeDef *desc = (ETH_DMADescTypeDef *)heth.TxDescList.TxDesc[f->last];
+
+    if (desc->DESC3 & ETH_DMATXNDESCWBF_OWN)
+      break;
+    /* the status of the frame is written back in its last descriptor */
+    if (desc->DESC3 & (ETH_DMATXNDESCWBF_LCO | ETH_DMATXNDESCWBF_EC))
+      stats.tx_collisions++;
+    else if (desc->DESC3 & (ETH_DMATXNDESCWBF_LCA | ETH_DMATXNDESCWBF_NC))
+      stats.tx_carrier_errors++;
+    if (f->p != NULL)
+      pbuf_free(f->p);
+    if (f->bounce >= 0)
+      tx_bounce_free |= 1U << f->bounce;
+    tx_descs -= f->descs;
+    stats.tx_inflight--;
+    tx_head = (tx_head + 1) % ETH_TX_DESC_CNT;
+  }
+}
+
+/* with the DMA stopped: the frames on the ring are dropped and the ring starts over at its first descriptor */
+static void tx_flush(void)
+{
+  while (stats.tx_inflight > 0)
+  {
+    tx_frame_t *f = &tx_frames[tx_head];
+
+    if (f->p != NULL)
+      pbuf_free(f->p);
+    if (f->bounce >= 0)
+      tx_bounce_free |= 1U << f->bounce;
+    stats.tx_inflight--;
+    stats.tx_dropped++;
+    tx_head = (tx_head + 1) % ETH_TX_DESC_CNT;
+  }
+  tx_descs = 0;
+  tx_pending = 0;
+  memset(DMATxDscrTab, 0, sizeof(DMATxDscrTab));
+  heth.TxDescList.CurTxDesc = 0;
+  WRITE_REG(heth.Instance->DMACTDLAR, (uint32_t)heth.Init.TxDesc);
+}
+
+/* room on the ring for descs descriptors and a bounce buffer when asked, waited for while the DMA sends. One
+ * descriptor stays free: with the tail pointer on the first busy one a full ring would look empty to the DMA */
+static int tx_room(uint32_t descs, int bounce)
+{
+  uint32_t start = HAL_GetTick();
 
+  tx_reclaim();
+  if (tx_descs + descs < ETH_TX_DESC_CNT && (!bounce || tx_bounce_free))
+    return 1;
+  stats.tx_waits++;
+  do
+  {
+    tx_reclaim();
+    if (tx_descs + descs < ETH_TX_DESC_CNT && (!bounce || tx_bounce_free))
+      return 1;
+  } while (HAL_GetTick() - start < ETH_DMA_TRANSMIT_TIMEOUT);
+  return 0;
+}
 /* USER CODE END 4 */
 
 /*******************************************************************************
@@ -256,7 +519,7 @@ static void low_level_init(struct netif *netif)
   /* End ETH HAL Init */
   
   /* Initialize the RX POOL */
-  LWIP_MEMPOOL_INIT(RX_POOL);
+  rx_pool_init();
 
 #if LWIP_ARP || LWIP_ETHERNET 
 
@@ -284,11 +547,13 @@ static void low_level_init(struct netif *netif)
 
   for(idx = 0; idx < ETH_RX_DESC_CNT; idx ++)
   {
-    HAL_ETH_DescAssignMemory(&heth, idx, Rx_Buff[idx], NULL);
+    HAL_ETH_DescAssignMemory(&heth, idx, rx_buffer_get()->data, NULL);
   } 
       
 /* USER CODE BEGIN low_level_init Code 1 for User BSP */ 
-    
+  checksum_init(netif);
+  SET_BIT(heth.Instance->MMCCR, ETH_MMCCR_RSTONRD);
+  phy_found = phy_init() == 0;
 /* USER CODE END low_level_init Code 1 for User BSP */
 
   if (hal_eth_init_status == HAL_OK)
@@ -325,41 +590,83 @@ static void low_level_init(struct netif *netif)
 
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
-  uint32_t i=0, framelen = 0;
+  /* the HAL reads the list only while it fills the descriptors */
+  static ETH_BufferTypeDef Txbuffer[ETH_TX_MAX_SEGMENTS];
+  uint32_t i = 0, descs;
+  int copy = 0, bounce = -1;
   struct pbuf *q;
-  err_t errval = ERR_OK;
-  ETH_BufferTypeDef Txbuffer[ETH_TX_DESC_CNT];
-  
-  memset(Txbuffer, 0 , ETH_TX_DESC_CNT*sizeof(ETH_BufferTypeDef));
-  
+  tx_frame_t *f;
+
+  if (p->tot_len > ETH_TX_BOUNCE_SIZE)
+    return ERR_IF;
+
   for(q = p; q != NULL; q = q->next)
   {
-    if(i >= ETH_TX_DESC_CNT)	
-      return ERR_IF;
-    
+    if (q->len == 0)
+      continue;
+    if (i == ETH_TX_MAX_SEGMENTS || !tx_reachable(q->payload))
+    {
+      copy = 1;
+      break;
+    }
     Txbuffer[i].buffer = q->payload;
     Txbuffer[i].len = q->len;
-    framelen += q->len;
-    
+    Txbuffer[i].next = NULL;
     if(i>0)
     {
       Txbuffer[i-1].next = &Txbuffer[i];
     }
-    
-    if(q->next == NULL)
-    {
-      Txbuffer[i].next = NULL;
-    }
-    
     i++;
   }
+  descs = copy ? 1 : (i + 1) / 2;
+
+  if (!tx_room(descs, copy))
+  {
+    stats.tx_dropped++;
+    return ERR_IF;
+  }
 
-  TxConfig.Length = framelen;
+  if (copy)
+  {
+    bounce = __builtin_ctz(tx_bounce_free);
+    tx_bounce_free &= ~(1U << bounce);
+    pbuf_copy_partial(p, tx_bounce[bounce], p->tot_len, 0);
+    Txbuffer[0].buffer = tx_bounce[bounce];
+    Txbuffer[0].len = p->tot_len;
+    Txbuffer[0].next = NULL;
+    stats.tx_bounced++;
+  }
+  for (ETH_BufferTypeDef *b = Txbuffer; b != NULL; b = b->next)
+  {
+    tx_clean(b->buffer, b->len);
+  }
+
+  TxConfig.Length = p->tot_len;
   TxConfig.TxBuffer = Txbuffer;
+  TxConfig.ChecksumCtrl = tx_checksum(p);
 
-  HAL_ETH_Transmit(&heth, &TxConfig, ETH_DMA_TRANSMIT_TIMEOUT);
-  
-  return errval;
+  if (HAL_ETH_Transmit_IT(&heth, &TxConfig) != HAL_OK)
+  {
+    if (bounce >= 0)
+      tx_bounce_free |= 1U << bounce;
+    stats.tx_dropped++;
+    return ERR_IF;
+  }
+
+  /* the HAL left the current descriptor past the last one of the frame */
+  f = &tx_frames[(tx_head + stats.tx_inflight) % ETH_TX_DESC_CNT];
+  f->p = copy ? NULL : p;
+  f->bounce = bounce;
+  f->descs = descs;
+  f->last = (heth.TxDescList.CurTxDesc + ETH_TX_DESC_CNT - 1) % ETH_TX_DESC_CNT;
+  if (f->p != NULL)
+    pbuf_ref(p);
+  tx_descs += descs;
+  stats.tx_frames++;
+  if (++stats.tx_inflight > stats.tx_max_inflight)
+    stats.tx_max_inflight = stats.tx_inflight;
+
+  return ERR_OK;
 }
 
 /**
@@ -375,26 +682,51 @@ static struct pbuf * low_level_input(struct netif *netif)
   struct pbuf *p = NULL;
   ETH_BufferTypeDef RxBuff;
   uint32_t framelength = 0;
-  struct pbuf_custom* custom_pbuf;
+  rx_buffer_t *rx, *fresh = NULL;
+  int csum = 0;
   
   
   if (HAL_ETH_IsRxDataAvailable(&heth))
   {
     HAL_ETH_GetRxDataBuffer(&heth, &RxBuff);
     HAL_ETH_GetRxDataLength(&heth, &framelength);
-    
-    /* Build Rx descriptor to be ready for next data reception */
-    HAL_ETH_BuildRxDescriptors(&heth);
+    rx = (rx_buffer_t *)(RxBuff.buffer - offsetof(rx_buffer_t, data));
 
+    /* the frame stays in its buffer for the stack, the descriptor takes a free one (a frame spread over several
+     * descriptors is too long for the MTU and dropped, so is one with a bad checksum) */
+    if (heth.RxDescList.AppDescNbr == 1U)
+    {
 #if !defined(DUAL_CORE) || defined(CORE_CM7)
-    /* Invalidate data cache for ETH Rx Buffers */
-    SCB_InvalidateDCache_by_Addr((uint32_t *)RxBuff.buffer, framelength);
+      /* Invalidate data cache for ETH Rx Buffers */
+      SCB_InvalidateDCache_by_Addr((uint32_t *)rx->data, framelength);
 #endif
-    printf("ETH RX\r\n");
-    custom_pbuf  = (struct pbuf_custom*)LWIP_MEMPOOL_ALLOC(RX_POOL);
-    custom_pbuf->custom_free_function = pbuf_free_custom;
+      csum = rx_checksum(rx->data, framelength);
+      if (csum >= 0)
+      {
+        fresh = rx_buffer_get();
+        if (fresh == NULL)
+          stats.rx_nomem++;
+      }
+    }
+    else
+    {
+      /* not a memory shortage, kept out of rx_nomem */
+      stats.rx_oversize++;
+    }
+    if (fresh != NULL)
+      ((ETH_DMADescTypeDef *)heth.RxDescList.RxDesc[heth.RxDescList.FirstAppDesc])->BackupAddr0 = (uint32_t)fresh->data;
+
+    /* Build Rx descriptor to be ready for next data reception */
+    HAL_ETH_BuildRxDescriptors(&heth);
+
+    /* dropped, the DMA keeps receiving into the same buffer */
+    if (fresh == NULL)
+      return NULL;
+
+    rx_software = csum > 0;
+    rx->pbuf.custom_free_function = pbuf_free_custom;
     
-    p = pbuf_alloced_custom(PBUF_RAW, framelength, PBUF_REF, custom_pbuf, RxBuff.buffer, ETH_RX_BUFFER_SIZE);
+    p = pbuf_alloced_custom(PBUF_RAW, framelength, PBUF_REF, &rx->pbuf, rx->data, ETH_RX_BUFFER_SIZE);
     
     return p;
   }
@@ -417,23 +749,50 @@ void ethernetif_input(struct netif *netif)
 {
   err_t err;
   struct pbuf *p;
+  uint32_t frames = 0;
 
-  /* move received packet into a new pbuf */
-  p = low_level_input(netif);
-    
-  /* no packet could be read, silently ignore this */
-  if (p == NULL) return;
-    
-  /* entry point to the LwIP stack */
-  err = netif->input(p, netif);
-    
-  if (err != ERR_OK)
+  if (tx_pending)
+    tx_reclaim();
+  if (!rx_pending)
+    return;
+  /* cleared first: a frame completing from here on raises it again */
+  rx_pending = 0;
+  stats.rx_polls++;
+
+  while (frames < rx_budget && HAL_ETH_IsRxDataAvailable(&heth))
   {
-    LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
-    pbuf_free(p);
-    p = NULL;    
+    frames++;
+
+    /* move received packet into a new pbuf */
+    p = low_level_input(netif);
+
+    /* dropped, the descriptor went back to the DMA */
+    if (p == NULL) continue;
+
+    /* entry point to the LwIP stack, it checks what the MAC could not (the flags are back for its own output) */
+    if (rx_software)
+      NETIF_SET_CHECKSUM_CTRL(netif, CHECKSUM_SOFTWARE);
+    err = netif->input(p, netif);
+    NETIF_SET_CHECKSUM_CTRL(netif, CHECKSUM_OFFLOAD);
+
+    if (err != ERR_OK)
+    {
+      LWIP_DEBUGF(NETIF_DEBUG, ("ethernetif_input: IP input error\n"));
+      pbuf_free(p);
+      p = NULL;
+    }
   }
-  
+
+  /* more may be waiting, they are taken on the next call */
+  if (frames == rx_budget)
+  {
+    stats.rx_budget_hits++;
+    rx_pending = 1;
+  }
+  stats.rx_frames += frames;
+  if (frames > stats.rx_max_batch)
+    stats.rx_max_batch = frames;
+  rx_drop_counters();
 }
 
 #if !LWIP_ARP
@@ -515,14 +874,15 @@ err_t ethernetif_init(struct netif *netif)
   */
 void pbuf_free_custom(struct pbuf *p)
 {
-  struct pbuf_custom* custom_pbuf = (struct pbuf_custom*)p;
+  rx_buffer_t *rx = (rx_buffer_t *)p;
   
 #if !defined(DUAL_CORE) || defined(CORE_CM7)
-  /* Invalidate data cache: lwIP and/or application may have written into buffer */
-  SCB_InvalidateDCache_by_Addr((uint32_t *)p->payload, p->tot_len);
+  /* Invalidate data cache: lwIP and/or application may have written into buffer, the payload pointer moved past the
+   * headers, the whole buffer goes */
+  SCB_InvalidateDCache_by_Addr((uint32_t *)rx->data, ETH_RX_BUFFER_SIZE);
 #endif
   
-  LWIP_MEMPOOL_FREE(RX_POOL, custom_pbuf);
+  rx_buffer_put(rx);
 }
 
 /* USER CODE BEGIN 6 */
@@ -562,8 +922,36 @@ u32_t sys_now(void)
   */
 void ethernet_link_check_state(struct netif *netif)
 {
-  
-  HAL_ETH_Start(&heth);
+  phy_status_t phy;
+  ETH_MACConfigTypeDef macconf;
+  int changed = phy_found ? phy_poll() : !netif_is_link_up(netif);
+
+  phy_status(&phy);
+  rx_drop_counters();
+  if (!changed)
+    return;
+
+  /* stopped on any change, the MAC takes a new mode only then, and the frames queued for the old link go */
+  if (netif_is_link_up(netif))
+  {
+    HAL_ETH_Stop_IT(&heth);
+    tx_flush();
+    netif_set_down(netif);
+    netif_set_link_down(netif);
+  }
+  if (phy_found && !phy.link)
+    return;
+
+  HAL_ETH_GetMACConfig(&heth, &macconf);
+  if (phy_found)
+  {
+    macconf.Speed = phy.speed == 100 ? ETH_SPEED_100M : ETH_SPEED_10M;
+    macconf.DuplexMode = phy.full ? ETH_FULLDUPLEX_MODE : ETH_HALFDUPLEX_MODE;
+    HAL_ETH_SetMACConfig(&heth, &macconf);
+  }
+  HAL_ETH_Start_IT(&heth);
+  /* a receive buffer unavailable stop is reported, a burst that starves the ring gets counted */
+  __HAL_ETH_DMA_ENABLE_IT(&heth, ETH_DMACIER_RBUE);
   netif_set_up(netif);
   netif_set_link_up(netif);
 
@@ -573,7 +961,41 @@ void ethernet_link_check_state(struct netif *netif)
 
 }
 /* USER CODE BEGIN 8 */
+void ethernetif_set_budget(uint32_t budget)
+{
+  rx_budget = budget < 1 ? 1 : budget > 255 ? 255 : budget;
+}
+
+uint32_t ethernetif_budget(void)
+{
+  return rx_budget;
+}
 
+void ethernetif_stats(ethernetif_stats_t *st)
+{
+  rx_drop_counters();
+  *st = stats;
+}
+
+int ethernetif_link(uint32_t *speed, int *full)
+{
+  ETH_MACConfigTypeDef macconf;
+
+  HAL_ETH_GetMACConfig(&heth, &macconf);
+  *speed = macconf.Speed == ETH_SPEED_100M ? 100 : 10;
+  *full = macconf.DuplexMode == ETH_FULLDUPLEX_MODE;
+  return phy_found;
+}
+
+void ethernetif_reset_stats(void)
+{
+  uint32_t free = stats.rx_pool_free, inflight = stats.tx_inflight;
+
+  rx_drop_counters();
+  memset(&stats, 0, sizeof(stats));
+  stats.rx_pool_free = stats.rx_pool_min = free;
+  stats.tx_inflight = stats.tx_max_inflight = inflight;
+}
 /* USER CODE END 8 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
 
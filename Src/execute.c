@@ -5,12 +5,26 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <bootctl.h>
 #include <bsp_driver_sd.h>
+#include <datalog.h>
 #include <fatfs.h>
 #include <ff.h>
+#include <fstream.h>
+#include <iperf.h>
+#include <logcat.h>
 #include <lwip.h>
 #include <main.h>
+#include <phy.h>
+#include <qspi_mode.h>
+#include <sd_bus.h>
+#include <sd_cache.h>
+#include <sd_format.h>
+#include <sdbench.h>
+#include <sections.h>
 #include <sfud.h>
+#include <update.h>
+#include <volume.h>
 #include <usbd_cdc_if.h>
 
 #include <stm32h7xx_hal_qspi.h>
@@ -42,11 +56,20 @@ static CMDFUNC(cmd_mwr);
 static CMDFUNC(cmd_reset);
 static CMDFUNC(cmd_sdinfo);
 static CMDFUNC(cmd_sdls);
+static CMDFUNC(cmd_sdcat);
+static CMDFUNC(cmd_sd);
+static CMDFUNC(cmd_sdbench);
+static CMDFUNC(cmd_sdseek);
+static CMDFUNC(cmd_sdformat);
+static CMDFUNC(cmd_datalog);
+static CMDFUNC(cmd_logcat);
 static CMDFUNC(cmd_qspi);
 static CMDFUNC(cmd_usb);
 static CMDFUNC(cmd_eth);
+static CMDFUNC(cmd_iperf);
 static CMDFUNC(cmd_485);
 static CMDFUNC(cmd_can);
+static CMDFUNC(cmd_update);
 
 static CMDFUNC(cmd_retcode)
 {
@@ -67,11 +90,20 @@ struct {
     {"gpio", cmd_gpio, "gpio subsystem"},
     {"sdinfo", cmd_sdinfo, "show sd information"},
     {"sdls", cmd_sdls, "ls on SDCard"},
+    {"sdcat", cmd_sdcat, "send a SD file to the console, USB or TCP"},
+    {"sd", cmd_sd, "sd subsystem"},
+    {"sdbench", cmd_sdbench, "SD card and FatFs throughput"},
+    {"sdseek", cmd_sdseek, "random reads in a SD file, FAT chain vs fast seek"},
+    {"sdformat", cmd_sdformat, "format SD aligned to its erase blocks"},
+    {"datalog", cmd_datalog, "contiguous data logger on SD"},
+    {"logcat", cmd_logcat, "records of a datalog capture in a time window"},
     {"qspi", cmd_qspi, "qspi subsystem"},
     {"usb", cmd_usb, "usb subsystem"},
     {"eth", cmd_eth, "ethernet subsystem"},
+    {"iperf", cmd_iperf, "TCP and UDP throughput, iperf 2 compatible"},
     {"485", cmd_485, "rs485 subsystem"},
     {"can", cmd_can, "CANBus subsystem"},
+    {"update", cmd_update, "QSPI image update over TCP or USB"},
 };
 
 static int readKey()
@@ -82,6 +114,8 @@ static int readKey()
     return -1;
 }
 
+static int keyPressed(void) { return readKey() != -1; }
+
 static CMDFUNC(cmd_gpio)
 {
     static const struct {
@@ -293,9 +327,21 @@ static const char *card_type[] = {
     "secured",
 };
 
+static const char *fs_name[] = {"?", "FAT12", "FAT16", "FAT32", "exFAT"};
+
+/* the logger writes the sectors of its file behind FatFs, a command formatting the card or writing raw sectors
+ * breaks it */
+static int sd_logging(void)
+{
+    if (!datalog_running())
+        return 0;
+    printf("SD in use by the data logger, stop it first\r\n");
+    return 1;
+}
+
 static CMDFUNC(cmd_sdinfo)
 {
-    if (BSP_SD_Init() == MSD_OK) {
+    if (volume_card(SDPath) == 0) {
         HAL_SD_CardInfoTypeDef info;
         BSP_SD_GetCardInfo(&info);
         printf("CardType:     %s\r\n", card_type[info.CardType]);
@@ -316,7 +362,7 @@ static CMDFUNC(cmd_sdinfo)
 static CMDFUNC(cmd_sdls)
 {
     static DIR dir;
-    if (f_mount(&SDFatFS, SDPath, 1) != FR_OK) {
+    if (volume_mount(SDPath) != FR_OK) {
         printf("Error mounting SD\r\n");
         return -1;
     }
@@ -330,11 +376,470 @@ static CMDFUNC(cmd_sdls)
     } else {
         printf("Fail to open SD\r\n");
     }
-    if (f_mount(NULL, SDPath, 1) != FR_OK) {
-        printf("Error unmounting SD\r\n");
+    return 0;
+}
+
+static CMDFUNC(cmd_sdcat)
+{
+    /* in AXI SRAM: the sectors f_forward reads into its buffer come with the IDMA */
+    static FIL fil AXISRAM_BSS;
+    char path[64];
+    FSIZE_t size, sent = 0;
+    uint32_t start;
+    FRESULT res;
+    int rc;
+
+    if (argc < 2 || argc > 4)
+        goto usage;
+    snprintf(path, sizeof(path), "%s%s", SDPath, argv[1]);
+    if (volume_mount(SDPath) != FR_OK) {
+        printf("Error mounting SD\r\n");
+        return -1;
+    }
+    if (f_open(&fil, path, FA_READ) != FR_OK) {
+        printf("Cannot open %s\r\n", path);
+        return -1;
+    }
+    size = f_size(&fil);
+    start = HAL_GetTick();
+    if (argc == 2) {
+        res = fstream_send(&fil, &fstream_uart, &huart1, size, &sent, keyPressed);
+        rc = res == FR_OK ? 0 : -1;
+    } else if (strcmp(argv[2], "usb") == 0 && argc == 3) {
+        res = fstream_send(&fil, &fstream_usb, NULL, size, &sent, keyPressed);
+        rc = res == FR_OK ? 0 : -1;
+    } else if (strcmp(argv[2], "tcp") == 0) {
+        int port = FSTREAM_TCP_PORT;
+        if (argc == 4 && sscanf(argv[3], "%i", &port) != 1) {
+            f_close(&fil);
+            goto usage;
+        }
+        printf("Waiting for a client on TCP port %d, any key cancels\r\n", port);
+        start = HAL_GetTick();
+        rc = fstream_serve_tcp(&fil, port, keyPressed);
+        sent = f_tell(&fil);
+    } else {
+        f_close(&fil);
+        goto usage;
+    }
+    f_close(&fil);
+    if (argc > 2) {
+        uint32_t ms = HAL_GetTick() - start;
+        printf("%s: %" PRIu32 " of %" PRIu32 " bytes in %" PRIu32 " ms", rc == 0 ? "Sent" : "Failed", (uint32_t)sent,
+               (uint32_t)size, ms);
+        if (ms)
+            printf(", %" PRIu32 " KB/s", (uint32_t)(sent / ms * 1000 / 1024));
+        printf("\r\n");
+    }
+    return rc;
+
+usage:
+    printf("usage: %s <file>              to the console\r\n"
+           "       %s <file> usb          to the USB CDC port\r\n"
+           "       %s <file> tcp [port]   to the first client on a TCP port (default %d)\r\n",
+           argv[0], argv[0], argv[0], FSTREAM_TCP_PORT);
+    return -1;
+}
+
+static void sd_bus_print(void)
+{
+    sd_bus_t bus;
+
+    sd_bus_info(&bus);
+    printf("width:      %" PRIu32 " bit\r\n", bus.width);
+    printf("clock:      %" PRIu32 " kHz (kernel %" PRIu32 " kHz%s)\r\n", bus.clock_hz / 1000, bus.kernel_hz / 1000,
+           bus.max_hz ? ", limited" : "");
+    printf("mode:       %s\r\n", bus.high_speed ? "high speed" : "default speed");
+    if (bus.phase >= 0)
+        printf("rx clock:   delay block phase %d\r\n", bus.phase);
+    else
+        printf("rx clock:   direct\r\n");
+    printf("CRC errors: %" PRIu32 ", %" PRIu32 " clock fallbacks\r\n", bus.crc_errors, bus.fallbacks);
+}
+
+static void sd_cache_print(void)
+{
+    sd_cache_stats_t st;
+
+    sd_cache_stats(&st);
+    printf("reads:   %" PRIu32 " hits, %" PRIu32 " misses, %" PRIu32 " read ahead\r\n", st.read_hits, st.read_misses,
+           st.read_ahead);
+    printf("writes:  %" PRIu32 " sectors, %" PRIu32 " rewrites, %" PRIu32 " dirty\r\n", st.writes, st.write_hits,
+           st.dirty);
+    printf("flushes: %" PRIu32 " syncs, %" PRIu32 " evictions, %" PRIu32 " sectors in %" PRIu32 " commands\r\n",
+           st.syncs, st.evictions, st.flushed, st.flush_writes);
+    printf("bypass:  %" PRIu32 " sectors\r\n", st.bypassed);
+}
+
+static void sd_volume_print(void)
+{
+    static const char *state[] = {"no card", "card ready", "mounted"};
+    volume_info_t v;
+
+    volume_info(SDPath, &v);
+    printf("state:    %s", state[v.state]);
+    if (v.state == VOLUME_MOUNTED)
+        printf(", %s, %" PRIu32 " KB clusters", fs_name[v.fs_type <= FS_EXFAT ? v.fs_type : 0], v.cluster_sectors / 2);
+    else if (v.error)
+        printf(", mount error %d", v.error);
+    printf("\r\n");
+    if (v.free_clusters != 0xFFFFFFFF)
+        printf("free:     %" PRIu32 " MB\r\n", v.free_clusters * v.cluster_sectors / 2048);
+    else if (v.state == VOLUME_MOUNTED)
+        printf("free:     not counted yet, sd vol free\r\n");
+    printf("mounts:   %" PRIu32 ", the last in %" PRIu32 " ms\r\n", v.mounts, v.mount_ms);
+    printf("removals: %" PRIu32 ", insertions: %" PRIu32 "\r\n", v.removals, v.insertions);
+}
+
+static CMDFUNC(cmd_sd)
+{
+    sd_bus_t bus;
+
+    if (argc >= 2 && strcmp(argv[1], "cache") == 0) {
+        if (argc == 3 && strcmp(argv[2], "reset") == 0)
+            sd_cache_reset_stats();
+        else if (argc != 2)
+            goto usage;
+        sd_cache_print();
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "vol") == 0) {
+        if (argc == 3 && strcmp(argv[2], "free") == 0) {
+            DWORD clusters;
+            FRESULT res = volume_free(SDPath, &clusters);
+            if (res != FR_OK) {
+                printf("Error mounting SD: error %d\r\n", res);
+                return -1;
+            }
+        } else if (argc == 3 && strcmp(argv[2], "eject") == 0) {
+            if (sd_logging())
+                return -1;
+            volume_release(SDPath);
+        } else if (argc != 2) {
+            goto usage;
+        }
+        sd_volume_print();
+        return 0;
+    }
+    if (argc < 2 || strcmp(argv[1], "bus") != 0)
+        goto usage;
+    /* the card was never initialized */
+    sd_bus_info(&bus);
+    if (bus.kernel_hz == 0 && volume_card(SDPath) != 0) {
+        printf("Error init SD\r\n");
         return -1;
     }
+    if (argc == 2) {
+        sd_bus_print();
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[2], "tune") == 0) {
+        if (sd_bus_negotiate() != 0) {
+            printf("Card fails at the slowest clock\r\n");
+            return -1;
+        }
+    } else if (argc == 4 && strcmp(argv[2], "clock") == 0) {
+        uint32_t khz = strcmp(argv[3], "auto") == 0 ? 0 : strtoul(argv[3], NULL, 0);
+        if (strcmp(argv[3], "auto") != 0 && khz == 0)
+            goto usage;
+        if (sd_bus_set_clock(khz * 1000) != 0) {
+            printf("Card fails at the slowest clock\r\n");
+            return -1;
+        }
+    } else if (argc == 4 && strcmp(argv[2], "width") == 0) {
+        if (sd_bus_set_width(strtoul(argv[3], NULL, 0)) != 0) {
+            printf("Bus width not available, the slot only wires D0\r\n");
+            return -1;
+        }
+    } else {
+        goto usage;
+    }
+    sd_bus_print();
     return 0;
+
+usage:
+    printf("usage: %s bus                    show the bus width and clock\r\n"
+           "       %s bus tune               negotiate the speed again\r\n"
+           "       %s bus clock <kHz>|auto   limit the clock\r\n"
+           "       %s bus width <1|4>        set the bus width\r\n"
+           "       %s cache [reset]          sector cache statistics\r\n"
+           "       %s vol [free|eject]       mounted volume, count the free space or unmount it\r\n",
+           argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return -1;
+}
+
+static CMDFUNC(cmd_sdbench)
+{
+    sdbench_opts_t opts = {.raw = 1, .file = 1, .file_size = 4 * 1024 * 1024};
+    int i = 1;
+
+    if (sd_logging())
+        return -1;
+
+    if (i < argc && strcmp(argv[i], "raw") == 0) {
+        opts.file = 0;
+        i++;
+    } else if (i < argc && strcmp(argv[i], "file") == 0) {
+        opts.raw = 0;
+        i++;
+    } else if (i < argc && strcmp(argv[i], "all") == 0) {
+        i++;
+    }
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "-w") == 0) {
+            opts.raw_write = 1;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            uint32_t mb = strtoul(argv[++i], NULL, 0);
+            if (mb == 0 || mb > 256)
+                goto usage;
+            opts.file_size = mb * 1024 * 1024;
+        } else {
+            goto usage;
+        }
+    }
+    if (opts.raw_write && opts.raw)
+        printf("Raw writes overwrite the last %d MB of the card\r\n", SDBENCH_RAW_AREA / (1024 * 1024));
+    return sdbench(&opts);
+
+usage:
+    printf("usage: %s [raw|file|all] [-w] [-s MB]\r\n"
+           "       raw    block reads over the SD driver, -w adds writes (destroys the end of the card)\r\n"
+           "       file   FatFs writes and reads of sdbench.tmp, -s MB per test (default 4)\r\n",
+           argv[0]);
+    return -1;
+}
+
+static CMDFUNC(cmd_sdseek)
+{
+    uint32_t seeks = 512;
+
+    if (argc < 2 || argc > 3)
+        goto usage;
+    if (argc == 3) {
+        seeks = strtoul(argv[2], NULL, 0);
+        if (seeks == 0)
+            goto usage;
+    }
+    return sdbench_seek(argv[1], seeks);
+
+usage:
+    printf("usage: %s <file> [seeks]   random sector reads (default 512), a large fragmented file shows the most\r\n",
+           argv[0]);
+    return -1;
+}
+
+static const char *sd_aligned(uint32_t sector, uint32_t block)
+{
+    return sector % block == 0 ? "aligned" : "not aligned";
+}
+
+static CMDFUNC(cmd_sdformat)
+{
+    sd_format_layout_t l;
+    FRESULT res;
+
+    if (sd_logging())
+        return -1;
+
+    if (argc == 3 && strcmp(argv[1], "-c") == 0) {
+        uint32_t cluster = strtoul(argv[2], NULL, 0);
+        if (cluster < 512 || cluster > 64 * 1024 || (cluster & (cluster - 1)))
+            goto usage;
+        res = sd_format(cluster);
+    } else if (argc == 1) {
+        res = sd_format(0);
+    } else if (argc != 2 || strcmp(argv[1], "info") != 0) {
+        goto usage;
+    } else {
+        res = FR_OK;
+    }
+    if (res != FR_OK) {
+        printf("Format failed: error %d\r\n", res);
+        return -1;
+    }
+    res = sd_format_layout(&l);
+    if (res != FR_OK) {
+        printf("Error mounting SD: error %d\r\n", res);
+        return -1;
+    }
+    printf("type:        %s, %" PRIu32 " clusters of %" PRIu32 " KB\r\n", fs_name[l.fs_type <= FS_EXFAT ? l.fs_type : 0],
+           l.clusters, l.cluster / 2);
+    printf("erase block: %" PRIu32 " sectors (%" PRIu32 " KB)\r\n", l.erase_block, l.erase_block / 2);
+    printf("volume:      sector %" PRIu32 ", %" PRIu32 " MB, %s\r\n", l.volume_start, l.volume_size / 2048,
+           sd_aligned(l.volume_start, l.erase_block));
+    printf("FAT:         sector %" PRIu32 ", %" PRIu32 " sectors, %s\r\n", l.fat_start, l.fat_size,
+           sd_aligned(l.fat_start, l.erase_block));
+    printf("data:        sector %" PRIu32 ", %s\r\n", l.data_start, sd_aligned(l.data_start, l.erase_block));
+    return 0;
+
+usage:
+    printf("usage: %s [-c <cluster bytes>]   partition and format the card, the data area on its erase blocks\r\n"
+           "       %s info                   layout of the volume on the card\r\n",
+           argv[0], argv[0]);
+    return -1;
+}
+
+static void datalog_print(void)
+{
+    datalog_stats_t st;
+
+    datalog_stats(&st);
+    printf("state:   %s", datalog_running() ? "running" : "stopped");
+    if (st.error)
+        printf(", error %d", st.error);
+    printf("\r\nrecords: %" PRIu32 " (%" PRIu32 " KB), %" PRIu32 " dropped\r\n", st.records, st.bytes / 1024,
+           st.dropped);
+    printf("card:    %" PRIu32 " buffers of %u KB in %" PRIu32 " files\r\n", st.written, DATALOG_BUFFER_SIZE / 1024,
+           st.files);
+    printf("slowest: %" PRIu32 " ms buffer write, %" PRIu32 " ms file rotation\r\n", st.max_write_ms, st.max_open_ms);
+}
+
+static CMDFUNC(cmd_datalog)
+{
+    if (argc >= 2 && strcmp(argv[1], "start") == 0) {
+        datalog_config_t cfg = {.prefix = "log", .file_size = 64 * 1024 * 1024, .rotate_ms = 0};
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+                uint32_t mb = strtoul(argv[++i], NULL, 0);
+                if (mb == 0 || mb > 4095)
+                    goto usage;
+                cfg.file_size = mb * 1024 * 1024;
+            } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                cfg.rotate_ms = strtoul(argv[++i], NULL, 0) * 1000;
+            } else if (argv[i][0] != '-') {
+                cfg.prefix = argv[i];
+            } else {
+                goto usage;
+            }
+        }
+        if (datalog_start(&cfg) != 0) {
+            printf("Cannot start the logger\r\n");
+            datalog_print();
+            return -1;
+        }
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        int rc = datalog_stop();
+        datalog_print();
+        return rc;
+    }
+    if (argc == 2 && strcmp(argv[1], "status") == 0) {
+        datalog_print();
+        return 0;
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "fill") == 0) {
+        static uint8_t record[DATALOG_MAX_DATA];
+        uint32_t seconds = strtoul(argv[2], NULL, 0);
+        uint32_t size = argc == 4 ? strtoul(argv[3], NULL, 0) : 256;
+        datalog_stats_t before, after;
+
+        if (!datalog_running() || seconds == 0 || size > DATALOG_MAX_DATA)
+            goto usage;
+        for (uint32_t i = 0; i < size; i++)
+            record[i] = i;
+        datalog_stats(&before);
+        uint32_t start = HAL_GetTick();
+        while (HAL_GetTick() - start < seconds * 1000 && datalog_running() && readKey() == -1) {
+            for (int i = 0; i < 64; i++)
+                datalog_write(DATALOG_USER, record, size);
+            datalog_poll();
+        }
+        uint32_t ms = HAL_GetTick() - start;
+        datalog_stats(&after);
+        uint32_t kb = (after.written - before.written) * (DATALOG_BUFFER_SIZE / 1024);
+        printf("%" PRIu32 " KB to the card in %" PRIu32 " ms, %" PRIu32 " KB/s, %" PRIu32 " records dropped\r\n", kb,
+               ms, ms ? kb * 1000 / ms : 0, after.dropped - before.dropped);
+        return 0;
+    }
+
+usage:
+    printf("usage: %s start [-s <MB per file>] [-t <seconds per file>] [prefix]\r\n"
+           "       %s stop | status\r\n"
+           "       %s fill <seconds> [record bytes]   log records as fast as the card takes them\r\n",
+           argv[0], argv[0], argv[0]);
+    return -1;
+}
+
+/* seconds with up to 3 decimals, in ms */
+static int parse_ms(const char *s, uint32_t *ms)
+{
+    char *end;
+    uint32_t v = strtoul(s, &end, 10) * 1000;
+
+    if (end == s)
+        return -1;
+    if (*end == '.')
+        for (uint32_t scale = 100, i = 1; end[i] >= '0' && end[i] <= '9' && scale; i++, scale /= 10)
+            v += (end[i] - '0') * scale;
+    *ms = v;
+    return 0;
+}
+
+static int logcat_print(const datalog_record_t *r, void *ctx)
+{
+    static const char *source[] = {"pad", "rs485", "can", "eth", "user"};
+    const uint8_t *data = (const uint8_t *)(r + 1);
+    uint32_t size = r->size - sizeof(*r);
+
+    if (*(int *)ctx)
+        return keyPressed();
+    printf("%6" PRIu32 ".%03" PRIu32 " %-5s %4" PRIu32 " ", r->time / 1000, r->time % 1000,
+           r->source <= DATALOG_USER ? source[r->source] : "?", size);
+    for (uint32_t i = 0; i < size && i < 16; i++)
+        printf(" %02x", data[i]);
+    printf("%s\r\n", size > 16 ? " ..." : "");
+    return keyPressed();
+}
+
+static CMDFUNC(cmd_logcat)
+{
+    uint32_t from = 0, to = UINT32_MAX;
+    int verify = 0, count = 0;
+    const char *name = NULL;
+    logcat_stats_t st;
+    uint32_t start;
+    FRESULT res;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &from) != 0)
+                goto usage;
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &to) != 0)
+                goto usage;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            count = 1;
+        } else if (argv[i][0] != '-' && !name) {
+            name = argv[i];
+        } else {
+            goto usage;
+        }
+    }
+    if (!name || from > to)
+        goto usage;
+
+    start = HAL_GetTick();
+    res = logcat(name, from, to, verify, logcat_print, &count, &st);
+    printf("%" PRIu32 " records in %" PRIu32 " ms: %" PRIu32 " files, %" PRIu32 " headers and %" PRIu32
+           " blocks read",
+           st.records, HAL_GetTick() - start, st.files, st.headers, st.blocks);
+    if (st.bad)
+        printf(", %" PRIu32 " bad blocks", st.bad);
+    printf("\r\n");
+    if (res != FR_OK) {
+        printf("Error %d\r\n", res);
+        return -1;
+    }
+    return 0;
+
+usage:
+    printf("usage: %s <file.log | prefix> [--from s[.ms]] [--to s[.ms]] [-v] [-c]\r\n"
+           "       times since the logger session boot, -v checks the block CRCs, -c counts only\r\n",
+           argv[0]);
+    return -1;
 }
 
 static void sfud_demo(uint32_t addr, size_t size, uint8_t *data)
@@ -432,41 +937,6 @@ static void sfud_printRet(const char *func, sfud_err errorCode)
     printf("SFUD %s return: %s\r\n", func, sfud_error_text[errorCode]);
 }
 
-uint8_t BSP_QSPI_MemoryMappedMode(void)
-{
-    extern QSPI_HandleTypeDef hqspi;
-    QSPI_CommandTypeDef s_command;
-    QSPI_MemoryMappedTypeDef s_mem_mapped_cfg;
-
-    /* Configure the command for the read instruction */
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Instruction = 0xEB;
-    s_command.AddressMode = QSPI_ADDRESS_4_LINES;
-    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-    s_command.DataMode = QSPI_DATA_4_LINES;
-    s_command.DummyCycles = 6;
-    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
-    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-    s_command.Address = 0;
-    s_command.AlternateBytes = 0;
-    s_command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
-    s_command.NbData = 0;
-
-    /* Configure the memory mapped mode */
-    s_mem_mapped_cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE;
-    s_mem_mapped_cfg.TimeOutPeriod = 1;
-
-    if (HAL_QSPI_MemoryMapped(&hqspi, &s_command, &s_mem_mapped_cfg) != HAL_OK) {
-        return -1;
-    }
-
-    SCB_CleanInvalidateDCache_by_Addr((uint32_t *)QSPI_BASE, 1 << hqspi.Init.FlashSize);
-
-    return 0;
-}
-
 static void testQPSIMemMap(void)
 {
     const int size = 32;
@@ -561,37 +1031,55 @@ static bool enable_quad_mode(sfud_flash *flash)
     return true;
 }
 
+/*
+ * Under XIP the probe unmaps the flash the code runs from: masked interrupts, ITCM code and a single indirect
+ * bracket, so the mapping only comes back once SFUD has a read command for it. The quad read qspiboot selected is
+ * selected again the same way.
+ */
+ITCM_FUNC static bool qspi_probe_xip(sfud_flash *flash)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint8_t status;
+    bool ok;
+
+    __disable_irq();
+    qspi_indirect_begin();
+    ok = sfud_init() == SFUD_SUCCESS;
+    if (ok && sfud_read_status(flash, &status) == SFUD_SUCCESS && (status & (1 << 6)))
+        sfud_qspi_fast_read_enable(flash, 4);
+    qspi_indirect_end();
+    __set_PRIMASK(primask);
+    return ok;
+}
+
+static bool qspi_probe(void)
+{
+    sfud_flash *flash = sfud_get_device(SFUD_W25_DEVICE_INDEX);
+
+    if (qspi_inited)
+        return true;
+    if (qspi_mode_is_xip()) {
+        qspi_inited = qspi_probe_xip(flash);
+    } else if (sfud_init() == SFUD_SUCCESS) {
+        printf("qspi init OK\r\n");
+        enable_quad_mode(flash);
+        /* enable qspi fast read mode, set four data lines width */
+        sfud_printRet("fast_read_enable", sfud_qspi_fast_read_enable(flash, 4));
+        qspi_inited = true;
+    }
+    if (!qspi_inited)
+        printf("qspi init fail\r\n");
+    return qspi_inited;
+}
+
 static CMDFUNC(cmd_qspi)
 {
     if (argc == 1)
         goto usage;
 
-    if (strcmp(argv[1], "mmap") == 0) {
-        if (strcmp(argv[2], "on") == 0) {
-            printf("Enter in mmap mode\n");
-            if (BSP_QSPI_MemoryMappedMode() == 0) {
-                puts("QSPI in mmap\n");
-                return 0;
-            } else {
-                puts("QSPI enter mmap error\n");
-                return -1;
-            }
-        }
-        if (strcmp(argv[2], "off") == 0) {
-            extern QSPI_HandleTypeDef hqspi;
-            extern void MX_QUADSPI_Init(void);
-            puts("Restart qspi");
-            HAL_QSPI_DeInit(&hqspi);
-            MX_QUADSPI_Init();
-            puts("Done");
-            return 0;
-        }
-        if (strcmp(argv[2], "test") == 0) {
-            testQPSIMemMap();
-            return 0;
-        }
-        printf("Unknown action: %s\n%s on|off|test\n", argv[1], argv[0]);
-        return 0;
+    if (qspi_mode_is_xip() && strcmp(argv[1], "mmap") != 0) {
+        puts("QSPI executes in place, only mmap test|stats are available");
+        return -1;
     }
 
     if (strcmp(argv[1], "freq") == 0) {
@@ -628,15 +1116,55 @@ static CMDFUNC(cmd_qspi)
 
     sfud_flash *flash = sfud_get_device(SFUD_W25_DEVICE_INDEX);
 
-    if (!qspi_inited) {
-        if (sfud_init() == SFUD_SUCCESS) {
-            printf("qspi init OK\r\n");
-            enable_quad_mode(flash);
-            /* enable qspi fast read mode, set four data lines width */
-            sfud_printRet("fast_read_enable", sfud_qspi_fast_read_enable(flash, 4));
-            qspi_inited = true;
-        } else
-            printf("qspi init fail\r\n");
+    /* under XIP the flash was probed by qspiboot, the mmap commands do not need SFUD */
+    if (!qspi_mode_is_xip())
+        qspi_probe();
+
+    if (strcmp(argv[1], "mmap") == 0) {
+        if (argc < 3)
+            goto usage;
+        if (strcmp(argv[2], "on") == 0) {
+            if (qspi_mmap_acquire() != 0) {
+                puts("QSPI enter mmap error\n");
+                return -1;
+            }
+            puts("QSPI in mmap\n");
+            return 0;
+        }
+        if (strcmp(argv[2], "off") == 0) {
+            qspi_mmap_release();
+            printf("QSPI %s\n", qspi_mmap_active() ? "still in mmap (leased)" : "in indirect mode");
+            return 0;
+        }
+        if (strcmp(argv[2], "test") == 0) {
+            if (qspi_mmap_acquire() != 0) {
+                puts("QSPI enter mmap error\n");
+                return -1;
+            }
+            testQPSIMemMap();
+            qspi_mmap_release();
+            return 0;
+        }
+        if (strcmp(argv[2], "stats") == 0) {
+            qspi_mode_stats_t st;
+            uint32_t mhz = HAL_RCC_GetSysClockFreq() / 1000000;
+            if (argc > 3 && strcmp(argv[3], "reset") == 0) {
+                qspi_mode_stats_reset();
+                return 0;
+            }
+            qspi_mode_stats(&st);
+            printf("mode:      %s, %" PRIu32 " leases\n", qspi_mmap_active() ? "mmap" : "indirect", st.leases);
+            printf("switches:  %" PRIu32 " enter, %" PRIu32 " abort, %" PRIu32 " failed\n", st.enters, st.aborts,
+                   st.failures);
+            printf("enter:     %" PRIu32 " us total\n", (uint32_t)(st.enter_cycles / mhz));
+            printf("abort:     %" PRIu32 " us total\n", (uint32_t)(st.abort_cycles / mhz));
+            printf("mapped:    %" PRIu32 " ms total\n", (uint32_t)(st.mapped_cycles / mhz / 1000));
+            printf("suspended: %" PRIu32 " us total, %" PRIu32 " us max\n", (uint32_t)(st.suspended_cycles / mhz),
+                   st.suspended_max / mhz);
+            return 0;
+        }
+        printf("Unknown action: %s\n%s mmap on|off|test|stats [reset]\n", argv[2], argv[0]);
+        return 0;
     }
 
     if (strcmp(argv[1], "demo") == 0) {
@@ -715,7 +1243,8 @@ usage:
            "  write <offset> <byte0> ... <byteN> Write bytes from offset\r\n"
            "  erase <offset>                     Erase 4K at <offset>\r\n"
            "  demo                               Start demo on first 1024 bytes\r\n"
-           "  mmap on|off|demo                   QSPI memory mapped commands\r\n",
+           "  mmap on|off|test                   Take/drop a memory mapped lease, dump the window\r\n"
+           "  mmap stats [reset]                 Mode switch counters and times\r\n",
            argv[0]);
     return -1;
 }
@@ -754,11 +1283,99 @@ static CMDFUNC(cmd_usb)
     return -1;
 }
 
+static void eth_stats_print(void)
+{
+    ethernetif_stats_t st;
+
+    ethernetif_stats(&st);
+    printf("rx:      %" PRIu32 " frames in %" PRIu32 " polls, %" PRIu32 " at most, budget %" PRIu32 " reached %" PRIu32
+           " times\r\n",
+           st.rx_frames, st.rx_polls, st.rx_max_batch, ethernetif_budget(), st.rx_budget_hits);
+    printf("dropped: %" PRIu32 " FIFO overruns, %" PRIu32 " missed by the DMA, %" PRIu32 " without a pbuf, %" PRIu32
+           " oversize\r\n",
+           st.rx_overruns, st.rx_missed, st.rx_nomem, st.rx_oversize);
+    printf("errors:  %" PRIu32 " rx buffer unavailable, %" PRIu32 " DMA\r\n", st.rx_starved, st.dma_errors);
+    printf("pool:    %" PRIu32 " of %u RX buffers free, %" PRIu32 " at least\r\n", st.rx_pool_free, ETH_RX_BUFFER_CNT,
+           st.rx_pool_min);
+    printf("tx:      %" PRIu32 " frames, %" PRIu32 " bounced, %" PRIu32 " in flight (%" PRIu32 " at most), %" PRIu32
+           " waited for the ring, %" PRIu32 " dropped\r\n",
+           st.tx_frames, st.tx_bounced, st.tx_inflight, st.tx_max_inflight, st.tx_waits, st.tx_dropped);
+    printf("csum:    rx %" PRIu32 " by the MAC, %" PRIu32 " by the stack, %" PRIu32 " bad; tx %" PRIu32
+           " by the MAC, %" PRIu32 " IP header only\r\n",
+           st.rx_csum_hw, st.rx_csum_sw, st.rx_csum_errors, st.tx_csum_hw, st.tx_csum_sw);
+    printf("line:    %" PRIu32 " CRC errors, %" PRIu32 " alignment errors, %" PRIu32 " tx collisions, %" PRIu32
+           " carrier losses\r\n",
+           st.rx_crc_errors, st.rx_align_errors, st.tx_collisions, st.tx_carrier_errors);
+}
+
+static void eth_phy_print(void)
+{
+    phy_status_t phy;
+    phy_stats_t st;
+    uint32_t speed;
+    int full;
+
+    phy_status(&phy);
+    phy_stats(&st);
+    if (!ethernetif_link(&speed, &full)) {
+        printf("no PHY found, MAC at %" PRIu32 " Mb/s %s duplex\r\n", speed, full ? "full" : "half");
+        return;
+    }
+    printf("phy:     %s (ID %08" PRIX32 ") at address %u\r\n", phy.name ? phy.name : "unknown", phy.id, phy.addr);
+    if (phy.link)
+        printf("link:    up, %" PRIu32 " Mb/s %s duplex, %s, partner abilities %04X\r\n", phy.speed,
+               phy.full ? "full" : "half", phy.negotiated ? "autonegotiated" : "partner not negotiating",
+               phy.partner);
+    else
+        printf("link:    down\r\n");
+    if (phy.link && !phy.negotiated && !phy.full)
+        printf("         a partner forced to full duplex mismatches: watch the CRC errors there, collisions here\r\n");
+    printf("mac:     %" PRIu32 " Mb/s %s duplex\r\n", speed, full ? "full" : "half");
+    printf("events:  %" PRIu32 " up, %" PRIu32 " down, %" PRIu32 " without autonegotiation in %" PRIu32 " polls\r\n",
+           st.link_ups, st.link_downs, st.parallel, st.polls);
+    printf("errors:  %" PRIu32 " symbol, %" PRIu32 " remote fault, %" PRIu32 " jabber, %" PRIu32
+           " parallel detection fault, %" PRIu32 " MDIO\r\n",
+           st.symbol_errors, st.remote_faults, st.jabbers, st.faults, st.mdio_errors);
+}
+
 static CMDFUNC(cmd_eth)
 {
     if (argc < 2)
         goto usage;
 
+    if (strcmp(argv[1], "stats") == 0 && argc <= 3) {
+        if (argc == 3 && strcmp(argv[2], "reset") != 0)
+            goto usage;
+        eth_stats_print();
+        if (argc == 3)
+            ethernetif_reset_stats();
+        return 0;
+    }
+
+    if (strcmp(argv[1], "budget") == 0 && argc <= 3) {
+        if (argc == 3) {
+            uint32_t budget = strtoul(argv[2], NULL, 0);
+            if (budget < 1 || budget > 255)
+                goto usage;
+            ethernetif_set_budget(budget);
+        }
+        printf("rx budget: %" PRIu32 " frames per poll\r\n", ethernetif_budget());
+        return 0;
+    }
+
+    if (strcmp(argv[1], "phy") == 0 && argc <= 3) {
+        if (argc == 3 && strcmp(argv[2], "reset") != 0 && strcmp(argv[2], "restart") != 0)
+            goto usage;
+        eth_phy_print();
+        if (argc == 3 && strcmp(argv[2], "reset") == 0)
+            phy_reset_stats();
+        if (argc == 3 && strcmp(argv[2], "restart") == 0 && phy_restart() != 0) {
+            printf("cannot restart autonegotiation\r\n");
+            return -1;
+        }
+        return 0;
+    }
+
     if (strcmp(argv[1], "phyrd") == 0) {
         if (argc < 3)
             goto usage;
@@ -770,7 +1387,9 @@ static CMDFUNC(cmd_eth)
         }
 
         uint32_t val;
-        HAL_ETH_ReadPHYRegister(&heth, 0, reg, &val);
+        phy_status_t phy;
+        phy_status(&phy);
+        HAL_ETH_ReadPHYRegister(&heth, phy.addr, reg, &val);
         printf("reg[%02X] = 0x%08X\r\n", reg, (unsigned int)val);
         for (int bit = 0; bit < 16; bit++)
             printf("   bit[%d] = %d\r\n", bit, (int)((val >> bit) & 1));
@@ -793,7 +1412,9 @@ static CMDFUNC(cmd_eth)
             goto usage;
         }
 
-        HAL_ETH_WritePHYRegister(&heth, 0, reg, (uint32_t)val);
+        phy_status_t phy;
+        phy_status(&phy);
+        HAL_ETH_WritePHYRegister(&heth, phy.addr, reg, (uint32_t)val);
 
         return 0;
     }
@@ -819,14 +1440,115 @@ static CMDFUNC(cmd_eth)
 usage:
     printf("usage: %s <command>\r\n"
            " where <command> is one of:\r\n"
+           "   phy [reset|restart] Link state, PHY counters, autonegotiation again\r\n"
            "   phyrd  <reg>        Read PHY register\r\n"
            "   phywr  <reg> <val>  Write PHY register\r\n"
+           "   stats [reset]       Receive and transmit counters\r\n"
+           "   budget [1-255]      Frames handed to the stack per main loop turn\r\n"
            "   rawtx...            Send raw packet (TODO)\r\n"
            "   rawrx...            Receive raw packet (TODO)\r\n",
            argv[0]);
     return -1;
 }
 
+static void iperf_print(const iperf_report_t *r)
+{
+    char line[160];
+
+    iperf_format(r, line, sizeof(line));
+    printf("%s\r\n", line);
+}
+
+/* bit/s with an optional k or M */
+static int parse_rate(const char *s, uint32_t *rate)
+{
+    char *end;
+    uint64_t v = strtoul(s, &end, 10);
+
+    if (end == s)
+        return -1;
+    if (*end == 'k' || *end == 'K')
+        v *= 1000, end++;
+    else if (*end == 'm' || *end == 'M')
+        v *= 1000000, end++;
+    if (*end || v == 0 || v > 1000000000)
+        return -1;
+    *rate = v;
+    return 0;
+}
+
+static CMDFUNC(cmd_iperf)
+{
+    iperf_config_t cfg = {.port = IPERF_PORT, .duration_ms = 10000, .interval_ms = 1000, .rate = IPERF_RATE};
+    bool client = false;
+
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        if (!iperf_running(true) && !iperf_running(false)) {
+            printf("Not running\r\n");
+            return -1;
+        }
+        iperf_stop(-1);
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            cfg.server = true;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            if (!ipaddr_aton(argv[++i], &cfg.remote))
+                goto usage;
+            client = true;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            cfg.udp = true;
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            cfg.port = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &cfg.duration_ms) != 0)
+                goto usage;
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            if (parse_ms(argv[++i], &cfg.interval_ms) != 0)
+                goto usage;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            if (parse_rate(argv[++i], &cfg.rate) != 0)
+                goto usage;
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            cfg.len = strtoul(argv[++i], NULL, 0);
+        } else {
+            goto usage;
+        }
+    }
+    if (cfg.server == client || cfg.port == 0)
+        goto usage;
+    if (cfg.len == 0)
+        cfg.len = cfg.udp ? IPERF_LEN_UDP : IPERF_LEN_TCP;
+
+    if (iperf_start(&cfg, iperf_print) != 0) {
+        printf("Cannot start the %s\r\n", cfg.server ? "server (already running, or the port is taken)" : "client");
+        return -1;
+    }
+    if (cfg.server) {
+        printf("%s server on port %u, reports from the main loop until 'iperf stop'\r\n", cfg.udp ? "UDP" : "TCP",
+               (unsigned)cfg.port);
+        return 0;
+    }
+    /* the client in the foreground, a key ends the test early */
+    while (iperf_running(false)) {
+        MX_LWIP_Process();
+        iperf_poll();
+        if (keyPressed())
+            iperf_stop(0);
+    }
+    return 0;
+
+usage:
+    printf("usage: %s -s [-u] [-p port] [-i seconds]    server, in the background\r\n"
+           "       %s -c <ip> [-u] [-b bit/s[k|M]] [-t seconds] [-l bytes] [-p port] [-i seconds]\r\n"
+           "       %s stop                              ends the server and a client\r\n"
+           " defaults: port %d, 10 s, reports every 1 s (-i 0: final only), UDP %d bit/s,\r\n"
+           " %d bytes per TCP write, %d per datagram (at most %d)\r\n",
+           argv[0], argv[0], argv[0], IPERF_PORT, IPERF_RATE, IPERF_LEN_TCP, IPERF_LEN_UDP, IPERF_LEN_MAX);
+    return -1;
+}
+
 static CMDFUNC(cmd_485)
 {
     if (argc > 1) {
@@ -862,6 +1584,68 @@ static CMDFUNC(cmd_can)
     return 0;
 }
 
+static CMDFUNC(cmd_update)
+{
+    update_stats_t st;
+    bootctl_t rec;
+    int rc;
+
+    if (argc < 2)
+        goto usage;
+    if (!qspi_probe())
+        return -1;
+
+    if (strcmp(argv[1], "info") == 0) {
+        if (bootctl_read(&rec) == 0)
+            printf("boot record: slot %c, %" PRIu32 " bytes, CRC32 0x%08" PRIX32 ", sequence %" PRIu32 "\r\n",
+                   'A' + (int)rec.slot, rec.image_size, rec.image_crc, rec.seq);
+        else
+            printf("boot record: none, slot A\r\n");
+        if (qspi_mode_is_xip())
+            printf("running:     slot %c\r\n", SCB->VTOR - QSPI_BASE >= BOOTCTL_SLOT_B ? 'B' : 'A');
+        printf("next update: slot %c, build it with make XIP=1 SLOT=%c\r\n", 'B' - (int)bootctl_active(),
+               'b' - (int)bootctl_active());
+        return 0;
+    }
+
+    if (strcmp(argv[1], "tcp") == 0) {
+        int port = UPDATE_TCP_PORT;
+        if (argc > 2 && sscanf(argv[2], "%i", &port) != 1)
+            goto usage;
+        rc = update_tcp(port, keyPressed);
+    } else if (strcmp(argv[1], "usb") == 0) {
+        rc = update_usb(keyPressed);
+    } else
+        goto usage;
+
+    update_stats(&st);
+    if (rc != UPDATE_DONE)
+        return -1;
+    printf("Slot %c: %" PRIu32 " bytes in %" PRIu32 " ms", 'A' + (int)st.slot, st.size, st.total_ms);
+    if (st.total_ms)
+        printf(", %" PRIu32 " bytes/s", (uint32_t)((uint64_t)st.size * 1000 / st.total_ms));
+    printf(", CRC32 0x%08" PRIX32 "\r\n", st.crc);
+    printf("  receive    %" PRIu32 " ms\r\n", st.receive_ms);
+    printf("  erase      %" PRIu32 " ms (flash busy)\r\n", st.erase_ms);
+    printf("  program    %" PRIu32 " ms\r\n", st.program_ms);
+    printf("  verify     %" PRIu32 " ms\r\n", st.verify_ms);
+    printf("  erase wait %" PRIu32 " ms (data ready, block not erased)\r\n", st.erase_wait_ms);
+    printf("  held back  %" PRIu32 " ms (both buffers full)\r\n", st.full_ms);
+    if (st.stall_ms)
+        printf("  stalled    %" PRIu32 " ms (XIP erase, interrupts masked)\r\n", st.stall_ms);
+    printf("The next reset starts slot %c\r\n", 'A' + (int)st.slot);
+    return 0;
+
+usage:
+    printf("usage: %s <command>\r\n"
+           " where <command> is one of:\r\n"
+           "   info        Boot record and slots\r\n"
+           "   tcp [port]  Receive the image on a TCP port (default %d)\r\n"
+           "   usb         Receive the image on the USB CDC port\r\n",
+           argv[0], UPDATE_TCP_PORT);
+    return -1;
+}
+
 int mrl_execute(int argc, const char *const *argv)
 {
     for (int i = 0; i < (sizeof(commands) / sizeof(*commands)); i++)
@@ -17,6 +17,8 @@
   */
 
 #include "fatfs.h"
+#include "sd_cache.h"
+#include "volume.h"
 
 uint8_t retSD;    /* Return value for SD */
 char SDPath[4];   /* SD logical drive path */
@@ -24,16 +26,19 @@ FATFS SDFatFS;    /* File system object for SD logical drive */
 FIL SDFile;       /* File object for SD */
 
 /* USER CODE BEGIN Variables */
+/* partition 0 mounts the first FAT volume found, sd_format() points it to the one it creates */
+PARTITION VolToPart[_VOLUMES] = {{0, 0}};
 
 /* USER CODE END Variables */    
 
 void MX_FATFS_Init(void) 
 {
-  /*## FatFS: Link the SD driver ###########################*/
-  retSD = FATFS_LinkDriver(&SD_Driver, SDPath);
+  /*## FatFS: Link the SD driver, through the write-back cache ##*/
+  retSD = FATFS_LinkDriver(&SD_Cache_Driver, SDPath);
 
   /* USER CODE BEGIN Init */
-  /* additional user code for init */     
+  /* mounted on first use and kept mounted, see volume.h */
+  volume_register(SDPath, &SDFatFS, BSP_SD_IsDetected);
   /* USER CODE END Init */
 }
 
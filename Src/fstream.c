@@ -0,0 +1,210 @@
+#include <fstream.h>
+
+#include <lwip.h>
+#include <lwip/tcp.h>
+#include <stm32h7xx_hal.h>
+#include <usbd_cdc_if.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#define SECTOR 512
+#define CHUNK (64 * 1024) /* forwarded between two polls */
+#define USB_TIMEOUT 1000
+#define TCP_DRAIN_TIMEOUT 5000
+
+/* f_forward takes a function without a context */
+static const fstream_sink_t *sink;
+static void *sink_ctx;
+static FSIZE_t remain;
+
+static UINT forward(const BYTE *data, UINT n)
+{
+    if (!data) {
+        UINT need = remain < SECTOR ? (UINT)remain : SECTOR;
+        return sink->room(sink_ctx) >= need;
+    }
+    n = sink->write(sink_ctx, data, n);
+    remain -= n;
+    return n;
+}
+
+FRESULT fstream_send(FIL *fp, const fstream_sink_t *s, void *ctx, FSIZE_t size, FSIZE_t *sent, int (*poll)(void))
+{
+    FRESULT res = FR_OK;
+    UINT n;
+
+    sink = s;
+    sink_ctx = ctx;
+    remain = size;
+    if (remain > f_size(fp) - f_tell(fp))
+        remain = f_size(fp) - f_tell(fp);
+    *sent = 0;
+    while (res == FR_OK && remain) {
+        res = f_forward(fp, forward, remain < CHUNK ? (UINT)remain : CHUNK, &n);
+        *sent += n;
+        if (res == FR_OK && poll && poll())
+            res = FR_TIMEOUT;
+    }
+    /* not after a failure: the poll can be what saw the TCP client reset, lwIP has freed its pcb (ctx) then */
+    if (res == FR_OK && s->flush)
+        s->flush(ctx);
+    return res;
+}
+
+/* UART: polled transmit straight from the window */
+static UINT uart_room(void *ctx)
+{
+    return SECTOR;
+}
+
+static UINT uart_write(void *ctx, const BYTE *data, UINT n)
+{
+    return HAL_UART_Transmit(ctx, (uint8_t *)data, n, HAL_MAX_DELAY) == HAL_OK ? n : 0;
+}
+
+const fstream_sink_t fstream_uart = {uart_room, uart_write, NULL};
+
+/* USB CDC: the IN endpoint reads the window until the transfer completes (the class adds the zero length packet after
+ * a full one), it is waited for */
+extern USBD_HandleTypeDef hUsbDeviceFS;
+
+static USBD_CDC_HandleTypeDef *usb_cdc(void)
+{
+    return (USBD_CDC_HandleTypeDef *)hUsbDeviceFS.pClassData;
+}
+
+static bool usb_wait(void)
+{
+    USBD_CDC_HandleTypeDef *cdc = usb_cdc();
+
+    for (uint32_t start = HAL_GetTick(); cdc->TxState;)
+        if (HAL_GetTick() - start >= USB_TIMEOUT)
+            return false;
+    return true;
+}
+
+static UINT usb_room(void *ctx)
+{
+    USBD_CDC_HandleTypeDef *cdc = usb_cdc();
+
+    return cdc && !cdc->TxState ? SECTOR : 0;
+}
+
+static UINT usb_write(void *ctx, const BYTE *data, UINT n)
+{
+    return CDC_Transmit_FS((uint8_t *)data, n) == USBD_OK && usb_wait() ? n : 0;
+}
+
+const fstream_sink_t fstream_usb = {usb_room, usb_write, NULL};
+
+/* TCP: copied into the segments, the send buffer is the flow control */
+static UINT tcp_room(void *ctx)
+{
+    struct tcp_pcb *pcb = ctx;
+
+    /* a window can start a segment and fill another one */
+    if (tcp_sndqueuelen(pcb) + 2 > TCP_SND_QUEUELEN)
+        return 0;
+    return tcp_sndbuf(pcb);
+}
+
+static UINT tcp_write_window(void *ctx, const BYTE *data, UINT n)
+{
+    return tcp_write(ctx, data, n, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE) == ERR_OK ? n : 0;
+}
+
+static void tcp_flush(void *ctx)
+{
+    tcp_output(ctx);
+}
+
+const fstream_sink_t fstream_tcp = {tcp_room, tcp_write_window, tcp_flush};
+
+static struct {
+    struct tcp_pcb *listener;
+    struct tcp_pcb *conn;
+    int (*cancel)(void);
+} net;
+
+static err_t net_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    /* nothing is expected from the client, its close only ends its direction */
+    if (!p)
+        return ERR_OK;
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static void net_err(void *arg, err_t err)
+{
+    net.conn = NULL;
+}
+
+static err_t net_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    if (err != ERR_OK || net.conn) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    net.conn = pcb;
+    tcp_recv(pcb, net_recv);
+    tcp_err(pcb, net_err);
+    return ERR_OK;
+}
+
+/* while the data goes out: the stack runs, segments are sent as the window opens */
+static int net_poll(void)
+{
+    if (net.conn)
+        tcp_output(net.conn);
+    MX_LWIP_Process();
+    return !net.conn || net.cancel();
+}
+
+static void net_close(void)
+{
+    if (net.conn) {
+        tcp_arg(net.conn, NULL);
+        tcp_recv(net.conn, NULL);
+        tcp_err(net.conn, NULL);
+        if (tcp_close(net.conn) != ERR_OK)
+            tcp_abort(net.conn);
+    }
+    if (net.listener)
+        tcp_close(net.listener);
+    memset(&net, 0, sizeof(net));
+}
+
+int fstream_serve_tcp(FIL *fp, uint16_t port, int (*cancel)(void))
+{
+    FSIZE_t sent;
+    FRESULT res;
+
+    memset(&net, 0, sizeof(net));
+    net.cancel = cancel;
+    net.listener = tcp_new();
+    if (!net.listener || tcp_bind(net.listener, IP_ADDR_ANY, port) != ERR_OK) {
+        net_close();
+        return -1;
+    }
+    net.listener = tcp_listen(net.listener);
+    tcp_accept(net.listener, net_accept);
+
+    while (!net.conn) {
+        MX_LWIP_Process();
+        if (cancel()) {
+            net_close();
+            return -1;
+        }
+    }
+    res = fstream_send(fp, &fstream_tcp, net.conn, f_size(fp) - f_tell(fp), &sent, net_poll);
+    /* everything acknowledged before the close */
+    for (uint32_t start = HAL_GetTick(); res == FR_OK && net.conn && tcp_sndqueuelen(net.conn);) {
+        if (net_poll() || HAL_GetTick() - start >= TCP_DRAIN_TIMEOUT)
+            res = FR_TIMEOUT;
+    }
+    net_close();
+    return res == FR_OK ? 0 : -1;
+}
@@ -0,0 +1,583 @@
+#include <iperf.h>
+
+#include <cycles.h>
+#include <sections.h>
+#include <stm32h7xx_hal.h>
+
+#include "lwip/def.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HEADER_VERSION1 0x80000000
+#define CLIENT_HDR 24          /* flags, threads, port, buffer length, window or rate, amount */
+#define DATAGRAM_HDR 12        /* id, tv_sec, tv_usec */
+#define SERVER_HDR 10          /* words, see server_ack() */
+#define UDP_HEAD (DATAGRAM_HDR + CLIENT_HDR)
+#define UDP_BURST 8            /* datagrams of a client behind its rate, per poll */
+
+enum { IDLE, CONNECTING, RUNNING, ENDING, DONE };
+
+typedef struct {
+    uint64_t bytes;
+    uint32_t ids;          /* UDP: sent by a client, the highest id seen + 1 by a server */
+    uint32_t received;     /* UDP server */
+    uint32_t out_of_order;
+    uint32_t errors;
+} counters_t;
+
+typedef struct {
+    bool active;
+    int state;
+    iperf_config_t cfg;
+    iperf_report_fn report;
+    struct tcp_pcb *listener, *conn;
+    struct udp_pcb *udp;
+    uint64_t start, end, stop; /* us: the test, a client's time limit, the end of what the final report covers */
+    uint64_t mark_at;          /* the last interval report */
+    counters_t total, mark;
+    bool aborted;
+    /* UDP server: the sender, jitter over its timestamps, the report of its last test */
+    ip_addr_t peer;
+    u16_t peer_port;
+    uint64_t last_rx;
+    uint32_t transit;
+    bool has_transit;
+    uint64_t jitter16;         /* us * 16 */
+    uint32_t ack[SERVER_HDR];
+    bool has_ack;
+    /* UDP client: the last datagram and the server report */
+    uint32_t fins;
+    uint64_t fin_at;
+    bool has_remote;
+    uint64_t remote_bytes;
+    uint32_t remote_lost, remote_out_of_order, remote_jitter_us;
+} session_t;
+
+static session_t sessions[2]; /* client, server */
+
+/* client payload, read by the ETH DMA in place */
+static uint8_t pattern[IPERF_LEN_MAX] AXISRAM_BSS;
+
+static uint64_t now_us(void)
+{
+    return cycles_now() / (SystemCoreClock / 1000000);
+}
+
+/* from the last interval report to `to`, or the whole test */
+static void report(session_t *s, uint64_t to, bool final)
+{
+    static const counters_t zero;
+    const counters_t *c = &s->total, *m = final ? &zero : &s->mark;
+    iperf_report_t r = {.server = s->cfg.server, .udp = s->cfg.udp, .final = final, .aborted = final && s->aborted};
+    uint32_t received = c->received - m->received;
+
+    r.from_ms = ((final ? s->start : s->mark_at) - s->start) / 1000;
+    r.to_ms = (to - s->start) / 1000;
+    r.bytes = c->bytes - m->bytes;
+    r.datagrams = c->ids - m->ids;
+    r.out_of_order = c->out_of_order - m->out_of_order;
+    r.errors = c->errors - m->errors;
+    if (s->cfg.server && s->cfg.udp) {
+        r.lost = r.datagrams > received ? r.datagrams - received : 0;
+        r.jitter_us = s->jitter16 / 16;
+    } else if (final && s->has_remote) {
+        r.remote = true;
+        r.remote_bytes = s->remote_bytes;
+        r.lost = s->remote_lost;
+        r.out_of_order = s->remote_out_of_order;
+        r.jitter_us = s->remote_jitter_us;
+    }
+    if (!final) {
+        s->mark = s->total;
+        s->mark_at = to;
+    }
+    if (s->report)
+        s->report(&r);
+}
+
+static void begin(session_t *s, uint64_t now)
+{
+    memset(&s->total, 0, sizeof(s->total));
+    memset(&s->mark, 0, sizeof(s->mark));
+    s->start = s->mark_at = s->last_rx = now;
+    s->end = now + (uint64_t)s->cfg.duration_ms * 1000;
+    s->has_transit = false;
+    s->jitter16 = 0;
+    s->aborted = false;
+    s->state = RUNNING;
+}
+
+static void end(session_t *s, uint64_t stop, bool aborted)
+{
+    if (s->state == CONNECTING)
+        s->start = s->mark_at = stop; /* never connected */
+    else if (s->state != RUNNING && s->state != ENDING)
+        return;
+    s->stop = stop;
+    s->aborted = aborted || s->state == CONNECTING;
+    s->state = DONE;
+}
+
+static void close_conn(session_t *s)
+{
+    struct tcp_pcb *pcb = s->conn;
+
+    s->conn = NULL;
+    if (!pcb)
+        return;
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+    if (tcp_close(pcb) != ERR_OK)
+        tcp_abort(pcb);
+}
+
+static void close_all(session_t *s)
+{
+    close_conn(s);
+    if (s->listener)
+        tcp_close(s->listener);
+    if (s->udp)
+        udp_remove(s->udp);
+    s->listener = NULL;
+    s->udp = NULL;
+    s->active = false;
+}
+
+/* TCP: a reset or a close of the other end ends the test */
+static void net_err(void *arg, err_t err)
+{
+    session_t *s = arg;
+
+    s->conn = NULL;
+    end(s, now_us(), true);
+}
+
+static err_t net_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    session_t *s = arg;
+
+    if (!p) {
+        end(s, now_us(), false);
+        return ERR_OK;
+    }
+    if (s->cfg.server && s->state == RUNNING) {
+        s->total.bytes += p->tot_len;
+        s->last_rx = now_us();
+    }
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+/*
+ * TCP client: whole writes, or at least a segment, from the pattern while the queue takes them. Writes shorter than a
+ * segment are copied: lwIP fills a segment with them, where each one would be a pbuf of its own in place and the
+ * queue limit would hold back a partial segment until the delayed ACK.
+ */
+static void net_fill(session_t *s)
+{
+    struct tcp_pcb *pcb = s->conn;
+    u16_t min = s->cfg.len < TCP_MSS ? s->cfg.len : TCP_MSS;
+    u8_t flags = s->cfg.len < TCP_MSS ? TCP_WRITE_FLAG_MORE | TCP_WRITE_FLAG_COPY : TCP_WRITE_FLAG_MORE;
+    bool queued = false;
+
+    while (s->state == RUNNING && tcp_sndqueuelen(pcb) + 2 <= TCP_SND_QUEUELEN) {
+        u16_t n = tcp_sndbuf(pcb);
+        if (n > s->cfg.len)
+            n = s->cfg.len;
+        if (n < min)
+            break;
+        if (tcp_write(pcb, pattern, n, flags) != ERR_OK) {
+            s->total.errors++;
+            break;
+        }
+        queued = true;
+    }
+    if (queued)
+        tcp_output(pcb);
+}
+
+static err_t net_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+    session_t *s = arg;
+
+    s->total.bytes += len;
+    net_fill(s);
+    return ERR_OK;
+}
+
+static err_t net_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    static const uint8_t hdr[CLIENT_HDR];
+    session_t *s = arg;
+
+    begin(s, now_us());
+    if (tcp_write(pcb, hdr, sizeof(hdr), TCP_WRITE_FLAG_MORE) != ERR_OK)
+        s->total.errors++;
+    net_fill(s);
+    return ERR_OK;
+}
+
+static err_t net_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    session_t *s = arg;
+
+    if (err != ERR_OK || s->state != IDLE) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    s->conn = pcb;
+    tcp_arg(pcb, s);
+    tcp_recv(pcb, net_recv);
+    tcp_err(pcb, net_err);
+    begin(s, now_us());
+    return ERR_OK;
+}
+
+/* UDP server: the report of the last test to its sender */
+static void server_ack(session_t *s)
+{
+    uint64_t us = s->stop - s->start;
+    uint32_t lost = s->total.ids > s->total.received ? s->total.ids - s->total.received : 0;
+    uint32_t jitter = s->jitter16 / 16;
+
+    s->ack[0] = lwip_htonl(HEADER_VERSION1);
+    s->ack[1] = lwip_htonl(s->total.bytes >> 32);
+    s->ack[2] = lwip_htonl(s->total.bytes);
+    s->ack[3] = lwip_htonl(us / 1000000);
+    s->ack[4] = lwip_htonl(us % 1000000);
+    s->ack[5] = lwip_htonl(lost);
+    s->ack[6] = lwip_htonl(s->total.out_of_order);
+    s->ack[7] = lwip_htonl(s->total.ids);
+    s->ack[8] = lwip_htonl(jitter / 1000000);
+    s->ack[9] = lwip_htonl(jitter % 1000000);
+    s->has_ack = true;
+}
+
+static void send_ack(session_t *s, uint32_t id)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, DATAGRAM_HDR + sizeof(s->ack), PBUF_RAM);
+    uint32_t hdr[3] = {id, 0, 0};
+
+    if (!p)
+        return;
+    pbuf_take(p, hdr, sizeof(hdr));
+    pbuf_take_at(p, s->ack, sizeof(s->ack), sizeof(hdr));
+    udp_sendto(s->udp, p, &s->peer, s->peer_port);
+    pbuf_free(p);
+}
+
+static void udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    session_t *s = arg;
+    uint64_t now = now_us();
+    uint32_t hdr[3];
+    bool same;
+    int32_t id;
+
+    if (pbuf_copy_partial(p, hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        pbuf_free(p);
+        return;
+    }
+    id = lwip_ntohl(hdr[0]);
+    same = ip_addr_cmp(&s->peer, addr) && s->peer_port == port;
+
+    if (id >= 0 && s->state == IDLE) {
+        ip_addr_copy(s->peer, *addr);
+        s->peer_port = port;
+        s->has_ack = false;
+        begin(s, now);
+        same = true;
+    }
+    if (same && s->state == RUNNING && id >= 0) {
+        /* RFC 1889: the change of the transit time, sender clock against ours */
+        uint32_t transit = (uint32_t)now - (lwip_ntohl(hdr[1]) * 1000000 + lwip_ntohl(hdr[2]));
+        if (s->has_transit) {
+            int32_t d = transit - s->transit;
+            s->jitter16 -= s->jitter16 / 16;
+            s->jitter16 += d < 0 ? -d : d;
+        }
+        s->transit = transit;
+        s->has_transit = true;
+        s->total.bytes += p->tot_len;
+        s->total.received++;
+        if ((uint32_t)id < s->total.ids)
+            s->total.out_of_order++;
+        else
+            s->total.ids = id + 1;
+        s->last_rx = now;
+    } else if (same && id < 0) {
+        if (s->state == RUNNING) {
+            end(s, now, false);
+            server_ack(s);
+        }
+        if (s->has_ack)
+            send_ack(s, hdr[0]);
+    }
+    pbuf_free(p);
+}
+
+/* UDP client: the header in RAM, the payload from the pattern */
+static err_t send_datagram(session_t *s, int32_t id, uint64_t now)
+{
+    uint32_t head = s->cfg.len < UDP_HEAD ? s->cfg.len : UDP_HEAD;
+    uint32_t hdr[3] = {lwip_htonl(id), lwip_htonl(now / 1000000), lwip_htonl(now % 1000000)};
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, head, PBUF_RAM), *data;
+    err_t err;
+
+    if (!p)
+        return ERR_MEM;
+    /* a client header with flags 0 after it: no test back from the server */
+    memset(p->payload, 0, head);
+    memcpy(p->payload, hdr, sizeof(hdr));
+    if (s->cfg.len > head) {
+        data = pbuf_alloc(PBUF_RAW, s->cfg.len - head, PBUF_REF);
+        if (!data) {
+            pbuf_free(p);
+            return ERR_MEM;
+        }
+        data->payload = pattern;
+        pbuf_cat(p, data);
+    }
+    err = udp_send(s->udp, p);
+    pbuf_free(p);
+    return err;
+}
+
+static void udp_client_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    session_t *s = arg;
+    uint32_t ack[3 + SERVER_HDR];
+
+    if (s->state == ENDING && pbuf_copy_partial(p, ack, sizeof(ack), 0) == sizeof(ack) &&
+        (int32_t)lwip_ntohl(ack[0]) < 0 && lwip_ntohl(ack[3]) & HEADER_VERSION1) {
+        s->has_remote = true;
+        s->remote_bytes = (uint64_t)lwip_ntohl(ack[4]) << 32 | lwip_ntohl(ack[5]);
+        s->remote_lost = lwip_ntohl(ack[8]);
+        s->remote_out_of_order = lwip_ntohl(ack[9]);
+        s->remote_jitter_us = lwip_ntohl(ack[11]) * 1000000 + lwip_ntohl(ack[12]);
+        s->state = DONE;
+    }
+    pbuf_free(p);
+}
+
+static void udp_client_poll(session_t *s, uint64_t now)
+{
+    if (s->state == RUNNING) {
+        /* the bytes due at the rate since the start, a datagram goes when they are not all sent */
+        uint64_t due = (now - s->start) * s->cfg.rate / 8000000;
+        for (int n = 0; n < UDP_BURST && s->total.bytes <= due; n++) {
+            if (send_datagram(s, s->total.ids, now) != ERR_OK) {
+                s->total.errors++;
+                break;
+            }
+            s->total.ids++;
+            s->total.bytes += s->cfg.len;
+        }
+    } else if (s->state == ENDING && (!s->fins || now - s->fin_at >= IPERF_FIN_MS * 1000)) {
+        if (s->fins == IPERF_FIN_TRIES) {
+            s->state = DONE;
+            return;
+        }
+        send_datagram(s, -(int32_t)s->total.ids, now);
+        s->fins++;
+        s->fin_at = now;
+    }
+}
+
+static void client_poll(session_t *s, uint64_t now)
+{
+    if (s->state == RUNNING && now >= s->end) {
+        s->state = ENDING;
+        s->stop = s->end;
+    }
+    if (s->cfg.udp) {
+        udp_client_poll(s, now);
+    } else if (s->state == RUNNING) {
+        net_fill(s);
+    } else if (s->state == ENDING && (!tcp_sndqueuelen(s->conn) || now - s->end >= IPERF_DRAIN_MS * 1000)) {
+        /* the time of the last acknowledgement */
+        s->stop = now;
+        s->state = DONE;
+    }
+}
+
+static void intervals(session_t *s, uint64_t now)
+{
+    uint64_t iv = (uint64_t)s->cfg.interval_ms * 1000, limit = s->state == DONE ? s->stop : now;
+
+    if (!iv || s->state < RUNNING)
+        return;
+    if (!s->cfg.server && limit > s->end)
+        limit = s->end;
+    while (s->mark_at + iv <= limit)
+        report(s, s->mark_at + iv, false);
+}
+
+static void finish(session_t *s)
+{
+    report(s, s->stop, true);
+    if (s->cfg.server) {
+        close_conn(s);
+        s->state = IDLE;
+    } else {
+        close_all(s);
+    }
+}
+
+int iperf_start(const iperf_config_t *config, iperf_report_fn fn)
+{
+    session_t *s = &sessions[config->server];
+    bool ok;
+
+    if (s->active)
+        return -1;
+    if (!config->server && (config->duration_ms == 0 || config->len == 0 || config->len > IPERF_LEN_MAX ||
+                            (config->udp && (config->len < DATAGRAM_HDR || config->rate == 0))))
+        return -1;
+    memset(s, 0, sizeof(*s));
+    s->cfg = *config;
+    s->report = fn;
+    s->active = true;
+    if (!pattern[0])
+        for (int i = 0; i < IPERF_LEN_MAX; i++)
+            pattern[i] = '0' + i % 10;
+    now_us();
+
+    if (config->udp) {
+        s->udp = udp_new();
+        if (config->server)
+            ok = s->udp && udp_bind(s->udp, IP_ADDR_ANY, config->port) == ERR_OK;
+        else
+            ok = s->udp && udp_connect(s->udp, &config->remote, config->port) == ERR_OK;
+        if (ok)
+            udp_recv(s->udp, config->server ? udp_server_recv : udp_client_recv, s);
+        if (ok && !config->server)
+            begin(s, now_us());
+    } else if (config->server) {
+        s->listener = tcp_new();
+        ok = s->listener && tcp_bind(s->listener, IP_ADDR_ANY, config->port) == ERR_OK;
+        if (ok) {
+            struct tcp_pcb *pcb = tcp_listen(s->listener);
+            ok = pcb != NULL;
+            if (ok)
+                s->listener = pcb;
+        }
+        if (ok) {
+            tcp_arg(s->listener, s);
+            tcp_accept(s->listener, net_accept);
+        }
+    } else {
+        s->conn = tcp_new();
+        ok = s->conn != NULL;
+        if (ok) {
+            tcp_arg(s->conn, s);
+            tcp_recv(s->conn, net_recv);
+            tcp_sent(s->conn, net_sent);
+            tcp_err(s->conn, net_err);
+            s->state = CONNECTING;
+            ok = tcp_connect(s->conn, &config->remote, config->port, net_connected) == ERR_OK;
+        }
+    }
+    if (!ok) {
+        close_all(s);
+        return -1;
+    }
+    return 0;
+}
+
+void iperf_stop(int server)
+{
+    uint64_t now = now_us();
+
+    for (int i = 0; i < 2; i++) {
+        session_t *s = &sessions[i];
+        if (!s->active || (server >= 0 && i != !!server))
+            continue;
+        end(s, s->state == ENDING ? s->stop : now, false);
+        if (s->state == DONE) {
+            intervals(s, now);
+            report(s, s->stop, true);
+        }
+        close_all(s);
+    }
+}
+
+bool iperf_running(bool server)
+{
+    return sessions[server].active;
+}
+
+void iperf_poll(void)
+{
+    uint64_t now = now_us();
+
+    for (int i = 0; i < 2; i++) {
+        session_t *s = &sessions[i];
+        if (!s->active)
+            continue;
+        if (s->cfg.server) {
+            /* a sender that went away without its last datagrams */
+            if (s->cfg.udp && s->state == RUNNING && now - s->last_rx >= IPERF_UDP_IDLE_MS * 1000) {
+                end(s, s->last_rx, true);
+                server_ack(s);
+            }
+        } else {
+            client_poll(s, now);
+        }
+        intervals(s, now);
+        if (s->state == DONE)
+            finish(s);
+    }
+}
+
+/* snprintf at the end of what buf holds, never past it */
+static size_t append(char *buf, size_t size, size_t n, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (n >= size)
+        return n;
+    va_start(ap, fmt);
+    len = vsnprintf(buf + n, size - n, fmt, ap);
+    va_end(ap);
+    return len < 0 ? n : n + len;
+}
+
+void iperf_format(const iperf_report_t *r, char *buf, size_t size)
+{
+    uint32_t ms = r->to_ms - r->from_ms;
+    size_t n = 0;
+
+    n = append(buf, size, n,
+               "%s %3" PRIu32 ".%" PRIu32 "-%3" PRIu32 ".%" PRIu32 " s %8" PRIu32 " KB %7" PRIu32 " kbit/s",
+               r->server ? "server" : "client", r->from_ms / 1000, r->from_ms % 1000 / 100, r->to_ms / 1000,
+               r->to_ms % 1000 / 100, (uint32_t)(r->bytes / 1024), ms ? (uint32_t)(r->bytes * 8 / ms) : 0);
+    if (r->udp && r->server) {
+        n = append(buf, size, n, " %3" PRIu32 ".%03" PRIu32 " ms %" PRIu32 "/%" PRIu32 " lost %" PRIu32 " out of order",
+                   r->jitter_us / 1000, r->jitter_us % 1000, r->lost, r->datagrams, r->out_of_order);
+    } else if (r->udp) {
+        n = append(buf, size, n, " %" PRIu32 " datagrams", r->datagrams);
+        if (r->remote)
+            n = append(buf, size, n, ", server %" PRIu32 " KB %" PRIu32 ".%03" PRIu32 " ms %" PRIu32 "/%" PRIu32
+                       " lost %" PRIu32 " out of order", (uint32_t)(r->remote_bytes / 1024), r->jitter_us / 1000,
+                       r->jitter_us % 1000, r->lost, r->datagrams, r->out_of_order);
+        else if (r->final)
+            n = append(buf, size, n, ", no server report");
+    }
+    if (r->errors)
+        n = append(buf, size, n, ", %" PRIu32 " send errors", r->errors);
+    if (r->aborted)
+        n = append(buf, size, n, ", aborted");
+    if (r->final)
+        append(buf, size, n, " (total)");
+}
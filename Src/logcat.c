@@ -0,0 +1,323 @@
+#include <logcat.h>
+
+#include <clmt.h>
+#include <crc32.h>
+#include <diskio.h>
+#include <fatfs.h>
+#include <sections.h>
+#include <volume.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define SECTOR 512
+#define ALIGN 8
+#define TRAILER (DATALOG_INDEX * sizeof(datalog_index_t))
+#define DIGITS 5
+
+/* in AXI SRAM, the whole sectors of a block come with the IDMA */
+static FIL file AXISRAM_BSS;
+static uint8_t block[DATALOG_BUFFER_SIZE] AXISRAM_BSS;
+static uint8_t sector[SECTOR] AXISRAM_BSS;
+static datalog_block_t head;
+static char path[64];
+static logcat_stats_t stats;
+
+/* the file the logger writes is locked against f_open (_FS_LOCK): its blocks are read on the card, where the logger
+ * puts them, up to the bytes it wrote */
+static struct {
+    int on;
+    uint32_t lba;
+    uint32_t size;
+} live;
+
+typedef struct {
+    uint32_t from, to;
+    int verify;
+    logcat_fn fn;
+    void *ctx;
+    int done; /* past the window */
+} query_t;
+
+static FRESULT read_live(FSIZE_t pos, uint8_t *buf, UINT n)
+{
+    if (pos + n > live.size)
+        return FR_INT_ERR;
+    while (n) {
+        uint32_t off = pos % SECTOR;
+        UINT part = n < SECTOR - off ? n : SECTOR - off;
+        /* whole sectors into the block buffer straight from the card */
+        if (!off && n >= SECTOR && buf >= block && buf < block + sizeof(block)) {
+            part = n / SECTOR * SECTOR;
+            if (disk_read(SDFatFS.drv, buf, live.lba + pos / SECTOR, part / SECTOR) != RES_OK)
+                return FR_DISK_ERR;
+        } else {
+            if (disk_read(SDFatFS.drv, sector, live.lba + pos / SECTOR, 1) != RES_OK)
+                return FR_DISK_ERR;
+            memcpy(buf, sector + off, part);
+        }
+        pos += part;
+        buf += part;
+        n -= part;
+    }
+    return FR_OK;
+}
+
+static FRESULT read_at(FSIZE_t pos, void *buf, UINT n)
+{
+    FRESULT res;
+    UINT got = 0;
+
+    if (live.on)
+        return read_live(pos, buf, n);
+    res = f_lseek(&file, pos);
+    if (res == FR_OK)
+        res = f_read(&file, buf, n, &got);
+    return res == FR_OK && got != n ? FR_INT_ERR : res;
+}
+
+static FSIZE_t file_bytes(void)
+{
+    return live.on ? live.size : f_size(&file);
+}
+
+/* header of block i of the open file into head, *valid when it belongs to the log that starts at block 0 */
+static FRESULT header(uint32_t i, uint32_t seq0, int *valid)
+{
+    FRESULT res = read_at((FSIZE_t)i * DATALOG_BUFFER_SIZE, &head, sizeof(head));
+
+    stats.headers++;
+    *valid = res == FR_OK && head.magic == DATALOG_MAGIC && (i == 0 || head.seq == seq0 + i) && head.records &&
+             head.used <= DATALOG_PAYLOAD && head.entries <= DATALOG_INDEX;
+    return res;
+}
+
+/* records of block i in the window, head holds its header */
+static FRESULT read_block(uint32_t i, query_t *q)
+{
+    FSIZE_t base = (FSIZE_t)i * DATALOG_BUFFER_SIZE;
+    uint8_t *payload = block + sizeof(head);
+    datalog_index_t *index = (datalog_index_t *)(payload + DATALOG_PAYLOAD);
+    uint32_t off = 0;
+    FRESULT res;
+
+    if (q->verify) {
+        res = read_at(base, block, DATALOG_BUFFER_SIZE);
+        if (res != FR_OK)
+            return res;
+        if (crc32(payload, DATALOG_PAYLOAD + TRAILER) != head.crc) {
+            stats.bad++;
+            return FR_OK;
+        }
+    } else if (q->from > head.first_time) {
+        res = read_at(base + sizeof(head) + DATALOG_PAYLOAD, index, TRAILER);
+        if (res != FR_OK)
+            return res;
+    }
+    /* the last entry before the window */
+    if (q->from > head.first_time)
+        for (uint32_t e = 0; e < head.entries && index[e].time < q->from; e++)
+            off = index[e].offset;
+    if (off >= head.used)
+        off = 0;
+    if (!q->verify) {
+        /* from the sector holding the first record to the end of the records */
+        uint32_t first = (sizeof(head) + off) / SECTOR * SECTOR;
+        res = read_at(base + first, block + first, sizeof(head) + head.used - first);
+        if (res != FR_OK)
+            return res;
+    }
+
+    stats.blocks++;
+    while (off < head.used) {
+        const datalog_record_t *r = (const datalog_record_t *)(payload + off);
+        if (r->size < sizeof(*r) || off + r->size > head.used) {
+            stats.bad++;
+            break;
+        }
+        off += (r->size + ALIGN - 1) & ~(ALIGN - 1);
+        if (r->time < q->from)
+            continue;
+        if (r->time > q->to) {
+            q->done = 1;
+            break;
+        }
+        stats.records++;
+        if (q->fn(r, q->ctx)) {
+            q->done = 1;
+            break;
+        }
+    }
+    return FR_OK;
+}
+
+/* the open file: bisect for the first block not entirely before the window, then forward */
+static FRESULT read_file(query_t *q)
+{
+    uint32_t n = file_bytes() / DATALOG_BUFFER_SIZE;
+    uint32_t lo = 0, hi = n, seq0;
+    FRESULT res;
+    int valid;
+
+    if (n == 0)
+        return FR_OK;
+    res = header(0, 0, &valid);
+    if (res != FR_OK || !valid)
+        return res;
+    seq0 = head.seq;
+    if (head.first_time > q->to) {
+        q->done = 1;
+        return FR_OK;
+    }
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        res = header(mid, seq0, &valid);
+        if (res != FR_OK)
+            return res;
+        if (valid && head.last_time < q->from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint32_t i = lo; i < n && !q->done; i++) {
+        res = header(i, seq0, &valid);
+        if (res != FR_OK || !valid)
+            return res;
+        if (head.first_time > q->to) {
+            q->done = 1;
+            break;
+        }
+        res = read_block(i, q);
+        if (res != FR_OK)
+            return res;
+    }
+    return FR_OK;
+}
+
+/* the file at path, through the logger when it is the one being written */
+static FRESULT open_path(void)
+{
+    const char *active = datalog_file(&live.lba, &live.size);
+    FRESULT res;
+
+    live.on = active && strcasecmp(active, path) == 0;
+    res = live.on ? FR_OK : clmt_open(&file, path);
+    if (res == FR_OK)
+        stats.files++;
+    return res;
+}
+
+static void close_path(void)
+{
+    if (!live.on)
+        clmt_close(&file);
+    live.on = 0;
+}
+
+static FRESULT open_file(const char *prefix, uint32_t index)
+{
+    snprintf(path, sizeof(path), "%s%s%0*" PRIu32 ".log", SDPath, prefix, DIGITS, index);
+    return open_path();
+}
+
+/* first block time of a file, UINT32_MAX when it has none: the bisection then starts earlier, never too late */
+static uint32_t first_time(const char *prefix, uint32_t index)
+{
+    uint32_t time = UINT32_MAX;
+    int valid;
+
+    if (open_file(prefix, index) != FR_OK)
+        return time;
+    if (file_bytes() >= DATALOG_BUFFER_SIZE && header(0, 0, &valid) == FR_OK && valid)
+        time = head.first_time;
+    close_path();
+    return time;
+}
+
+/* lowest and highest number of the <prefix>NNNNN.log files */
+static FRESULT file_range(const char *prefix, uint32_t *lo, uint32_t *hi)
+{
+    static DIR dir;
+    static FILINFO info;
+    size_t len = strlen(prefix);
+    FRESULT res = f_opendir(&dir, SDPath);
+
+    *lo = UINT32_MAX;
+    *hi = 0;
+    while (res == FR_OK) {
+        res = f_readdir(&dir, &info);
+        if (res != FR_OK || info.fname[0] == 0)
+            break;
+        const char *s = info.fname;
+        if (strlen(s) != len + DIGITS + 4 || strncmp(s, prefix, len) != 0 || strcmp(s + len + DIGITS, ".log") != 0)
+            continue;
+        char *end;
+        uint32_t index = strtoul(s + len, &end, 10);
+        if (end != s + len + DIGITS)
+            continue;
+        if (index < *lo)
+            *lo = index;
+        if (index > *hi)
+            *hi = index;
+    }
+    f_closedir(&dir);
+    if (res == FR_OK && *lo == UINT32_MAX)
+        res = FR_NO_FILE;
+    return res;
+}
+
+static FRESULT read_prefix(const char *prefix, query_t *q)
+{
+    uint32_t lo, hi, last;
+    FRESULT res = file_range(prefix, &lo, &hi);
+
+    if (res != FR_OK)
+        return res;
+    /* the last file starting before the window */
+    last = hi;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo + 1) / 2;
+        if (first_time(prefix, mid) <= q->from)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    for (uint32_t i = lo; i <= last && !q->done; i++) {
+        res = open_file(prefix, i);
+        if (res == FR_NO_FILE)
+            continue;
+        if (res != FR_OK)
+            return res;
+        res = read_file(q);
+        close_path();
+        if (res != FR_OK)
+            return res;
+    }
+    return FR_OK;
+}
+
+FRESULT logcat(const char *name, uint32_t from, uint32_t to, int verify, logcat_fn fn, void *ctx,
+               logcat_stats_t *st)
+{
+    query_t q = {.from = from, .to = to, .verify = verify, .fn = fn, .ctx = ctx};
+    size_t len = strlen(name);
+    FRESULT res;
+
+    memset(&stats, 0, sizeof(stats));
+    res = volume_mount(SDPath);
+    if (res == FR_OK && len > 4 && strcmp(name + len - 4, ".log") == 0) {
+        snprintf(path, sizeof(path), "%s%s", SDPath, name);
+        res = open_path();
+        if (res == FR_OK) {
+            res = read_file(&q);
+            close_path();
+        }
+    } else if (res == FR_OK) {
+        res = read_prefix(name, &q);
+    }
+    *st = stats;
+    return res;
+}
@@ -26,6 +26,7 @@
 #endif /* MDK ARM Compiler */
 
 /* USER CODE BEGIN 0 */
+#include "phy.h"
 
 /* USER CODE END 0 */
 /* Private function prototypes -----------------------------------------------*/
@@ -36,6 +37,7 @@ void Error_Handler(void);
 uint32_t DHCPfineTimer = 0;
 uint32_t DHCPcoarseTimer = 0;
 /* USER CODE BEGIN 1 */
+static uint32_t link_checked;
 
 /* USER CODE END 1 */
 
@@ -117,6 +119,12 @@ void MX_LWIP_Process(void)
   sys_check_timeouts();
 
 /* USER CODE BEGIN 4_3 */
+  /* link up or down, and the mode negotiated by the PHY applied to the MAC */
+  if (HAL_GetTick() - link_checked >= PHY_CHECK_MS)
+  {
+    link_checked = HAL_GetTick();
+    ethernet_link_check_state(&gnetif);
+  }
 /* USER CODE END 4_3 */
 }
 
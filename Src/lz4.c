@@ -0,0 +1,62 @@
+#include <lz4.h>
+
+#include <string.h>
+
+/* 4 bits in the token, 255 continues with the next byte */
+static int read_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+
+    if (*len != 15)
+        return 0;
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+/*
+ * Sequences are a token, literals, a 16 bit offset and a match length. The last sequence stops after its literals.
+ * Every length and offset is checked against both buffers, a corrupt block never writes outside dst.
+ */
+int lz4_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_size;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t len = token >> 4;
+
+        if (read_length(&ip, iend, &len) != 0 || len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return -1;
+        len = token & 15;
+        if (read_length(&ip, iend, &len) != 0)
+            return -1;
+        len += 4;
+        if (len > (size_t)(oend - op))
+            return -1;
+        /* byte by byte, the match may overlap the bytes it produces (runs) */
+        const uint8_t *match = op - offset;
+        while (len--)
+            *op++ = *match++;
+    }
+    return op - dst;
+}
@@ -27,9 +27,14 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "memory.h"
+#include <datalog.h>
 #include <execute.h>
+#include <sfud_cfg.h>
 #include <inttypes.h>
+#include <iperf.h>
 #include <microrl.h>
+#include <qspi_mode.h>
+#include <volume.h>
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -73,6 +78,7 @@ static void MX_SDMMC1_SD_Init(void);
 static void MX_USART1_UART_Init(void);
 static void MX_FDCAN1_Init(void);
 static void MX_UART8_Init(void);
+static void MPU_Config(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
@@ -90,10 +96,17 @@ void mrl_print(const char *str) { HAL_UART_Transmit(&huart1, (uint8_t *)str, str
 int main(void)
 {
     /* USER CODE BEGIN 1 */
-    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Pos;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
     DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#ifdef XIP
+    /* clocks come from qspiboot, HAL_Init() programs the tick from SystemCoreClock */
+    SystemCoreClockUpdate();
+#endif
     /* USER CODE END 1 */
 
+    /* MPU Configuration--------------------------------------------------------*/
+    MPU_Config();
+
     /* Enable I-Cache---------------------------------------------------------*/
     SCB_EnableICache();
 
@@ -110,7 +123,9 @@ int main(void)
     /* USER CODE END Init */
 
     /* Configure the system clock */
+#ifndef XIP
     SystemClock_Config();
+#endif
 
     /* USER CODE BEGIN SysInit */
 
@@ -140,6 +155,9 @@ int main(void)
         /* USER CODE END WHILE */
 
         /* USER CODE BEGIN 3 */
+        datalog_poll();
+        volume_poll();
+        iperf_poll();
         uint8_t ch;
         if (HAL_UART_Receive(&huart1, &ch, 1, 0) == HAL_OK) {
             microrl_insert_char(&mrl, ch);
@@ -286,7 +304,16 @@ void MX_QUADSPI_Init(void)
 {
 
     /* USER CODE BEGIN QUADSPI_Init 0 */
-
+#ifdef XIP
+    /* qspiboot left the controller memory-mapped and this code runs from it, adopt it as is */
+    hqspi.Instance = QUADSPI;
+    hqspi.Init.FlashSize = SFUD_QSPI_FLASH_SIZE;
+    hqspi.Init.FlashID = SFUD_QSPI_FLASH_ID;
+    hqspi.Init.DualFlash = SFUD_QSPI_DUAL_FLASH_MODE;
+    hqspi.State = HAL_QSPI_STATE_BUSY_MEM_MAPPED;
+    qspi_mode_adopt_xip();
+    return;
+#endif
     /* USER CODE END QUADSPI_Init 0 */
 
     /* USER CODE BEGIN QUADSPI_Init 1 */
@@ -297,11 +324,11 @@ void MX_QUADSPI_Init(void)
     hqspi.Init.ClockPrescaler = 0;
     hqspi.Init.FifoThreshold = 1;
     hqspi.Init.SampleShifting = QSPI_SAMPLE_SHIFTING_NONE;
-    hqspi.Init.FlashSize = 24;
+    hqspi.Init.FlashSize = SFUD_QSPI_FLASH_SIZE;
     hqspi.Init.ChipSelectHighTime = QSPI_CS_HIGH_TIME_3_CYCLE;
     hqspi.Init.ClockMode = QSPI_CLOCK_MODE_0;
-    hqspi.Init.FlashID = QSPI_FLASH_ID_2;
-    hqspi.Init.DualFlash = QSPI_DUALFLASH_DISABLE;
+    hqspi.Init.FlashID = SFUD_QSPI_FLASH_ID;
+    hqspi.Init.DualFlash = SFUD_QSPI_DUAL_FLASH_MODE;
     if (HAL_QSPI_Init(&hqspi) != HAL_OK) {
         Error_Handler();
     }
@@ -332,6 +359,13 @@ static void MX_SDMMC1_SD_Init(void)
     hsd1.Init.HardwareFlowControl = SDMMC_HARDWARE_FLOW_CONTROL_DISABLE;
     hsd1.Init.ClockDiv = 0;
     /* USER CODE BEGIN SDMMC1_Init 2 */
+    /* 3.3V only slot: no 1.8V signalling switch for UHS cards */
+    hsd1.Init.TranceiverPresent = SDMMC_TRANSCEIVER_NOT_PRESENT;
+    /* 24MHz from the 48MHz kernel clock until sd_bus_negotiate() picks the speed */
+    hsd1.Init.ClockDiv = 1;
+    /* card detect: the slot switch grounds SDMMC_CD with a card in, the internal pull-up keeps it high otherwise */
+    GPIO_InitTypeDef cd = {.Pin = SDMMC_CD_Pin, .Mode = GPIO_MODE_INPUT, .Pull = GPIO_PULLUP};
+    HAL_GPIO_Init(SDMMC_CD_GPIO_Port, &cd);
 
     /* USER CODE END SDMMC1_Init 2 */
 }
@@ -512,6 +546,35 @@ void __stdio_putchar(int c) { HAL_UART_Transmit(&huart1, (uint8_t *)&c, 1, HAL_M
 
 /* USER CODE END 4 */
 
+/* MPU Configuration */
+
+static void MPU_Config(void)
+{
+    MPU_Region_InitTypeDef MPU_InitStruct = {0};
+
+    /* Disables the MPU */
+    HAL_MPU_Disable();
+    /** Initializes and configures the Region and the memory to be protected
+     * The ETH DMA descriptor rings at the start of D2 SRAM (.eth_desc in the linker script): device memory, not
+     * cached
+     */
+    MPU_InitStruct.Enable = MPU_REGION_ENABLE;
+    MPU_InitStruct.Number = MPU_REGION_NUMBER0;
+    MPU_InitStruct.BaseAddress = 0x30000000;
+    MPU_InitStruct.Size = MPU_REGION_SIZE_1KB;
+    MPU_InitStruct.SubRegionDisable = 0x0;
+    MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL0;
+    MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
+    MPU_InitStruct.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+    MPU_InitStruct.IsShareable = MPU_ACCESS_SHAREABLE;
+    MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+    MPU_InitStruct.IsBufferable = MPU_ACCESS_BUFFERABLE;
+
+    HAL_MPU_ConfigRegion(&MPU_InitStruct);
+    /* Enables the MPU */
+    HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+}
+
 /**
  * @brief  This function is executed in case of error occurrence.
  * @retval None
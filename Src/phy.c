@@ -0,0 +1,232 @@
+#include <phy.h>
+
+#include <stm32h7xx_hal.h>
+
+#include <string.h>
+
+/* IEEE 802.3 clause 22 */
+#define BMCR 0
+#define BMSR 1
+#define ID1 2
+#define ID2 3
+#define ANAR 4
+#define ANLPAR 5
+#define ANER 6
+
+#define BMCR_RESET 0x8000
+#define BMCR_100M 0x2000
+#define BMCR_AN_ENABLE 0x1000
+#define BMCR_AN_RESTART 0x0200
+#define BMCR_FULL 0x0100
+
+#define BMSR_AN_COMPLETE 0x0020
+#define BMSR_REMOTE_FAULT 0x0010
+#define BMSR_LINK 0x0004
+#define BMSR_JABBER 0x0002
+
+#define AN_100FD 0x0100
+#define AN_100HD 0x0080
+#define AN_10FD 0x0040
+#define AN_10HD 0x0020
+#define AN_802_3 0x0001
+
+#define ANER_PDF 0x0010
+#define ANER_LP_AN_ABLE 0x0001
+
+/* the speed indication field of both families: 1 10 half, 2 100 half, 5 10 full, 6 100 full */
+#define MODE_100M 0x2
+#define MODE_FULL 0x4
+
+typedef struct {
+    uint32_t id, mask;
+    const char *name;
+    uint8_t mode_reg, mode_shift; /* speed indication */
+    uint8_t errors_reg;           /* receive symbol errors */
+    bool errors_clear;            /* on read, else it wraps */
+} model_t;
+
+static const model_t models[] = {
+    {0x0007c130, 0xfffffff0, "LAN8742A", 31, 2, 26, false},
+    {0x0007c0f0, 0xfffffff0, "LAN8720A", 31, 2, 26, false},
+    {0x00221560, 0xfffffff0, "KSZ8081", 0x1e, 0, 0x15, true},
+};
+
+extern ETH_HandleTypeDef heth;
+
+static const model_t *model;
+static phy_status_t status;
+static phy_stats_t stats;
+static uint16_t errors_last;
+
+static int rd(uint32_t reg, uint16_t *val)
+{
+    uint32_t v;
+
+    if (HAL_ETH_ReadPHYRegister(&heth, status.addr, reg, &v) != HAL_OK) {
+        stats.mdio_errors++;
+        return -1;
+    }
+    *val = v;
+    return 0;
+}
+
+static int wr(uint32_t reg, uint16_t val)
+{
+    if (HAL_ETH_WritePHYRegister(&heth, status.addr, reg, val) != HAL_OK) {
+        stats.mdio_errors++;
+        return -1;
+    }
+    return 0;
+}
+
+static int probe(uint8_t addr)
+{
+    uint16_t id1, id2;
+
+    status.addr = addr;
+    if (rd(ID1, &id1) || rd(ID2, &id2) || id1 == 0xffff || (id1 == 0 && id2 == 0))
+        return -1;
+    status.id = (uint32_t)id1 << 16 | id2;
+    model = NULL;
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+        if ((status.id & models[i].mask) == models[i].id)
+            model = &models[i];
+    status.name = model ? model->name : NULL;
+    return 0;
+}
+
+int phy_init(void)
+{
+    uint16_t bmcr;
+    uint32_t start;
+    int addr;
+
+    memset(&status, 0, sizeof(status));
+    for (addr = 0; addr < 32 && probe(addr); addr++)
+        ;
+    /* the probe of an empty address is no MDIO error */
+    stats.mdio_errors = 0;
+    if (addr == 32)
+        return -1;
+    status.found = true;
+
+    if (wr(BMCR, BMCR_RESET))
+        return -1;
+    start = HAL_GetTick();
+    do {
+        if (rd(BMCR, &bmcr))
+            return -1;
+    } while ((bmcr & BMCR_RESET) && HAL_GetTick() - start < PHY_RESET_MS);
+    if (bmcr & BMCR_RESET)
+        return -1;
+
+    if (model && model->errors_reg)
+        rd(model->errors_reg, &errors_last);
+    if (wr(ANAR, AN_100FD | AN_100HD | AN_10FD | AN_10HD | AN_802_3))
+        return -1;
+    return phy_restart();
+}
+
+int phy_restart(void)
+{
+    if (!status.found)
+        return -1;
+    return wr(BMCR, BMCR_AN_ENABLE | BMCR_AN_RESTART);
+}
+
+/* the mode of a link up */
+static int resolve(void)
+{
+    uint16_t bmcr, anar, aner, mode;
+
+    if (rd(BMCR, &bmcr) || rd(ANAR, &anar) || rd(ANLPAR, &status.partner) || rd(ANER, &aner))
+        return -1;
+    if (aner & ANER_PDF)
+        stats.faults++;
+
+    if (!(bmcr & BMCR_AN_ENABLE)) {
+        status.negotiated = false;
+        status.speed = bmcr & BMCR_100M ? 100 : 10;
+        status.full = bmcr & BMCR_FULL;
+        return 0;
+    }
+    status.negotiated = aner & ANER_LP_AN_ABLE;
+    if (model) {
+        if (rd(model->mode_reg, &mode))
+            return -1;
+        mode = (mode >> model->mode_shift) & 7;
+        status.speed = mode & MODE_100M ? 100 : 10;
+        status.full = mode & MODE_FULL;
+    } else if (status.negotiated) {
+        uint16_t common = anar & status.partner;
+        status.speed = common & (AN_100FD | AN_100HD) ? 100 : 10;
+        status.full = common & AN_100FD || (!(common & AN_100HD) && common & AN_10FD);
+    } else {
+        /* parallel detection: the detected technology in ANLPAR, half duplex */
+        status.speed = status.partner & (AN_100FD | AN_100HD) ? 100 : 10;
+        status.full = false;
+    }
+    return 0;
+}
+
+static void count_errors(void)
+{
+    uint16_t n;
+
+    if (!model || !model->errors_reg || rd(model->errors_reg, &n))
+        return;
+    if (model->errors_clear) {
+        stats.symbol_errors += n;
+    } else {
+        stats.symbol_errors += (uint16_t)(n - errors_last);
+        errors_last = n;
+    }
+}
+
+int phy_poll(void)
+{
+    phy_status_t was = status;
+    uint16_t latched, bmsr, bmcr;
+    bool link;
+
+    if (!status.found)
+        return 0;
+    stats.polls++;
+    /* the first read returns the latched bits, the second one the link now */
+    if (rd(BMSR, &latched) || rd(BMSR, &bmsr) || rd(BMCR, &bmcr))
+        return 0;
+    if (latched & BMSR_REMOTE_FAULT)
+        stats.remote_faults++;
+    if (latched & BMSR_JABBER)
+        stats.jabbers++;
+    count_errors();
+
+    link = bmsr & BMSR_LINK && (!(bmcr & BMCR_AN_ENABLE) || bmsr & BMSR_AN_COMPLETE);
+    if (link && resolve())
+        return 0;
+    status.link = link;
+    if (was.link && (!link || !(latched & BMSR_LINK)))
+        stats.link_downs++;
+    if (link && (!was.link || !(latched & BMSR_LINK))) {
+        stats.link_ups++;
+        if (!status.negotiated)
+            stats.parallel++;
+    }
+    return link != was.link || (link && !(latched & BMSR_LINK)) ||
+           (link && (status.speed != was.speed || status.full != was.full));
+}
+
+void phy_status(phy_status_t *st)
+{
+    *st = status;
+}
+
+void phy_stats(phy_stats_t *st)
+{
+    *st = stats;
+}
+
+void phy_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,205 @@
+/*
+ * QSPI memory-mapped/indirect mode arbitration, see qspi_mode.h
+ */
+#include <qspi_mode.h>
+
+#include <sfud.h>
+#include <stm32h7xx_hal.h>
+
+extern QSPI_HandleTypeDef hqspi;
+
+static uint32_t leases;
+static uint32_t indirect_depth;
+static bool mapped;
+static bool xip;
+static uint32_t mode_since;    /* CYCCNT at the last switch or stats fold */
+static uint32_t suspend_since; /* CYCCNT when leased readers lost the mapping */
+static qspi_mode_stats_t stats;
+
+static uint32_t irq_save(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    return primask;
+}
+
+static void irq_restore(uint32_t primask) { __set_PRIMASK(primask); }
+
+/* account the time spent in the current mode up to now */
+static void fold_mode_time(void)
+{
+    uint32_t now = DWT->CYCCNT;
+    if (mapped)
+        stats.mapped_cycles += now - mode_since;
+    mode_since = now;
+}
+
+static uint32_t lines_mode(uint8_t lines, uint32_t none, uint32_t one, uint32_t two, uint32_t four)
+{
+    switch (lines) {
+    case 1:
+        return one;
+    case 2:
+        return two;
+    case 4:
+        return four;
+    default:
+        return none;
+    }
+}
+
+/* the memory-mapped read is the one SFUD validated for the device, fast read included */
+static int enter_mapped(void)
+{
+    const sfud_flash *flash = sfud_get_device(SFUD_W25_DEVICE_INDEX);
+    const sfud_qspi_read_cmd_format *fmt = &flash->read_cmd_format;
+    QSPI_CommandTypeDef cmd;
+    QSPI_MemoryMappedTypeDef cfg;
+    uint32_t start = DWT->CYCCNT;
+
+    if (!flash->init_ok)
+        return -1;
+
+    if (SFUD_QSPI_DIE_COUNT == 1 && hqspi.Init.FlashID != SFUD_QSPI_FLASH_ID)
+        HAL_QSPI_SetFlashID(&hqspi, SFUD_QSPI_FLASH_ID);
+
+    cmd.Instruction = fmt->instruction;
+    cmd.InstructionMode = lines_mode(fmt->instruction_lines, QSPI_INSTRUCTION_NONE, QSPI_INSTRUCTION_1_LINE,
+                                     QSPI_INSTRUCTION_2_LINES, QSPI_INSTRUCTION_4_LINES);
+    cmd.Address = 0;
+    cmd.AddressSize = fmt->address_size == 32 ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS;
+    cmd.AddressMode = lines_mode(fmt->address_lines, QSPI_ADDRESS_NONE, QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_2_LINES,
+                                 QSPI_ADDRESS_4_LINES);
+    cmd.AlternateBytes = 0;
+    cmd.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+    cmd.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+    cmd.DummyCycles = fmt->dummy_cycles;
+    cmd.NbData = 0;
+    cmd.DataMode = lines_mode(fmt->data_lines, QSPI_DATA_NONE, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES, QSPI_DATA_4_LINES);
+    cmd.DdrMode = QSPI_DDR_MODE_DISABLE;
+    cmd.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+    cmd.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+    /* release nCS one cycle after the last access so an abort never waits for a prefetch */
+    cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE;
+    cfg.TimeOutPeriod = 1;
+
+    if (HAL_QSPI_MemoryMapped(&hqspi, &cmd, &cfg) != HAL_OK) {
+        stats.failures++;
+        return -1;
+    }
+    /* the array may have been programmed since the last mapping, drop stale lines (whole cache, by set/way) */
+    SCB_CleanInvalidateDCache();
+
+    fold_mode_time();
+    mapped = true;
+    stats.enters++;
+    stats.enter_cycles += DWT->CYCCNT - start;
+    return 0;
+}
+
+static void leave_mapped(void)
+{
+    uint32_t start = DWT->CYCCNT;
+
+    if (HAL_QSPI_Abort(&hqspi) != HAL_OK)
+        stats.failures++;
+    fold_mode_time();
+    mapped = false;
+    stats.aborts++;
+    stats.abort_cycles += DWT->CYCCNT - start;
+}
+
+int qspi_mmap_acquire(void)
+{
+    uint32_t primask = irq_save();
+    int ret = 0;
+
+    /* an indirect operation is outstanding (an erase the flash still runs): nothing to read until it ends */
+    if (!mapped && indirect_depth > 0)
+        ret = -1;
+    else if (!mapped)
+        ret = enter_mapped();
+    if (ret == 0)
+        leases++;
+    irq_restore(primask);
+    return ret;
+}
+
+void qspi_mmap_release(void)
+{
+    uint32_t primask = irq_save();
+
+    if (leases > (xip ? 1u : 0u) && --leases == 0 && mapped)
+        leave_mapped();
+    irq_restore(primask);
+}
+
+bool qspi_mmap_active(void) { return mapped; }
+
+void qspi_mode_adopt_xip(void)
+{
+    uint32_t primask = irq_save();
+
+    xip = true;
+    mapped = true;
+    leases = 1;
+    mode_since = DWT->CYCCNT;
+    irq_restore(primask);
+}
+
+bool qspi_mode_is_xip(void) { return xip; }
+
+void qspi_indirect_begin(void)
+{
+    uint32_t primask = irq_save();
+
+    if (indirect_depth++ == 0) {
+        /*
+         * Under XIP the mapping goes away only with interrupts masked by the caller (the SFUD lock, or around
+         * sfud_init()): no vector or handler is fetched from QSPI meanwhile, the call path is in ITCM (itcm_qspi.ld).
+         * Otherwise let the command fail in the HAL.
+         */
+        if (mapped && xip && !primask)
+            stats.failures++;
+        else if (mapped)
+            leave_mapped();
+        suspend_since = DWT->CYCCNT;
+    }
+    irq_restore(primask);
+}
+
+void qspi_indirect_end(void)
+{
+    uint32_t primask = irq_save();
+
+    if (indirect_depth > 0 && --indirect_depth == 0 && leases > 0) {
+        uint32_t waited = DWT->CYCCNT - suspend_since;
+        stats.suspended_cycles += waited;
+        if (waited > stats.suspended_max)
+            stats.suspended_max = waited;
+        if (!mapped)
+            enter_mapped();
+    }
+    irq_restore(primask);
+}
+
+void qspi_mode_stats(qspi_mode_stats_t *out)
+{
+    uint32_t primask = irq_save();
+
+    fold_mode_time();
+    *out = stats;
+    out->leases = leases;
+    irq_restore(primask);
+}
+
+void qspi_mode_stats_reset(void)
+{
+    uint32_t primask = irq_save();
+    qspi_mode_stats_t empty = {0};
+
+    stats = empty;
+    mode_since = DWT->CYCCNT;
+    irq_restore(primask);
+}
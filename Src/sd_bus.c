@@ -0,0 +1,165 @@
+#include <sd_bus.h>
+
+#include <stm32h7xx_hal.h>
+
+#include <stdbool.h>
+
+extern SD_HandleTypeDef hsd1;
+
+/* D1-D3 would be PC9-PC11: PC10 is the card detect and PC11 the QSPI bank 2 NCS, the slot is wired 1-bit */
+#define BOARD_WIDTH 1
+
+#define DEFAULT_SPEED_HZ 25000000
+#define HIGH_SPEED_HZ 50000000
+#define MIN_HZ 400000
+#define DLYB_PHASES 12
+#define TEST_READS 4
+#define TEST_TIMEOUT_MS 100
+
+static sd_bus_t bus = {.width = 1, .phase = -1};
+
+static uint32_t clock_of(uint32_t div)
+{
+    return div ? bus.kernel_hz / (2 * div) : bus.kernel_hz;
+}
+
+static void set_clock(uint32_t hz)
+{
+    uint32_t div = 0;
+
+    if (bus.kernel_hz > hz)
+        div = (bus.kernel_hz + 2 * hz - 1) / (2 * hz);
+    if (div > SDMMC_CLKCR_CLKDIV_Msk)
+        div = SDMMC_CLKCR_CLKDIV_Msk;
+    MODIFY_REG(hsd1.Instance->CLKCR, SDMMC_CLKCR_CLKDIV, div);
+    hsd1.Init.ClockDiv = div;
+    bus.clock_hz = clock_of(div);
+}
+
+/* polled reads of block 0 with a short timeout, a bad sampling phase shows as a CRC error or a missed start bit */
+static bool bus_test(void)
+{
+    static uint32_t block[128];
+
+    for (int i = 0; i < TEST_READS; i++) {
+        hsd1.ErrorCode = HAL_SD_ERROR_NONE;
+        if (HAL_SD_ReadBlocks(&hsd1, (uint8_t *)block, 0, 1, TEST_TIMEOUT_MS) != HAL_OK)
+            return false;
+    }
+    return true;
+}
+
+static void rx_clock_direct(void)
+{
+    DelayBlock_Disable(DLYB_SDMMC1);
+    CLEAR_BIT(hsd1.Instance->CLKCR, SDMMC_CLKCR_SELCLKRX);
+    bus.phase = -1;
+}
+
+static void set_phase(uint32_t phase)
+{
+    DLYB_SDMMC1->CR = DLYB_CR_DEN | DLYB_CR_SEN;
+    MODIFY_REG(DLYB_SDMMC1->CFGR, DLYB_CFGR_SEL, phase);
+    DLYB_SDMMC1->CR = DLYB_CR_DEN;
+}
+
+/* the middle of the longest run of phases reading clean, the direct receive clock when none does */
+static void tune(void)
+{
+    int best = -1, best_len = 0, run = 0;
+
+    if (DelayBlock_Enable(DLYB_SDMMC1) != HAL_OK) {
+        rx_clock_direct();
+        return;
+    }
+    MODIFY_REG(hsd1.Instance->CLKCR, SDMMC_CLKCR_SELCLKRX, SDMMC_CLKCR_SELCLKRX_1);
+    for (int phase = 0; phase < DLYB_PHASES; phase++) {
+        set_phase(phase);
+        run = bus_test() ? run + 1 : 0;
+        if (run > best_len) {
+            best_len = run;
+            best = phase - run + 1;
+        }
+    }
+    if (best < 0) {
+        rx_clock_direct();
+        return;
+    }
+    bus.phase = best + best_len / 2;
+    set_phase(bus.phase);
+}
+
+static void apply(uint32_t hz)
+{
+    set_clock(hz);
+    if (bus.clock_hz > DEFAULT_SPEED_HZ)
+        tune();
+    else
+        rx_clock_direct();
+}
+
+/* half the clock, -1 at the slowest */
+static int step_down(void)
+{
+    if (bus.clock_hz / 2 < MIN_HZ)
+        return -1;
+    bus.fallbacks++;
+    apply(bus.clock_hz / 2);
+    return 0;
+}
+
+int sd_bus_negotiate(void)
+{
+    uint32_t hz;
+
+    bus.kernel_hz = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_SDMMC);
+    if (bus.width > BOARD_WIDTH)
+        bus.width = BOARD_WIDTH;
+    if (HAL_SD_ConfigWideBusOperation(&hsd1, bus.width == 4 ? SDMMC_BUS_WIDE_4B : SDMMC_BUS_WIDE_1B) != HAL_OK)
+        bus.width = 1;
+
+    /* the HAL only switches the cards it classed as high speed, a UHS card does high speed at 3.3V as well */
+    bus.high_speed = 0;
+    if (hsd1.SdCard.CardSpeed != CARD_NORMAL_SPEED) {
+        uint32_t speed = hsd1.SdCard.CardSpeed;
+        hsd1.SdCard.CardSpeed = CARD_HIGH_SPEED;
+        bus.high_speed = HAL_SD_ConfigSpeedBusOperation(&hsd1, SDMMC_SPEED_MODE_HIGH) == HAL_OK;
+        hsd1.SdCard.CardSpeed = speed;
+    }
+
+    hz = bus.high_speed ? HIGH_SPEED_HZ : DEFAULT_SPEED_HZ;
+    if (bus.max_hz && bus.max_hz < hz)
+        hz = bus.max_hz;
+    apply(hz);
+    while (!bus_test())
+        if (step_down() != 0)
+            return -1;
+    return 0;
+}
+
+int sd_bus_set_width(uint32_t width)
+{
+    if ((width != 1 && width != 4) || width > BOARD_WIDTH)
+        return -1;
+    bus.width = width;
+    return sd_bus_negotiate();
+}
+
+int sd_bus_set_clock(uint32_t max_hz)
+{
+    bus.max_hz = max_hz;
+    return sd_bus_negotiate();
+}
+
+int sd_bus_recover(void)
+{
+    if (!(HAL_SD_GetError(&hsd1) & (HAL_SD_ERROR_DATA_CRC_FAIL | HAL_SD_ERROR_CMD_CRC_FAIL)))
+        return -1;
+    bus.crc_errors++;
+    return step_down();
+}
+
+void sd_bus_info(sd_bus_t *info)
+{
+    *info = bus;
+}
@@ -0,0 +1,264 @@
+#include <sd_cache.h>
+
+#include <sd_diskio.h>
+#include <sections.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#define SECTOR 512
+#define RUN_MAX 32 /* sectors per command through the staging buffer */
+#define READ_AHEAD 16
+
+typedef struct {
+    DWORD sector;
+    uint32_t used;
+    uint8_t valid;
+    uint8_t dirty;
+} slot_t;
+
+static slot_t slots[SD_CACHE_SECTORS];
+/* in AXI SRAM: the IDMA moves them without the bounce buffer */
+static uint8_t data[SD_CACHE_SECTORS][SECTOR] AXISRAM_BSS;
+static uint8_t staging[RUN_MAX * SECTOR] AXISRAM_BSS;
+
+static uint32_t age;
+static DWORD next_read;
+static DWORD card_sectors;
+static sd_cache_stats_t stats;
+
+static int find(DWORD sector)
+{
+    for (int i = 0; i < SD_CACHE_SECTORS; i++)
+        if (slots[i].valid && slots[i].sector == sector)
+            return i;
+    return -1;
+}
+
+/* free slot or least recently used one, clean ones only when asked */
+static int victim(bool clean)
+{
+    int v = -1;
+
+    for (int i = 0; i < SD_CACHE_SECTORS; i++) {
+        if (!slots[i].valid)
+            return i;
+        if (clean && slots[i].dirty)
+            continue;
+        if (v < 0 || slots[i].used < slots[v].used)
+            v = i;
+    }
+    return v;
+}
+
+static DRESULT flush(BYTE lun)
+{
+    int order[SD_CACHE_SECTORS];
+    int n = 0;
+
+    for (int i = 0; i < SD_CACHE_SECTORS; i++) {
+        if (!slots[i].valid || !slots[i].dirty)
+            continue;
+        int j = n++;
+        for (; j > 0 && slots[order[j - 1]].sector > slots[i].sector; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for (int i = 0; i < n;) {
+        DWORD first = slots[order[i]].sector;
+        int run = 1;
+        while (i + run < n && run < RUN_MAX && slots[order[i + run]].sector == first + run)
+            run++;
+        const BYTE *src = data[order[i]];
+        if (run > 1) {
+            for (int j = 0; j < run; j++)
+                memcpy(staging + j * SECTOR, data[order[i + j]], SECTOR);
+            src = staging;
+        }
+        if (SD_Driver.disk_write(lun, src, first, run) != RES_OK)
+            return RES_ERROR;
+        for (int j = 0; j < run; j++)
+            slots[order[i + j]].dirty = 0;
+        stats.flush_writes++;
+        stats.flushed += run;
+        stats.dirty -= run;
+        i += run;
+    }
+    return RES_OK;
+}
+
+/* read data, a full cache is not flushed for it */
+static void insert_clean(DWORD sector, const BYTE *src)
+{
+    int i;
+
+    if (find(sector) >= 0 || (i = victim(true)) < 0)
+        return;
+    memcpy(data[i], src, SECTOR);
+    slots[i].sector = sector;
+    slots[i].valid = 1;
+    slots[i].dirty = 0;
+    slots[i].used = age;
+}
+
+static void drop(DWORD sector, UINT count)
+{
+    for (int i = 0; i < SD_CACHE_SECTORS; i++) {
+        if (!slots[i].valid || slots[i].sector - sector >= count)
+            continue;
+        if (slots[i].dirty)
+            stats.dirty--;
+        slots[i].valid = 0;
+        slots[i].dirty = 0;
+    }
+}
+
+static DSTATUS cache_initialize(BYTE lun)
+{
+    DSTATUS st;
+    BSP_SD_CardInfo info;
+
+    flush(lun);
+    sd_cache_invalidate();
+    st = SD_Driver.disk_initialize(lun);
+    if (!(st & STA_NOINIT)) {
+        BSP_SD_GetCardInfo(&info);
+        card_sectors = info.LogBlockNbr;
+    }
+    return st;
+}
+
+static DSTATUS cache_status(BYTE lun)
+{
+    return SD_Driver.disk_status(lun);
+}
+
+static DRESULT cache_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+    bool sequential = sector == next_read;
+
+    next_read = sector + count;
+    if (count >= SD_CACHE_BYPASS) {
+        if (SD_Driver.disk_read(lun, buff, sector, count) != RES_OK)
+            return RES_ERROR;
+        /* the cache holds newer data for its dirty sectors */
+        for (int i = 0; i < SD_CACHE_SECTORS; i++)
+            if (slots[i].valid && slots[i].dirty && slots[i].sector - sector < count)
+                memcpy(buff + (slots[i].sector - sector) * SECTOR, data[i], SECTOR);
+        stats.bypassed += count;
+        return RES_OK;
+    }
+
+    while (count > 0) {
+        int i = find(sector);
+        if (i >= 0) {
+            memcpy(buff, data[i], SECTOR);
+            slots[i].used = ++age;
+            stats.read_hits++;
+            buff += SECTOR;
+            sector++;
+            count--;
+            continue;
+        }
+
+        /* the missing run, and what follows it on a sequential stream */
+        UINT run = 1;
+        while (run < count && find(sector + run) < 0)
+            run++;
+        UINT n = run + (sequential ? READ_AHEAD : 0);
+        if (n > RUN_MAX)
+            n = RUN_MAX;
+        if (card_sectors && sector + n > card_sectors)
+            n = card_sectors - sector > run ? card_sectors - sector : run;
+        if (SD_Driver.disk_read(lun, staging, sector, n) != RES_OK)
+            return RES_ERROR;
+        memcpy(buff, staging, run * SECTOR);
+        ++age;
+        for (UINT j = 0; j < n; j++)
+            insert_clean(sector + j, staging + j * SECTOR);
+        stats.read_misses += run;
+        stats.read_ahead += n - run;
+        buff += run * SECTOR;
+        sector += run;
+        count -= run;
+    }
+    return RES_OK;
+}
+
+static DRESULT cache_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+{
+    if (count >= SD_CACHE_BYPASS) {
+        drop(sector, count);
+        stats.bypassed += count;
+        return SD_Driver.disk_write(lun, buff, sector, count);
+    }
+
+    for (; count > 0; count--, sector++, buff += SECTOR) {
+        int i = find(sector);
+        if (i < 0) {
+            i = victim(false);
+            if (slots[i].dirty) {
+                stats.evictions++;
+                if (flush(lun) != RES_OK)
+                    return RES_ERROR;
+            }
+            slots[i].sector = sector;
+            slots[i].valid = 1;
+        } else if (slots[i].dirty) {
+            stats.write_hits++;
+        }
+        memcpy(data[i], buff, SECTOR);
+        if (!slots[i].dirty)
+            stats.dirty++;
+        slots[i].dirty = 1;
+        slots[i].used = ++age;
+        stats.writes++;
+    }
+    return RES_OK;
+}
+
+static DRESULT cache_ioctl(BYTE lun, BYTE cmd, void *buff)
+{
+    if (cmd == CTRL_SYNC) {
+        stats.syncs++;
+        if (flush(lun) != RES_OK)
+            return RES_ERROR;
+    } else if (cmd == CTRL_TRIM) {
+        /* the trimmed sectors belong to no file any more, dirty ones are dropped unwritten */
+        drop(((DWORD *)buff)[0], ((DWORD *)buff)[1] - ((DWORD *)buff)[0] + 1);
+    } else if (cmd == CTRL_EJECT) {
+        /* the card is gone, what was not written is lost and must not go to the next one */
+        sd_cache_invalidate();
+        return RES_OK;
+    }
+    return SD_Driver.disk_ioctl(lun, cmd, buff);
+}
+
+const Diskio_drvTypeDef SD_Cache_Driver = {
+    cache_initialize, //
+    cache_status,     //
+    cache_read,       //
+    cache_write,      //
+    cache_ioctl,      //
+};
+
+void sd_cache_stats(sd_cache_stats_t *st)
+{
+    *st = stats;
+}
+
+void sd_cache_reset_stats(void)
+{
+    uint32_t dirty = stats.dirty;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.dirty = dirty;
+}
+
+void sd_cache_invalidate(void)
+{
+    memset(slots, 0, sizeof(slots));
+    stats.dirty = 0;
+    next_read = 0;
+}
@@ -18,7 +18,7 @@
   */
 /* USER CODE END Header */
 
-/* Note: code generation based on sd_diskio_template.c v2.0.2 as "Use dma template" is disabled. */
+/* Note: code generation based on sd_diskio_template.c v2.0.2, reads and writes moved to the SDMMC IDMA. */
 
 /* USER CODE BEGIN firstSection */
 /* can be used to modify / undefine following code or add new definitions */
@@ -28,6 +28,10 @@
 #include "ff_gen_drv.h"
 #include "sd_diskio.h"
 
+#include <sd_bus.h>
+#include <sections.h>
+#include <string.h>
+
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 /* use the default SD timout as defined in the platform BSP driver*/
@@ -41,6 +45,22 @@
 
 #define SD_DEFAULT_BLOCK_SIZE 512
 
+/* IDMA transfer (ms) and card programming after a write */
+#define SD_DMA_TIMEOUT 30 * 1000
+
+/* the IDMA of SDMMC1 only reaches the AXI SRAM, not the DTCM holding .data, .bss and the stacks */
+#define SD_DMA_RAM_START 0x24000000
+#define SD_DMA_RAM_END (0x24000000 + 512 * 1024)
+
+/* bounce buffer for the other buffers, in blocks */
+#define SD_SCRATCH_BLOCKS 32
+
+/* blocks per erase command of a trim, keeps each one well inside SD_DMA_TIMEOUT */
+#define SD_TRIM_BLOCKS (64 * 1024)
+
+/* largest alignment f_mkfs accepts from GET_BLOCK_SIZE */
+#define SD_MAX_ERASE_BLOCK 32768
+
 /*
  * Depending on the use case, the SD card initialization could be done at the
  * application level: if it is the case define the flag below to disable
@@ -55,6 +75,15 @@
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
+/* IDMA transfer state, set by the completion callbacks */
+enum { SD_DMA_IDLE, SD_DMA_BUSY, SD_DMA_ERROR };
+static volatile int DmaStatus = SD_DMA_IDLE;
+
+static uint8_t Scratch[SD_SCRATCH_BLOCKS * SD_DEFAULT_BLOCK_SIZE] AXISRAM_BSS;
+
+/* GET_BLOCK_SIZE of the card in the slot, 0 until asked */
+static DWORD EraseBlock;
+
 /* Private function prototypes -----------------------------------------------*/
 static DSTATUS SD_CheckStatus(BYTE lun);
 DSTATUS SD_initialize (BYTE);
@@ -106,6 +135,7 @@ static DSTATUS SD_CheckStatus(BYTE lun)
 DSTATUS SD_initialize(BYTE lun)
 {
   Stat = STA_NOINIT;
+  EraseBlock = 0;
 #if !defined(DISABLE_SD_INIT)
 
   if(BSP_SD_Init() == MSD_OK)
@@ -130,7 +160,123 @@ DSTATUS SD_status(BYTE lun)
 }
 
 /* USER CODE BEGIN beforeReadSection */
-/* can be used to modify previous code / undefine following code / add new code */
+/*
+ * Reads and writes run on the SDMMC internal DMA, the core sleeps until the completion interrupt. A buffer the IDMA
+ * cannot reach or not on a cache line boundary goes through Scratch[], up to SD_SCRATCH_BLOCKS at a time.
+ */
+static int SD_DmaCapable(const BYTE *buff)
+{
+  uint32_t addr = (uint32_t)buff;
+
+  return addr >= SD_DMA_RAM_START && addr < SD_DMA_RAM_END && (addr & 31) == 0;
+}
+
+static int SD_WaitReady(uint32_t start)
+{
+  while (DmaStatus == SD_DMA_BUSY)
+  {
+    if (HAL_GetTick() - start >= SD_DMA_TIMEOUT)
+    {
+      BSP_SD_Abort();
+      DmaStatus = SD_DMA_ERROR;
+      break;
+    }
+    /* the completion interrupt wakes the core even masked, no wake up can be missed between the test and WFI */
+    __disable_irq();
+    if (DmaStatus == SD_DMA_BUSY)
+    {
+      __WFI();
+    }
+    __enable_irq();
+  }
+  if (DmaStatus != SD_DMA_IDLE)
+  {
+    return -1;
+  }
+
+  /* a write is done once the card leaves the programming state */
+  while (BSP_SD_GetCardState() != SD_TRANSFER_OK)
+  {
+    if (HAL_GetTick() - start >= SD_DMA_TIMEOUT)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* buff is DMA capable, the cache lines it covers are its own */
+static int SD_TransferOnce(int write, BYTE *buff, DWORD sector, UINT count)
+{
+  uint32_t size = count * SD_DEFAULT_BLOCK_SIZE;
+  uint32_t start = HAL_GetTick();
+  uint8_t status;
+
+  DmaStatus = SD_DMA_BUSY;
+  if (write)
+  {
+    SCB_CleanDCache_by_Addr((uint32_t *)buff, size);
+    if (count > 1)
+    {
+      /* ACMD23 ahead of the CMD25: the card pre-erases the blocks */
+      status = BSP_SD_WriteBlocksPreErased_DMA((uint32_t *)buff, (uint32_t)sector, count);
+    }
+    else
+    {
+      status = BSP_SD_WriteBlocks_DMA((uint32_t *)buff, (uint32_t)sector, count);
+    }
+  }
+  else
+  {
+    /* no dirty line may be evicted over the incoming data */
+    SCB_InvalidateDCache_by_Addr((uint32_t *)buff, size);
+    status = BSP_SD_ReadBlocks_DMA((uint32_t *)buff, (uint32_t)sector, count);
+  }
+  if (status != MSD_OK)
+  {
+    DmaStatus = SD_DMA_IDLE;
+    return -1;
+  }
+  if (SD_WaitReady(start) != 0)
+  {
+    DmaStatus = SD_DMA_IDLE;
+    return -1;
+  }
+  if (!write)
+  {
+    /* drop the lines speculatively fetched during the transfer */
+    SCB_InvalidateDCache_by_Addr((uint32_t *)buff, size);
+  }
+  return 0;
+}
+
+/* a CRC error lowers the bus clock, then the transfer is tried again */
+static int SD_Transfer(int write, BYTE *buff, DWORD sector, UINT count)
+{
+  while (SD_TransferOnce(write, buff, sector, count) != 0)
+  {
+    if (sd_bus_recover() != 0)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void BSP_SD_ReadCpltCallback(void)
+{
+  DmaStatus = SD_DMA_IDLE;
+}
+
+void BSP_SD_WriteCpltCallback(void)
+{
+  DmaStatus = SD_DMA_IDLE;
+}
+
+void BSP_SD_ErrorCallback(void)
+{
+  DmaStatus = SD_DMA_ERROR;
+}
 /* USER CODE END beforeReadSection */
 /**
   * @brief  Reads Sector(s)
@@ -142,20 +288,25 @@ DSTATUS SD_status(BYTE lun)
   */
 DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
+  if (SD_DmaCapable(buff))
+  {
+    return SD_Transfer(0, buff, sector, count) == 0 ? RES_OK : RES_ERROR;
+  }
 
-  if(BSP_SD_ReadBlocks((uint32_t*)buff,
-                       (uint32_t) (sector),
-                       count, SD_TIMEOUT) == MSD_OK)
+  while (count > 0)
   {
-    /* wait until the read operation is finished */
-    while(BSP_SD_GetCardState()!= MSD_OK)
+    UINT n = count < SD_SCRATCH_BLOCKS ? count : SD_SCRATCH_BLOCKS;
+
+    if (SD_Transfer(0, Scratch, sector, n) != 0)
     {
+      return RES_ERROR;
     }
-    res = RES_OK;
+    memcpy(buff, Scratch, n * SD_DEFAULT_BLOCK_SIZE);
+    buff += n * SD_DEFAULT_BLOCK_SIZE;
+    sector += n;
+    count -= n;
   }
-
-  return res;
+  return RES_OK;
 }
 
 /* USER CODE BEGIN beforeWriteSection */
@@ -172,25 +323,68 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 #if _USE_WRITE == 1
 DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
-  DRESULT res = RES_ERROR;
+  if (SD_DmaCapable(buff))
+  {
+    return SD_Transfer(1, (BYTE *)buff, sector, count) == 0 ? RES_OK : RES_ERROR;
+  }
 
-  if(BSP_SD_WriteBlocks((uint32_t*)buff,
-                        (uint32_t)(sector),
-                        count, SD_TIMEOUT) == MSD_OK)
+  while (count > 0)
   {
-	/* wait until the Write operation is finished */
-    while(BSP_SD_GetCardState() != MSD_OK)
+    UINT n = count < SD_SCRATCH_BLOCKS ? count : SD_SCRATCH_BLOCKS;
+
+    memcpy(Scratch, buff, n * SD_DEFAULT_BLOCK_SIZE);
+    if (SD_Transfer(1, Scratch, sector, n) != 0)
     {
+      return RES_ERROR;
     }
-    res = RES_OK;
+    buff += n * SD_DEFAULT_BLOCK_SIZE;
+    sector += n;
+    count -= n;
   }
-
-  return res;
+  return RES_OK;
 }
 #endif /* _USE_WRITE == 1 */
 
 /* USER CODE BEGIN beforeIoctlSection */
-/* can be used to modify previous code / undefine following code / add new code */
+/* the largest power of two dividing the erase unit, f_mkfs aligns the data area to it */
+static DWORD SD_EraseBlock(void)
+{
+  if (EraseBlock == 0)
+  {
+    uint32_t unit = BSP_SD_GetEraseUnit();
+
+    EraseBlock = unit ? unit & -unit : 1;
+    if (EraseBlock > SD_MAX_ERASE_BLOCK)
+    {
+      EraseBlock = SD_MAX_ERASE_BLOCK;
+    }
+  }
+  return EraseBlock;
+}
+
+/* the card maps the blocks out, a later write to them skips the erase */
+static int SD_Trim(DWORD start, DWORD end)
+{
+  while (start <= end)
+  {
+    DWORD last = end - start >= SD_TRIM_BLOCKS ? start + SD_TRIM_BLOCKS - 1 : end;
+    uint32_t tick = HAL_GetTick();
+
+    if (BSP_SD_Erase(start, last) != MSD_OK)
+    {
+      return -1;
+    }
+    while (BSP_SD_GetCardState() != SD_TRANSFER_OK)
+    {
+      if (HAL_GetTick() - tick >= SD_DMA_TIMEOUT)
+      {
+        return -1;
+      }
+    }
+    start = last + 1;
+  }
+  return 0;
+}
 /* USER CODE END beforeIoctlSection */
 /**
   * @brief  I/O control operation
@@ -230,11 +424,15 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 
   /* Get erase block size in unit of sector (DWORD) */
   case GET_BLOCK_SIZE :
-    BSP_SD_GetCardInfo(&CardInfo);
-    *(DWORD*)buff = CardInfo.LogBlockSize / SD_DEFAULT_BLOCK_SIZE;
+    *(DWORD*)buff = SD_EraseBlock();
     res = RES_OK;
     break;
 
+  /* Erase the sectors from ((DWORD*)buff)[0] to ((DWORD*)buff)[1] included */
+  case CTRL_TRIM :
+    res = SD_Trim(((DWORD*)buff)[0], ((DWORD*)buff)[1]) == 0 ? RES_OK : RES_ERROR;
+    break;
+
   default:
     res = RES_PARERR;
   }
@@ -0,0 +1,90 @@
+#include <sd_format.h>
+
+#include <diskio.h>
+#include <fatfs.h>
+#include <sections.h>
+#include <volume.h>
+
+#include <string.h>
+
+#define SECTOR 512
+#define MBR_TABLE 446
+#define MBR_MIN_START 2048 /* 1MB, where partition tools start the first one */
+#define WORK_SECTORS 32
+
+/* in AXI SRAM, f_mkfs writes the FAT and the root directory from it in multi-sector runs */
+static uint8_t work[WORK_SECTORS * SECTOR] AXISRAM_BSS;
+
+static void put_dword(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* one primary partition, CHS fields at their maximum: LBA only */
+static DRESULT write_mbr(BYTE pdrv, DWORD start, DWORD size)
+{
+    uint8_t *pte = work + MBR_TABLE;
+
+    memset(work, 0, SECTOR);
+    pte[1] = 0xFE;
+    pte[2] = 0xFF;
+    pte[3] = 0xFF;
+    pte[4] = 0x0C; /* FAT32 LBA, f_mkfs writes the type it picks */
+    pte[5] = 0xFE;
+    pte[6] = 0xFF;
+    pte[7] = 0xFF;
+    put_dword(pte + 8, start);
+    put_dword(pte + 12, size);
+    work[510] = 0x55;
+    work[511] = 0xAA;
+    return disk_write(pdrv, work, 0, 1);
+}
+
+FRESULT sd_format(uint32_t cluster_bytes)
+{
+    BYTE pdrv = SDPath[0] - '0';
+    DWORD sectors, block, start;
+    FRESULT res;
+
+    volume_release(SDPath);
+    if (volume_card(SDPath) != 0)
+        return FR_NOT_READY;
+    if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &sectors) != RES_OK || disk_ioctl(pdrv, GET_BLOCK_SIZE, &block) != RES_OK)
+        return FR_DISK_ERR;
+    start = block > MBR_MIN_START ? block : MBR_MIN_START;
+    if (sectors < start + 2 * block)
+        return FR_MKFS_ABORTED;
+    if (write_mbr(pdrv, start, (sectors - start) / block * block) != RES_OK)
+        return FR_DISK_ERR;
+
+    /* f_mkfs takes the volume from the partition table when it is given a partition */
+    VolToPart[pdrv].pt = 1;
+    res = f_mkfs(SDPath, FM_ANY, cluster_bytes, work, sizeof(work));
+    VolToPart[pdrv].pt = 0;
+    return res;
+}
+
+FRESULT sd_format_layout(sd_format_layout_t *layout)
+{
+    BYTE pdrv = SDPath[0] - '0';
+    FRESULT res = volume_mount(SDPath);
+    DWORD block;
+
+    if (res != FR_OK)
+        return res;
+    if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &block) != RES_OK)
+        block = 1;
+    layout->erase_block = block;
+    layout->volume_start = SDFatFS.volbase;
+    layout->fat_start = SDFatFS.fatbase;
+    layout->fat_size = SDFatFS.fsize * SDFatFS.n_fats;
+    layout->data_start = SDFatFS.database;
+    layout->cluster = SDFatFS.csize;
+    layout->clusters = SDFatFS.n_fatent - 2;
+    layout->volume_size = layout->data_start - layout->volume_start + layout->clusters * layout->cluster;
+    layout->fs_type = SDFatFS.fs_type;
+    return FR_OK;
+}
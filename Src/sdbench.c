@@ -0,0 +1,442 @@
+#include <sdbench.h>
+
+#include <bsp_driver_sd.h>
+#include <clmt.h>
+#include <fatfs.h>
+#include <sd_bus.h>
+#include <sd_cache.h>
+#include <sections.h>
+#include <volume.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECTOR 512
+#define BUF_SIZE (64 * 1024)
+#define MAX_SAMPLES 2048
+#define MAX_ROWS 32
+#define RAW_SEQ_BYTES (8 * 1024 * 1024)
+#define RAW_RANDOM_OPS 512
+#define STALL_WARN_US 100000 /* garbage collection territory */
+#define SEEK_REOPENS 16
+
+typedef struct {
+    const char *test;
+    const char *op;
+    uint32_t size;  /* bytes per operation */
+    uint32_t count; /* operations */
+    uint64_t bytes;
+    uint64_t cycles;
+    uint32_t max_cycles; /* the samples keep the first MAX_SAMPLES operations only */
+    uint32_t p50, p90, p99, max; /* us */
+    int write;
+} row_t;
+
+extern SD_HandleTypeDef hsd1;
+
+static uint8_t buf[BUF_SIZE] AXISRAM_BSS;
+static uint32_t samples[MAX_SAMPLES];
+static uint32_t nsamples;
+static row_t rows[MAX_ROWS];
+static int nrows;
+static uint32_t rng = 0x12345678;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t to_us(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+static row_t *begin(const char *test, const char *op, uint32_t size, int write)
+{
+    row_t *r = &rows[nrows < MAX_ROWS - 1 ? nrows++ : nrows];
+
+    memset(r, 0, sizeof(*r));
+    r->test = test;
+    r->op = op;
+    r->size = size;
+    r->write = write;
+    nsamples = 0;
+    return r;
+}
+
+static void sample(row_t *r, uint32_t cycles, uint32_t bytes)
+{
+    if (nsamples < MAX_SAMPLES)
+        samples[nsamples++] = cycles;
+    r->count++;
+    r->bytes += bytes;
+    r->cycles += cycles;
+    if (cycles > r->max_cycles)
+        r->max_cycles = cycles;
+}
+
+static void end(row_t *r)
+{
+    if (nsamples == 0)
+        return;
+    qsort(samples, nsamples, sizeof(samples[0]), cmp_u32);
+    r->p50 = to_us(samples[(nsamples - 1) * 50 / 100]);
+    r->p90 = to_us(samples[(nsamples - 1) * 90 / 100]);
+    r->p99 = to_us(samples[(nsamples - 1) * 99 / 100]);
+    r->max = to_us(r->max_cycles);
+}
+
+/* MB/s in hundredths, operations per second */
+static uint32_t rate(const row_t *r)
+{
+    return r->cycles ? r->bytes * 100 * SystemCoreClock / r->cycles / (1024 * 1024) : 0;
+}
+
+static uint32_t iops(const row_t *r)
+{
+    return r->cycles ? (uint64_t)r->count * SystemCoreClock / r->cycles : 0;
+}
+
+static void print_size(char *s, size_t n, uint32_t size)
+{
+    if (size >= 1024)
+        snprintf(s, n, "%" PRIu32 "K", size / 1024);
+    else
+        snprintf(s, n, "%" PRIu32 "B", size);
+}
+
+static void print_row(const row_t *r)
+{
+    char size[8];
+    uint32_t mbs = rate(r);
+
+    print_size(size, sizeof(size), r->size);
+    printf("%-5s %-11s %5s %6" PRIu32 " %4" PRIu32 ".%02" PRIu32 " %7" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32
+           " %8" PRIu32 "%s\r\n",
+           r->test, r->op, size, r->count, mbs / 100, mbs % 100, iops(r), r->p50, r->p90, r->p99, r->max,
+           r->write && r->max >= STALL_WARN_US ? " <" : "");
+}
+
+static int raw_test(const char *op, int write, int random, uint32_t blocks, DWORD area, DWORD area_blocks)
+{
+    uint32_t ops = random ? RAW_RANDOM_OPS : RAW_SEQ_BYTES / (blocks * SECTOR);
+    row_t *r = begin("raw", op, blocks * SECTOR, write);
+    DWORD lba = area;
+
+    if (ops > MAX_SAMPLES)
+        ops = MAX_SAMPLES;
+    for (uint32_t i = 0; i < ops; i++) {
+        if (random)
+            lba = area + next_random() % (area_blocks / blocks) * blocks;
+        else if (lba + blocks > area + area_blocks)
+            lba = area;
+        uint32_t start = DWT->CYCCNT;
+        DRESULT res = write ? SD_Driver.disk_write(0, buf, lba, blocks) : SD_Driver.disk_read(0, buf, lba, blocks);
+        uint32_t cycles = DWT->CYCCNT - start;
+        if (res != RES_OK) {
+            printf("SD %s error at block %" PRIu32 "\r\n", write ? "write" : "read", (uint32_t)lba);
+            return -1;
+        }
+        sample(r, cycles, blocks * SECTOR);
+        lba += blocks;
+    }
+    end(r);
+    print_row(r);
+    return 0;
+}
+
+static int raw_tests(int with_writes)
+{
+    static const uint32_t seq_blocks[] = {1, 8, 64, BUF_SIZE / SECTOR};
+    static const uint32_t rand_blocks[] = {1, 8};
+    BSP_SD_CardInfo info;
+    DWORD area, area_blocks = SDBENCH_RAW_AREA / SECTOR;
+
+    /* the sector cache must not hold what the raw writes replace */
+    SD_Cache_Driver.disk_ioctl(0, CTRL_SYNC, NULL);
+    if (volume_card(SDPath) != 0) {
+        printf("Error init SD\r\n");
+        return -1;
+    }
+    BSP_SD_GetCardInfo(&info);
+    if (info.LogBlockNbr < 2 * area_blocks)
+        area_blocks = info.LogBlockNbr / 2;
+    /* 4MB aligned, the allocation unit of most cards */
+    area = (info.LogBlockNbr - area_blocks) & ~((DWORD)(4 * 1024 * 1024 / SECTOR) - 1);
+
+    for (size_t i = 0; i < sizeof(seq_blocks) / sizeof(seq_blocks[0]); i++)
+        if (raw_test("seq read", 0, 0, seq_blocks[i], area, area_blocks) != 0)
+            return -1;
+    for (size_t i = 0; i < sizeof(rand_blocks) / sizeof(rand_blocks[0]); i++)
+        if (raw_test("rand read", 0, 1, rand_blocks[i], area, area_blocks) != 0)
+            return -1;
+    if (!with_writes)
+        return 0;
+    for (size_t i = 0; i < sizeof(seq_blocks) / sizeof(seq_blocks[0]); i++)
+        if (raw_test("seq write", 1, 0, seq_blocks[i], area, area_blocks) != 0)
+            return -1;
+    for (size_t i = 0; i < sizeof(rand_blocks) / sizeof(rand_blocks[0]); i++)
+        if (raw_test("rand write", 1, 1, rand_blocks[i], area, area_blocks) != 0)
+            return -1;
+    /* the area may have held files, FatFs reads the volume again */
+    sd_cache_invalidate();
+    volume_release(SDPath);
+    return 0;
+}
+
+static int file_write(const char *path, uint32_t chunk, uint32_t size, int prealloc)
+{
+    static FIL fil;
+    row_t *r = begin("file", prealloc ? "write pre" : "write", chunk, 1);
+    UINT done;
+
+    if (f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+        printf("Cannot create %s\r\n", path);
+        return -1;
+    }
+    /* one contiguous run of clusters, the writes then find them allocated */
+    if (prealloc && f_expand(&fil, size, 1) != FR_OK) {
+        printf("Cannot allocate %" PRIu32 " bytes\r\n", size);
+        f_close(&fil);
+        return -1;
+    }
+    for (uint32_t pos = 0; pos < size; pos += chunk) {
+        uint32_t start = DWT->CYCCNT;
+        FRESULT res = f_write(&fil, buf + pos % BUF_SIZE, chunk, &done);
+        uint32_t cycles = DWT->CYCCNT - start;
+        if (res != FR_OK || done != chunk) {
+            printf("File write error %d\r\n", res);
+            f_close(&fil);
+            return -1;
+        }
+        sample(r, cycles, chunk);
+    }
+    /* the close flushes the FAT and the directory entry, a stall of the last write */
+    uint32_t start = DWT->CYCCNT;
+    FRESULT res = f_close(&fil);
+    sample(r, DWT->CYCCNT - start, 0);
+    r->count--;
+    if (res != FR_OK) {
+        printf("File close error %d\r\n", res);
+        return -1;
+    }
+    end(r);
+    print_row(r);
+    return 0;
+}
+
+static int file_read(const char *path, uint32_t chunk, uint32_t size)
+{
+    static FIL fil;
+    row_t *r = begin("file", "read", chunk, 0);
+    UINT done;
+
+    if (f_open(&fil, path, FA_READ) != FR_OK) {
+        printf("Cannot open %s\r\n", path);
+        return -1;
+    }
+    for (uint32_t pos = 0; pos < size; pos += chunk) {
+        uint32_t start = DWT->CYCCNT;
+        FRESULT res = f_read(&fil, buf, chunk, &done);
+        uint32_t cycles = DWT->CYCCNT - start;
+        if (res != FR_OK || done != chunk) {
+            printf("File read error %d\r\n", res);
+            f_close(&fil);
+            return -1;
+        }
+        sample(r, cycles, chunk);
+    }
+    f_close(&fil);
+    end(r);
+    print_row(r);
+    return 0;
+}
+
+static int file_tests(uint32_t size)
+{
+    static const uint32_t chunks[] = {512, 4096, 32768};
+    char path[24];
+    int rc = 0;
+
+    snprintf(path, sizeof(path), "%ssdbench.tmp", SDPath);
+    if (volume_mount(SDPath) != FR_OK) {
+        printf("Error mounting SD\r\n");
+        return -1;
+    }
+    for (size_t i = 0; rc == 0 && i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        uint32_t n = size - size % chunks[i];
+        rc = file_write(path, chunks[i], n, 0);
+        if (rc == 0)
+            rc = file_write(path, chunks[i], n, 1);
+        if (rc == 0)
+            rc = file_read(path, chunks[i], n);
+    }
+    f_unlink(path);
+    return rc;
+}
+
+static void print_header(void)
+{
+    HAL_SD_CardCIDTypeDef cid;
+    BSP_SD_CardInfo info;
+    sd_bus_t bus;
+
+    BSP_SD_GetCardInfo(&info);
+    sd_bus_info(&bus);
+    if (HAL_SD_GetCardCID(&hsd1, &cid) == HAL_OK)
+        printf("card: MID 0x%02X OID %c%c PNM %c%c%c%c%c rev %u.%u SN %08" PRIX32 ", ", cid.ManufacturerID,
+               cid.OEM_AppliID >> 8, cid.OEM_AppliID & 0xFF, (int)(cid.ProdName1 >> 24), (int)(cid.ProdName1 >> 16) & 0xFF,
+               (int)(cid.ProdName1 >> 8) & 0xFF, (int)cid.ProdName1 & 0xFF, cid.ProdName2, cid.ProdRev >> 4,
+               cid.ProdRev & 0xF, cid.ProdSN);
+    printf("%" PRIu32 " MB, bus %" PRIu32 " bit %" PRIu32 " kHz\r\n", info.LogBlockNbr / 2048, bus.width,
+           bus.clock_hz / 1000);
+    printf("test  operation    size    ops MB/s     IOPS   p50 us   p90 us   p99 us   max us\r\n");
+}
+
+int sdbench(const sdbench_opts_t *opts)
+{
+    const row_t *worst = NULL;
+    int rc = 0;
+
+    nrows = 0;
+    for (size_t i = 0; i < BUF_SIZE; i++)
+        buf[i] = next_random();
+    if (volume_card(SDPath) != 0) {
+        printf("Error init SD\r\n");
+        return -1;
+    }
+    print_header();
+    if (opts->raw)
+        rc = raw_tests(opts->raw_write);
+    if (rc == 0 && opts->file)
+        rc = file_tests(opts->file_size);
+
+    for (int i = 0; i < nrows; i++)
+        if (rows[i].write && (!worst || rows[i].max > worst->max))
+            worst = &rows[i];
+    if (worst) {
+        char size[8];
+        print_size(size, sizeof(size), worst->size);
+        printf("worst write stall: %" PRIu32 ".%03" PRIu32 " ms (%s %s %s)%s\r\n", worst->max / 1000,
+               worst->max % 1000, worst->test, worst->op, size,
+               worst->max >= STALL_WARN_US ? ", a garbage collection pause" : "");
+    }
+
+    printf("\r\ntest,operation,size,ops,kBps,iops,p50_us,p90_us,p99_us,max_us\r\n");
+    for (int i = 0; i < nrows; i++) {
+        const row_t *r = &rows[i];
+        printf("%s,%s,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\r\n",
+               r->test, r->op, r->size, r->count, rate(r) * 1024 / 100, iops(r), r->p50, r->p90, r->p99, r->max);
+    }
+    return rc;
+}
+
+/* random 512 byte reads: the seek from the file position, then the read */
+static int seek_test(FIL *fp, const char *op, uint32_t seeks)
+{
+    row_t *r = begin("seek", op, SECTOR, 0);
+    FSIZE_t sectors = f_size(fp) / SECTOR;
+    UINT n;
+
+    rng = 0x12345678;
+    for (uint32_t i = 0; i < seeks; i++) {
+        FSIZE_t ofs = (FSIZE_t)(((uint64_t)next_random() << 32 | next_random()) % sectors) * SECTOR;
+        uint32_t start = DWT->CYCCNT;
+        FRESULT res = f_lseek(fp, ofs);
+        if (res == FR_OK)
+            res = f_read(fp, buf, SECTOR, &n);
+        uint32_t cycles = DWT->CYCCNT - start;
+        if (res != FR_OK || n != SECTOR) {
+            printf("Read error at %" PRIu32 " KB\r\n", (uint32_t)(ofs / 1024));
+            return -1;
+        }
+        sample(r, cycles, SECTOR);
+    }
+    end(r);
+    print_row(r);
+    return 0;
+}
+
+static int seek_open(FIL *fp, const char *path, const char *op, int fast, int times)
+{
+    row_t *r = begin("seek", op, 0, 0);
+
+    for (int i = 0; i < times; i++) {
+        uint32_t start = DWT->CYCCNT;
+        FRESULT res = fast ? clmt_open(fp, path) : f_open(fp, path, FA_READ);
+        uint32_t cycles = DWT->CYCCNT - start;
+        if (res != FR_OK) {
+            printf("Cannot open %s\r\n", path);
+            return -1;
+        }
+        sample(r, cycles, 0);
+        if (i == times - 1)
+            break;
+        if (fast)
+            clmt_close(fp);
+        else
+            f_close(fp);
+    }
+    end(r);
+    print_row(r);
+    return 0;
+}
+
+int sdbench_seek(const char *name, uint32_t seeks)
+{
+    static FIL fil AXISRAM_BSS;
+    char path[64];
+    clmt_stats_t st;
+    int rc;
+
+    nrows = 0;
+    if (seeks > MAX_SAMPLES)
+        seeks = MAX_SAMPLES;
+    snprintf(path, sizeof(path), "%s%s", SDPath, name);
+    if (volume_mount(SDPath) != FR_OK) {
+        printf("Error mounting SD\r\n");
+        return -1;
+    }
+    /* the tables of an earlier run would make the first fast seek open a hit */
+    clmt_invalidate();
+    printf("test  operation    size    ops MB/s     IOPS   p50 us   p90 us   p99 us   max us\r\n");
+
+    rc = seek_open(&fil, path, "fat open", 0, 1);
+    if (rc == 0 && f_size(&fil) < SECTOR) {
+        printf("%s is shorter than a sector\r\n", path);
+        rc = -1;
+    }
+    if (rc == 0)
+        rc = seek_test(&fil, "fat seek", seeks);
+    f_close(&fil);
+
+    if (rc == 0)
+        rc = seek_open(&fil, path, "clmt build", 1, 1);
+    if (rc == 0) {
+        clmt_close(&fil);
+        rc = seek_open(&fil, path, "clmt open", 1, SEEK_REOPENS);
+    }
+    if (rc == 0) {
+        if (!fil.cltbl)
+            printf("No fast seek: the file has too many fragments for the table pool\r\n");
+        rc = seek_test(&fil, "clmt seek", seeks);
+        clmt_close(&fil);
+    }
+
+    clmt_stats(&st);
+    printf("table pool: %" PRIu32 " tables, %" PRIu32 " of %d words, %" PRIu32 " hits in %" PRIu32 " opens, %" PRIu32
+           " evictions\r\n",
+           st.tables, st.used, CLMT_POOL_WORDS, st.hits, st.opens, st.evictions);
+    return rc;
+}
@@ -23,6 +23,7 @@
 #include "main.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include <cycles.h>
 #include <stdio.h>
 /* USER CODE END Includes */
 
@@ -213,6 +214,8 @@ void ReportHardFault(uint32_t *stack_frame, uint32_t exc)
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
+extern SD_HandleTypeDef hsd1;
+extern ETH_HandleTypeDef heth;
 extern PCD_HandleTypeDef hpcd_USB_OTG_FS;
 /* USER CODE BEGIN EV */
 
@@ -344,7 +347,7 @@ void SysTick_Handler(void)
     /* USER CODE END SysTick_IRQn 0 */
     HAL_IncTick();
     /* USER CODE BEGIN SysTick_IRQn 1 */
-
+    cycles_tick();
     /* USER CODE END SysTick_IRQn 1 */
 }
 
@@ -355,6 +358,34 @@ void SysTick_Handler(void)
 /* please refer to the startup file (startup_stm32h7xx.s).                    */
 /******************************************************************************/
 
+/**
+ * @brief This function handles SDMMC1 global interrupt.
+ */
+void SDMMC1_IRQHandler(void)
+{
+    /* USER CODE BEGIN SDMMC1_IRQn 0 */
+
+    /* USER CODE END SDMMC1_IRQn 0 */
+    HAL_SD_IRQHandler(&hsd1);
+    /* USER CODE BEGIN SDMMC1_IRQn 1 */
+
+    /* USER CODE END SDMMC1_IRQn 1 */
+}
+
+/**
+ * @brief This function handles Ethernet global interrupt.
+ */
+void ETH_IRQHandler(void)
+{
+    /* USER CODE BEGIN ETH_IRQn 0 */
+
+    /* USER CODE END ETH_IRQn 0 */
+    HAL_ETH_IRQHandler(&heth);
+    /* USER CODE BEGIN ETH_IRQn 1 */
+
+    /* USER CODE END ETH_IRQn 1 */
+}
+
 /**
  * @brief This function handles USB On The Go FS global interrupt.
  */
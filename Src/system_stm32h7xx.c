@@ -83,8 +83,12 @@
 /*!< Uncomment the following line if you need to relocate your vector Table in
      Internal SRAM. */
 /* #define VECT_TAB_SRAM */
+/*!< VECT_TAB_QSPI (make XIP=1) relocates it at QSPI_BASE, the application runs from the memory-mapped flash, the
+     Makefile sets the offset of the update slot it is linked for */
+#ifndef VECT_TAB_OFFSET
 #define VECT_TAB_OFFSET  0x00000000UL /*!< Vector Table base offset field.
                                       This value must be a multiple of 0x200. */
+#endif
 /******************************************************************************/
 
 /**
@@ -147,6 +151,7 @@ void SystemInit (void)
   #if (__FPU_PRESENT == 1) && (__FPU_USED == 1)
     SCB->CPACR |= ((3UL << (10*2))|(3UL << (11*2)));  /* set CP10 and CP11 Full Access */
   #endif
+#if !defined(XIP)
   /* Reset the RCC clock configuration to the default reset state ------------*/
   /* Set HSION bit */
   RCC->CR |= RCC_CR_HSION;
@@ -193,6 +198,7 @@ void SystemInit (void)
 
   /* Disable all interrupts */
   RCC->CIER = 0x00000000;
+#endif /* !XIP: executing from QSPI, keep the clock tree set up by qspiboot */
 
 #if defined (DATA_IN_D2_SRAM)
   /* in case of initialized data in D2 SRAM (AHB SRAM) , enable the D2 SRAM clock ((AHB SRAM clock) */
@@ -224,8 +230,10 @@ void SystemInit (void)
   }
 
   /* Configure the Vector Table location add offset address for cortex-M7 ------------------*/
-#ifdef VECT_TAB_SRAM
+#if defined(VECT_TAB_SRAM)
   SCB->VTOR = D1_AXISRAM_BASE  | VECT_TAB_OFFSET; /* Vector Table Relocation in Internal D1 AXI-RAM */
+#elif defined(VECT_TAB_QSPI)
+  SCB->VTOR = QSPI_BASE | VECT_TAB_OFFSET; /* Vector Table in the memory-mapped QSPI flash */
 #else
   SCB->VTOR = FLASH_BANK1_BASE | VECT_TAB_OFFSET; /* Vector Table Relocation in Internal FLASH */
 #endif
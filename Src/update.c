@@ -0,0 +1,471 @@
+#include <update.h>
+
+#include <bootctl.h>
+#include <crc32.h>
+#include <cycles.h>
+#include <lwip.h>
+#include <lwip/tcp.h>
+#include <qspi_mode.h>
+#include <sections.h>
+#include <sfud.h>
+#include <stm32h7xx_hal.h>
+#include <usbd_cdc_if.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_SIZE (64 * 1024)
+/* programmed per poll: the SFUD lock masks interrupts for the whole write, about 3 ms */
+#define SLICE_SIZE 1024
+#define PAGE_SIZE 256
+
+static uint8_t buffers[2][BLOCK_SIZE] AXISRAM_BSS;
+
+static struct {
+    sfud_flash *flash;
+    int state;
+    uint32_t slot;
+    uint32_t base;
+    update_header_t header;
+    uint32_t header_len;
+    uint32_t received;   /* image bytes in the buffers, block n in buffers[n & 1] */
+    uint32_t programmed; /* image bytes written */
+    uint32_t erased;     /* slot bytes erased */
+    uint32_t erasing;    /* bytes of the erase in progress, 0 when the flash is idle */
+    uint64_t now; /* cycles at the last clock_cycles() */
+    uint64_t start, first_byte, last_byte, erase_since, wait_since, full_since;
+    uint64_t erase_cycles, program_cycles, verify_cycles, erase_wait_cycles, full_cycles, stall_cycles, total_cycles;
+} up;
+
+static uint64_t clock_cycles(void)
+{
+    up.now = cycles_now();
+    return up.now;
+}
+
+static uint32_t to_ms(uint64_t cycles) { return cycles / (SystemCoreClock / 1000); }
+
+/* accumulate the time a condition holds, sampled at every poll */
+static void track(bool on, uint64_t *since, uint64_t *total)
+{
+    if (on && !*since)
+        *since = up.now;
+    else if (!on && *since) {
+        *total += up.now - *since;
+        *since = 0;
+    }
+}
+
+static int fail(const char *msg)
+{
+    printf("\r\nUpdate failed: %s\r\n", msg);
+    up.state = UPDATE_FAILED;
+    return UPDATE_FAILED;
+}
+
+int update_begin(void)
+{
+    memset(&up, 0, sizeof(up));
+    up.flash = sfud_get_device(SFUD_W25_DEVICE_INDEX);
+    if (!up.flash->init_ok || up.flash->chip.capacity < BOOTCTL_RECORD + 2 * BOOTCTL_SECTOR) {
+        printf("QSPI flash not ready for the update slots\r\n");
+        return -1;
+    }
+    up.slot = !bootctl_active();
+    up.base = bootctl_slot_base(up.slot);
+    up.start = clock_cycles();
+    up.state = UPDATE_RUNNING;
+    return 0;
+}
+
+size_t update_space(void)
+{
+    if (up.state != UPDATE_RUNNING)
+        return 0;
+    if (up.header_len < sizeof(up.header))
+        return sizeof(up.header) - up.header_len;
+
+    /* the block being programmed and the next one */
+    uint32_t limit = up.programmed / BLOCK_SIZE * BLOCK_SIZE + 2 * BLOCK_SIZE;
+    if (limit > up.header.image_size)
+        limit = up.header.image_size;
+    return limit - up.received;
+}
+
+static int check_header(const update_header_t *h)
+{
+    if (h->magic != UPDATE_MAGIC)
+        return fail("not an update stream");
+    if (h->image_size < 8 || h->image_size > BOOTCTL_SLOT_SIZE)
+        return fail("image does not fit in a slot");
+    printf("Updating slot %c with %" PRIu32 " bytes\r\n", 'A' + (int)up.slot, h->image_size);
+    return 0;
+}
+
+/* the image runs from where it is linked, only one slot can hold it */
+static int check_vectors(const uint32_t *vectors)
+{
+    uint32_t base = QSPI_BASE + up.base;
+
+    if (vectors[1] < base || vectors[1] >= base + BOOTCTL_SLOT_SIZE) {
+        printf("\r\nImage entry 0x%08" PRIX32 ", slot %c needs an image built with make XIP=1 SLOT=%c\r\n",
+               vectors[1], 'A' + (int)up.slot, 'a' + (int)up.slot);
+        return fail("image linked for the other slot");
+    }
+    return 0;
+}
+
+size_t update_feed(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    size_t n = update_space();
+
+    if (n > size)
+        n = size;
+    if (up.header_len < sizeof(up.header)) {
+        memcpy((uint8_t *)&up.header + up.header_len, p, n);
+        up.header_len += n;
+        if (up.header_len == sizeof(up.header))
+            check_header(&up.header);
+        return n;
+    }
+    if (n && !up.first_byte)
+        up.first_byte = clock_cycles();
+    for (size_t done = 0; done < n;) {
+        uint32_t offset = up.received % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - offset < n - done ? BLOCK_SIZE - offset : n - done;
+        memcpy(&buffers[(up.received / BLOCK_SIZE) & 1][offset], p + done, chunk);
+        up.received += chunk;
+        done += chunk;
+    }
+    if (up.received >= 8 && up.received - n < 8)
+        check_vectors((const uint32_t *)buffers[0]);
+    if (up.received == up.header.image_size)
+        up.last_byte = clock_cycles();
+    return n;
+}
+
+static bool blank(const uint8_t *p, size_t n)
+{
+    while (n--)
+        if (*p++ != 0xFF)
+            return false;
+    return true;
+}
+
+/* one slice from the buffer of its block, erased pages left at 0xFF are not programmed */
+static int program_slice(uint32_t size)
+{
+    const uint8_t *data = &buffers[(up.programmed / BLOCK_SIZE) & 1][up.programmed % BLOCK_SIZE];
+    uint64_t start = clock_cycles();
+
+    for (uint32_t page = 0; page < size; page += PAGE_SIZE) {
+        uint32_t n = size - page < PAGE_SIZE ? size - page : PAGE_SIZE;
+        if (blank(data + page, n))
+            continue;
+        if (sfud_write(up.flash, up.base + up.programmed + page, n, data + page) != SFUD_SUCCESS)
+            return fail("flash write error");
+    }
+    up.programmed += size;
+    up.program_cycles += clock_cycles() - start;
+    return 0;
+}
+
+static int start_erase(void)
+{
+    uint32_t addr = up.base + up.erased;
+    size_t started;
+
+    /*
+     * An XIP image must not return to the flash while it erases: one block per poll, waited for inside the SFUD lock.
+     * Interrupts stay masked for the erase (150 ms typical, up to 2 s a block), the transport stalls meanwhile.
+     */
+    if (qspi_mode_is_xip()) {
+        uint64_t start = clock_cycles();
+        started = BLOCK_SIZE - addr % BLOCK_SIZE;
+        if (started > up.header.image_size - up.erased)
+            started = up.header.image_size - up.erased;
+        if (sfud_erase(up.flash, addr, started) != SFUD_SUCCESS)
+            return fail("flash erase error");
+        up.erased += started;
+        up.erase_cycles += clock_cycles() - start;
+        up.stall_cycles += up.now - start;
+        return 0;
+    }
+    /* the controller stays in indirect mode until the erase ends, no lease maps the busy flash meanwhile */
+    qspi_indirect_begin();
+    if (sfud_erase_start(up.flash, addr, up.header.image_size - up.erased, &started) != SFUD_SUCCESS) {
+        qspi_indirect_end();
+        return fail("flash erase error");
+    }
+    up.erasing = started;
+    up.erase_since = clock_cycles();
+    return 0;
+}
+
+static void end_erase(void)
+{
+    up.erased += up.erasing;
+    up.erasing = 0;
+    up.erase_cycles += up.now - up.erase_since;
+    qspi_indirect_end();
+}
+
+static int finish(void)
+{
+    uint64_t start = clock_cycles();
+    uint32_t crc;
+
+    if (qspi_mmap_acquire() != 0)
+        return fail("cannot map the flash");
+    crc = crc32((const void *)(QSPI_BASE + up.base), up.header.image_size);
+    qspi_mmap_release();
+    up.verify_cycles = clock_cycles() - start;
+    if (crc != up.header.image_crc) {
+        printf("\r\nSlot CRC 0x%08" PRIX32 ", expected 0x%08" PRIX32 "\r\n", crc, up.header.image_crc);
+        return fail("image CRC mismatch");
+    }
+    if (bootctl_write(up.flash, up.slot, up.header.image_size, crc) != SFUD_SUCCESS)
+        return fail("cannot write the boot record");
+    up.total_cycles = clock_cycles() - up.start;
+    up.state = UPDATE_DONE;
+    return UPDATE_DONE;
+}
+
+int update_poll(void)
+{
+    uint32_t size = up.header.image_size;
+
+    if (up.state != UPDATE_RUNNING || up.header_len < sizeof(up.header))
+        return up.state;
+    clock_cycles();
+    track(update_space() == 0 && up.received < size, &up.full_since, &up.full_cycles);
+
+    if (up.erasing) {
+        bool busy;
+        if (sfud_busy(up.flash, &busy) != SFUD_SUCCESS)
+            return fail("flash status error");
+        if (busy) {
+            track(up.received - up.programmed >= SLICE_SIZE || up.received == size, &up.wait_since,
+                  &up.erase_wait_cycles);
+            return UPDATE_RUNNING;
+        }
+        end_erase();
+    }
+
+    if (up.programmed < size) {
+        uint32_t block_end = up.programmed / BLOCK_SIZE * BLOCK_SIZE + BLOCK_SIZE;
+        uint32_t slice = SLICE_SIZE;
+        if (slice > block_end - up.programmed)
+            slice = block_end - up.programmed;
+        if (slice > size - up.programmed)
+            slice = size - up.programmed;
+        if (up.received - up.programmed >= slice) {
+            if (up.erased >= up.programmed + slice) {
+                track(false, &up.wait_since, &up.erase_wait_cycles);
+                return program_slice(slice) == 0 ? UPDATE_RUNNING : UPDATE_FAILED;
+            }
+            track(true, &up.wait_since, &up.erase_wait_cycles);
+        }
+        /* nothing to program: erase ahead of the data */
+        if (up.erased < size)
+            return start_erase() == 0 ? UPDATE_RUNNING : UPDATE_FAILED;
+        return UPDATE_RUNNING;
+    }
+    return finish();
+}
+
+void update_abort(void)
+{
+    if (up.erasing) {
+        sfud_wait_ready(up.flash);
+        clock_cycles();
+        end_erase();
+    }
+    if (up.state == UPDATE_RUNNING)
+        up.state = UPDATE_FAILED;
+}
+
+void update_stats(update_stats_t *st)
+{
+    st->slot = up.slot;
+    st->size = up.received;
+    st->crc = up.header.image_crc;
+    st->total_ms = to_ms(up.total_cycles);
+    st->receive_ms = up.last_byte ? to_ms(up.last_byte - up.first_byte) : 0;
+    st->erase_ms = to_ms(up.erase_cycles);
+    st->program_ms = to_ms(up.program_cycles);
+    st->verify_ms = to_ms(up.verify_cycles);
+    st->erase_wait_ms = to_ms(up.erase_wait_cycles);
+    st->full_ms = to_ms(up.full_cycles);
+    st->stall_ms = to_ms(up.stall_cycles);
+}
+
+static int result_line(char *line, size_t size)
+{
+    update_stats_t st;
+
+    update_stats(&st);
+    if (up.state == UPDATE_DONE)
+        return snprintf(line, size, "OK slot %c, %" PRIu32 " bytes in %" PRIu32 " ms, CRC32 0x%08" PRIX32 "\r\n",
+                        'A' + (int)st.slot, st.size, st.total_ms, st.crc);
+    return snprintf(line, size, "FAIL after %" PRIu32 " bytes\r\n", st.size);
+}
+
+/* TCP: the receive window is only reopened for the bytes the buffers took */
+static struct {
+    struct tcp_pcb *listener;
+    struct tcp_pcb *conn;
+    struct pbuf *pending;
+    uint16_t offset;
+    bool closed;
+} net;
+
+static err_t net_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    if (!p) {
+        net.closed = true;
+        return ERR_OK;
+    }
+    if (net.pending)
+        pbuf_cat(net.pending, p);
+    else
+        net.pending = p;
+    return ERR_OK;
+}
+
+static void net_err(void *arg, err_t err)
+{
+    net.conn = NULL;
+    net.closed = true;
+}
+
+static err_t net_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    if (err != ERR_OK || net.conn) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    net.conn = pcb;
+    tcp_recv(pcb, net_recv);
+    tcp_err(pcb, net_err);
+    return ERR_OK;
+}
+
+static void net_pump(void)
+{
+    while (net.pending) {
+        size_t n = update_feed((uint8_t *)net.pending->payload + net.offset, net.pending->len - net.offset);
+        if (n == 0)
+            break;
+        net.offset += n;
+        if (net.conn)
+            tcp_recved(net.conn, n);
+        if (net.offset == net.pending->len) {
+            struct pbuf *next = net.pending->next;
+            if (next)
+                pbuf_ref(next);
+            pbuf_free(net.pending);
+            net.pending = next;
+            net.offset = 0;
+        }
+    }
+}
+
+static void net_close(void)
+{
+    if (net.pending)
+        pbuf_free(net.pending);
+    if (net.conn) {
+        tcp_arg(net.conn, NULL);
+        tcp_recv(net.conn, NULL);
+        tcp_err(net.conn, NULL);
+        if (tcp_close(net.conn) != ERR_OK)
+            tcp_abort(net.conn);
+    }
+    if (net.listener)
+        tcp_close(net.listener);
+    memset(&net, 0, sizeof(net));
+}
+
+int update_tcp(uint16_t port, int (*cancel)(void))
+{
+    char line[80];
+    int rc = UPDATE_RUNNING;
+
+    if (update_begin() != 0)
+        return UPDATE_FAILED;
+    memset(&net, 0, sizeof(net));
+    net.listener = tcp_new();
+    if (!net.listener || tcp_bind(net.listener, IP_ADDR_ANY, port) != ERR_OK) {
+        net_close();
+        return fail("cannot bind the port");
+    }
+    net.listener = tcp_listen(net.listener);
+    tcp_accept(net.listener, net_accept);
+    printf("Waiting for the image on TCP port %u, any key cancels\r\n", port);
+
+    while (rc == UPDATE_RUNNING) {
+        MX_LWIP_Process();
+        net_pump();
+        rc = update_poll();
+        if (rc == UPDATE_RUNNING && net.closed && !net.pending && up.received < up.header.image_size)
+            rc = fail("connection closed");
+        if (rc == UPDATE_RUNNING && cancel())
+            rc = fail("cancelled");
+    }
+    update_abort();
+    if (net.conn) {
+        int n = result_line(line, sizeof(line));
+        tcp_write(net.conn, line, n, TCP_WRITE_FLAG_COPY);
+        tcp_output(net.conn);
+        /* let the reply leave before the close */
+        for (uint32_t start = HAL_GetTick(); HAL_GetTick() - start < 100;)
+            MX_LWIP_Process();
+    }
+    net_close();
+    return rc;
+}
+
+/* USB CDC: a packet is released, and the endpoint re-armed, once the buffers took all of it */
+int update_usb(int (*cancel)(void))
+{
+    extern USBD_HandleTypeDef hUsbDeviceFS;
+    USBD_CDC_HandleTypeDef *cdc = (USBD_CDC_HandleTypeDef *)hUsbDeviceFS.pClassData;
+    static char line[80];
+    uint32_t offset = 0;
+    int rc = UPDATE_RUNNING;
+
+    if (!cdc) {
+        printf("USB not configured\r\n");
+        return UPDATE_FAILED;
+    }
+    if (update_begin() != 0)
+        return UPDATE_FAILED;
+    CDC_setPacketMode(1);
+    printf("Waiting for the image on USB CDC, any key cancels\r\n");
+
+    while (rc == UPDATE_RUNNING) {
+        uint8_t *buf;
+        uint32_t len;
+        if (CDC_getPacket(&buf, &len)) {
+            offset += update_feed(buf + offset, len - offset);
+            if (offset == len) {
+                offset = 0;
+                CDC_releasePacket();
+            }
+        }
+        rc = update_poll();
+        if (rc == UPDATE_RUNNING && cancel())
+            rc = fail("cancelled");
+    }
+    update_abort();
+    CDC_setPacketMode(0);
+    int n = result_line(line, sizeof(line));
+    for (uint32_t start = HAL_GetTick(); cdc->TxState && HAL_GetTick() - start < 100;) {
+    }
+    CDC_Transmit_FS((uint8_t *)line, n);
+    return rc;
+}
@@ -101,6 +101,9 @@ uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
 RingBuffer *rxBuffer;
+static volatile int packetMode;
+static uint8_t *volatile packetBuf;
+static volatile uint32_t packetLen;
 /* USER CODE END PRIVATE_VARIABLES */
 
 /**
@@ -266,6 +269,11 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
+  if (packetMode) {
+    packetLen = *Len;
+    packetBuf = Buf;
+    return (USBD_OK);
+  }
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
   USBD_CDC_ReceivePacket(&hUsbDeviceFS);
   for (int i=0; i<*Len; i++)
@@ -308,6 +316,31 @@ int CDC_getByte(uint8_t *b)
   *b = *ptr;
   return 1;
 }
+
+void CDC_setPacketMode(int on)
+{
+  packetMode = on;
+  if (!on)
+    CDC_releasePacket();
+}
+
+int CDC_getPacket(uint8_t **buf, uint32_t *len)
+{
+  if (!packetBuf)
+    return 0;
+  *buf = packetBuf;
+  *len = packetLen;
+  return 1;
+}
+
+void CDC_releasePacket(void)
+{
+  if (!packetBuf)
+    return;
+  packetBuf = NULL;
+  USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+}
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
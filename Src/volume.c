@@ -0,0 +1,183 @@
+#include <volume.h>
+
+#include <ff_gen_drv.h>
+#include <stm32h7xx_hal.h>
+
+#include <string.h>
+
+typedef struct {
+    FATFS *fs;
+    const char *path;
+    uint8_t (*detected)(void);
+    uint8_t misses;
+    uint8_t present; /* card detect at the last check */
+    uint32_t checked; /* tick */
+    volume_info_t info;
+} volume_t;
+
+extern Disk_drvTypeDef disk;
+
+static volume_t volumes[_VOLUMES];
+
+static volume_t *find(const char *path)
+{
+    int vol = path[0] - '0';
+
+    if (vol < 0 || vol >= _VOLUMES || !volumes[vol].fs)
+        return NULL;
+    return &volumes[vol];
+}
+
+static BYTE drive(const volume_t *v)
+{
+    return VolToPart[v - volumes].pd;
+}
+
+int volume_register(const char *path, FATFS *fs, uint8_t (*detected)(void))
+{
+    int vol = path[0] - '0';
+
+    if (vol < 0 || vol >= _VOLUMES)
+        return -1;
+    memset(&volumes[vol], 0, sizeof(volumes[vol]));
+    volumes[vol].fs = fs;
+    volumes[vol].path = path;
+    volumes[vol].detected = detected;
+    volumes[vol].info.free_clusters = 0xFFFFFFFF;
+    volumes[vol].present = detected && detected();
+    return 0;
+}
+
+/* the card went away: nothing of it is kept, the drive is initialized again before the next use */
+static void removed(volume_t *v)
+{
+    if (v->info.state == VOLUME_MOUNTED)
+        f_mount(NULL, v->path, 0);
+    disk_ioctl(drive(v), CTRL_EJECT, NULL);
+    disk.is_initialized[drive(v)] = 0;
+    v->info.state = VOLUME_EMPTY;
+    v->info.free_clusters = 0xFFFFFFFF;
+    v->info.removals++;
+}
+
+int volume_card(const char *path)
+{
+    volume_t *v = find(path);
+
+    if (!v)
+        return -1;
+    if (v->detected && !v->detected())
+        return -1;
+    if (v->info.state != VOLUME_EMPTY)
+        return 0;
+    disk.is_initialized[drive(v)] = 0;
+    if (disk_initialize(drive(v)) & STA_NOINIT)
+        return -1;
+    v->info.state = VOLUME_READY;
+    v->misses = 0;
+    v->checked = HAL_GetTick();
+    return 0;
+}
+
+/* card detect edges: a card pulled out is unmounted, a card put in initialized for the next volume_mount() */
+static void detect(volume_t *v)
+{
+    uint8_t present = v->detected() != 0;
+
+    if (present == v->present)
+        return;
+    v->present = present;
+    if (!present) {
+        removed(v);
+        return;
+    }
+    v->info.insertions++;
+    volume_card(v->path);
+}
+
+FRESULT volume_mount(const char *path)
+{
+    volume_t *v = find(path);
+    uint32_t start = HAL_GetTick();
+    FRESULT res;
+
+    if (!v)
+        return FR_INVALID_DRIVE;
+    if (volume_card(path) != 0)
+        return FR_NOT_READY;
+    if (v->info.state == VOLUME_MOUNTED)
+        return FR_OK;
+    res = f_mount(v->fs, path, 1);
+    v->info.error = res;
+    if (res != FR_OK)
+        return res;
+    v->info.state = VOLUME_MOUNTED;
+    v->info.mounts++;
+    v->info.mount_ms = HAL_GetTick() - start;
+    return FR_OK;
+}
+
+void volume_release(const char *path)
+{
+    volume_t *v = find(path);
+
+    if (!v || v->info.state != VOLUME_MOUNTED)
+        return;
+    disk_ioctl(drive(v), CTRL_SYNC, NULL);
+    f_mount(NULL, path, 0);
+    v->info.state = VOLUME_READY;
+    v->info.free_clusters = 0xFFFFFFFF;
+}
+
+FRESULT volume_free(const char *path, DWORD *clusters)
+{
+    volume_t *v = find(path);
+    FATFS *fs;
+    FRESULT res = volume_mount(path);
+
+    if (res == FR_OK)
+        res = f_getfree(path, clusters, &fs);
+    if (res == FR_OK)
+        v->info.free_clusters = *clusters;
+    return res;
+}
+
+void volume_poll(void)
+{
+    uint32_t now = HAL_GetTick();
+
+    for (int i = 0; i < _VOLUMES; i++) {
+        volume_t *v = &volumes[i];
+        if (!v->fs || now - v->checked < VOLUME_CHECK_MS)
+            continue;
+        v->checked = now;
+        if (v->detected) {
+            detect(v);
+            continue;
+        }
+        if (v->info.state == VOLUME_EMPTY)
+            continue;
+        /* no card detect, the card status: a card busy with a write also fails the check once */
+        if (!(disk_status(drive(v)) & STA_NOINIT))
+            v->misses = 0;
+        else if (++v->misses >= VOLUME_MISSES)
+            removed(v);
+    }
+}
+
+int volume_info(const char *path, volume_info_t *info)
+{
+    volume_t *v = find(path);
+
+    if (!v)
+        return -1;
+    *info = v->info;
+    if (v->info.state == VOLUME_MOUNTED) {
+        info->fs_type = v->fs->fs_type;
+        info->cluster_sectors = v->fs->csize;
+        /* what FatFs keeps, FSINFO or the last count */
+        if (v->fs->free_clst <= v->fs->n_fatent - 2)
+            info->free_clusters = v->fs->free_clst;
+    }
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Internal flash stage of the XIP boot (application built with make XIP=1)
+ *
+ * Brings up the clock tree the application expects (it does not reconfigure clocks while running from QSPI), probes
+ * the QSPI flash with SFUD, maps it with the fastest read SFUD validated and jumps to the vector table of the slot the
+ * boot control record selects (Inc/bootctl.h), or of the other one when that slot holds no image. The application
+ * startup code copies its hot code to ITCM and adopts the memory-mapped controller as is.
+ */
+#include <bootctl.h>
+#include <qspi_mode.h>
+#include <sfud.h>
+#include <stm32h7xx_hal.h>
+
+#include <stdbool.h>
+
+/* status register bit enable_quad_mode() of the testbed sets, the quad reads need it */
+#define STATUS_QUAD_ENABLE (1 << 6)
+
+QSPI_HandleTypeDef hqspi;
+
+void Error_Handler(void)
+{
+    __disable_irq();
+    while (1) {
+    }
+}
+
+void SysTick_Handler(void) { HAL_IncTick(); }
+
+/* must stay the same as SystemClock_Config() in Src/main.c, the XIP application keeps this clock tree */
+static void SystemClock_Config(void)
+{
+    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+    RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+    RCC_PeriphCLKInitTypeDef PeriphClkInitStruct = {0};
+
+    HAL_PWREx_ConfigSupply(PWR_LDO_SUPPLY);
+
+    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE0);
+
+    while (!__HAL_PWR_GET_FLAG(PWR_FLAG_VOSRDY)) {
+    }
+
+    __HAL_RCC_PLL_PLLSOURCE_CONFIG(RCC_PLLSOURCE_HSE);
+
+    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+    RCC_OscInitStruct.HSEState = RCC_HSE_ON;
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+    RCC_OscInitStruct.PLL.PLLM = 4;
+    RCC_OscInitStruct.PLL.PLLN = 480;
+    RCC_OscInitStruct.PLL.PLLP = 2;
+    RCC_OscInitStruct.PLL.PLLQ = 20;
+    RCC_OscInitStruct.PLL.PLLR = 2;
+    RCC_OscInitStruct.PLL.PLLRGE = RCC_PLL1VCIRANGE_1;
+    RCC_OscInitStruct.PLL.PLLVCOSEL = RCC_PLL1VCOWIDE;
+    RCC_OscInitStruct.PLL.PLLFRACN = 0;
+    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+        Error_Handler();
+
+    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 |
+                                  RCC_CLOCKTYPE_PCLK2 | RCC_CLOCKTYPE_D3PCLK1 | RCC_CLOCKTYPE_D1PCLK1;
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    RCC_ClkInitStruct.SYSCLKDivider = RCC_SYSCLK_DIV1;
+    RCC_ClkInitStruct.AHBCLKDivider = RCC_HCLK_DIV2;
+    RCC_ClkInitStruct.APB3CLKDivider = RCC_APB3_DIV2;
+    RCC_ClkInitStruct.APB1CLKDivider = RCC_APB1_DIV2;
+    RCC_ClkInitStruct.APB2CLKDivider = RCC_APB2_DIV2;
+    RCC_ClkInitStruct.APB4CLKDivider = RCC_APB4_DIV2;
+
+    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_4) != HAL_OK)
+        Error_Handler();
+    PeriphClkInitStruct.PeriphClockSelection = RCC_PERIPHCLK_FDCAN | RCC_PERIPHCLK_USART1 | RCC_PERIPHCLK_UART8 |
+                                               RCC_PERIPHCLK_SDMMC | RCC_PERIPHCLK_USB | RCC_PERIPHCLK_QSPI;
+    PeriphClkInitStruct.PLL2.PLL2M = 4;
+    PeriphClkInitStruct.PLL2.PLL2N = 110;
+    PeriphClkInitStruct.PLL2.PLL2P = 2;
+    PeriphClkInitStruct.PLL2.PLL2Q = 2;
+    PeriphClkInitStruct.PLL2.PLL2R = 2;
+    PeriphClkInitStruct.PLL2.PLL2RGE = RCC_PLL2VCIRANGE_1;
+    PeriphClkInitStruct.PLL2.PLL2VCOSEL = RCC_PLL2VCOWIDE;
+    PeriphClkInitStruct.PLL2.PLL2FRACN = 0;
+    PeriphClkInitStruct.QspiClockSelection = RCC_QSPICLKSOURCE_PLL2;
+    PeriphClkInitStruct.SdmmcClockSelection = RCC_SDMMCCLKSOURCE_PLL;
+    PeriphClkInitStruct.FdcanClockSelection = RCC_FDCANCLKSOURCE_PLL;
+    PeriphClkInitStruct.Usart234578ClockSelection = RCC_USART234578CLKSOURCE_D2PCLK1;
+    PeriphClkInitStruct.Usart16ClockSelection = RCC_USART16CLKSOURCE_D2PCLK2;
+    PeriphClkInitStruct.UsbClockSelection = RCC_USBCLKSOURCE_PLL;
+    if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInitStruct) != HAL_OK)
+        Error_Handler();
+
+    HAL_PWREx_EnableUSBVoltageDetector();
+}
+
+/* same settings as MX_QUADSPI_Init() in Src/main.c, pins come from HAL_QSPI_MspInit() */
+static void MX_QUADSPI_Init(void)
+{
+    hqspi.Instance = QUADSPI;
+    hqspi.Init.ClockPrescaler = 0;
+    hqspi.Init.FifoThreshold = 1;
+    hqspi.Init.SampleShifting = QSPI_SAMPLE_SHIFTING_NONE;
+    hqspi.Init.FlashSize = SFUD_QSPI_FLASH_SIZE;
+    hqspi.Init.ChipSelectHighTime = QSPI_CS_HIGH_TIME_3_CYCLE;
+    hqspi.Init.ClockMode = QSPI_CLOCK_MODE_0;
+    hqspi.Init.FlashID = SFUD_QSPI_FLASH_ID;
+    hqspi.Init.DualFlash = SFUD_QSPI_DUAL_FLASH_MODE;
+    if (HAL_QSPI_Init(&hqspi) != HAL_OK)
+        Error_Handler();
+}
+
+/* quad I/O reads only when the flash has them enabled, otherwise the application runs from single line reads */
+static void select_read_mode(sfud_flash *flash)
+{
+    uint8_t status;
+
+    if (sfud_read_status(flash, &status) == SFUD_SUCCESS && (status & STATUS_QUAD_ENABLE))
+        sfud_qspi_fast_read_enable(flash, 4);
+}
+
+/* an erased or foreign image, or one linked for the other slot, must not be started */
+static bool image_valid(const uint32_t *vectors)
+{
+    uint32_t sp = vectors[0];
+    uint32_t pc = vectors[1];
+    uint32_t base = (uint32_t)vectors;
+
+    bool sp_ok = (sp > D1_DTCMRAM_BASE && sp <= D1_DTCMRAM_BASE + 128 * 1024) ||
+                 (sp > D1_AXISRAM_BASE && sp <= D1_AXISRAM_BASE + 512 * 1024);
+    bool pc_ok = (pc & 1) && pc >= base && pc < base + BOOTCTL_SLOT_SIZE;
+    return sp_ok && pc_ok;
+}
+
+static void __attribute__((noreturn)) jump_to_application(const uint32_t *vectors)
+{
+    void (*reset_handler)(void) = (void (*)(void))vectors[1];
+
+    __disable_irq();
+    SysTick->CTRL = 0;
+    SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+    for (unsigned i = 0; i < sizeof(NVIC->ICER) / sizeof(NVIC->ICER[0]); i++) {
+        NVIC->ICER[i] = 0xFFFFFFFF;
+        NVIC->ICPR[i] = 0xFFFFFFFF;
+    }
+    SCB->VTOR = (uint32_t)vectors;
+    __set_MSP(vectors[0]);
+    __DSB();
+    __ISB();
+    /* reset state for the application, nothing is left enabled to fire */
+    __enable_irq();
+    reset_handler();
+    while (1) {
+    }
+}
+
+int main(void)
+{
+    const uint32_t *vectors;
+    uint32_t slot;
+
+    HAL_Init();
+    SystemClock_Config();
+    MX_QUADSPI_Init();
+
+    if (sfud_init() != SFUD_SUCCESS)
+        Error_Handler();
+    select_read_mode(sfud_get_device(SFUD_W25_DEVICE_INDEX));
+
+    /* the lease is never released, the application inherits the mapping */
+    if (qspi_mmap_acquire() != 0)
+        Error_Handler();
+    slot = bootctl_active();
+    vectors = (const uint32_t *)(QSPI_BASE + bootctl_slot_base(slot));
+    if (!image_valid(vectors))
+        vectors = (const uint32_t *)(QSPI_BASE + bootctl_slot_base(!slot));
+    if (!image_valid(vectors))
+        Error_Handler();
+
+    jump_to_application(vectors);
+}
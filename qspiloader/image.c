@@ -0,0 +1,316 @@
+#include "image.h"
+
+#include <crc32.h>
+#include <lz4.h>
+#include <qspi_mode.h>
+#include <qspipack.h>
+#include <stm32h7xx_hal.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define PAGE_SIZE 256
+
+static uint8_t chunk[CHUNK_SIZE];
+static uint8_t packed[CHUNK_SIZE];
+
+typedef struct {
+    const image_source_t *src;
+    uint8_t peek[sizeof(qspipack_header_t)]; /* bytes read to tell a packed image, part of a plain one */
+    size_t peeked;
+    uint32_t size;           /* unpacked image size */
+    uint32_t chunk_size;     /* CHUNK_SIZE, or the packer's chunk size */
+    uint32_t crc;            /* CRC-32 of the unpacked image, packed images only */
+    qspipack_chunk_t *table; /* NULL for a plain binary */
+    bool delta;              /* some chunks are skipped */
+} image_t;
+
+static const char *sfud_error_str[] = {
+    "Not an error",                  //
+    "not found or not supported",    //
+    "write error",                   //
+    "read error",                    //
+    "timeout error",                 //
+    "address is out of flash bound", //
+};
+
+static size_t read_stream(image_t *img, void *buf, size_t size)
+{
+    size_t n = img->peeked < size ? img->peeked : size;
+
+    memcpy(buf, img->peek, n);
+    memmove(img->peek, img->peek + n, img->peeked - n);
+    img->peeked -= n;
+    if (n < size)
+        n += img->src->read(img->src->ctx, (uint8_t *)buf + n, size - n);
+    return n;
+}
+
+static int open_image(image_t *img, const image_source_t *src)
+{
+    qspipack_header_t h;
+
+    memset(img, 0, sizeof(*img));
+    img->src = src;
+    if (src->length < sizeof(h)) {
+        img->size = src->length;
+        img->chunk_size = CHUNK_SIZE;
+        img->peeked = src->read(src->ctx, img->peek, src->length);
+        return img->peeked == src->length ? 0 : -1;
+    }
+    if (src->read(src->ctx, &h, sizeof(h)) != sizeof(h)) {
+        printf("Cannot read the image\n");
+        return -1;
+    }
+    if (h.magic != QSPIPACK_MAGIC) {
+        /* plain binary, the header bytes are its start */
+        memcpy(img->peek, &h, sizeof(h));
+        img->peeked = sizeof(h);
+        img->size = src->length;
+        img->chunk_size = CHUNK_SIZE;
+        return 0;
+    }
+
+    uint32_t header_crc = h.header_crc;
+    size_t table_size = h.chunk_count * sizeof(qspipack_chunk_t);
+    if (h.chunk_log2 > 16 || (1u << h.chunk_log2) > CHUNK_SIZE) {
+        printf("Packed chunks of %u bytes, the loader handles up to %u\n", 1u << h.chunk_log2, CHUNK_SIZE);
+        return -1;
+    }
+    if (h.chunk_count != (h.image_size + (1u << h.chunk_log2) - 1) >> h.chunk_log2) {
+        printf("Packed image table does not match its size\n");
+        return -1;
+    }
+    img->table = malloc(table_size);
+    if (!img->table || src->read(src->ctx, img->table, table_size) != table_size) {
+        printf("Cannot read the chunk table\n");
+        return -1;
+    }
+    h.header_crc = 0;
+    if (crc32_update(crc32(&h, sizeof(h)), img->table, table_size) != header_crc) {
+        printf("Packed image header is corrupt\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < h.chunk_count; i++)
+        img->delta |= img->table[i].type == QSPIPACK_SKIP;
+    img->size = h.image_size;
+    img->chunk_size = 1u << h.chunk_log2;
+    img->crc = h.image_crc;
+    return 0;
+}
+
+/* next chunk into chunk[], returns its CRC */
+static int fetch_chunk(image_t *img, uint32_t index, size_t size, uint32_t *crc)
+{
+    if (!img->table) {
+        if (read_stream(img, chunk, size) != size) {
+            printf("\nShort read of chunk %u\n", (unsigned)index);
+            return -1;
+        }
+        *crc = crc32(chunk, size);
+        return 0;
+    }
+
+    const qspipack_chunk_t *c = &img->table[index];
+    int len = size;
+    switch (c->type) {
+    case QSPIPACK_FILL:
+        memset(chunk, c->fill, size);
+        break;
+    case QSPIPACK_RAW:
+        if (c->stored_size != size || read_stream(img, chunk, size) != size)
+            len = -1;
+        break;
+    case QSPIPACK_LZ4:
+        if (c->stored_size > sizeof(packed) || read_stream(img, packed, c->stored_size) != c->stored_size)
+            len = -1;
+        else
+            len = lz4_decompress(packed, c->stored_size, chunk, size);
+        break;
+    default:
+        len = -1;
+        break;
+    }
+    *crc = crc32(chunk, size);
+    if (len != (int)size || *crc != c->crc) {
+        printf("\nPacked chunk %u is corrupt\n", (unsigned)index);
+        return -1;
+    }
+    return 0;
+}
+
+static sfud_err erase_chunk(sfud_flash *flash, uint32_t addr, size_t size, size_t started)
+{
+    sfud_err e = sfud_wait_ready(flash);
+    /* the rest, when the flash has no erase unit as large as a chunk */
+    if (e == SFUD_SUCCESS && started < size)
+        e = sfud_erase(flash, addr + started, size - started);
+    return e;
+}
+
+static bool blank(const uint8_t *p, size_t n)
+{
+    while (n--)
+        if (*p++ != 0xFF)
+            return false;
+    return true;
+}
+
+/* the chunk is erased, pages left at 0xFF (padding, free space) are not programmed */
+static sfud_err write_chunk(sfud_flash *flash, uint32_t addr, size_t size)
+{
+    size_t start = 0;
+
+    while (start < size) {
+        size_t n = size - start < PAGE_SIZE ? size - start : PAGE_SIZE;
+        if (blank(chunk + start, n)) {
+            start += n;
+            continue;
+        }
+        size_t end = start + n;
+        while (end < size) {
+            n = size - end < PAGE_SIZE ? size - end : PAGE_SIZE;
+            if (blank(chunk + end, n))
+                break;
+            end += n;
+        }
+        sfud_err e = sfud_write(flash, addr + start, end - start, chunk + start);
+        if (e != SFUD_SUCCESS)
+            return e;
+        start = end;
+    }
+    return SFUD_SUCCESS;
+}
+
+/* CRC of what the CPU reads back, the lease maps the flash with the read command SFUD validated */
+static int verify_chunk(uint32_t addr, size_t size, uint32_t expected)
+{
+    uint32_t crc;
+
+    if (qspi_mmap_acquire() != 0) {
+        printf("\nError entering memory mapped mode\n");
+        return -1;
+    }
+    crc = crc32((const void *)(QSPI_BASE + addr), size);
+    qspi_mmap_release();
+    if (crc != expected) {
+        printf("\nError verify write at 0x%08X: CRC 0x%08X, expected 0x%08X\n", (unsigned)addr, (unsigned)crc,
+               (unsigned)expected);
+        return -1;
+    }
+    return 0;
+}
+
+static sfud_err program(sfud_flash *flash, image_t *img, image_result_t *result)
+{
+    uint32_t image_crc = 0;
+    uint32_t addr;
+    uint32_t index;
+    sfud_err e;
+
+    if (img->size > flash->chip.capacity) {
+        printf("\nImage of %u bytes does not fit in %u bytes\n", (unsigned)img->size, (unsigned)flash->chip.capacity);
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+
+    for (addr = 0, index = 0; addr < img->size; index++) {
+        size_t size = img->size - addr < img->chunk_size ? img->size - addr : img->chunk_size;
+        size_t started;
+        uint32_t crc;
+
+        /* the host found the chunk in the flash hashes (MAILBOX_HASH), nothing to erase or program */
+        if (img->table && img->table[index].type == QSPIPACK_SKIP) {
+            result->skipped += size;
+            addr += size;
+            continue;
+        }
+
+        /* the flash stays unmapped while it erases (qspi_mode.h) */
+        qspi_indirect_begin();
+        e = sfud_erase_start(flash, addr, size, &started);
+        if (e != SFUD_SUCCESS) {
+            qspi_indirect_end();
+            printf("\nError erasing qspi: %s\n", sfud_error_str[e]);
+            return e;
+        }
+        /* the transfer, unpacking and CRC run while the flash erases */
+        int fetched = fetch_chunk(img, index, size, &crc);
+        e = erase_chunk(flash, addr, size, started);
+        qspi_indirect_end();
+        if (e != SFUD_SUCCESS) {
+            printf("\nError erasing qspi: %s\n", sfud_error_str[e]);
+            return e;
+        }
+        if (fetched != 0)
+            return SFUD_ERR_READ;
+        e = write_chunk(flash, addr, size);
+        if (e != SFUD_SUCCESS) {
+            printf("\nError writing qspi: %s\n", sfud_error_str[e]);
+            return e;
+        }
+        if (verify_chunk(addr, size, crc) != 0)
+            return SFUD_ERR_WRITE;
+        image_crc = crc32_update(image_crc, chunk, size);
+        addr += size;
+        if (img->src->progress)
+            img->src->progress(img->src->ctx, addr);
+    }
+    /* a delta image only holds the changed chunks, the whole image is checked on what the flash now holds */
+    if (img->delta) {
+        if (qspi_mmap_acquire() != 0) {
+            printf("\nError entering memory mapped mode\n");
+            return SFUD_ERR_READ;
+        }
+        image_crc = crc32((const void *)QSPI_BASE, img->size);
+        qspi_mmap_release();
+    }
+    if (img->table && image_crc != img->crc) {
+        printf("\nImage CRC 0x%08X, expected 0x%08X\n", (unsigned)image_crc, (unsigned)img->crc);
+        return SFUD_ERR_WRITE;
+    }
+
+    result->size = addr;
+    result->crc = image_crc;
+    return SFUD_SUCCESS;
+}
+
+int image_hash(uint32_t size, uint32_t sector_size, uint32_t *hashes, uint32_t max)
+{
+    uint32_t count = (size + sector_size - 1) / sector_size;
+
+    if (count > max) {
+        printf("Cannot hash %u sectors, up to %u\n", (unsigned)count, (unsigned)max);
+        return -1;
+    }
+    if (qspi_mmap_acquire() != 0) {
+        printf("Error entering memory mapped mode\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t addr = i * sector_size;
+        uint32_t n = size - addr < sector_size ? size - addr : sector_size;
+        hashes[i] = crc32((const void *)(QSPI_BASE + addr), n);
+    }
+    qspi_mmap_release();
+    return count;
+}
+
+sfud_err image_program(sfud_flash *flash, const image_source_t *src, image_result_t *result)
+{
+    image_t img;
+    sfud_err e;
+
+    memset(result, 0, sizeof(*result));
+    result->transferred = src->length;
+    if (open_image(&img, src) != 0) {
+        free(img.table);
+        return SFUD_ERR_READ;
+    }
+    result->packed = img.table != NULL;
+    e = program(flash, &img, result);
+    free(img.table);
+    return e;
+}
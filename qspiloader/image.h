@@ -0,0 +1,34 @@
+/*
+ * Write an image into the QSPI flash: plain binary or qspipack image (Inc/qspipack.h)
+ *
+ * The image comes from a byte stream (semihosting file or RAM mailbox). Every chunk is erased in the background while
+ * the next bytes are fetched and unpacked, then programmed and verified by CRC through the memory-mapped window.
+ */
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <sfud.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    size_t (*read)(void *ctx, void *buf, size_t size); /* fewer bytes on error */
+    void (*progress)(void *ctx, uint32_t programmed);  /* after every chunk, may be NULL */
+    void *ctx;
+    uint32_t length;                                   /* stream bytes */
+} image_source_t;
+
+typedef struct {
+    uint32_t size;        /* image bytes */
+    uint32_t skipped;     /* image bytes already in flash (delta image) */
+    uint32_t transferred; /* stream bytes */
+    uint32_t crc;         /* CRC-32 of the image */
+    int packed;
+} image_result_t;
+
+sfud_err image_program(sfud_flash *flash, const image_source_t *src, image_result_t *result);
+
+/* CRC-32 of every sector of the first size bytes of flash, the last sector may be shorter. Returns the count. */
+int image_hash(uint32_t size, uint32_t sector_size, uint32_t *hashes, uint32_t max);
+
+#endif /* __IMAGE_H__ */
@@ -0,0 +1,117 @@
+#include "mailbox.h"
+
+#include <stm32h7xx_hal.h>
+
+#include <string.h>
+
+_Static_assert(sizeof(mailbox_t) <= MAILBOX_SLOT_OFFSET, "mailbox descriptor overlaps the slots");
+_Static_assert(MAILBOX_SLOT_OFFSET + MAILBOX_SLOTS * MAILBOX_SLOT_SIZE <= MAILBOX_HASH_OFFSET, "mailbox slots overlap");
+_Static_assert(MAILBOX_HASH_OFFSET + MAILBOX_HASH_MAX * 4 <= MAILBOX_SIZE, "mailbox hash table does not fit");
+
+static uint8_t *slot(mailbox_reader_t *r, uint32_t index)
+{
+    mailbox_t *m = r->mbox;
+    return (uint8_t *)m + m->slot_offset + (index % m->slot_count) * m->slot_size;
+}
+
+/* wait for the host to fill the slot at tail, 0 when it gave up */
+static int wait_slot(mailbox_reader_t *r)
+{
+    mailbox_t *m = r->mbox;
+    uint32_t start = HAL_GetTick();
+
+    while (m->head == m->tail) {
+        if (HAL_GetTick() - start > r->timeout)
+            return 0;
+    }
+    /* slot data and fill[] were written before head */
+    __DMB();
+    return 1;
+}
+
+static size_t mailbox_read(void *ctx, void *buf, size_t size)
+{
+    mailbox_reader_t *r = ctx;
+    mailbox_t *m = r->mbox;
+    uint8_t *dst = buf;
+    size_t done = 0;
+
+    while (done < size) {
+        if (!wait_slot(r))
+            break;
+        uint32_t fill = m->fill[m->tail % m->slot_count];
+        size_t n = fill - r->pos < size - done ? fill - r->pos : size - done;
+        memcpy(dst + done, slot(r, m->tail) + r->pos, n);
+        done += n;
+        r->pos += n;
+        if (r->pos >= fill) {
+            /* the copy is done before the host may overwrite the slot */
+            __DMB();
+            m->tail = m->tail + 1;
+            r->pos = 0;
+        }
+    }
+    return done;
+}
+
+static void mailbox_progress(void *ctx, uint32_t programmed)
+{
+    mailbox_reader_t *r = ctx;
+    r->mbox->programmed = programmed;
+}
+
+int mailbox_open(mailbox_reader_t *reader, void *base, uint32_t timeout)
+{
+    mailbox_t *m = base;
+    uint32_t start;
+
+    reader->mbox = m;
+    reader->pos = 0;
+    reader->timeout = timeout;
+
+    m->slot_count = MAILBOX_SLOTS;
+    m->slot_size = MAILBOX_SLOT_SIZE;
+    m->slot_offset = MAILBOX_SLOT_OFFSET;
+    m->length = 0;
+    m->head = 0;
+    m->tail = 0;
+    m->programmed = 0;
+    m->command = 0;
+    m->hash_count = 0;
+    m->hash_offset = MAILBOX_HASH_OFFSET;
+    m->status = MAILBOX_RUNNING;
+    __DMB();
+    m->magic = MAILBOX_MAGIC;
+
+    start = HAL_GetTick();
+    while (m->command == 0) {
+        if (HAL_GetTick() - start > timeout)
+            return -1;
+    }
+    /* length was written before the command */
+    __DMB();
+    return m->command;
+}
+
+void mailbox_source(mailbox_reader_t *reader, image_source_t *src)
+{
+    src->read = mailbox_read;
+    src->progress = mailbox_progress;
+    src->ctx = reader;
+    src->length = reader->mbox->length;
+}
+
+uint32_t mailbox_hash_length(mailbox_reader_t *reader) { return reader->mbox->length; }
+
+uint32_t *mailbox_hash_table(mailbox_reader_t *reader)
+{
+    return (uint32_t *)((uint8_t *)reader->mbox + MAILBOX_HASH_OFFSET);
+}
+
+void mailbox_publish_hashes(mailbox_reader_t *reader, uint32_t count) { reader->mbox->hash_count = count; }
+
+void mailbox_close(mailbox_reader_t *reader, int status)
+{
+    __DMB();
+    reader->mbox->status = status;
+}
@@ -0,0 +1,81 @@
+/*
+ * RAM mailbox between qspiloader and the host (mailbox.tcl through OpenOCD, or the flashsim stand-in)
+ *
+ * The host writes the image into a ring of slots over the debug port while the core runs and programs the previous
+ * slot, no semihosting round trip per transfer. Single producer (host), single consumer (loader):
+ *
+ *   loader  fills slot_count, slot_size, slot_offset and status, then writes magic last
+ *   host    writes length, then command last
+ *
+ * MAILBOX_PROGRAM, length is the size of the image stream (plain or qspipack):
+ *   host    for every slot: data, fill[head % slot_count], head + 1 (waits while head - tail == slot_count)
+ *   loader  consumes slot tail % slot_count, then tail + 1
+ *
+ * MAILBOX_HASH, length is the size of the image to compare with:
+ *   loader  CRC-32 of every MAILBOX_HASH_SECTOR bytes of flash up to length, at hash_offset, count in hash_count
+ *   host    builds a delta image out of them (qspipack.py --base)
+ *
+ *   loader  status goes from MAILBOX_RUNNING to 0 (done) or a negative error
+ *
+ * The host clears magic before starting the loader. Offsets are fixed, mailbox.tcl uses them as numbers.
+ */
+#ifndef __MAILBOX_H__
+#define __MAILBOX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+/* upper half of AXI SRAM, the loader links in the lower half */
+#define MAILBOX_BASE 0x24040000
+#define MAILBOX_SIZE (256 * 1024)
+
+#define MAILBOX_MAGIC 0x584F424D /* "MBOX" */
+#define MAILBOX_SLOTS 3
+#define MAILBOX_SLOT_SIZE (64 * 1024)
+#define MAILBOX_SLOT_OFFSET 0x100
+#define MAILBOX_HASH_OFFSET 0x31000
+#define MAILBOX_HASH_MAX 8192 /* 32MB of 4K sectors */
+#define MAILBOX_HASH_SECTOR 4096
+#define MAILBOX_RUNNING 1
+
+enum { MAILBOX_PROGRAM = 1, MAILBOX_HASH = 2 };
+
+typedef struct {
+    volatile uint32_t magic;       /* 0x00 loader */
+    volatile uint32_t slot_count;  /* 0x04 loader */
+    volatile uint32_t slot_size;   /* 0x08 loader */
+    volatile uint32_t slot_offset; /* 0x0C loader, first slot from the mailbox base, slots are contiguous */
+    volatile uint32_t length;      /* 0x10 host, stream or image bytes */
+    volatile uint32_t head;        /* 0x14 host, slots written */
+    volatile uint32_t tail;        /* 0x18 loader, slots consumed */
+    volatile int32_t status;       /* 0x1C loader */
+    volatile uint32_t programmed;  /* 0x20 loader, image bytes programmed and verified */
+    volatile uint32_t fill[MAILBOX_SLOTS]; /* 0x24 host, bytes in each slot */
+    volatile uint32_t command;     /* 0x30 host, MAILBOX_PROGRAM or MAILBOX_HASH, written last */
+    volatile uint32_t hash_count;  /* 0x34 loader */
+    volatile uint32_t hash_offset; /* 0x38 loader, hash table from the mailbox base */
+} mailbox_t;
+
+typedef struct {
+    mailbox_t *mbox;
+    uint32_t pos;       /* read position in the current slot */
+    uint32_t timeout;   /* ms without host progress before giving up */
+} mailbox_reader_t;
+
+/* publish the mailbox at base and wait for the host command, -1 when none came */
+int mailbox_open(mailbox_reader_t *reader, void *base, uint32_t timeout);
+
+/* MAILBOX_PROGRAM: the image stream is read from the slots */
+void mailbox_source(mailbox_reader_t *reader, image_source_t *src);
+
+/* MAILBOX_HASH: sectors to hash and the table to fill, then publish the count */
+uint32_t mailbox_hash_length(mailbox_reader_t *reader);
+uint32_t *mailbox_hash_table(mailbox_reader_t *reader);
+void mailbox_publish_hashes(mailbox_reader_t *reader, uint32_t count);
+
+/* final status for the host, 0 or a negative error */
+void mailbox_close(mailbox_reader_t *reader, int status);
+
+#endif /* __MAILBOX_H__ */
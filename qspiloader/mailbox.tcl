@@ -0,0 +1,115 @@
+# Start the loader and write $binary_file through the RAM mailbox (mailbox.h)
+#
+#   openocd -f interface/cmsis-dap.cfg -f target/stm32h7x.cfg -c init \
+#           -c "set firmware build/exflashloader.elf" -c "set binary_file image.qpk" -f mailbox.tcl
+#
+# Slots are written with load_image while the core runs, the loader programs
+# the previous one meanwhile. Semihosting (the loader's printf) is serviced by
+# polling the target whenever the script waits.
+#
+# With hash_file set, the loader only hashes the flash sectors the size of
+# $binary_file covers and the table is saved there (the first half of a delta
+# flash, see the delta target in the Makefile):
+#
+#           ... -c "set binary_file image.bin" -c "set hash_file hashes.bin" -f mailbox.tcl
+
+set mbox 0x24040000
+set MAGIC 0x584F424D
+set RUNNING 1
+set TIMEOUT_MS 30000
+set PROGRAM 1
+set HASH 2
+
+proc mb_read {off} { global mbox; return [mrw [expr {$mbox + $off}]] }
+proc mb_write {off value} { global mbox; mww [expr {$mbox + $off}] $value }
+
+# services semihosting calls and notices a halted loader
+proc service {} { capture poll }
+
+# wait until [cond] is true, servicing the target meanwhile
+proc wait_for {what cond} {
+    global TIMEOUT_MS
+    set deadline [expr {[clock milliseconds] + $TIMEOUT_MS}]
+    while {![uplevel 1 [list expr $cond]]} {
+        if {[clock milliseconds] > $deadline} {
+            echo "timeout waiting for $what"
+            shutdown error
+        }
+        service
+    }
+}
+
+reset halt
+load_image $firmware
+verify_image $firmware
+arm semihosting enable
+arm semihosting_resexit enable
+arm semihosting_cmdline "@mailbox"
+# a stale descriptor from a previous run must not be taken for this one
+mww $mbox 0
+
+set base 0x24000000
+set Reset_Handler [format "0x%08X" [expr ([mrw [expr $base + 0x04]] & 0xFFFFFFFE)]]
+reset halt
+reg pc $Reset_Handler
+resume
+
+wait_for "the loader mailbox" {[mb_read 0x00] == $MAGIC}
+set slots [mb_read 0x04]
+set slot_size [mb_read 0x08]
+set slot_offset [mb_read 0x0C]
+
+set length [file size $binary_file]
+mb_write 0x10 $length
+
+if {[info exists hash_file]} {
+    mb_write 0x30 $HASH
+    wait_for "the sector hashes" {[mb_read 0x1C] != $RUNNING}
+    if {[mb_read 0x1C] != 0} {
+        echo "Loader failed to hash the flash"
+        shutdown error
+    }
+    set count [mb_read 0x34]
+    dump_image $hash_file [expr {$mbox + [mb_read 0x38]}] [expr {$count * 4}]
+    echo "$count sector hashes saved in $hash_file"
+    wait_halt 300000
+    exit
+}
+
+mb_write 0x30 $PROGRAM
+echo "Writing $binary_file ($length bytes), $slots slots of $slot_size bytes"
+
+set start [clock milliseconds]
+set head 0
+set sent 0
+while {$sent < $length} {
+    wait_for "a free slot" {$head - [mb_read 0x18] < $slots || [mb_read 0x1C] != $RUNNING}
+    if {[mb_read 0x1C] != $RUNNING} {
+        break
+    }
+    set n [expr {$length - $sent < $slot_size ? $length - $sent : $slot_size}]
+    set index [expr {$head % $slots}]
+    set addr [expr {$mbox + $slot_offset + $index * $slot_size}]
+    # file bytes sent..sent+n land at addr: the file is offset, the rest is clipped by min_addr and max_length (Jim Tcl
+    # has no binary file reads to hand write_memory)
+    load_image $binary_file [expr {$addr - $sent}] bin $addr $n
+    mb_write [expr {0x24 + 4 * $index}] $n
+    incr head
+    mb_write 0x14 $head
+    incr sent $n
+}
+
+wait_for "the end of programming" {[mb_read 0x1C] != $RUNNING}
+set status [mb_read 0x1C]
+set status [expr {$status >= 0x80000000 ? $status - 0x100000000 : $status}]
+set ms [expr {[clock milliseconds] - $start}]
+if {$ms > 0} {
+    echo [format "Transferred %d bytes in %d ms, %d bytes/s" $length $ms [expr {$length * 1000 / $ms}]]
+}
+if {$status != 0} {
+    echo "Loader failed, status $status"
+}
+
+wait_halt 300000
+reg r0
+exit
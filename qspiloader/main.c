@@ -1,3 +1,8 @@
+#include "image.h"
+#include "mailbox.h"
+
+#include <bootctl.h>
+#include <qspi_mode.h>
 #include <sfud.h>
 #include <stm32h7xx_hal.h>
 #include <stm32h7xx_hal_gpio.h>
@@ -161,45 +166,10 @@ void DebugMon_Handler() { hostExit(7); }
 void PendSV_Handler() { hostExit(8); }
 void SysTick_Handler() { HAL_IncTick(); }
 
-static char sector[4 * 1024];
-static char temporal[4 * 1024];
-
-/**
- * @brief  Configure the QSPI in memory-mapped mode
- * @retval QSPI memory status
- */
-static HAL_StatusTypeDef QSPI_EnableMemoryMappedMode()
-{
-
-    QSPI_CommandTypeDef s_command;
-    QSPI_MemoryMappedTypeDef s_mem_mapped_cfg;
-    /*   const sfud_flash *flash = sfud_get_device(SFUD_W25_DEVICE_INDEX);
-       uint8_t status;
-       sfud_read_status(flash, &status);
-       status |= 1 << 6;
-       sfud_write_status(flash, true, status);*/
-
-    s_command.Instruction = 0xEB;
-    s_command.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-    s_command.Address = 0;
-    s_command.AddressSize = QSPI_ADDRESS_24_BITS;
-    s_command.AddressMode = QSPI_ADDRESS_4_LINES;
-    s_command.AlternateBytes = 1;
-    s_command.AlternateByteMode = QSPI_ALTERNATE_BYTES_4_LINES;
-    s_command.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
-    s_command.DummyCycles = 6;
-    s_command.NbData = 0;
-    s_command.DataMode = QSPI_DATA_4_LINES;
-    s_command.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-    s_command.DdrMode = QSPI_DDR_MODE_DISABLE;
-    s_command.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-
-    /* Configure the memory mapped mode */
-    s_mem_mapped_cfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
-    s_mem_mapped_cfg.TimeOutPeriod = 0;
-
-    return HAL_QSPI_MemoryMapped(&hqspi, &s_command, &s_mem_mapped_cfg);
-}
+/* command line selecting the RAM mailbox transfer (mailbox.tcl) instead of a semihosting file */
+#define MAILBOX_CMDLINE "@mailbox"
+/* host silent for that long: the transfer is abandoned */
+#define MAILBOX_TIMEOUT_MS 10000
 
 static void runCodeFromQSPI(void) __attribute__((noreturn));
 
@@ -211,7 +181,7 @@ static void hexdump(__IO uint32_t *ptr, size_t n)
 
 static void runCodeFromQSPI(void)
 {
-    if (QSPI_EnableMemoryMappedMode() == HAL_OK) {
+    if (qspi_mmap_acquire() == 0) {
 #if 1
         printf("memdump from QSPI\n");
         hexdump((__IO uint32_t *)QSPI_BASE, 32);
@@ -230,6 +200,9 @@ static void runCodeFromQSPI(void)
         hostExit(255);
 }
 
+/* host clock in centiseconds, SysTick does not count while the core is halted by semihosting calls */
+static uint32_t hostClock(void) { return call_host(SEMIHOSTING_SYS_CLOCK, NULL); }
+
 static const char *sfud_error_str[] = {
     "Not an error",                  //
     "not found or not supported",    //
@@ -239,6 +212,126 @@ static const char *sfud_error_str[] = {
     "address is out of flash bound", //
 };
 
+/*
+ * Semihosting stops the core for every fread(), only what the flash does on its own (the erase started before the
+ * fetch) overlaps the transfer.
+ */
+static size_t fileRead(void *ctx, void *buf, size_t size) { return fread(buf, 1, size, ctx); }
+
+static void fileProgress(void *ctx, uint32_t programmed)
+{
+    (void)ctx;
+    (void)programmed;
+    printf("#");
+    fflush(stdout);
+}
+
+/* the loader writes slot A, qspiboot starts the slot of the boot record */
+static sfud_err selectSlotA(sfud_flash *flash, const image_result_t *r)
+{
+    bootctl_t rec;
+    sfud_err e;
+
+    if (bootctl_read(&rec) == 0 && rec.slot == 0 && rec.image_size == r->size && rec.image_crc == r->crc)
+        return SFUD_SUCCESS;
+    e = bootctl_write(flash, 0, r->size, r->crc);
+    if (e != SFUD_SUCCESS)
+        printf("Error writing the boot record\n");
+    return e;
+}
+
+static void printResult(const image_result_t *r, uint32_t ms)
+{
+    printf("Done, %lu bytes (%lu transferred%s) in %lu.%03lu s", r->size, r->transferred, r->packed ? ", packed" : "",
+           ms / 1000, ms % 1000);
+    if (r->skipped)
+        printf(", %lu unchanged", r->skipped);
+    if (ms)
+        printf(", %lu bytes/s", (uint32_t)((uint64_t)r->size * 1000 / ms));
+    printf(", CRC32 0x%08lX\n", r->crc);
+}
+
+static sfud_err programFile(sfud_flash *flash, const char *name)
+{
+    image_source_t src = {fileRead, fileProgress, NULL, 0};
+    image_result_t result;
+    uint32_t start = hostClock();
+    long length;
+    sfud_err e;
+
+    FILE *f = fopen(name, "rb");
+    if (!f) {
+        perror("open file");
+        return SFUD_ERR_READ;
+    }
+    setvbuf(f, NULL, _IONBF, 0);
+    if (fseek(f, 0, SEEK_END) != 0 || (length = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        perror("file size");
+        fclose(f);
+        return SFUD_ERR_READ;
+    }
+    src.ctx = f;
+    src.length = length;
+    printf("Writing %s to flash\n[", name);
+    e = image_program(flash, &src, &result);
+    fclose(f);
+    if (e == SFUD_SUCCESS)
+        e = selectSlotA(flash, &result);
+    if (e == SFUD_SUCCESS) {
+        printf("]\n");
+        printResult(&result, (hostClock() - start) * 10);
+    }
+    return e;
+}
+
+/*
+ * The host writes the image into AXI SRAM over the debug port while the core runs: the transfer overlaps erase,
+ * programming and verification. No semihosting call is made until the end, the host only services them between
+ * slots. For a delta flash the host first asks for the sector hashes, then sends an image with only the sectors that
+ * changed, in a second run.
+ */
+static sfud_err programMailbox(sfud_flash *flash)
+{
+    static mailbox_reader_t reader;
+    image_source_t src;
+    image_result_t result;
+    uint32_t start;
+    uint32_t length;
+    sfud_err e;
+    int count;
+
+    int command = mailbox_open(&reader, (void *)MAILBOX_BASE, MAILBOX_TIMEOUT_MS);
+    start = HAL_GetTick();
+    switch (command) {
+    case MAILBOX_PROGRAM:
+        mailbox_source(&reader, &src);
+        e = image_program(flash, &src, &result);
+        if (e == SFUD_SUCCESS)
+            e = selectSlotA(flash, &result);
+        mailbox_close(&reader, -(int)e);
+        if (e == SFUD_SUCCESS)
+            printResult(&result, HAL_GetTick() - start);
+        return e;
+    case MAILBOX_HASH:
+        length = mailbox_hash_length(&reader);
+        if (length > flash->chip.capacity)
+            length = flash->chip.capacity;
+        count = image_hash(length, MAILBOX_HASH_SECTOR, mailbox_hash_table(&reader), MAILBOX_HASH_MAX);
+        if (count < 0) {
+            mailbox_close(&reader, -SFUD_ERR_READ);
+            return SFUD_ERR_READ;
+        }
+        mailbox_publish_hashes(&reader, count);
+        mailbox_close(&reader, 0);
+        printf("Hashed %d sectors in %lu ms\n", count, HAL_GetTick() - start);
+        return SFUD_SUCCESS;
+    default:
+        mailbox_close(&reader, -SFUD_ERR_TIMEOUT);
+        printf("No transfer from the host\n");
+        return SFUD_ERR_TIMEOUT;
+    }
+}
+
 int main()
 {
     printf("Flash writer utility\n");
@@ -285,11 +378,11 @@ int main()
     hqspi.Init.ClockPrescaler = 0;
     hqspi.Init.FifoThreshold = 4;
     hqspi.Init.SampleShifting = QSPI_SAMPLE_SHIFTING_NONE;
-    hqspi.Init.FlashSize = 21; // 4MBytes
+    hqspi.Init.FlashSize = SFUD_QSPI_FLASH_SIZE;
     hqspi.Init.ChipSelectHighTime = QSPI_CS_HIGH_TIME_3_CYCLE;
     hqspi.Init.ClockMode = QSPI_CLOCK_MODE_0;
-    hqspi.Init.FlashID = QSPI_FLASH_ID_2;
-    hqspi.Init.DualFlash = QSPI_DUALFLASH_DISABLE;
+    hqspi.Init.FlashID = SFUD_QSPI_FLASH_ID;
+    hqspi.Init.DualFlash = SFUD_QSPI_DUAL_FLASH_MODE;
     if (HAL_QSPI_Init(&hqspi) != HAL_OK)
         Error_Handler();
 
@@ -316,36 +409,12 @@ int main()
     }
     printf("Cmd line: <<%s>>\n", cmdLine);
 
-    FILE *f = fopen(cmdLine, "rb");
-    if (f) {
-        printf("Writing %s to flash\n[", cmdLine);
-        uint32_t addr = 0;
-        while (1) {
-            size_t readed = fread(sector, sizeof(char), sizeof(sector), f);
-            if (readed == 0 || readed == -1)
-                break;
-            e = sfud_erase_write(flash, addr, readed, (const uint8_t *)sector);
-            if (e != SFUD_SUCCESS) {
-                printf("\nError writing qspi: %s\n", sfud_error_str[e]);
-                hostExit(-2);
-            }
-            e = sfud_read(flash, addr, readed, (uint8_t *)temporal);
-            if (e != SFUD_SUCCESS) {
-                printf("\nError reading qspi: %s\n", sfud_error_str[e]);
-                hostExit(-3);
-            }
-            if (memcmp(temporal, sector, readed) != 0) {
-                printf("Error verify write\n");
-                hostExit(-4);
-            }
-            printf("#");
-            fflush(stdout);
-            addr += readed;
-        }
-        fclose(f);
-        printf("]\nDone\n");
-    } else
-        perror("open file");
+    if (strcmp(cmdLine, MAILBOX_CMDLINE) == 0)
+        e = programMailbox(flash);
+    else
+        e = programFile(flash, cmdLine);
+    if (e != SFUD_SUCCESS)
+        hostExit(-2);
 
     hostExit(0);
 }
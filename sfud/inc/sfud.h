@@ -141,6 +141,42 @@ sfud_err sfud_write(const sfud_flash *flash, uint32_t addr, size_t size, const u
  */
 sfud_err sfud_erase_write(const sfud_flash *flash, uint32_t addr, size_t size, const uint8_t *data);
 
+/**
+ * start erasing one erase unit and return without waiting for the flash
+ *
+ * @note The largest eraser aligned on addr and not larger than size is used. The flash stays busy after the call,
+ *       poll it with sfud_busy() or wait with sfud_wait_ready() before the next command.
+ * @note Not for code executing from the flash: it runs again as soon as the call returns, while the flash is busy.
+ *       Such an image erases with sfud_erase(), which waits inside the lock.
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size size still to erase from addr
+ * @param erased size of the erase unit started
+ *
+ * @return result
+ */
+sfud_err sfud_erase_start(const sfud_flash *flash, uint32_t addr, size_t size, size_t *erased);
+
+/**
+ * check if the flash is still executing a program or erase operation
+ *
+ * @param flash flash device
+ * @param busy true while the flash does not accept new commands
+ *
+ * @return result
+ */
+sfud_err sfud_busy(const sfud_flash *flash, bool *busy);
+
+/**
+ * wait for the end of a program or erase operation
+ *
+ * @param flash flash device
+ *
+ * @return result
+ */
+sfud_err sfud_wait_ready(const sfud_flash *flash);
+
 /**
  * erase all flash data
  *
@@ -35,14 +35,68 @@
 
 #define SFUD_USING_QSPI
 
+/*
+ * QSPI flash topology.
+ *
+ * The board only wires bank 2 (BK2_IO0..3 + BK2_NCS), so the default is one
+ * single-flash device on that bank. When a second chip sits on bank 1 either
+ * define SFUD_QSPI_BANK1_FLASH to drive it as an independent SFUD device
+ * (the port switches QUADSPI_CR.FSEL per command), or SFUD_QSPI_DUAL_FLASH to
+ * run both banks in dual-flash mode: SFUD then sees one device with twice the
+ * capacity and erase granularity, even bytes on bank 1 and odd bytes on bank 2.
+ * Dual-flash accesses must be 2 bytes aligned in address and size, the
+ * controller forces ADDRESS[0] and DL[0].
+ *
+ * tools/flashsim runs this port against simulated dies for every topology.
+ */
+/* #define SFUD_QSPI_BANK1_FLASH */
+/* #define SFUD_QSPI_DUAL_FLASH */
+
+#if defined(SFUD_QSPI_BANK1_FLASH) && defined(SFUD_QSPI_DUAL_FLASH)
+#error "SFUD_QSPI_BANK1_FLASH and SFUD_QSPI_DUAL_FLASH are mutually exclusive"
+#endif
+
+/* log2 of one flash die size in bytes (W25Q128: 16MB) */
+#ifndef SFUD_QSPI_DIE_SIZE_LOG2
+#define SFUD_QSPI_DIE_SIZE_LOG2 24
+#endif
+
+/*
+ * QUADSPI init values derived from the topology above, shared by the
+ * application and the qspiloader. FSIZE covers the whole memory mapped window:
+ * 2^(FSIZE + 1) bytes, which is the sum of both dies in dual-flash mode.
+ */
+#ifdef SFUD_QSPI_DUAL_FLASH
+#define SFUD_QSPI_DIE_COUNT 2
+#define SFUD_QSPI_FLASH_SIZE (SFUD_QSPI_DIE_SIZE_LOG2)
+#define SFUD_QSPI_DUAL_FLASH_MODE QSPI_DUALFLASH_ENABLE
+#define SFUD_QSPI_FLASH_ID QSPI_FLASH_ID_1
+#else
+#define SFUD_QSPI_DIE_COUNT 1
+#define SFUD_QSPI_FLASH_SIZE (SFUD_QSPI_DIE_SIZE_LOG2 - 1)
+#define SFUD_QSPI_DUAL_FLASH_MODE QSPI_DUALFLASH_DISABLE
+#define SFUD_QSPI_FLASH_ID QSPI_FLASH_ID_2
+#endif
+
 enum {
     SFUD_W25_DEVICE_INDEX = 0,
+#ifdef SFUD_QSPI_BANK1_FLASH
+    SFUD_BK1_DEVICE_INDEX,
+#endif
 };
 
+#ifdef SFUD_QSPI_BANK1_FLASH
+#define SFUD_FLASH_DEVICE_TABLE                                                \
+{                                                                              \
+    [SFUD_W25_DEVICE_INDEX] = {.name = "W25Q128B", .spi.name = "QSPI1"},       \
+    [SFUD_BK1_DEVICE_INDEX] = {.name = "BK1", .spi.name = "QSPI1.BK1"},        \
+}
+#else
 #define SFUD_FLASH_DEVICE_TABLE                                                \
 {                                                                              \
     [SFUD_W25_DEVICE_INDEX] = {.name = "W25Q128B", .spi.name = "QSPI1"},       \
 }
+#endif
 
 
 #endif /* _SFUD_CFG_H_ */
@@ -118,6 +118,10 @@ if (!(EXPR))                                                                   \
 #define SFUD_CMD_READ_DATA                             0x03
 #endif
 
+#ifndef SFUD_CMD_READ_DATA_4B
+#define SFUD_CMD_READ_DATA_4B                          0x13
+#endif
+
 #ifndef SFUD_CMD_DUAL_OUTPUT_READ_DATA 
 #define SFUD_CMD_DUAL_OUTPUT_READ_DATA                 0x3B
 #endif
@@ -199,6 +203,12 @@ typedef enum {
     SFUD_ERR_ADDR_OUT_OF_BOUND = 5,                        /**< address is out of flash bound */
 } sfud_err;
 
+/**
+ * address bytes in a command buffer. An interleaved (dual-flash) device above 16MB keeps its whole address here while
+ * its dies still use 3-Byte addressing, the port sends the die address size on the bus.
+ */
+#define SFUD_CMD_ADDR_LEN(flash) (((flash)->addr_in_4_byte || (flash)->chip.capacity > (1L << 24)) ? 4 : 3)
+
 #ifdef SFUD_USING_QSPI
 /**
  * QSPI flash read cmd format
@@ -165,12 +165,14 @@ const sfud_flash *sfud_get_device_table(void) {
 #ifdef SFUD_USING_QSPI
 static void qspi_set_read_cmd_format(sfud_flash *flash, uint8_t ins, uint8_t ins_lines, uint8_t addr_lines,
         uint8_t dummy_cycles, uint8_t data_lines) {
-    /* if medium size greater than 16Mb, use 4-Byte address, instruction should be added one */
-    if (flash->chip.capacity <= 0x1000000) {
+    /* if the flash is in 4-Byte addressing, use the 4-Byte address variant of the instruction. The capacity is not
+     * checked here because an interleaved (dual-flash) device is larger than each die it is made of. */
+    if (!flash->addr_in_4_byte) {
         flash->read_cmd_format.instruction = ins;
         flash->read_cmd_format.address_size = 24;
     } else {
-        flash->read_cmd_format.instruction = ins + 1;
+        /* 0Bh/3Bh/BBh/6Bh/EBh map to the next opcode, the normal read (03h) maps to 13h */
+        flash->read_cmd_format.instruction = (ins == SFUD_CMD_READ_DATA) ? SFUD_CMD_READ_DATA_4B : ins + 1;
         flash->read_cmd_format.address_size = 32;
     }
 
@@ -240,6 +242,32 @@ sfud_err sfud_qspi_fast_read_enable(sfud_flash *flash, uint8_t data_line_width)
 }
 #endif /* SFUD_USING_QSPI */
 
+#if defined(SFUD_USING_QSPI) && defined(SFUD_QSPI_DIE_COUNT) && (SFUD_QSPI_DIE_COUNT > 1)
+/**
+ * Scale the flash geometry for QSPI dual-flash mode.
+ *
+ * Every command is sent to all dies at the same time and the controller spreads consecutive bytes across them, so
+ * the device looks like one flash with the capacity and erase sizes multiplied by the die count. Page program stays
+ * in 256 bytes chunks, each die then programs a part of the same page.
+ *
+ * @param flash flash device
+ * @param dies number of interleaved dies
+ */
+static void interleave_geometry(sfud_flash *flash, size_t dies) {
+    size_t i;
+
+    flash->chip.capacity *= dies;
+    flash->chip.erase_gran *= dies;
+#ifdef SFUD_USING_SFDP
+    flash->sfdp.capacity *= dies;
+    for (i = 0; i < SFUD_SFDP_ERASE_TYPE_MAX_NUM; i++) {
+        flash->sfdp.eraser[i].size *= dies;
+    }
+#endif
+    SFUD_INFO("%d interleaved dies, total size is %ld bytes.", (int)dies, flash->chip.capacity);
+}
+#endif
+
 /**
  * hardware initialize
  */
@@ -364,6 +392,11 @@ static sfud_err hardware_init(sfud_flash *flash) {
         flash->addr_in_4_byte = false;
     }
 
+#if defined(SFUD_USING_QSPI) && defined(SFUD_QSPI_DIE_COUNT) && (SFUD_QSPI_DIE_COUNT > 1)
+    /* the geometry above is the one of a single die, the port interleaves all dies into one address space */
+    interleave_geometry(flash, SFUD_QSPI_DIE_COUNT);
+#endif
+
     return result;
 }
 
@@ -422,7 +455,7 @@ sfud_err sfud_read(const sfud_flash *flash, uint32_t addr, size_t size, uint8_t
         {
             cmd_data[0] = SFUD_CMD_READ_DATA;
             make_adress_byte_array(flash, addr, &cmd_data[1]);
-            cmd_size = flash->addr_in_4_byte ? 5 : 4;
+            cmd_size = 1 + SFUD_CMD_ADDR_LEN(flash);
             result = spi->wr(spi, cmd_data, cmd_size, data, size);
         }
     }
@@ -549,7 +582,7 @@ sfud_err sfud_erase(const sfud_flash *flash, uint32_t addr, size_t size) {
 
         cmd_data[0] = cur_erase_cmd;
         make_adress_byte_array(flash, addr, &cmd_data[1]);
-        cmd_size = flash->addr_in_4_byte ? 5 : 4;
+        cmd_size = 1 + SFUD_CMD_ADDR_LEN(flash);
         result = spi->wr(spi, cmd_data, cmd_size, NULL, 0);
         if (result != SFUD_SUCCESS) {
             SFUD_INFO("Error: Flash erase SPI communicate error.");
@@ -588,6 +621,143 @@ __exit:
     return result;
 }
 
+/**
+ * start erasing one erase unit and return without waiting for the flash
+ *
+ * @note The largest eraser aligned on addr and not larger than size is used. The flash stays busy after the call,
+ *       poll it with sfud_busy() or wait with sfud_wait_ready() before the next command.
+ * @note Not for code executing from the flash: it runs again as soon as the call returns, while the flash is busy.
+ *       Such an image erases with sfud_erase(), which waits inside the lock.
+ *
+ * @param flash flash device
+ * @param addr start address
+ * @param size size still to erase from addr
+ * @param erased size of the erase unit started
+ *
+ * @return result
+ */
+sfud_err sfud_erase_start(const sfud_flash *flash, uint32_t addr, size_t size, size_t *erased) {
+    extern size_t sfud_sfdp_get_suitable_eraser(const sfud_flash *flash, uint32_t addr, size_t erase_size);
+
+    sfud_err result = SFUD_SUCCESS;
+    const sfud_spi *spi = &flash->spi;
+    uint8_t cmd_data[5], cmd_size, cur_erase_cmd;
+    size_t cur_erase_size;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(erased);
+    /* must be call this function after initialize OK */
+    SFUD_ASSERT(flash->init_ok);
+    /* check the flash address bound */
+    if (size == 0 || addr + size > flash->chip.capacity) {
+        SFUD_INFO("Error: Flash address is out of bound.");
+        return SFUD_ERR_ADDR_OUT_OF_BOUND;
+    }
+
+#ifdef SFUD_USING_SFDP
+    size_t eraser_index;
+    if (flash->sfdp.available) {
+        eraser_index = sfud_sfdp_get_suitable_eraser(flash, addr, size);
+        cur_erase_cmd = flash->sfdp.eraser[eraser_index].cmd;
+        cur_erase_size = flash->sfdp.eraser[eraser_index].size;
+    } else {
+#else
+    {
+#endif
+        cur_erase_cmd = flash->chip.erase_gran_cmd;
+        cur_erase_size = flash->chip.erase_gran;
+    }
+
+    /* lock SPI */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+
+    result = set_write_enabled(flash, true);
+    if (result == SFUD_SUCCESS) {
+        cmd_data[0] = cur_erase_cmd;
+        make_adress_byte_array(flash, addr, &cmd_data[1]);
+        cmd_size = 1 + SFUD_CMD_ADDR_LEN(flash);
+        result = spi->wr(spi, cmd_data, cmd_size, NULL, 0);
+        if (result != SFUD_SUCCESS) {
+            SFUD_INFO("Error: Flash erase SPI communicate error.");
+        }
+    }
+    /* no write disable: the flash ignores it while busy and clears the latch itself at the end of the erase */
+
+    /* unlock SPI */
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+
+    /* the erased part ends at the next boundary of the erase unit */
+    *erased = cur_erase_size - addr % cur_erase_size;
+    if (*erased > size) {
+        *erased = size;
+    }
+
+    return result;
+}
+
+/**
+ * check if the flash is still executing a program or erase operation
+ *
+ * @param flash flash device
+ * @param busy true while the flash does not accept new commands
+ *
+ * @return result
+ */
+sfud_err sfud_busy(const sfud_flash *flash, bool *busy) {
+    const sfud_spi *spi = &flash->spi;
+    sfud_err result;
+    uint8_t status;
+
+    SFUD_ASSERT(flash);
+    SFUD_ASSERT(busy);
+
+    /* a locked operation of its own: an XIP image polls from the mapped flash between the reads */
+    if (spi->lock) {
+        spi->lock(spi);
+    }
+    result = sfud_read_status(flash, &status);
+    if (spi->unlock) {
+        spi->unlock(spi);
+    }
+    *busy = (result != SFUD_SUCCESS) || (status & SFUD_STATUS_REGISTER_BUSY);
+
+    return result;
+}
+
+/**
+ * wait for the end of a program or erase operation, with the retry limits of the flash device
+ *
+ * @param flash flash device
+ *
+ * @return result
+ */
+sfud_err sfud_wait_ready(const sfud_flash *flash) {
+    sfud_err result = SFUD_SUCCESS;
+    size_t retry_times = flash->retry.times;
+    bool busy;
+
+    SFUD_ASSERT(flash);
+
+    /* sfud_busy() per read, the lock is not held for the whole erase */
+    while (true) {
+        result = sfud_busy(flash, &busy);
+        if (result == SFUD_SUCCESS && !busy) {
+            break;
+        }
+        SFUD_RETRY_PROCESS(flash->retry.delay, retry_times, result);
+    }
+
+    if (result != SFUD_SUCCESS || busy) {
+        SFUD_INFO("Error: Flash wait busy has an error.");
+    }
+
+    return result;
+}
+
 /**
  * write flash data (no erase operate) for write 1 to 256 bytes per page mode or byte write mode
  *
@@ -631,7 +801,7 @@ static sfud_err page256_or_1_byte_write(const sfud_flash *flash, uint32_t addr,
         }
         cmd_data[0] = SFUD_CMD_PAGE_PROGRAM;
         make_adress_byte_array(flash, addr, &cmd_data[1]);
-        cmd_size = flash->addr_in_4_byte ? 5 : 4;
+        cmd_size = 1 + SFUD_CMD_ADDR_LEN(flash);
 
         /* make write align and calculate next write address */
         if (addr % write_gran != 0) {
@@ -723,7 +893,7 @@ static sfud_err aai_write(const sfud_flash *flash, uint32_t addr, size_t size, c
     while (size >= 2) {
         if (first_write) {
             make_adress_byte_array(flash, addr, &cmd_data[1]);
-            cmd_size = flash->addr_in_4_byte ? 5 : 4;
+            cmd_size = 1 + SFUD_CMD_ADDR_LEN(flash);
             cmd_data[cmd_size] = *data;
             cmd_data[cmd_size + 1] = *(data + 1);
             first_write = false;
@@ -992,7 +1162,7 @@ static void make_adress_byte_array(const sfud_flash *flash, uint32_t addr, uint8
     SFUD_ASSERT(flash);
     SFUD_ASSERT(array);
 
-    len = flash->addr_in_4_byte ? 4 : 3;
+    len = SFUD_CMD_ADDR_LEN(flash);
 
     for (i = 0; i < len; i++) {
         array[i] = (addr >> ((len - (i + 1)) * 8)) & 0xFF;
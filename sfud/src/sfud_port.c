@@ -26,15 +26,16 @@
  * Created on: 2018-11-23
  */
 
+#include <qspi_mode.h>
 #include <sfud.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stm32h7xx_hal.h>
 #include <stm32h7xx_hal_gpio.h>
 #include <string.h>
 
 void sfud_log_info(const char *format, ...);
-sfud_err qspi_send_then_recv(const void *send_buf, size_t send_length, void *recv_buf, size_t recv_length);
 extern QSPI_HandleTypeDef hqspi;
 
 typedef struct
@@ -42,22 +43,131 @@ typedef struct
     QSPI_HandleTypeDef *spix;
     GPIO_TypeDef *cs_gpiox;
     uint16_t cs_gpio_pin;
+    uint32_t flash_id; /* QSPI bank of the chip, QSPI_FLASH_ID_x */
+    uint8_t dies;      /* dies answering every command, 2 in dual-flash mode */
 } spi_user_data, *spi_user_data_t;
 
+/* largest register read (JEDEC ID, SFDP table) split across the dies in dual-flash mode */
+#define DUAL_REG_READ_MAX 64
+
 static char log_buf[256];
 
 void sfud_log_debug(const char *file, const long line, const char *format, ...);
+static sfud_err qspi_send_then_recv(spi_user_data_t spi_dev, uint8_t addr_bytes, uint32_t addr_size,
+                                    const void *send_buf, size_t send_length, void *recv_buf, size_t recv_length);
 
 static void spi_lock(const sfud_spi *spi)
 {
     __disable_irq();
+    /* one mode switch for the whole SFUD operation */
+    qspi_indirect_begin();
 }
 
 static void spi_unlock(const sfud_spi *spi)
 {
+    qspi_indirect_end();
     __enable_irq();
 }
 
+/**
+ * The flash device owning a SPI device, the port needs its addressing mode
+ */
+static const sfud_flash *spi_to_flash(const sfud_spi *spi)
+{
+    return (const sfud_flash *)((const uint8_t *)spi - offsetof(sfud_flash, spi));
+}
+
+/**
+ * Route the next command to the bank of this device. In dual-flash mode FSEL is ignored.
+ */
+static void select_bank(spi_user_data_t spi_dev)
+{
+    if (spi_dev->dies == 1 && spi_dev->spix->Init.FlashID != spi_dev->flash_id)
+        HAL_QSPI_SetFlashID(spi_dev->spix, spi_dev->flash_id);
+}
+
+/**
+ * Number of address bytes following the instruction in a SFUD command buffer
+ */
+static uint8_t cmd_address_bytes(const sfud_spi *spi, uint8_t cmd)
+{
+    /* SFDP is always read with a 3-Byte address, whatever the addressing mode */
+    if (cmd == SFUD_CMD_READ_SFDP_REGISTER)
+        return 3;
+    return SFUD_CMD_ADDR_LEN(spi_to_flash(spi));
+}
+
+/**
+ * Address size on the bus, it follows the addressing mode of the dies
+ */
+static uint32_t cmd_address_size(const sfud_spi *spi, uint8_t cmd)
+{
+    if (cmd == SFUD_CMD_READ_SFDP_REGISTER || !spi_to_flash(spi)->addr_in_4_byte)
+        return QSPI_ADDRESS_24_BITS;
+    return QSPI_ADDRESS_32_BITS;
+}
+
+/**
+ * Register commands carry one byte per die in dual-flash mode, array commands carry interleaved data
+ */
+static bool is_status_read(uint8_t cmd) { return cmd == SFUD_CMD_READ_STATUS_REGISTER || cmd == 0x35 || cmd == 0x15; }
+
+static bool is_status_write(uint8_t cmd) { return cmd == SFUD_CMD_WRITE_STATUS_REGISTER || cmd == 0x31 || cmd == 0x11; }
+
+static bool is_id_read(uint8_t cmd)
+{
+    return cmd == SFUD_CMD_JEDEC_ID || cmd == SFUD_CMD_READ_SFDP_REGISTER || cmd == SFUD_CMD_MANUFACTURER_DEVICE_ID ||
+           cmd == SFUD_CMD_READ_UNIQUE_ID;
+}
+
+/**
+ * Register access on two interleaved dies: written bytes are duplicated, read bytes come in pairs (bank 1 first).
+ * Status registers are merged so the device is busy while any die is busy and write enabled only when all are.
+ * Identification data is taken from bank 1, both dies are expected to be the same part.
+ */
+static sfud_err dual_register_access(spi_user_data_t spi_dev, uint8_t addr_bytes, uint32_t addr_size,
+                                     const uint8_t *write_buf, size_t write_size, uint8_t *read_buf, size_t read_size)
+{
+    uint8_t cmd[2 * DUAL_REG_READ_MAX];
+    uint8_t recv[2 * DUAL_REG_READ_MAX];
+    size_t i;
+    sfud_err result;
+
+    if (write_size > DUAL_REG_READ_MAX || read_size > DUAL_REG_READ_MAX)
+        return SFUD_ERR_NOT_FOUND;
+
+    if (is_status_write(write_buf[0])) {
+        cmd[0] = write_buf[0];
+        for (i = 1; i < write_size; i++)
+            cmd[2 * i - 1] = cmd[2 * i] = write_buf[i];
+        return qspi_send_then_recv(spi_dev, addr_bytes, addr_size, cmd, 2 * write_size - 1, NULL, 0);
+    }
+
+    memcpy(cmd, write_buf, write_size);
+    if (write_buf[0] == SFUD_CMD_READ_SFDP_REGISTER && write_size >= 4) {
+        /* the controller halves the address for each die, ask for the same SFDP offset on both */
+        uint32_t addr = ((write_buf[1] << 16) | (write_buf[2] << 8) | write_buf[3]) * 2;
+        cmd[1] = addr >> 16;
+        cmd[2] = addr >> 8;
+        cmd[3] = addr;
+    }
+    result = qspi_send_then_recv(spi_dev, addr_bytes, addr_size, cmd, write_size, recv, 2 * read_size);
+    if (result != SFUD_SUCCESS)
+        return result;
+
+    for (i = 0; i < read_size; i++) {
+        uint8_t bk1 = recv[2 * i], bk2 = recv[2 * i + 1];
+        if (is_status_read(write_buf[0]))
+            read_buf[i] = ((bk1 | bk2) & ~SFUD_STATUS_REGISTER_WEL) | (bk1 & bk2 & SFUD_STATUS_REGISTER_WEL);
+        else
+            read_buf[i] = bk1;
+    }
+    if (write_buf[0] == SFUD_CMD_JEDEC_ID && recv[0] != recv[1])
+        sfud_log_info("dual-flash dies report different manufacturer IDs (%02X/%02X)", recv[0], recv[1]);
+
+    return SFUD_SUCCESS;
+}
+
 /**
  * SPI write data then read data
  */
@@ -76,26 +186,39 @@ static sfud_err spi_write_read(const sfud_spi *spi, const uint8_t *write_buf, si
     {
         SFUD_ASSERT(read_buf);
     }
+    if (!write_size)
+        return result;
+
+    /* commands issued outside of a SFUD operation (probe, application register access) */
+    qspi_indirect_begin();
+    select_bank(spi_dev);
 
     /* reset cs pin */
     if (spi_dev->cs_gpiox != NULL)
         HAL_GPIO_WritePin(spi_dev->cs_gpiox, spi_dev->cs_gpio_pin, GPIO_PIN_RESET);
 
-    if (write_size && read_size)
+    uint8_t addr_bytes = cmd_address_bytes(spi, write_buf[0]);
+    uint32_t addr_size = cmd_address_size(spi, write_buf[0]);
+    if (spi_dev->dies > 1 && (is_status_read(write_buf[0]) || is_status_write(write_buf[0]) || is_id_read(write_buf[0])))
+    {
+        result = dual_register_access(spi_dev, addr_bytes, addr_size, write_buf, write_size, read_buf, read_size);
+    }
+    else if (read_size)
     {
         /* read data */
-        qspi_send_then_recv(write_buf, write_size, read_buf, read_size);
+        result = qspi_send_then_recv(spi_dev, addr_bytes, addr_size, write_buf, write_size, read_buf, read_size);
     }
-    else if (write_size)
+    else
     {
         /* send data */
-        qspi_send_then_recv(write_buf, write_size, NULL, 0);
+        result = qspi_send_then_recv(spi_dev, addr_bytes, addr_size, write_buf, write_size, NULL, 0);
     }
 
     /* set cs pin */
     if (spi_dev->cs_gpiox != NULL)
         HAL_GPIO_WritePin(spi_dev->cs_gpiox, spi_dev->cs_gpio_pin, GPIO_PIN_SET);
 
+    qspi_indirect_end();
     return result;
 }
 
@@ -107,7 +230,10 @@ static sfud_err qspi_read(const struct __sfud_spi *spi, uint32_t addr, sfud_qspi
 
     sfud_err result = SFUD_SUCCESS;
     QSPI_CommandTypeDef Cmdhandler;
-    extern QSPI_HandleTypeDef hqspi;
+    spi_user_data_t spi_dev = (spi_user_data_t) spi->user_data;
+
+    qspi_indirect_begin();
+    select_bank(spi_dev);
 
     /* set cmd struct */
     Cmdhandler.Instruction = qspi_read_cmd_format->instruction;
@@ -126,7 +252,13 @@ static sfud_err qspi_read(const struct __sfud_spi *spi, uint32_t addr, sfud_qspi
     }
 
     Cmdhandler.Address = addr;
-    Cmdhandler.AddressSize = QSPI_ADDRESS_24_BITS;
+    if (qspi_read_cmd_format->address_size == 32)
+    {
+        Cmdhandler.AddressSize = QSPI_ADDRESS_32_BITS;
+    }else
+    {
+        Cmdhandler.AddressSize = QSPI_ADDRESS_24_BITS;
+    }
     if(qspi_read_cmd_format->address_lines == 0)
     {
         Cmdhandler.AddressMode = QSPI_ADDRESS_NONE;
@@ -166,15 +298,16 @@ static sfud_err qspi_read(const struct __sfud_spi *spi, uint32_t addr, sfud_qspi
     Cmdhandler.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
     Cmdhandler.DdrMode = QSPI_DDR_MODE_DISABLE;
     Cmdhandler.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-    HAL_QSPI_Command(&hqspi, &Cmdhandler, 5000);
+    HAL_QSPI_Command(spi_dev->spix, &Cmdhandler, 5000);
 
-    if (HAL_QSPI_Receive(&hqspi, read_buf, 5000) != HAL_OK)
+    if (HAL_QSPI_Receive(spi_dev->spix, read_buf, 5000) != HAL_OK)
     {
-        sfud_log_info("qspi recv data failed(%d)!", hqspi.ErrorCode);
-        hqspi.State = HAL_QSPI_STATE_READY;
+        sfud_log_info("qspi recv data failed(%d)!", spi_dev->spix->ErrorCode);
+        spi_dev->spix->State = HAL_QSPI_STATE_READY;
         result = SFUD_ERR_READ;
     }
 
+    qspi_indirect_end();
     return result;
 }
 
@@ -185,12 +318,39 @@ static void retry_delay_100us(void)
     while (delay--);
 }
 
-static spi_user_data spi1 = {
+/* the chip on bank 2, or both banks in dual-flash mode */
+static spi_user_data qspi_bank2 = {
     .spix = &hqspi,
     .cs_gpiox = NULL,
-    .cs_gpio_pin = 0
+    .cs_gpio_pin = 0,
+    .flash_id = SFUD_QSPI_FLASH_ID,
+    .dies = SFUD_QSPI_DIE_COUNT,
 };
 
+#ifdef SFUD_QSPI_BANK1_FLASH
+static spi_user_data qspi_bank1 = {
+    .spix = &hqspi,
+    .cs_gpiox = NULL,
+    .cs_gpio_pin = 0,
+    .flash_id = QSPI_FLASH_ID_1,
+    .dies = 1,
+};
+#endif
+
+static void qspi_port_setup(sfud_flash *flash, spi_user_data_t spi_dev)
+{
+    /* set the interfaces and data */
+    flash->spi.wr = spi_write_read;
+    flash->spi.qspi_read = qspi_read;
+    flash->spi.lock = spi_lock;
+    flash->spi.unlock = spi_unlock;
+    flash->spi.user_data = spi_dev;
+    /* about 100 microsecond delay */
+    flash->retry.delay = retry_delay_100us;
+    /* adout 60 seconds timeout */
+    flash->retry.times = 60 * 10000;
+}
+
 sfud_err sfud_spi_port_init(sfud_flash *flash)
 {
     sfud_err result = SFUD_SUCCESS;
@@ -198,20 +358,16 @@ sfud_err sfud_spi_port_init(sfud_flash *flash)
     switch (flash->index)
     {
     case SFUD_W25_DEVICE_INDEX:
-    {
-        /* set the interfaces and data */
-        flash->spi.wr = spi_write_read;
-        flash->spi.qspi_read = qspi_read;
-        flash->spi.lock = spi_lock;
-        flash->spi.unlock = spi_unlock;
-        flash->spi.user_data = &spi1;
-        /* about 100 microsecond delay */
-        flash->retry.delay = retry_delay_100us;
-        /* adout 60 seconds timeout */
-        flash->retry.times = 60 * 10000;
-
+        qspi_port_setup(flash, &qspi_bank2);
+        break;
+#ifdef SFUD_QSPI_BANK1_FLASH
+    case SFUD_BK1_DEVICE_INDEX:
+        qspi_port_setup(flash, &qspi_bank1);
+        break;
+#endif
+    default:
+        result = SFUD_ERR_NOT_FOUND;
         break;
-    }
     }
 
     return result;
@@ -229,6 +385,9 @@ void sfud_log_debug(const char *file, const long line, const char *format, ...)
 {
     va_list args;
 
+    /* printf lives in the unmapped flash while an XIP image writes it */
+    if (qspi_mode_is_xip() && !qspi_mmap_active())
+        return;
     /* args point to the first variable parameter */
     va_start(args, format);
     printf("[SFUD](%s:%ld) ", file, line);
@@ -248,6 +407,9 @@ void sfud_log_info(const char *format, ...)
 {
     va_list args;
 
+    /* printf lives in the unmapped flash while an XIP image writes it */
+    if (qspi_mode_is_xip() && !qspi_mmap_active())
+        return;
     /* args point to the first variable parameter */
     va_start(args, format);
     printf("[SFUD]");
@@ -259,14 +421,19 @@ void sfud_log_info(const char *format, ...)
 
 /**
  * This function can send or send then receive QSPI data.
+ *
+ * The command buffer holds the instruction, then addr_bytes of address when it is long enough to carry one, then
+ * dummy bytes (receive) or data (send). Shorter commands, like a status register write, have no address stage.
+ * addr_size is the address size on the bus, QSPI_ADDRESS_24_BITS or QSPI_ADDRESS_32_BITS.
  */
-sfud_err qspi_send_then_recv(const void *send_buf, size_t send_length, void *recv_buf, size_t recv_length)
+static sfud_err qspi_send_then_recv(spi_user_data_t spi_dev, uint8_t addr_bytes, uint32_t addr_size,
+                                    const void *send_buf, size_t send_length, void *recv_buf, size_t recv_length)
 {
     assert_param(send_buf);
-    assert_param(recv_buf);
     assert_param(send_length != 0);
 
     QSPI_CommandTypeDef Cmdhandler;
+    QSPI_HandleTypeDef *qspi = spi_dev->spix;
     unsigned char *ptr = (unsigned char *)send_buf;
     size_t count = 0;
     sfud_err result = SFUD_SUCCESS;
@@ -277,26 +444,19 @@ sfud_err qspi_send_then_recv(const void *send_buf, size_t send_length, void *rec
     count++;
 
     /* get address */
-    if (send_length > 1)
+    if (send_length >= 1u + addr_bytes)
     {
-        if (send_length >= 4)
+        if (addr_bytes == 4)
         {
-            /* address size is 3 Byte */
-            Cmdhandler.Address = (ptr[1] << 16) | (ptr[2] << 8) | (ptr[3]);
-            Cmdhandler.AddressSize = QSPI_ADDRESS_24_BITS;
-            count += 3;
+            Cmdhandler.Address = ((uint32_t)ptr[1] << 24) | (ptr[2] << 16) | (ptr[3] << 8) | (ptr[4]);
         }
         else
         {
-            if (send_length < 3)
-            {
-                return SFUD_ERR_READ;
-            }
-            Cmdhandler.Address = 0;
-            Cmdhandler.AddressMode = QSPI_ADDRESS_NONE;
-            Cmdhandler.AddressSize = 0;
+            Cmdhandler.Address = (ptr[1] << 16) | (ptr[2] << 8) | (ptr[3]);
         }
+        Cmdhandler.AddressSize = addr_size;
         Cmdhandler.AddressMode = QSPI_ADDRESS_1_LINE;
+        count += addr_bytes;
     }
     else
     {
@@ -331,14 +491,14 @@ sfud_err qspi_send_then_recv(const void *send_buf, size_t send_length, void *rec
         /* set recv size */
         Cmdhandler.DataMode = QSPI_DATA_1_LINE;
         Cmdhandler.NbData = recv_length;
-        HAL_QSPI_Command(&hqspi, &Cmdhandler, 5000);
+        HAL_QSPI_Command(qspi, &Cmdhandler, 5000);
 
         if (recv_length != 0)
         {
-            if (HAL_QSPI_Receive(&hqspi, recv_buf, 5000) != HAL_OK)
+            if (HAL_QSPI_Receive(qspi, recv_buf, 5000) != HAL_OK)
             {
-                sfud_log_info("qspi recv data failed(%d)!", hqspi.ErrorCode);
-                hqspi.State = HAL_QSPI_STATE_READY;
+                sfud_log_info("qspi recv data failed(%d)!", qspi->ErrorCode);
+                qspi->State = HAL_QSPI_STATE_READY;
                 result = SFUD_ERR_READ;
             }
         }
@@ -363,14 +523,14 @@ sfud_err qspi_send_then_recv(const void *send_buf, size_t send_length, void *rec
 
         /* set send buf and send size */
         Cmdhandler.NbData = send_length - count;
-        HAL_QSPI_Command(&hqspi, &Cmdhandler, 5000);
+        HAL_QSPI_Command(qspi, &Cmdhandler, 5000);
 
         if (send_length - count > 0)
         {
-            if (HAL_QSPI_Transmit(&hqspi, (uint8_t *)(ptr + count), 5000) != HAL_OK)
+            if (HAL_QSPI_Transmit(qspi, (uint8_t *)(ptr + count), 5000) != HAL_OK)
             {
-                sfud_log_info("qspi send data failed(%d)!", hqspi.ErrorCode);
-                hqspi.State = HAL_QSPI_STATE_READY;
+                sfud_log_info("qspi send data failed(%d)!", qspi->ErrorCode);
+                qspi->State = HAL_QSPI_STATE_READY;
                 result = SFUD_ERR_WRITE;
             }
         }
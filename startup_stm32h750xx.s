@@ -61,6 +61,25 @@ defined in linker script */
 Reset_Handler:  
   ldr   sp, =_estack      /* set stack pointer */
 
+/* Copy the ITCM code (ITCM_FUNC, itcm_hot.ld) from its load address to ITCM */
+  movs  r1, #0
+  b  LoopCopyItcm
+
+CopyItcm:
+  ldr  r3, =_siitcm
+  ldr  r3, [r3, r1]
+  str  r3, [r0, r1]
+  adds  r1, r1, #4
+
+LoopCopyItcm:
+  ldr  r0, =_sitcm
+  ldr  r3, =_eitcm
+  adds  r2, r0, r1
+  cmp  r2, r3
+  bcc  CopyItcm
+  dsb
+  isb
+
 /* Copy the data segment initializers from flash to SRAM */  
   movs  r1, #0
   b  LoopCopyDataInit
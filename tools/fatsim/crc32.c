@@ -0,0 +1,15 @@
+/* bitwise CRC-32 of crc32.h for the host build, the firmware uses the CRC unit (Src/crc32.c) */
+#include <crc32.h>
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (size--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
@@ -0,0 +1,21 @@
+/*
+ * FatFs integer types for a 64-bit host, forced in with -include before ff.h pulls integer.h (same guard): the
+ * embedded branch of integer.h makes DWORD an unsigned long, 64 bits here, and the exFAT checksums then carry past bit
+ * 31.
+ */
+#ifndef _FF_INTEGER
+#define _FF_INTEGER
+
+#include <stdint.h>
+
+typedef int INT;
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+typedef short SHORT;
+typedef unsigned short WORD;
+typedef unsigned short WCHAR;
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+typedef uint64_t QWORD;
+
+#endif
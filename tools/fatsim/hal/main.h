@@ -0,0 +1 @@
+/* ffconf.h includes it, the host build needs none of the board definitions */
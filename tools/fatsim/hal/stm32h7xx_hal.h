@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for the HAL definitions Inc/bsp_driver_sd.h needs. The card is the disk image of imgdisk.c, which
+ * implements BSP_SD_GetCardInfo() for the sector cache (Src/sd_cache.c) and HAL_GetTick() on its simulated clock for
+ * Src/volume.c.
+ */
+#ifndef STM32H7XX_HAL_H
+#define STM32H7XX_HAL_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t CardType;
+    uint32_t CardVersion;
+    uint32_t Class;
+    uint32_t RelCardAdd;
+    uint32_t BlockNbr;
+    uint32_t BlockSize;
+    uint32_t LogBlockNbr;
+    uint32_t LogBlockSize;
+    uint32_t CardSpeed;
+} HAL_SD_CardInfoTypeDef;
+
+uint32_t HAL_GetTick(void);
+
+#endif
@@ -0,0 +1,200 @@
+#include "imgdisk.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ff_gen_drv.h>
+#include <sd_diskio.h>
+
+#define SECTOR 512
+
+const imgdisk_model_t imgdisk_sdhc = {
+    .read_cmd_us = 100,
+    .write_cmd_us = 400,
+    .read_sector_ns = 85000, /* 512 bytes and CRC on one data line at 50MHz */
+    .write_sector_ns = 90000,
+    .au_sectors = 8192,      /* 4MB */
+    .open_aus = 2,
+    .au_open_us = 3000,
+    .gc_sectors = 65536,     /* 32MB */
+    .gc_us = 150000,
+    .trim_au_us = 1000,
+};
+
+static int fd = -1;
+static uint32_t card_sectors;
+static imgdisk_model_t model;
+static imgdisk_stats_t stats;
+static uint32_t open_au[IMGDISK_OPEN_AUS_MAX]; /* most recently written first */
+static uint32_t open_count;
+static uint32_t since_gc;
+static uint64_t clock_ns; /* not reset with the statistics */
+
+int imgdisk_open(const char *path, uint32_t sectors, const imgdisk_model_t *m)
+{
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)sectors * SECTOR) != 0) {
+        perror(path);
+        return -1;
+    }
+    card_sectors = sectors;
+    model = *m;
+    if (model.open_aus > IMGDISK_OPEN_AUS_MAX)
+        model.open_aus = IMGDISK_OPEN_AUS_MAX;
+    if (model.open_aus == 0)
+        model.open_aus = 1;
+    if (model.au_sectors == 0)
+        model.au_sectors = 1;
+    open_count = 0;
+    since_gc = 0;
+    imgdisk_reset_stats();
+    return 0;
+}
+
+void imgdisk_close(void)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+void imgdisk_idle(uint32_t us)
+{
+    clock_ns += (uint64_t)us * 1000;
+}
+
+void imgdisk_stats(imgdisk_stats_t *st)
+{
+    *st = stats;
+}
+
+void imgdisk_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return clock_ns / 1000000;
+}
+
+void BSP_SD_GetCardInfo(BSP_SD_CardInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->BlockNbr = info->LogBlockNbr = card_sectors;
+    info->BlockSize = info->LogBlockSize = SECTOR;
+}
+
+static void advance(uint64_t ns)
+{
+    stats.time_ns += ns;
+    clock_ns += ns;
+}
+
+/* time of the writes to one allocation unit beyond the transfer */
+static uint64_t touch_au(uint32_t au)
+{
+    uint32_t i;
+    int hit;
+
+    for (i = 0; i < open_count && open_au[i] != au; i++)
+        ;
+    hit = i < open_count;
+    if (!hit) {
+        /* a free place, else the least recently written one is closed */
+        if (open_count < model.open_aus)
+            open_count++;
+        i = open_count - 1;
+    }
+    memmove(&open_au[1], &open_au[0], i * sizeof(open_au[0]));
+    open_au[0] = au;
+    if (hit)
+        return 0;
+    stats.au_opens++;
+    return (uint64_t)model.au_open_us * 1000;
+}
+
+static DSTATUS img_initialize(BYTE lun)
+{
+    return fd < 0 ? STA_NOINIT : 0;
+}
+
+static DSTATUS img_status(BYTE lun)
+{
+    return fd < 0 ? STA_NOINIT : 0;
+}
+
+static DRESULT img_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+    if (sector + count > card_sectors)
+        return RES_PARERR;
+    if (pread(fd, buff, (size_t)count * SECTOR, (off_t)sector * SECTOR) != (ssize_t)count * SECTOR)
+        return RES_ERROR;
+    stats.reads++;
+    stats.read_sectors += count;
+    advance((uint64_t)model.read_cmd_us * 1000 + (uint64_t)model.read_sector_ns * count);
+    return RES_OK;
+}
+
+static DRESULT img_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+{
+    uint64_t t = (uint64_t)model.write_cmd_us * 1000 + (uint64_t)model.write_sector_ns * count;
+
+    if (sector + count > card_sectors)
+        return RES_PARERR;
+    if (pwrite(fd, buff, (size_t)count * SECTOR, (off_t)sector * SECTOR) != (ssize_t)count * SECTOR)
+        return RES_ERROR;
+    for (uint32_t au = sector / model.au_sectors; au <= (sector + count - 1) / model.au_sectors; au++)
+        t += touch_au(au);
+    since_gc += count;
+    if (model.gc_sectors && since_gc >= model.gc_sectors) {
+        since_gc -= model.gc_sectors;
+        stats.gc_stalls++;
+        t += (uint64_t)model.gc_us * 1000;
+    }
+    stats.writes++;
+    stats.write_sectors += count;
+    advance(t);
+    if (t / 1000 > stats.max_write_us)
+        stats.max_write_us = t / 1000;
+    return RES_OK;
+}
+
+static DRESULT img_ioctl(BYTE lun, BYTE cmd, void *buff)
+{
+    switch (cmd) {
+    case CTRL_SYNC:
+        return RES_OK;
+    case GET_SECTOR_COUNT:
+        *(DWORD *)buff = card_sectors;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD *)buff = SECTOR;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        /* what sd_diskio.c reports: the largest power of two dividing the AU, up to what f_mkfs takes */
+        *(DWORD *)buff = model.au_sectors & -model.au_sectors;
+        if (*(DWORD *)buff > 32768)
+            *(DWORD *)buff = 32768;
+        return RES_OK;
+    case CTRL_TRIM: {
+        DWORD *range = buff;
+        uint32_t aus = range[1] / model.au_sectors - range[0] / model.au_sectors + 1;
+        stats.trims++;
+        advance((uint64_t)model.write_cmd_us * 1000 + (uint64_t)model.trim_au_us * 1000 * aus);
+        return RES_OK;
+    }
+    default:
+        return RES_PARERR;
+    }
+}
+
+const Diskio_drvTypeDef SD_Driver = {
+    img_initialize, //
+    img_status,     //
+    img_read,       //
+    img_write,      //
+    img_ioctl,      //
+};
@@ -0,0 +1,57 @@
+/*
+ * SD_Driver of the host build: a raw disk image with a timing model of an SD card.
+ *
+ * Nothing waits, every command adds its modelled duration to a simulated clock:
+ *
+ *   a fixed cost per read or write command (the write one includes the busy time after the data)
+ *   a cost per sector transferred
+ *   a write to an allocation unit outside the few the card keeps open: it closes the oldest one and opens another
+ *   a garbage collection stall every so many sectors written
+ *   a cost per allocation unit trimmed
+ *
+ * The defaults are those of a class 10 SDHC card on the board's 1-bit bus at 50MHz.
+ */
+#ifndef IMGDISK_H
+#define IMGDISK_H
+
+#include <stdint.h>
+
+#define IMGDISK_OPEN_AUS_MAX 8
+
+typedef struct {
+    uint32_t read_cmd_us;
+    uint32_t write_cmd_us;
+    uint32_t read_sector_ns;
+    uint32_t write_sector_ns;
+    uint32_t au_sectors;   /* allocation unit, also GET_BLOCK_SIZE */
+    uint32_t open_aus;     /* allocation units written without a penalty, up to IMGDISK_OPEN_AUS_MAX */
+    uint32_t au_open_us;   /* penalty of a write to another one */
+    uint32_t gc_sectors;   /* sectors written between two garbage collections, 0 for none */
+    uint32_t gc_us;
+    uint32_t trim_au_us;
+} imgdisk_model_t;
+
+typedef struct {
+    uint64_t time_ns;      /* simulated */
+    uint32_t reads;        /* commands */
+    uint32_t writes;
+    uint32_t trims;
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+    uint32_t au_opens;
+    uint32_t gc_stalls;
+    uint32_t max_write_us; /* slowest write command */
+} imgdisk_stats_t;
+
+extern const imgdisk_model_t imgdisk_sdhc;
+
+int imgdisk_open(const char *path, uint32_t sectors, const imgdisk_model_t *model);
+void imgdisk_close(void);
+
+/* time passing without a card command (producers of a capture), not counted in the statistics */
+void imgdisk_idle(uint32_t us);
+
+void imgdisk_stats(imgdisk_stats_t *stats);
+void imgdisk_reset_stats(void);
+
+#endif
@@ -0,0 +1,613 @@
+/*
+ * Storage path benchmarks on the host.
+ *
+ * FatFs is built with the firmware's ffconf.h, on top of the sector cache (Src/sd_cache.c) and the SD card model of
+ * imgdisk.c. The card is formatted by Src/sd_format.c like the sdformat command does and mounted by Src/volume.c.
+ * Each scenario reports the time the modelled card needed and the throughput it gives. The model is deterministic:
+ * with --check the run fails when a scenario takes longer than in a baseline file, the storage regression gate of
+ * `make run`.
+ */
+#include "imgdisk.h"
+
+#include <clmt.h>
+#include <datalog.h>
+#include <fatfs.h>
+#include <logcat.h>
+#include <sd_cache.h>
+#include <sd_format.h>
+#include <volume.h>
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SCENARIOS 16
+#define SMALL_FILES 256
+#define SMALL_SIZE 3000
+#define LOG_RECORDS 4000
+#define LOG_RECORD 100
+#define LOG_SYNC 10
+#define BIG_SIZE (16 * 1024 * 1024)
+#define CONTIG_CHUNK (32 * 1024)
+#define BIG_CHUNK 4096
+#define FRAG_SIZE (2 * 1024 * 1024)
+#define FRAG_CHUNK 8192 /* a cluster, the two files interleave */
+#define SEEKS 2000
+#define CAPTURE_RECORDS 60000
+#define CAPTURE_PERIOD_US 250
+#define CAPTURE_FILE (1024 * 1024)
+#define WINDOWS 50
+#define WINDOW_MS 20
+
+char SDPath[4];
+FATFS SDFatFS;
+FIL SDFile;
+PARTITION VolToPart[_VOLUMES] = {{0, 0}};
+
+typedef struct {
+    const char *name;
+    int (*run)(uint32_t *ops, uint64_t *bytes);
+} scenario_t;
+
+typedef struct {
+    const char *name;
+    double ms;
+} result_t;
+
+static uint8_t buf[64 * 1024];
+static uint8_t check[64 * 1024];
+static result_t results[MAX_SCENARIOS];
+static int nresults;
+static int plain_format;
+
+DWORD get_fattime(void)
+{
+    return 0;
+}
+
+static void fill(uint8_t *p, size_t n, uint32_t seed)
+{
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245 + 12345;
+        p[i] = seed >> 16;
+    }
+}
+
+static int failed(const char *what, FRESULT res)
+{
+    fprintf(stderr, "%s: error %d\n", what, res);
+    return -1;
+}
+
+static int format(uint32_t *ops, uint64_t *bytes)
+{
+    static uint8_t work[32 * 512];
+    FRESULT res;
+
+    if (plain_format)
+        res = f_mkfs(SDPath, FM_ANY, 0, work, sizeof(work));
+    else
+        res = sd_format(0);
+    if (res != FR_OK)
+        return failed("format", res);
+    *ops = 1;
+    return 0;
+}
+
+static int small_files(uint32_t *ops, uint64_t *bytes)
+{
+    char path[32];
+    FRESULT res;
+    UINT n;
+
+    res = f_mkdir("small");
+    if (res != FR_OK)
+        return failed("mkdir", res);
+    for (int i = 0; i < SMALL_FILES; i++) {
+        snprintf(path, sizeof(path), "small/file%03d.txt", i);
+        fill(buf, SMALL_SIZE, i);
+        res = f_open(&SDFile, path, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res == FR_OK)
+            res = f_write(&SDFile, buf, SMALL_SIZE, &n);
+        if (res == FR_OK)
+            res = f_close(&SDFile);
+        if (res != FR_OK || n != SMALL_SIZE)
+            return failed(path, res);
+    }
+    for (int i = 0; i < SMALL_FILES; i++) {
+        snprintf(path, sizeof(path), "small/file%03d.txt", i);
+        fill(check, SMALL_SIZE, i);
+        res = f_open(&SDFile, path, FA_READ);
+        if (res == FR_OK)
+            res = f_read(&SDFile, buf, SMALL_SIZE, &n);
+        f_close(&SDFile);
+        if (res != FR_OK || n != SMALL_SIZE || memcmp(buf, check, SMALL_SIZE) != 0)
+            return failed(path, res != FR_OK ? res : FR_INT_ERR);
+    }
+    *ops = 2 * SMALL_FILES;
+    *bytes = 2ull * SMALL_FILES * SMALL_SIZE;
+    return 0;
+}
+
+static int dir_scan(uint32_t *ops, uint64_t *bytes)
+{
+    static DIR dir;
+    static FILINFO info, st;
+    char path[8 + _MAX_LFN];
+    FRESULT res;
+
+    for (int pass = 0; pass < 4; pass++) {
+        uint32_t found = 0;
+        res = f_opendir(&dir, "small");
+        while (res == FR_OK && (res = f_readdir(&dir, &info)) == FR_OK && info.fname[0]) {
+            snprintf(path, sizeof(path), "small/%s", info.fname);
+            res = f_stat(path, &st);
+            found++;
+            *ops += 2;
+        }
+        f_closedir(&dir);
+        if (res != FR_OK || found != SMALL_FILES)
+            return failed("scan", res != FR_OK ? res : FR_INT_ERR);
+    }
+    return 0;
+}
+
+/* text records with an f_sync every few, how a logger without preallocation keeps its data safe */
+static int logging(uint32_t *ops, uint64_t *bytes)
+{
+    FRESULT res;
+    UINT n;
+
+    res = f_open(&SDFile, "log.txt", FA_OPEN_APPEND | FA_WRITE);
+    for (int i = 0; res == FR_OK && i < LOG_RECORDS; i++) {
+        fill(buf, LOG_RECORD, i);
+        res = f_write(&SDFile, buf, LOG_RECORD, &n);
+        if (res == FR_OK && i % LOG_SYNC == LOG_SYNC - 1)
+            res = f_sync(&SDFile);
+    }
+    if (res == FR_OK)
+        res = f_close(&SDFile);
+    if (res != FR_OK)
+        return failed("log.txt", res);
+    *ops = LOG_RECORDS;
+    *bytes = (uint64_t)LOG_RECORDS * LOG_RECORD;
+    return 0;
+}
+
+/* the datalog pattern: one contiguous allocation, then whole buffers */
+static int contiguous(uint32_t *ops, uint64_t *bytes)
+{
+    FRESULT res;
+    UINT n;
+
+    res = f_open(&SDFile, "contig.bin", FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK)
+        res = f_expand(&SDFile, BIG_SIZE, 1);
+    for (uint32_t pos = 0; res == FR_OK && pos < BIG_SIZE; pos += CONTIG_CHUNK) {
+        fill(buf, CONTIG_CHUNK, pos);
+        res = f_write(&SDFile, buf, CONTIG_CHUNK, &n);
+    }
+    if (res == FR_OK)
+        res = f_close(&SDFile);
+    if (res != FR_OK)
+        return failed("contig.bin", res);
+    *ops = BIG_SIZE / CONTIG_CHUNK;
+    *bytes = BIG_SIZE;
+    return 0;
+}
+
+static int big_file(uint32_t *ops, uint64_t *bytes)
+{
+    FRESULT res;
+    UINT n;
+
+    res = f_open(&SDFile, "big.bin", FA_CREATE_ALWAYS | FA_WRITE);
+    for (uint32_t pos = 0; res == FR_OK && pos < BIG_SIZE; pos += BIG_CHUNK) {
+        fill(buf, BIG_CHUNK, pos);
+        res = f_write(&SDFile, buf, BIG_CHUNK, &n);
+    }
+    if (res == FR_OK)
+        res = f_close(&SDFile);
+    if (res == FR_OK)
+        res = f_open(&SDFile, "big.bin", FA_READ);
+    for (uint32_t pos = 0; res == FR_OK && pos < BIG_SIZE; pos += BIG_CHUNK) {
+        fill(check, BIG_CHUNK, pos);
+        res = f_read(&SDFile, buf, BIG_CHUNK, &n);
+        if (res == FR_OK && (n != BIG_CHUNK || memcmp(buf, check, BIG_CHUNK) != 0))
+            res = FR_INT_ERR;
+    }
+    f_close(&SDFile);
+    if (res != FR_OK)
+        return failed("big.bin", res);
+    *ops = 2 * BIG_SIZE / BIG_CHUNK;
+    *bytes = 2ull * BIG_SIZE;
+    return 0;
+}
+
+/* f_forward as Src/fstream.c uses it: the sink checks the windows against the data big_file() wrote */
+static uint32_t forwarded;
+
+static UINT check_window(const BYTE *data, UINT n)
+{
+    if (!data)
+        return 1;
+    if (forwarded % BIG_CHUNK == 0)
+        fill(check, BIG_CHUNK, forwarded);
+    if (memcmp(data, &check[forwarded % BIG_CHUNK], n) != 0)
+        return 0;
+    forwarded += n;
+    return n;
+}
+
+static int forward(uint32_t *ops, uint64_t *bytes)
+{
+    FRESULT res;
+    UINT n;
+
+    forwarded = 0;
+    res = f_open(&SDFile, "big.bin", FA_READ);
+    while (res == FR_OK && forwarded < BIG_SIZE) {
+        res = f_forward(&SDFile, check_window, 64 * 1024, &n);
+        if (res == FR_OK && n == 0)
+            res = FR_INT_ERR;
+        (*ops)++;
+    }
+    f_close(&SDFile);
+    if (res != FR_OK)
+        return failed("forward big.bin", res);
+    *bytes = BIG_SIZE;
+    return 0;
+}
+
+/* random sector reads through the cluster link map of a file in one fragment per cluster */
+static int seek(uint32_t *ops, uint64_t *bytes)
+{
+    static FIL other;
+    static const char *names[] = {"frag.bin", "other.bin"};
+    clmt_stats_t st;
+    FRESULT res;
+    UINT n;
+
+    res = f_open(&SDFile, names[0], FA_CREATE_ALWAYS | FA_WRITE);
+    if (res == FR_OK)
+        res = f_open(&other, names[1], FA_CREATE_ALWAYS | FA_WRITE);
+    for (uint32_t pos = 0; res == FR_OK && pos < FRAG_SIZE; pos += FRAG_CHUNK) {
+        fill(buf, FRAG_CHUNK, pos);
+        res = f_write(&SDFile, buf, FRAG_CHUNK, &n);
+        if (res == FR_OK)
+            res = f_write(&other, buf, FRAG_CHUNK, &n);
+    }
+    f_close(&SDFile);
+    f_close(&other);
+    if (res != FR_OK)
+        return failed(names[0], res);
+
+    for (int pass = 0; pass < 2; pass++) {
+        res = clmt_open(&SDFile, names[0]);
+        if (res == FR_OK && !SDFile.cltbl)
+            res = FR_NOT_ENOUGH_CORE;
+        for (int i = 0; res == FR_OK && i < SEEKS; i++) {
+            uint32_t pos = (uint32_t)rand() % (FRAG_SIZE / 512) * 512;
+            res = f_lseek(&SDFile, pos);
+            if (res == FR_OK)
+                res = f_read(&SDFile, buf, 512, &n);
+            fill(check, FRAG_CHUNK, pos - pos % FRAG_CHUNK);
+            if (res == FR_OK && memcmp(buf, &check[pos % FRAG_CHUNK], 512) != 0)
+                res = FR_INT_ERR;
+            (*ops)++;
+            *bytes += 512;
+        }
+        clmt_close(&SDFile);
+        if (res != FR_OK)
+            return failed("seek frag.bin", res);
+    }
+    clmt_stats(&st);
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        f_unlink(names[i]);
+    /* the second open found the table, built with one FAT walk */
+    if (st.built != 1 || st.hits != 1)
+        return failed("clmt", FR_INT_ERR);
+    return 0;
+}
+
+static uint32_t capture_time[CAPTURE_RECORDS];
+
+typedef struct {
+    uint32_t records;
+    int bad;
+} window_t;
+
+static int in_window(const datalog_record_t *r, void *ctx)
+{
+    window_t *w = ctx;
+    uint32_t i;
+
+    memcpy(&i, r + 1, sizeof(i));
+    w->bad |= r->size != sizeof(*r) + sizeof(i) + i % 200 || i >= CAPTURE_RECORDS || capture_time[i] != r->time;
+    w->records++;
+    return 0;
+}
+
+/* a capture through the datalog, then time windows out of it with logcat */
+static int capture(uint32_t *ops, uint64_t *bytes)
+{
+    datalog_config_t cfg = {.prefix = "cap", .file_size = CAPTURE_FILE};
+    datalog_stats_t ds;
+    logcat_stats_t ls;
+    uint32_t headers = 0, blocks = 0;
+    uint32_t lba, written;
+    const char *active;
+    int live_read = 0;
+    FRESULT res;
+
+    if (datalog_start(&cfg) != 0)
+        return failed("datalog_start", FR_INT_ERR);
+    for (uint32_t i = 0; i < CAPTURE_RECORDS; i++) {
+        memcpy(buf, &i, sizeof(i));
+        capture_time[i] = HAL_GetTick();
+        datalog_write(DATALOG_USER, buf, sizeof(i) + i % 200);
+        imgdisk_idle(CAPTURE_PERIOD_US);
+        if (i % 64 == 63)
+            datalog_poll();
+        /* once, the file being written: locked to f_open, logcat reads it through the logger */
+        active = datalog_file(&lba, &written);
+        if (!live_read && active && written >= 2 * DATALOG_BUFFER_SIZE) {
+            window_t w = {0};
+            live_read = 1;
+            res = logcat(active + strlen(SDPath), 0, UINT32_MAX, 1, in_window, &w, &ls);
+            if (res != FR_OK)
+                return failed("logcat live", res);
+            if (w.bad || !w.records || ls.bad)
+                return failed("logcat live", FR_INT_ERR);
+        }
+    }
+    datalog_stop();
+    datalog_stats(&ds);
+    if (ds.error || ds.dropped || ds.records != CAPTURE_RECORDS)
+        return failed("datalog", ds.error ? ds.error : FR_INT_ERR);
+
+    for (int i = 0; i < WINDOWS; i++) {
+        uint32_t from = capture_time[0] + (uint32_t)rand() % (capture_time[CAPTURE_RECORDS - 1] - capture_time[0]);
+        uint32_t to = from + WINDOW_MS, expected = 0;
+        window_t w = {0};
+
+        for (uint32_t j = 0; j < CAPTURE_RECORDS; j++)
+            expected += capture_time[j] >= from && capture_time[j] <= to;
+        res = logcat("cap", from, to, i & 1, in_window, &w, &ls);
+        if (res != FR_OK)
+            return failed("logcat", res);
+        if (w.bad || w.records != expected || ls.bad)
+            return failed("logcat window", FR_INT_ERR);
+        headers += ls.headers;
+        blocks += ls.blocks;
+    }
+    *ops = CAPTURE_RECORDS + WINDOWS;
+    *bytes = (uint64_t)ds.written * DATALOG_BUFFER_SIZE;
+    printf("           %" PRIu32 " files, %" PRIu32 " blocks, %d windows: %.1f headers and %.1f blocks read per window\n",
+           ds.files, ds.written, WINDOWS, (double)headers / WINDOWS, (double)blocks / WINDOWS);
+    /* a window of a few ms is one or two blocks, found in a few dozen header reads */
+    if (blocks > 2 * WINDOWS || headers > 40 * WINDOWS)
+        return failed("logcat bisection", FR_INT_ERR);
+    return 0;
+}
+
+static int delete(uint32_t *ops, uint64_t *bytes)
+{
+    static const char *files[] = {"log.txt", "contig.bin", "big.bin", "small"};
+    char path[32];
+    FRESULT res;
+
+    for (int i = 0; i < SMALL_FILES; i++) {
+        snprintf(path, sizeof(path), "small/file%03d.txt", i);
+        res = f_unlink(path);
+        if (res != FR_OK)
+            return failed(path, res);
+    }
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        res = f_unlink(files[i]);
+        if (res != FR_OK)
+            return failed(files[i], res);
+    }
+    *ops = SMALL_FILES + sizeof(files) / sizeof(files[0]);
+    return 0;
+}
+
+static const scenario_t scenarios[] = {
+    {"format", format},         //
+    {"smallfiles", small_files}, //
+    {"dirscan", dir_scan},      //
+    {"logging", logging},       //
+    {"contig", contiguous},     //
+    {"bigfile", big_file},      //
+    {"forward", forward},       //
+    {"seek", seek},             //
+    {"capture", capture},       //
+    {"delete", delete},         //
+};
+
+static int run(const scenario_t *s)
+{
+    imgdisk_stats_t st;
+    sd_cache_stats_t cs;
+    uint32_t ops = 0;
+    uint64_t bytes = 0;
+
+    imgdisk_reset_stats();
+    sd_cache_reset_stats();
+    if (s->run(&ops, &bytes) != 0)
+        return -1;
+    /* what is still in the cache belongs to the scenario */
+    disk_ioctl(0, CTRL_SYNC, NULL);
+    imgdisk_stats(&st);
+    sd_cache_stats(&cs);
+
+    double ms = st.time_ns / 1e6;
+    printf("%-10s %6" PRIu32 " %9.1f %10.1f %9.1f %6" PRIu32 "/%-7" PRIu64 " %6" PRIu32 "/%-7" PRIu64 " %5" PRIu32
+           " %3" PRIu32 " %7" PRIu32 " %6" PRIu32 "/%-6" PRIu32 "\n",
+           s->name, ops, bytes / 1024.0, ms, ms > 0 ? bytes / 1024.0 / (ms / 1000) : 0, st.reads, st.read_sectors,
+           st.writes, st.write_sectors, st.au_opens, st.gc_stalls, st.max_write_us, cs.read_hits, cs.read_misses);
+    results[nresults].name = s->name;
+    results[nresults].ms = ms;
+    nresults++;
+    return 0;
+}
+
+static void print_layout(void)
+{
+    static const char *fs_name[] = {"?", "FAT12", "FAT16", "FAT32", "exFAT"};
+    sd_format_layout_t l;
+
+    if (sd_format_layout(&l) != FR_OK)
+        return;
+    printf("%s, %" PRIu32 " clusters of %" PRIu32 " KB, erase block %" PRIu32 " KB\n",
+           fs_name[l.fs_type <= FS_EXFAT ? l.fs_type : 0], l.clusters, l.cluster / 2, l.erase_block / 2);
+    printf("volume at %" PRIu32 ", FAT at %" PRIu32 " (%" PRIu32 " sectors), data at %" PRIu32 "%s\n\n",
+           l.volume_start, l.fat_start, l.fat_size, l.data_start,
+           l.data_start % l.erase_block ? ", not on an erase block" : "");
+}
+
+static int save(const char *path)
+{
+    FILE *f = fopen(path, "w");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "# scenario simulated_ms, from tools/fatsim with the default model\n");
+    for (int i = 0; i < nresults; i++)
+        fprintf(f, "%s %.1f\n", results[i].name, results[i].ms);
+    fclose(f);
+    return 0;
+}
+
+/* 0 when no scenario is slower than its baseline by more than tolerance percent */
+static int compare(const char *path, double tolerance)
+{
+    FILE *f = fopen(path, "r");
+    char line[128], name[64];
+    double base;
+    int rc = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    printf("\n");
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%63s %lf", name, &base) != 2)
+            continue;
+        for (int i = 0; i < nresults; i++) {
+            if (strcmp(results[i].name, name) != 0)
+                continue;
+            double change = base > 0 ? (results[i].ms - base) * 100 / base : 0;
+            int slower = results[i].ms > base * (1 + tolerance / 100) + 0.05;
+            printf("%-10s %10.1f ms, baseline %10.1f ms, %+6.1f%%%s\n", name, results[i].ms, base, change,
+                   slower ? "  SLOWER" : "");
+            rc |= slower;
+        }
+    }
+    fclose(f);
+    printf("%s\n", rc ? "FAIL" : "PASS");
+    return rc ? -1 : 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] [scenario...]\n"
+            "  -i <image>         disk image (build/fatsim.img)\n"
+            "  -s <MB>            card size (256)\n"
+            "  --au <KB>          allocation unit (4096)\n"
+            "  --open-aus <n>     allocation units the card keeps open (2)\n"
+            "  --gc <MB>          written between garbage collection stalls, 0 for none (32)\n"
+            "  --no-latency       no timing model, only the command counts\n"
+            "  --no-cache         FatFs straight on the card, without Src/sd_cache.c\n"
+            "  --plain            f_mkfs on its own instead of the erase block aligned sd_format()\n"
+            "  --save <file>      write the times as a baseline\n"
+            "  --check <file>     fail when a scenario is slower than the baseline\n"
+            "  --tolerance <pct>  allowed slowdown for --check (2)\n"
+            "scenarios:",
+            argv0);
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        fprintf(stderr, " %s", scenarios[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    enum { OPT_AU = 256, OPT_OPEN, OPT_GC, OPT_NOLAT, OPT_NOCACHE, OPT_PLAIN, OPT_SAVE, OPT_CHECK, OPT_TOL };
+    static const struct option options[] = {
+        {"au", required_argument, 0, OPT_AU},         {"open-aus", required_argument, 0, OPT_OPEN},
+        {"gc", required_argument, 0, OPT_GC},         {"no-latency", no_argument, 0, OPT_NOLAT},
+        {"no-cache", no_argument, 0, OPT_NOCACHE},    {"plain", no_argument, 0, OPT_PLAIN},
+        {"save", required_argument, 0, OPT_SAVE},     {"check", required_argument, 0, OPT_CHECK},
+        {"tolerance", required_argument, 0, OPT_TOL}, {0, 0, 0, 0},
+    };
+    imgdisk_model_t model = imgdisk_sdhc;
+    const char *image = "build/fatsim.img", *save_to = NULL, *check_with = NULL;
+    uint32_t size_mb = 256;
+    double tolerance = 2;
+    int cache = 1, opt, rc = 0;
+
+    while ((opt = getopt_long(argc, argv, "i:s:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'i': image = optarg; break;
+        case 's': size_mb = strtoul(optarg, NULL, 0); break;
+        case OPT_AU: model.au_sectors = strtoul(optarg, NULL, 0) * 2; break;
+        case OPT_OPEN: model.open_aus = strtoul(optarg, NULL, 0); break;
+        case OPT_GC: model.gc_sectors = strtoul(optarg, NULL, 0) * 2048; break;
+        case OPT_NOLAT:
+            model = (imgdisk_model_t){.au_sectors = model.au_sectors, .open_aus = model.open_aus};
+            break;
+        case OPT_NOCACHE: cache = 0; break;
+        case OPT_PLAIN: plain_format = 1; break;
+        case OPT_SAVE: save_to = optarg; break;
+        case OPT_CHECK: check_with = optarg; break;
+        case OPT_TOL: tolerance = strtod(optarg, NULL); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (size_mb < 64 || imgdisk_open(image, size_mb * 2048, &model) != 0)
+        return 2;
+    FATFS_LinkDriver(cache ? &SD_Cache_Driver : &SD_Driver, SDPath);
+    volume_register(SDPath, &SDFatFS, NULL);
+    printf("%" PRIu32 " MB card, AU %" PRIu32 " KB, %" PRIu32 " open, %s, %s format\n", size_mb,
+           model.au_sectors / 2, model.open_aus, cache ? "sector cache" : "no cache",
+           plain_format ? "plain" : "aligned");
+    printf("%-10s %6s %9s %10s %9s %14s %14s %5s %3s %7s %13s\n", "scenario", "ops", "KB", "card ms", "KB/s",
+           "reads/sectors", "writes/sect.", "AUs", "gc", "max us", "cache hit/miss");
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]) && rc == 0; i++) {
+        int selected = optind == argc;
+        for (int a = optind; a < argc; a++)
+            selected |= strcmp(argv[a], scenarios[i].name) == 0;
+        /* the others run on a formatted and mounted volume */
+        if (!selected && i != 0)
+            continue;
+        if (selected)
+            rc = run(&scenarios[i]);
+        else
+            rc = format(&(uint32_t){0}, &(uint64_t){0});
+        if (rc == 0 && i == 0) {
+            FRESULT res = volume_mount(SDPath);
+            if (res != FR_OK)
+                rc = failed("mount", res);
+        }
+    }
+    volume_release(SDPath);
+    if (rc == 0) {
+        printf("\n");
+        print_layout();
+    }
+    imgdisk_close();
+
+    if (rc == 0 && save_to)
+        rc = save(save_to);
+    if (rc == 0 && check_with)
+        rc = compare(check_with, tolerance);
+    return rc ? 1 : 0;
+}
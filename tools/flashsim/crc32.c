@@ -0,0 +1,17 @@
+/*
+ * Host replacement of Src/crc32.c (CRC unit), same values: reflected CRC-32, bit by bit.
+ */
+#include <crc32.h>
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (size--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
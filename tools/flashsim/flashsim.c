@@ -0,0 +1,433 @@
+/*
+ * Host simulator of the QSPI NOR flash setup used by the board, see flashsim.h
+ */
+#include "flashsim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SR_BUSY (1 << 0)
+#define SR_WEL (1 << 1)
+
+#define PAGE_SIZE 256
+#define SFDP_BFPT 0x30
+
+/* status polls a die stays busy after each operation */
+#define BUSY_PROGRAM 1
+#define BUSY_ERASE 3
+
+/* CPU cycles accounted to each controller operation */
+#define CYCLES_COMMAND 200
+#define CYCLES_SWITCH 50
+
+QSPI_HandleTypeDef hqspi;
+DWT_Type flashsim_dwt;
+
+static flashsim_die *banks[2];
+static QSPI_CommandTypeDef pending;
+static QSPI_CommandTypeDef mapped;
+static unsigned controller_errors;
+static size_t window_size;
+
+uint8_t *flashsim_window;
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void build_sfdp(flashsim_die *die)
+{
+    uint8_t *t = die->sfdp;
+
+    memset(t, 0xFF, sizeof(die->sfdp));
+    /* SFDP header, revision 1.0, one parameter header */
+    memcpy(t, "SFDP", 4);
+    t[4] = 0;
+    t[5] = 1;
+    t[6] = 0;
+    /* JEDEC basic flash parameter header, 9 DWORDs at SFDP_BFPT */
+    t[8] = 0x00;
+    t[9] = 0;
+    t[10] = 1;
+    t[11] = 9;
+    t[12] = SFDP_BFPT;
+    t[13] = 0;
+    t[14] = 0;
+    /* 4K erase (20h), 256B pages, 1-1-2/1-2-2/1-4-4/1-1-4 reads, 3 or 4-Byte addressing above 16MB */
+    t = die->sfdp + SFDP_BFPT;
+    t[0] = 0xE5;
+    t[1] = 0x20;
+    t[2] = die->size > (1u << 24) ? 0xF3 : 0xF1;
+    t[3] = 0xFF;
+    put32(t + 4, die->size * 8 - 1);
+    put32(t + 8, 0x6B08EB44);
+    put32(t + 12, 0xBB423B08);
+    put32(t + 16, 0xFFFFFFEE);
+    put32(t + 20, 0xFF00FFFF);
+    put32(t + 24, 0xEB44FFFF);
+    /* erase types: 4K 20h, 32K 52h, 64K D8h */
+    put32(t + 28, 0x520F200C);
+    put32(t + 32, 0x0000D810);
+}
+
+flashsim_die *flashsim_die_new(const char *name, unsigned size_log2)
+{
+    flashsim_die *die = calloc(1, sizeof(*die));
+    if (!die)
+        return NULL;
+    die->name = name;
+    die->size = 1u << size_log2;
+    die->mem = malloc(die->size);
+    if (!die->mem) {
+        free(die);
+        return NULL;
+    }
+    memset(die->mem, 0xFF, die->size);
+    die->jedec[0] = 0xEF;
+    die->jedec[1] = 0x40;
+    die->jedec[2] = size_log2;
+    build_sfdp(die);
+    return die;
+}
+
+void flashsim_die_free(flashsim_die *die)
+{
+    if (die) {
+        free(die->mem);
+        free(die);
+    }
+}
+
+void flashsim_attach(int bank, flashsim_die *die) { banks[bank == 1 ? 0 : 1] = die; }
+
+unsigned flashsim_errors(const flashsim_die *die)
+{
+    return die->stats.addr_errors + die->stats.busy_errors + die->stats.wel_errors + die->stats.align_errors;
+}
+
+void flashsim_print_stats(const flashsim_die *die)
+{
+    printf("  %-6s %u cmds, %u reads, %u programs, %u erases | errors: addr %u busy %u wel %u align %u\n", die->name,
+           die->stats.commands, die->stats.reads, die->stats.programs, die->stats.erases, die->stats.addr_errors,
+           die->stats.busy_errors, die->stats.wel_errors, die->stats.align_errors);
+}
+
+static bool is_4byte_opcode(uint8_t op)
+{
+    switch (op) {
+    case 0x13: case 0x0C: case 0x3C: case 0x6C: case 0xBC: case 0xEC:
+    case 0x12: case 0x34: case 0x21: case 0x5C: case 0xDC:
+        return true;
+    }
+    return false;
+}
+
+static bool is_read(uint8_t op)
+{
+    switch (op) {
+    case 0x03: case 0x0B: case 0x3B: case 0x6B: case 0xBB: case 0xEB:
+    case 0x13: case 0x0C: case 0x3C: case 0x6C: case 0xBC: case 0xEC:
+        return true;
+    }
+    return false;
+}
+
+static unsigned erase_size(uint8_t op)
+{
+    switch (op) {
+    case 0x20: case 0x21:
+        return 4 * 1024;
+    case 0x52: case 0x5C:
+        return 32 * 1024;
+    case 0xD8: case 0xDC:
+        return 64 * 1024;
+    }
+    return 0;
+}
+
+static unsigned address_bits(uint32_t size)
+{
+    switch (size) {
+    case QSPI_ADDRESS_8_BITS:
+        return 8;
+    case QSPI_ADDRESS_16_BITS:
+        return 16;
+    case QSPI_ADDRESS_24_BITS:
+        return 24;
+    default:
+        return 32;
+    }
+}
+
+static bool need_wel(flashsim_die *die, uint8_t op)
+{
+    if (die->sr & SR_WEL)
+        return true;
+    fprintf(stderr, "%s: %02Xh without write enable\n", die->name, op);
+    die->stats.wel_errors++;
+    return false;
+}
+
+/*
+ * One command on one die. tx/rx hold the bytes of this die only and are walked with the given stride, so dual-flash
+ * data can be used in place.
+ */
+static void die_command(flashsim_die *die, const QSPI_CommandTypeDef *cmd, uint32_t addr, const uint8_t *tx,
+                        uint8_t *rx, size_t n, size_t stride)
+{
+    uint8_t op = cmd->Instruction;
+    bool has_addr = cmd->AddressMode != QSPI_ADDRESS_NONE;
+    size_t i;
+
+    die->stats.commands++;
+
+    if (op == 0x05 || op == 0x35 || op == 0x15) {
+        for (i = 0; i < n; i++)
+            rx[i * stride] = op == 0x05 ? die->sr : 0x00;
+        if (die->busy > 0 && --die->busy == 0)
+            die->sr &= ~SR_BUSY;
+        return;
+    }
+    if (die->sr & SR_BUSY) {
+        fprintf(stderr, "%s: %02Xh while busy\n", die->name, op);
+        die->stats.busy_errors++;
+        return;
+    }
+
+    if (has_addr) {
+        unsigned expected = 24;
+        if (op != 0x5A && (die->addr4 || is_4byte_opcode(op)))
+            expected = 32;
+        if (address_bits(cmd->AddressSize) != expected) {
+            fprintf(stderr, "%s: %02Xh with a %u bit address, the die expects %u\n", die->name, op,
+                    address_bits(cmd->AddressSize), expected);
+            die->stats.addr_errors++;
+            return;
+        }
+        if (expected == 24)
+            addr &= 0xFFFFFF;
+        addr &= die->size - 1;
+    }
+
+    if (is_read(op)) {
+        die->stats.reads++;
+        for (i = 0; i < n; i++)
+            rx[i * stride] = die->mem[(addr + i) & (die->size - 1)];
+        return;
+    }
+
+    switch (op) {
+    case 0x06:
+        die->sr |= SR_WEL;
+        break;
+    case 0x04:
+        die->sr &= ~SR_WEL;
+        break;
+    case 0x01:
+        if (need_wel(die, op)) {
+            if (n)
+                die->sr = (die->sr & (SR_BUSY | SR_WEL)) | (tx[0] & ~(SR_BUSY | SR_WEL));
+            die->sr &= ~SR_WEL;
+        }
+        break;
+    case 0x9F:
+        for (i = 0; i < n; i++)
+            rx[i * stride] = i < 3 ? die->jedec[i] : 0;
+        break;
+    case 0x5A:
+        for (i = 0; i < n; i++)
+            rx[i * stride] = (addr + i) < sizeof(die->sfdp) ? die->sfdp[addr + i] : 0xFF;
+        break;
+    case 0x66:
+        break;
+    case 0x99:
+        die->sr &= ~SR_WEL;
+        die->addr4 = false;
+        break;
+    case 0xB7:
+        die->addr4 = true;
+        break;
+    case 0xE9:
+        die->addr4 = false;
+        break;
+    case 0x02:
+    case 0x12:
+    case 0x32:
+    case 0x34:
+        if (need_wel(die, op)) {
+            uint32_t page = addr & ~(PAGE_SIZE - 1);
+            for (i = 0; i < n; i++)
+                die->mem[page + ((addr + i) & (PAGE_SIZE - 1))] &= tx[i * stride];
+            die->stats.programs++;
+            die->sr = (die->sr & ~SR_WEL) | SR_BUSY;
+            die->busy = BUSY_PROGRAM;
+        }
+        break;
+    case 0xC7:
+    case 0x60:
+        if (need_wel(die, op)) {
+            memset(die->mem, 0xFF, die->size);
+            die->stats.erases++;
+            die->sr = (die->sr & ~SR_WEL) | SR_BUSY;
+            die->busy = BUSY_ERASE;
+        }
+        break;
+    default:
+        if (erase_size(op)) {
+            if (need_wel(die, op)) {
+                memset(die->mem + (addr & ~(erase_size(op) - 1)), 0xFF, erase_size(op));
+                die->stats.erases++;
+                die->sr = (die->sr & ~SR_WEL) | SR_BUSY;
+                die->busy = BUSY_ERASE;
+            }
+        } else {
+            fprintf(stderr, "%s: unsupported command %02Xh\n", die->name, op);
+        }
+        break;
+    }
+}
+
+/* run the pending command on the selected bank, or on both in dual-flash mode */
+static HAL_StatusTypeDef execute(const uint8_t *tx, uint8_t *rx, size_t n)
+{
+    if (hqspi.Init.DualFlash == QSPI_DUALFLASH_ENABLE) {
+        uint32_t addr = pending.Address;
+        if (!banks[0] || !banks[1])
+            return HAL_ERROR;
+        /* the controller forces ADDRESS[0] and DL[0], accesses are always byte pairs */
+        if ((pending.AddressMode != QSPI_ADDRESS_NONE && (addr & 1)) || (n & 1)) {
+            banks[0]->stats.align_errors++;
+            addr &= ~1u;
+            n = (n + 1) & ~(size_t)1;
+        }
+        die_command(banks[0], &pending, addr / 2, tx, rx, n / 2, 2);
+        die_command(banks[1], &pending, addr / 2, tx ? tx + 1 : NULL, rx ? rx + 1 : NULL, n / 2, 2);
+        return HAL_OK;
+    }
+
+    flashsim_die *die = banks[hqspi.Init.FlashID == QSPI_FLASH_ID_1 ? 0 : 1];
+    if (!die)
+        return HAL_ERROR;
+    die_command(die, &pending, pending.Address, tx, rx, n, 1);
+    return HAL_OK;
+}
+
+/* like the HAL, indirect accesses are refused while the controller is memory-mapped */
+static bool indirect_allowed(uint32_t op)
+{
+    if (hqspi.State != HAL_QSPI_STATE_BUSY_MEM_MAPPED)
+        return true;
+    fprintf(stderr, "QUADSPI: %02Xh while memory-mapped\n", (unsigned)op);
+    controller_errors++;
+    return false;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *qspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout)
+{
+    (void)qspi;
+    (void)Timeout;
+    if (!indirect_allowed(cmd->Instruction))
+        return HAL_BUSY;
+    flashsim_dwt.CYCCNT += CYCLES_COMMAND;
+    pending = *cmd;
+    if (cmd->DataMode == QSPI_DATA_NONE)
+        return execute(NULL, NULL, 0);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *qspi, uint8_t *pData, uint32_t Timeout)
+{
+    (void)qspi;
+    (void)Timeout;
+    if (!indirect_allowed(pending.Instruction))
+        return HAL_BUSY;
+    return execute(pData, NULL, pending.NbData);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *qspi, uint8_t *pData, uint32_t Timeout)
+{
+    (void)qspi;
+    (void)Timeout;
+    if (!indirect_allowed(pending.Instruction))
+        return HAL_BUSY;
+    if (hqspi.Init.DualFlash == QSPI_DUALFLASH_ENABLE && (pending.NbData & 1)) {
+        /* keep the caller buffer intact, the controller transfers a whole pair */
+        uint8_t *tmp = malloc(pending.NbData + 1);
+        HAL_StatusTypeDef ret = execute(NULL, tmp, pending.NbData + 1);
+        memcpy(pData, tmp, pending.NbData);
+        free(tmp);
+        return ret;
+    }
+    return execute(NULL, pData, pending.NbData);
+}
+
+HAL_StatusTypeDef HAL_QSPI_SetFlashID(QSPI_HandleTypeDef *qspi, uint32_t FlashID)
+{
+    qspi->Init.FlashID = FlashID;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *qspi, QSPI_CommandTypeDef *cmd,
+                                        QSPI_MemoryMappedTypeDef *cfg)
+{
+    (void)cfg;
+    if (qspi->State == HAL_QSPI_STATE_BUSY_MEM_MAPPED)
+        return HAL_BUSY;
+    flashsim_dwt.CYCCNT += CYCLES_SWITCH;
+    mapped = *cmd;
+    qspi->State = HAL_QSPI_STATE_BUSY_MEM_MAPPED;
+    if (flashsim_window)
+        flashsim_mmap_read(0, flashsim_window, window_size);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *qspi)
+{
+    if (qspi->State & 0x2) {
+        flashsim_dwt.CYCCNT += CYCLES_SWITCH;
+        qspi->State = HAL_QSPI_STATE_READY;
+        /* what a CPU would get from the unmapped window: nothing usable */
+        if (flashsim_window)
+            memset(flashsim_window, 0xA5, window_size);
+    }
+    return HAL_OK;
+}
+
+int flashsim_mmap_read(uint32_t addr, uint8_t *buf, size_t n)
+{
+    uint32_t start = addr, end = addr + n;
+    uint8_t *tmp;
+
+    if (hqspi.State != HAL_QSPI_STATE_BUSY_MEM_MAPPED) {
+        fprintf(stderr, "QUADSPI: mapped read at 0x%08X while in indirect mode\n", (unsigned)addr);
+        controller_errors++;
+        return -1;
+    }
+    /* the controller fetches whole byte pairs in dual-flash mode, whatever the bus access */
+    if (hqspi.Init.DualFlash == QSPI_DUALFLASH_ENABLE) {
+        start &= ~1u;
+        end = (end + 1) & ~1u;
+    }
+    tmp = malloc(end - start);
+    pending = mapped;
+    pending.Address = start;
+    pending.NbData = end - start;
+    execute(NULL, tmp, end - start);
+    memcpy(buf, tmp + (addr - start), n);
+    free(tmp);
+    return 0;
+}
+
+unsigned flashsim_controller_errors(void) { return controller_errors; }
+
+void flashsim_window_map(size_t size)
+{
+    window_size = size;
+    flashsim_window = malloc(size);
+    memset(flashsim_window, 0xA5, size);
+}
@@ -0,0 +1,76 @@
+/*
+ * Host simulator of the QSPI NOR flash setup used by the board.
+ *
+ * Each die models a W25Q-class SPI NOR: JEDEC ID, SFDP basic parameter table,
+ * status register with WEL/BUSY, 3/4-Byte addressing, page program and
+ * 4K/32K/64K/chip erase with NOR semantics (program only clears bits). The
+ * QUADSPI controller is modelled at the HAL level: single-flash mode routes
+ * every command to the bank selected by FlashID, dual-flash mode sends it to
+ * both banks with the address halved and the data bytes interleaved.
+ *
+ * Memory-mapped mode is modelled too: indirect commands are refused while
+ * the controller is mapped, and flashsim_mmap_read() stands for a CPU read of
+ * the QSPI window, issuing the configured read command on the dies. For code
+ * that dereferences QSPI_BASE, flashsim_window_map() backs it with a buffer.
+ *
+ * The die checks every command the way a real part would react and counts
+ * protocol violations (wrong address width, commands while busy, program or
+ * erase without WEL) so the SFUD port can be verified without hardware.
+ */
+#ifndef FLASHSIM_H
+#define FLASHSIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stm32h7xx_hal.h>
+
+typedef struct {
+    const char *name;
+    uint8_t *mem;
+    uint32_t size;
+    uint8_t jedec[3];
+    uint8_t sfdp[0x80];
+    uint8_t sr;
+    bool addr4;
+    int busy;
+    struct {
+        unsigned commands;
+        unsigned reads;
+        unsigned programs;
+        unsigned erases;
+        unsigned addr_errors;
+        unsigned busy_errors;
+        unsigned wel_errors;
+        unsigned align_errors;
+    } stats;
+} flashsim_die;
+
+/* QSPI controller handle used by the SFUD port (extern in sfud_port.c) */
+extern QSPI_HandleTypeDef hqspi;
+
+/* create a die of 2^size_log2 bytes, erased */
+flashsim_die *flashsim_die_new(const char *name, unsigned size_log2);
+void flashsim_die_free(flashsim_die *die);
+
+/* attach a die to bank 1 or 2 of the simulated QUADSPI, NULL detaches */
+void flashsim_attach(int bank, flashsim_die *die);
+
+/* total protocol violations seen by a die */
+unsigned flashsim_errors(const flashsim_die *die);
+
+void flashsim_print_stats(const flashsim_die *die);
+
+/* read the memory-mapped window at QSPI_BASE + addr, -1 (and an error) when not mapped */
+int flashsim_mmap_read(uint32_t addr, uint8_t *buf, size_t n);
+
+/*
+ * Back QSPI_BASE with a host buffer of size bytes: code reading the window through pointers (qspiloader) sees the
+ * flash content while mapped and garbage otherwise. Refreshed at every switch, keep the simulated flash small.
+ */
+void flashsim_window_map(size_t size);
+
+/* controller protocol violations: indirect access while mapped, mapped read in indirect mode */
+unsigned flashsim_controller_errors(void);
+
+#endif /* FLASHSIM_H */
@@ -0,0 +1,156 @@
+/*
+ * Host stand-in for the few STM32H7 HAL definitions used by the SFUD QSPI port
+ * (sfud/src/sfud_port.c). The QUADSPI functions are implemented by flashsim.c
+ * on top of the simulated flash dies.
+ */
+#ifndef STM32H7XX_HAL_H
+#define STM32H7XX_HAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+    HAL_OK = 0x00,
+    HAL_ERROR = 0x01,
+    HAL_BUSY = 0x02,
+    HAL_TIMEOUT = 0x03,
+} HAL_StatusTypeDef;
+
+typedef enum {
+    HAL_QSPI_STATE_RESET = 0x00,
+    HAL_QSPI_STATE_READY = 0x01,
+    HAL_QSPI_STATE_BUSY = 0x02,
+    HAL_QSPI_STATE_BUSY_MEM_MAPPED = 0x82,
+    HAL_QSPI_STATE_ERROR = 0x04,
+} HAL_QSPI_StateTypeDef;
+
+typedef struct {
+    uint32_t ClockPrescaler;
+    uint32_t FifoThreshold;
+    uint32_t SampleShifting;
+    uint32_t FlashSize;
+    uint32_t ChipSelectHighTime;
+    uint32_t ClockMode;
+    uint32_t FlashID;
+    uint32_t DualFlash;
+} QSPI_InitTypeDef;
+
+typedef struct {
+    void *Instance;
+    QSPI_InitTypeDef Init;
+    volatile HAL_QSPI_StateTypeDef State;
+    volatile uint32_t ErrorCode;
+} QSPI_HandleTypeDef;
+
+typedef struct {
+    uint32_t Instruction;
+    uint32_t Address;
+    uint32_t AlternateBytes;
+    uint32_t AddressSize;
+    uint32_t AlternateBytesSize;
+    uint32_t DummyCycles;
+    uint32_t InstructionMode;
+    uint32_t AddressMode;
+    uint32_t AlternateByteMode;
+    uint32_t DataMode;
+    uint32_t NbData;
+    uint32_t DdrMode;
+    uint32_t DdrHoldHalfCycle;
+    uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+typedef struct {
+    uint32_t TimeOutPeriod;
+    uint32_t TimeOutActivation;
+} QSPI_MemoryMappedTypeDef;
+
+#define QSPI_FLASH_ID_1 0x00000000u
+#define QSPI_FLASH_ID_2 0x00000080u
+#define QSPI_DUALFLASH_ENABLE 0x00000040u
+#define QSPI_DUALFLASH_DISABLE 0x00000000u
+
+#define QSPI_INSTRUCTION_NONE 0x00000000u
+#define QSPI_INSTRUCTION_1_LINE 0x00000100u
+#define QSPI_INSTRUCTION_2_LINES 0x00000200u
+#define QSPI_INSTRUCTION_4_LINES 0x00000300u
+
+#define QSPI_ADDRESS_NONE 0x00000000u
+#define QSPI_ADDRESS_1_LINE 0x00000400u
+#define QSPI_ADDRESS_2_LINES 0x00000800u
+#define QSPI_ADDRESS_4_LINES 0x00000C00u
+
+#define QSPI_ADDRESS_8_BITS 0x00000000u
+#define QSPI_ADDRESS_16_BITS 0x00001000u
+#define QSPI_ADDRESS_24_BITS 0x00002000u
+#define QSPI_ADDRESS_32_BITS 0x00003000u
+
+#define QSPI_ALTERNATE_BYTES_NONE 0x00000000u
+#define QSPI_ALTERNATE_BYTES_1_LINE 0x00004000u
+#define QSPI_ALTERNATE_BYTES_4_LINES 0x0000C000u
+#define QSPI_ALTERNATE_BYTES_8_BITS 0x00000000u
+
+#define QSPI_DATA_NONE 0x00000000u
+#define QSPI_DATA_1_LINE 0x01000000u
+#define QSPI_DATA_2_LINES 0x02000000u
+#define QSPI_DATA_4_LINES 0x03000000u
+
+#define QSPI_DDR_MODE_DISABLE 0x00000000u
+#define QSPI_DDR_HHC_ANALOG_DELAY 0x00000000u
+#define QSPI_SIOO_INST_EVERY_CMD 0x00000000u
+
+#define QSPI_TIMEOUT_COUNTER_DISABLE 0x00000000u
+#define QSPI_TIMEOUT_COUNTER_ENABLE 0x00000008u
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_SetFlashID(QSPI_HandleTypeDef *hqspi, uint32_t FlashID);
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd,
+                                        QSPI_MemoryMappedTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi);
+
+/* cycle counter, advanced by the simulated controller */
+typedef struct {
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+extern DWT_Type flashsim_dwt;
+#define DWT (&flashsim_dwt)
+
+typedef struct {
+    uint32_t dummy;
+} GPIO_TypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET,
+} GPIO_PinState;
+
+static inline void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    (void)GPIOx;
+    (void)GPIO_Pin;
+    (void)PinState;
+}
+
+/* the memory-mapped window, refreshed by flashsim when the controller enters memory-mapped mode */
+extern uint8_t *flashsim_window;
+#define QSPI_BASE ((uintptr_t)flashsim_window)
+
+static inline uint32_t HAL_GetTick(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline void __DMB(void) { __sync_synchronize(); }
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void SCB_CleanInvalidateDCache(void) {}
+
+#define assert_param(expr) ((void)0)
+
+#endif /* STM32H7XX_HAL_H */
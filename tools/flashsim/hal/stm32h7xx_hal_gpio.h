@@ -0,0 +1 @@
+/* GPIO definitions live in stm32h7xx_hal.h for the host build */
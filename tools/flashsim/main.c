@@ -0,0 +1,228 @@
+/*
+ * Verify the SFUD QSPI port against the flash simulator.
+ *
+ * The topology comes from sfud_cfg.h exactly like on the target, so the
+ * Makefile builds one binary per configuration (single bank, bank 1 + bank 2,
+ * dual-flash) and per die size (3-Byte and 4-Byte addressing). Each run drives
+ * every SFUD device through random erase/write/read rounds in normal and fast
+ * read mode, compares against a shadow copy and checks the simulator did not
+ * see any protocol violation. The memory-mapped device is verified while
+ * holding a qspi_mode lease: every update must go through an abort and leave
+ * the window mapped again with the new content. Every other round erases the
+ * way qspiloader does: sfud_erase_start(), poll, then sfud_write().
+ */
+#include "flashsim.h"
+
+#include <qspi_mode.h>
+#include <sfud.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned rounds = 200;
+static unsigned seed = 1;
+
+static uint32_t rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xFFFFFF;
+}
+
+static uint32_t rnd_range(uint32_t n) { return ((uint64_t)rnd() << 8 | (rnd() & 0xFF)) % n; }
+
+/* dual-flash mode only moves byte pairs, keep accesses aligned the way the application must */
+static uint32_t align_access(uint32_t v) { return SFUD_QSPI_DIE_COUNT > 1 ? v & ~1u : v; }
+
+static int erase_write(sfud_flash *flash, uint8_t *shadow, uint32_t addr, size_t size)
+{
+    uint32_t gran = flash->chip.erase_gran;
+    uint32_t end = ((addr + size + gran - 1) / gran) * gran;
+    uint8_t *data = malloc(size);
+    sfud_err e;
+
+    for (size_t i = 0; i < size; i++)
+        data[i] = rnd();
+    if (rnd() & 1) {
+        e = sfud_erase_write(flash, addr, size, data);
+    } else {
+        size_t started;
+        bool busy;
+        qspi_indirect_begin();
+        e = sfud_erase_start(flash, addr, size, &started);
+        if (e == SFUD_SUCCESS)
+            e = sfud_busy(flash, &busy);
+        if (e == SFUD_SUCCESS && !busy) {
+            printf("%s: not busy after sfud_erase_start()\n", flash->name);
+            e = SFUD_ERR_TIMEOUT;
+        }
+        /* the flash must not be mapped while it erases */
+        if (e == SFUD_SUCCESS && (qspi_mmap_active() || qspi_mmap_acquire() == 0)) {
+            printf("%s: memory-mapped during sfud_erase_start()\n", flash->name);
+            e = SFUD_ERR_TIMEOUT;
+        }
+        if (e == SFUD_SUCCESS)
+            e = sfud_wait_ready(flash);
+        qspi_indirect_end();
+        if (e == SFUD_SUCCESS && started < size)
+            e = sfud_erase(flash, addr + started, size - started);
+        if (e == SFUD_SUCCESS)
+            e = sfud_write(flash, addr, size, data);
+    }
+    if (e != SFUD_SUCCESS) {
+        printf("%s: erase_write 0x%08X+%u failed (%d)\n", flash->name, (unsigned)addr, (unsigned)size, e);
+        free(data);
+        return 1;
+    }
+    memset(shadow + addr, 0xFF, end - addr);
+    memcpy(shadow + addr, data, size);
+    free(data);
+    return 0;
+}
+
+static int read_check(sfud_flash *flash, const uint8_t *shadow, uint32_t addr, size_t size)
+{
+    uint8_t *data = malloc(size);
+    int fail = 0;
+
+    if (sfud_read(flash, addr, size, data) != SFUD_SUCCESS || memcmp(data, shadow + addr, size) != 0) {
+        printf("%s: read back 0x%08X+%u mismatch\n", flash->name, (unsigned)addr, (unsigned)size);
+        fail = 1;
+    }
+    free(data);
+    return fail;
+}
+
+/* what a CPU reading QSPI_BASE would see, the lease must have brought the mapping back */
+static int mmap_check(const uint8_t *shadow, uint32_t addr, size_t size)
+{
+    uint8_t *data = malloc(size);
+    int fail = 0;
+
+    if (!qspi_mmap_active() || flashsim_mmap_read(addr, data, size) != 0 || memcmp(data, shadow + addr, size) != 0) {
+        printf("memory-mapped read 0x%08X+%u mismatch\n", (unsigned)addr, (unsigned)size);
+        fail = 1;
+    }
+    free(data);
+    return fail;
+}
+
+static int run_rounds(sfud_flash *flash, uint8_t *shadow, unsigned n, bool leased)
+{
+    uint32_t cap = flash->chip.capacity;
+    uint32_t gran = flash->chip.erase_gran;
+    int fail = 0;
+
+    for (unsigned r = 0; r < n && !fail; r++) {
+        uint32_t addr = rnd_range(cap / gran) * gran;
+        size_t size = align_access(2 + rnd_range(3 * gran));
+        if (addr + size > cap)
+            size = cap - addr;
+        fail |= erase_write(flash, shadow, addr, size);
+        if (leased && !fail)
+            fail |= mmap_check(shadow, addr, size);
+
+        addr = align_access(rnd_range(cap));
+        size = align_access(2 + rnd_range(4096));
+        if (addr + size > cap)
+            size = cap - addr;
+        fail |= read_check(flash, shadow, addr, size);
+    }
+    /* accesses crossing the 3-Byte address limit of the die */
+    if (!fail && cap > (1u << 24)) {
+        fail |= erase_write(flash, shadow, (1u << 24) - 2 * gran, 4 * gran);
+        fail |= read_check(flash, shadow, (1u << 24) - gran, 2 * gran);
+    }
+    return fail;
+}
+
+static int verify_device(sfud_flash *flash, flashsim_die *const *dies, bool leased)
+{
+    uint8_t *shadow = malloc(flash->chip.capacity);
+    int fail = 0;
+
+    printf("%s: %u bytes, erase granularity %u, %s addressing\n", flash->name, (unsigned)flash->chip.capacity,
+           (unsigned)flash->chip.erase_gran, flash->addr_in_4_byte ? "4-Byte" : "3-Byte");
+    memset(shadow, 0xFF, flash->chip.capacity);
+
+    if (leased && qspi_mmap_acquire() != 0) {
+        printf("%s: cannot take a memory-mapped lease\n", flash->name);
+        fail = 1;
+    }
+    fail |= run_rounds(flash, shadow, rounds / 2, leased);
+    if (sfud_qspi_fast_read_enable(flash, 4) != SFUD_SUCCESS)
+        fail = 1;
+    printf("%s: fast read %02Xh, %u bit address\n", flash->name, flash->read_cmd_format.instruction,
+           flash->read_cmd_format.address_size);
+    fail |= run_rounds(flash, shadow, rounds - rounds / 2, leased);
+    if (leased) {
+        qspi_mmap_release();
+        if (qspi_mmap_active()) {
+            printf("%s: still memory-mapped without leases\n", flash->name);
+            fail = 1;
+        }
+    }
+
+    /* the array content must be spread over the dies the way QUADSPI interleaves it */
+    for (uint32_t i = 0; i < flash->chip.capacity && !fail; i++) {
+        const flashsim_die *die = dies[i % SFUD_QSPI_DIE_COUNT];
+        if (die->mem[i / SFUD_QSPI_DIE_COUNT] != shadow[i]) {
+            printf("%s: byte 0x%08X is not at offset 0x%08X of %s\n", flash->name, (unsigned)i,
+                   (unsigned)(i / SFUD_QSPI_DIE_COUNT), die->name);
+            fail = 1;
+        }
+    }
+    free(shadow);
+    return fail;
+}
+
+int main(int argc, char **argv)
+{
+    flashsim_die *bk1 = flashsim_die_new("BK1", SFUD_QSPI_DIE_SIZE_LOG2);
+    flashsim_die *bk2 = flashsim_die_new("BK2", SFUD_QSPI_DIE_SIZE_LOG2);
+    int fail = 0;
+
+    if (argc > 1)
+        rounds = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        seed = strtoul(argv[2], NULL, 0);
+
+    hqspi.Init.FlashSize = SFUD_QSPI_FLASH_SIZE;
+    hqspi.Init.FlashID = SFUD_QSPI_FLASH_ID;
+    hqspi.Init.DualFlash = SFUD_QSPI_DUAL_FLASH_MODE;
+    flashsim_attach(2, bk2);
+#if defined(SFUD_QSPI_BANK1_FLASH) || defined(SFUD_QSPI_DUAL_FLASH)
+    flashsim_attach(1, bk1);
+#endif
+
+    if (sfud_init() != SFUD_SUCCESS) {
+        printf("sfud_init failed\n");
+        return 1;
+    }
+
+#ifdef SFUD_QSPI_DUAL_FLASH
+    flashsim_die *dual[2] = {bk1, bk2};
+    fail |= verify_device(sfud_get_device(SFUD_W25_DEVICE_INDEX), dual, true);
+#else
+    fail |= verify_device(sfud_get_device(SFUD_W25_DEVICE_INDEX), &bk2, true);
+#ifdef SFUD_QSPI_BANK1_FLASH
+    /* bank 1 updates must not disturb the bank 2 mapping: it is not leased here, but must stay reachable */
+    fail |= verify_device(sfud_get_device(SFUD_BK1_DEVICE_INDEX), &bk1, false);
+#endif
+#endif
+
+    qspi_mode_stats_t st;
+    qspi_mode_stats(&st);
+    printf("  QSPI   %u enters, %u aborts, %u failed, %llu cycles mapped, %llu cycles suspended\n",
+           (unsigned)st.enters, (unsigned)st.aborts, (unsigned)st.failures, (unsigned long long)st.mapped_cycles,
+           (unsigned long long)st.suspended_cycles);
+    flashsim_print_stats(bk1);
+    flashsim_print_stats(bk2);
+    if (flashsim_errors(bk1) || flashsim_errors(bk2) || flashsim_controller_errors() || st.failures ||
+        st.enters != st.aborts)
+        fail = 1;
+
+    printf("%s\n", fail ? "FAIL" : "PASS");
+    flashsim_die_free(bk1);
+    flashsim_die_free(bk2);
+    return fail;
+}
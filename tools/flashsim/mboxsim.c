@@ -0,0 +1,239 @@
+/*
+ * Host stand-in for qspiloader/mailbox.tcl.
+ *
+ * The loader side is the target code itself (qspiloader/image.c and
+ * mailbox.c) running against the flash simulator. A producer thread plays the
+ * debugger: it waits for the mailbox, writes the image file into the slots
+ * and bumps head, with random delays so the loader sees both full and empty
+ * rings. At the end the flash must hold the expected binary and the loader
+ * status must be 0.
+ *
+ *   mboxsim image.bin
+ *   mboxsim image.qpk image.bin     packed image, checked against the binary
+ *
+ * A delta flash starts from a flash holding an older binary (--preload), the
+ * first run saves the sector hashes the loader reports, the second one writes
+ * the delta image qspipack.py builds out of them:
+ *
+ *   mboxsim --preload old.bin --hash hashes.bin new.bin
+ *   mboxsim --preload old.bin delta.qpk new.bin
+ */
+#include "flashsim.h"
+
+#include "image.h"
+#include "mailbox.h"
+
+#include <crc32.h>
+#include <pthread.h>
+#include <sfud.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    mailbox_t *mbox;
+    const uint8_t *data;
+    size_t length;
+    unsigned seed;
+    unsigned stalls; /* times the ring was full */
+    bool hash;       /* MAILBOX_HASH instead of MAILBOX_PROGRAM */
+} producer_t;
+
+static uint8_t *load(const char *name, size_t *length)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *data;
+
+    if (!f) {
+        perror(name);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(*length ? *length : 1);
+    if (fread(data, 1, *length, f) != *length) {
+        perror(name);
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+static void jitter(producer_t *p)
+{
+    if (rand_r(&p->seed) % 4 == 0)
+        usleep(rand_r(&p->seed) % 2000);
+}
+
+/* what mailbox.tcl does through mrw/mww/write_memory */
+static void *producer(void *arg)
+{
+    producer_t *p = arg;
+    mailbox_t *m = p->mbox;
+    uint32_t head = 0;
+    size_t sent = 0;
+
+    while (m->magic != MAILBOX_MAGIC)
+        usleep(100);
+    __DMB();
+    m->length = p->length;
+    __DMB();
+    m->command = p->hash ? MAILBOX_HASH : MAILBOX_PROGRAM;
+    if (p->hash)
+        return NULL;
+    while (sent < p->length && m->status == MAILBOX_RUNNING) {
+        if (head - m->tail >= m->slot_count) {
+            p->stalls++;
+            while (head - m->tail >= m->slot_count && m->status == MAILBOX_RUNNING)
+                usleep(50);
+            continue;
+        }
+        jitter(p);
+        uint32_t index = head % m->slot_count;
+        size_t n = p->length - sent < m->slot_size ? p->length - sent : m->slot_size;
+        /* the debugger writes whole words, the tail of the last slot is padding */
+        memset((uint8_t *)m + m->slot_offset + index * m->slot_size, 0xFF, (n + 3) & ~3u);
+        memcpy((uint8_t *)m + m->slot_offset + index * m->slot_size, p->data + sent, n);
+        m->fill[index] = n;
+        __DMB();
+        m->head = ++head;
+        sent += n;
+    }
+    return NULL;
+}
+
+/* the loader side of a mailbox run, as qspiloader's programMailbox() */
+static sfud_err loader(sfud_flash *flash, mailbox_t *mbox, image_result_t *result)
+{
+    mailbox_reader_t reader;
+    image_source_t src;
+    sfud_err e = SFUD_ERR_TIMEOUT;
+    int count;
+
+    switch (mailbox_open(&reader, mbox, 5000)) {
+    case MAILBOX_PROGRAM:
+        mailbox_source(&reader, &src);
+        e = image_program(flash, &src, result);
+        break;
+    case MAILBOX_HASH:
+        count = image_hash(mailbox_hash_length(&reader), MAILBOX_HASH_SECTOR, mailbox_hash_table(&reader),
+                           MAILBOX_HASH_MAX);
+        e = count < 0 ? SFUD_ERR_READ : SFUD_SUCCESS;
+        if (count >= 0)
+            mailbox_publish_hashes(&reader, count);
+        break;
+    }
+    mailbox_close(&reader, -(int)e);
+    return e;
+}
+
+/* the hashes must be those of the flash content, as the host saves them */
+static int save_hashes(mailbox_t *m, const flashsim_die *die, size_t length, const char *name)
+{
+    const uint32_t *table = (const uint32_t *)((const uint8_t *)m + m->hash_offset);
+    uint32_t count = (length + MAILBOX_HASH_SECTOR - 1) / MAILBOX_HASH_SECTOR;
+    FILE *f;
+
+    if (m->hash_count != count) {
+        printf("%u sector hashes, expected %u\n", (unsigned)m->hash_count, (unsigned)count);
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        size_t n = length - i * MAILBOX_HASH_SECTOR < MAILBOX_HASH_SECTOR ? length - i * MAILBOX_HASH_SECTOR
+                                                                           : MAILBOX_HASH_SECTOR;
+        if (table[i] != crc32(die->mem + i * MAILBOX_HASH_SECTOR, n)) {
+            printf("sector %u hash 0x%08X does not match the flash\n", (unsigned)i, (unsigned)table[i]);
+            return -1;
+        }
+    }
+    f = fopen(name, "wb");
+    if (!f || fwrite(table, 4, count, f) != count) {
+        perror(name);
+        return -1;
+    }
+    fclose(f);
+    printf("%u sector hashes saved in %s\n", (unsigned)count, name);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    flashsim_die *die = flashsim_die_new("BK2", SFUD_QSPI_DIE_SIZE_LOG2);
+    producer_t prod = {0};
+    image_result_t result;
+    pthread_t thread;
+    size_t expected_length;
+    uint8_t *expected;
+    const char *hash_file = NULL;
+    uint8_t *preload = NULL;
+    size_t preload_length = 0;
+    int fail = 0;
+
+    for (; argc > 2 && argv[1][0] == '-'; argc -= 2, argv += 2) {
+        if (strcmp(argv[1], "--preload") == 0)
+            preload = load(argv[2], &preload_length);
+        else if (strcmp(argv[1], "--hash") == 0)
+            hash_file = argv[2];
+        else
+            break;
+    }
+    if (argc < 2 || argv[1][0] == '-') {
+        fprintf(stderr, "usage: %s [--preload old] [--hash table] image [expected]\n", argv[0]);
+        return 2;
+    }
+    prod.hash = hash_file != NULL;
+    prod.data = load(argv[1], &prod.length);
+    expected = argc > 2 ? load(argv[2], &expected_length) : (uint8_t *)prod.data;
+    expected_length = argc > 2 ? expected_length : prod.length;
+    prod.seed = 1;
+
+    hqspi.Init.FlashSize = SFUD_QSPI_FLASH_SIZE;
+    hqspi.Init.FlashID = SFUD_QSPI_FLASH_ID;
+    hqspi.Init.DualFlash = SFUD_QSPI_DUAL_FLASH_MODE;
+    flashsim_attach(2, die);
+    if (sfud_init() != SFUD_SUCCESS) {
+        printf("sfud_init failed\n");
+        return 1;
+    }
+    sfud_flash *flash = sfud_get_device(SFUD_W25_DEVICE_INDEX);
+    flashsim_window_map(flash->chip.capacity);
+    /* stale content the image must replace, or the image a delta is made against */
+    memset(die->mem, 0x5A, die->size);
+    if (preload)
+        memcpy(die->mem, preload, preload_length);
+
+    /* the AXI SRAM half the loader leaves to the host */
+    prod.mbox = calloc(1, MAILBOX_SIZE);
+    pthread_create(&thread, NULL, producer, &prod);
+
+    sfud_err e = loader(flash, prod.mbox, &result);
+    pthread_join(thread, NULL);
+
+    if (e != SFUD_SUCCESS || prod.mbox->status != 0) {
+        printf("loader failed (%d), status %d\n", e, (int)prod.mbox->status);
+        fail = 1;
+    } else if (hash_file) {
+        fail = save_hashes(prod.mbox, die, prod.length, hash_file) != 0;
+    } else if (result.size != expected_length || memcmp(die->mem, expected, expected_length) != 0 ||
+               (!result.skipped && prod.mbox->programmed != expected_length)) {
+        printf("flash content does not match %s\n", argc > 2 ? argv[2] : argv[1]);
+        fail = 1;
+    } else if (preload && !result.skipped) {
+        printf("delta image rewrote every sector\n");
+        fail = 1;
+    } else {
+        printf("%s: %u bytes (%u unchanged) from %u transferred (%s), %u slot waits, CRC32 0x%08X\n", argv[1],
+               (unsigned)result.size, (unsigned)result.skipped, (unsigned)result.transferred,
+               result.packed ? "packed" : "plain", prod.stalls, (unsigned)result.crc);
+    }
+    flashsim_print_stats(die);
+    if (flashsim_errors(die) || flashsim_controller_errors())
+        fail = 1;
+
+    printf("%s\n", fail ? "FAIL" : "PASS");
+    flashsim_die_free(die);
+    return fail;
+}
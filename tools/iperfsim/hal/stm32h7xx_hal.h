@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for the cycle counter Src/cycles.c extends, Src/iperf.c keeps its time with it. main.c advances it with
+ * the simulated clock and calls cycles_tick() every simulated millisecond like SysTick_Handler(). Nothing interrupts
+ * the host build, masking is a no-op.
+ */
+#ifndef STM32H7XX_HAL_H
+#define STM32H7XX_HAL_H
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+extern DWT_Type iperfsim_dwt;
+#define DWT (&iperfsim_dwt)
+
+extern uint32_t SystemCoreClock;
+
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) {}
+
+#endif
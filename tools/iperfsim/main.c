@@ -0,0 +1,391 @@
+/*
+ * iperf over a loopback wire: the server and the client of Src/iperf.c in one stack with the firmware's lwIP
+ * configuration, run like the firmware's main loop on a simulated clock (STEP_US per turn). Both ends speak the wire
+ * format of a host iperf 2, so a scenario that passes shows the byte counts, the server report and the loss accounting
+ * agree. The rates only tell how many turns the stack needed, not what the board does.
+ *
+ * With --tap the same stack runs on the host clock behind a Linux TAP interface instead, one test against a real
+ * iperf 2 on the host: the check of the wire format against the other implementation.
+ */
+#include <cycles.h>
+#include <iperf.h>
+
+#include "lwip/etharp.h"
+#include "lwip/init.h"
+#include "lwip/ip4.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/prot/ip.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+#include "netif/ethernet.h"
+#include "tap.h"
+#include <stm32h7xx_hal.h>
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STEP_US 10
+#define SETTLE_US 1000000 /* for the server to see the close or the last datagram */
+
+DWT_Type iperfsim_dwt;
+uint32_t SystemCoreClock = 480000000;
+
+static uint64_t now;
+static uint64_t ticked; /* ms of the last cycles_tick() */
+static bool bridge;     /* --tap: host clock and a TAP interface, no loopback wire */
+
+u32_t sys_now(void)
+{
+    return now / 1000;
+}
+
+/* final reports and interval counts: client, server */
+static iperf_report_t final[2];
+static int finals[2], intervals[2];
+
+static void on_report(const iperf_report_t *r)
+{
+    char line[200];
+
+    iperf_format(r, line, sizeof(line));
+    printf("  %s\n", line);
+    if (r->final) {
+        final[r->server] = *r;
+        finals[r->server]++;
+    } else {
+        intervals[r->server]++;
+    }
+}
+
+/*
+ * The wire: the interface sends to its own address, every packet is copied into pool pbufs like a received frame and
+ * goes up the stack at the next turn. The UDP data datagrams to the iperf port can be dropped or held back behind the
+ * next one on the way.
+ */
+#define WIRE_SIZE 64
+
+static struct netif wire_netif;
+static struct pbuf *wire[WIRE_SIZE];
+static uint32_t wire_head, wire_count, wire_overflows;
+static uint32_t drop_every, delay_every;
+static uint32_t datagrams, dropped, delayed;
+static struct pbuf *held;
+
+static void wire_put(struct pbuf *p)
+{
+    struct pbuf *q = wire_count < WIRE_SIZE ? pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_POOL) : NULL;
+
+    if (!q) {
+        wire_overflows++;
+        return;
+    }
+    pbuf_copy(q, p);
+    wire[(wire_head + wire_count++) % WIRE_SIZE] = q;
+}
+
+static err_t wire_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *addr)
+{
+    uint8_t b[20 + 8 + 4]; /* IP without options, UDP, the datagram id */
+
+    if (pbuf_copy_partial(p, b, sizeof(b), 0) != sizeof(b) || b[9] != IP_PROTO_UDP ||
+        (b[22] << 8 | b[23]) != IPERF_PORT || b[28] & 0x80) {
+        wire_put(p);
+        return ERR_OK;
+    }
+    datagrams++;
+    if (drop_every && datagrams % drop_every == 0) {
+        dropped++;
+        return ERR_OK;
+    }
+    if (delay_every && datagrams % delay_every == delay_every / 2 && !held) {
+        held = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_POOL);
+        if (held) {
+            pbuf_copy(held, p);
+            delayed++;
+        }
+        return ERR_OK;
+    }
+    wire_put(p);
+    if (held) {
+        wire_put(held);
+        pbuf_free(held);
+        held = NULL;
+    }
+    return ERR_OK;
+}
+
+static err_t wire_init(struct netif *netif)
+{
+    netif->name[0] = 's';
+    netif->name[1] = 'i';
+    netif->output = wire_output;
+    netif->mtu = 1500;
+    return ERR_OK;
+}
+
+/*
+ * The TAP link: an Ethernet interface with ARP like the board's, the host kernel on the other end. The stack computes
+ * every checksum here, the default of a netif, where the board leaves them to the MAC.
+ */
+static struct netif tap_netif;
+static uint8_t frame[1514];
+
+static err_t tap_output(struct netif *netif, struct pbuf *p)
+{
+    if (p->tot_len > sizeof(frame))
+        return ERR_BUF;
+    pbuf_copy_partial(p, frame, p->tot_len, 0);
+    return tap_write(frame, p->tot_len) == 0 ? ERR_OK : ERR_IF;
+}
+
+static err_t tap_init(struct netif *netif)
+{
+    static const uint8_t mac[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+    netif->name[0] = 't';
+    netif->name[1] = 'p';
+    netif->output = etharp_output;
+    netif->linkoutput = tap_output;
+    netif->mtu = 1500;
+    netif->hwaddr_len = sizeof(mac);
+    memcpy(netif->hwaddr, mac, sizeof(mac));
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+    return ERR_OK;
+}
+
+static void tap_poll(void)
+{
+    int n;
+
+    while ((n = tap_read(frame, sizeof(frame))) > 0) {
+        struct pbuf *p = pbuf_alloc(PBUF_RAW, n, PBUF_POOL);
+        if (!p)
+            break;
+        pbuf_take(p, frame, n);
+        if (tap_netif.input(p, &tap_netif) != ERR_OK)
+            pbuf_free(p);
+    }
+}
+
+static uint64_t host_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/* a turn of the firmware's main loop */
+static void step(void)
+{
+    static uint64_t epoch;
+
+    if (bridge)
+        tap_poll();
+    for (uint32_t n = wire_count; n; n--) {
+        struct pbuf *p = wire[wire_head];
+        wire_head = (wire_head + 1) % WIRE_SIZE;
+        wire_count--;
+        if (wire_netif.input(p, &wire_netif) != ERR_OK)
+            pbuf_free(p);
+    }
+    sys_check_timeouts();
+    iperf_poll();
+    if (bridge) {
+        epoch = epoch ? epoch : host_us();
+        now = host_us() - epoch;
+    } else {
+        now += STEP_US;
+    }
+    /* wraps every 8.9 s like the real one, the tick folds it */
+    iperfsim_dwt.CYCCNT = now * (SystemCoreClock / 1000000);
+    if (now / 1000 != ticked) {
+        ticked = now / 1000;
+        cycles_tick();
+    }
+}
+
+typedef struct {
+    const char *name;
+    bool udp;
+    uint32_t rate, len, seconds;
+    uint32_t drop_every, delay_every;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"tcp", false, 0, IPERF_LEN_TCP, 10, 0, 0},
+    {"tcp, short writes", false, 0, 100, 3, 0, 0},
+    {"udp 10 Mbit/s", true, 10000000, IPERF_LEN_UDP, 5, 0, 0},
+    {"udp 50 Mbit/s, 1 in 97 dropped, 1 in 89 late", true, 50000000, IPERF_LEN_UDP, 5, 97, 89},
+    {"udp 2 Mbit/s, header only", true, 2000000, 36, 3, 0, 0},
+};
+
+static int fail(const char *what)
+{
+    printf("FAIL: %s\n", what);
+    return 1;
+}
+
+static int run(const scenario_t *sc)
+{
+    iperf_config_t server = {.server = true, .udp = sc->udp, .port = IPERF_PORT, .interval_ms = 1000};
+    iperf_config_t client = {.udp = sc->udp,
+                             .port = IPERF_PORT,
+                             .duration_ms = sc->seconds * 1000,
+                             .interval_ms = 1000,
+                             .rate = sc->rate,
+                             .len = sc->len};
+    const iperf_report_t *c = &final[0], *s = &final[1];
+    int errors = 0;
+
+    printf("== %s\n", sc->name);
+    memset(final, 0, sizeof(final));
+    memset(finals, 0, sizeof(finals));
+    memset(intervals, 0, sizeof(intervals));
+    drop_every = sc->drop_every;
+    delay_every = sc->delay_every;
+    datagrams = dropped = delayed = wire_overflows = 0;
+
+    ip_addr_copy_from_ip4(client.remote, *netif_ip4_addr(&wire_netif));
+    if (iperf_start(&server, on_report) || iperf_start(&client, on_report))
+        return fail("start");
+    for (uint64_t until = now + (sc->seconds + 10) * 1000000ull; iperf_running(false) && now < until;)
+        step();
+    for (uint64_t until = now + SETTLE_US; !finals[1] && now < until;)
+        step();
+    iperf_stop(-1);
+    /* the last ACK of the server's close, its port is free for the next scenario */
+    for (uint64_t until = now + SETTLE_US; now < until;)
+        step();
+
+    if (finals[0] != 1 || finals[1] != 1)
+        errors += fail("one final report from each end");
+    if (intervals[0] != (int)sc->seconds)
+        errors += fail("an interval report per second from the client");
+    if (c->aborted || s->aborted)
+        errors += fail("aborted");
+    if (c->errors)
+        errors += fail("send errors");
+    if (wire_overflows)
+        errors += fail("packets lost on the wire");
+    if (!sc->udp) {
+        if (!c->bytes || c->bytes != s->bytes)
+            errors += fail("bytes acknowledged to the client and received by the server");
+        return errors;
+    }
+    printf("  %" PRIu32 " datagrams, %" PRIu32 " dropped, %" PRIu32 " late\n", datagrams, dropped, delayed);
+    if (!c->remote)
+        errors += fail("server report");
+    if (c->remote_bytes != s->bytes || c->bytes != s->bytes + (uint64_t)dropped * sc->len)
+        errors += fail("bytes sent, received and reported");
+    if (s->lost != dropped || c->lost != dropped || s->out_of_order != delayed || c->out_of_order != delayed)
+        errors += fail("lost and out of order datagrams");
+    if (c->datagrams != s->datagrams)
+        errors += fail("datagrams sent and seen by the server");
+    /* the pace of the client, within a datagram */
+    if (c->bytes * 8 / sc->seconds + sc->len * 8 < sc->rate || c->bytes * 8 / sc->seconds > sc->rate + sc->len * 8)
+        errors += fail("rate");
+    return errors;
+}
+
+/* one test against the host's iperf, a server until its final report or a client for its time */
+static int run_bridge(const iperf_config_t *cfg)
+{
+    const iperf_report_t *r = &final[cfg->server];
+
+    if (iperf_start(cfg, on_report))
+        return fail("start");
+    if (cfg->server)
+        printf("server on %s port %u, run iperf -c %s%s -i 1 on the host\n", ip4addr_ntoa(netif_ip4_addr(&tap_netif)),
+               cfg->port, ip4addr_ntoa(netif_ip4_addr(&tap_netif)), cfg->udp ? " -u" : "");
+    while (cfg->server ? !finals[1] : iperf_running(false))
+        step();
+    for (uint64_t until = now + SETTLE_US; now < until;)
+        step();
+    iperf_stop(-1);
+    if (finals[cfg->server] != 1)
+        return fail("one final report");
+    if (r->aborted)
+        return fail("aborted");
+    if (!r->bytes)
+        return fail("no data");
+    if (cfg->udp && !cfg->server && !r->remote)
+        return fail("server report");
+    printf("bridge test passed\n");
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s                  the loopback scenarios\n"
+            "       %s --tap <if> -s [-u]\n"
+            "       %s --tap <if> -c <host> [-u] [-b <bit/s>] [-t <s>] [-l <len>]\n"
+            "  --tap <if>    a TAP interface set up on the host (ip tuntap add <if> mode tap)\n"
+            "  --addr <ip>   the stack's address on it, a /24 (192.168.7.2)\n",
+            argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+    enum { OPT_TAP = 256, OPT_ADDR };
+    static const struct option options[] = {
+        {"tap", required_argument, 0, OPT_TAP}, {"addr", required_argument, 0, OPT_ADDR}, {0, 0, 0, 0},
+    };
+    iperf_config_t cfg = {.port = IPERF_PORT, .duration_ms = 10000, .interval_ms = 1000, .rate = IPERF_RATE};
+    const char *tap = NULL, *local = "192.168.7.2", *host = NULL;
+    int errors = 0, opt;
+
+    ip4_addr_t addr, mask, gw;
+
+    while ((opt = getopt_long(argc, argv, "sc:ub:t:l:h", options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_TAP: tap = optarg; break;
+        case OPT_ADDR: local = optarg; break;
+        case 's': cfg.server = true; break;
+        case 'c': host = optarg; break;
+        case 'u': cfg.udp = true; break;
+        case 'b': cfg.rate = strtoul(optarg, NULL, 0); break;
+        case 't': cfg.duration_ms = strtoul(optarg, NULL, 0) * 1000; break;
+        case 'l': cfg.len = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (!cfg.len)
+        cfg.len = cfg.udp ? IPERF_LEN_UDP : IPERF_LEN_TCP;
+    if (tap && (cfg.server == (host != NULL) || (host && !ipaddr_aton(host, &cfg.remote)))) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    lwip_init();
+    IP4_ADDR(&mask, 255, 255, 255, 0);
+    ip4_addr_set_zero(&gw);
+    if (tap) {
+        if (!ip4addr_aton(local, &addr) || tap_open(tap) != 0)
+            return 2;
+        bridge = true;
+        netif_add(&tap_netif, &addr, &mask, &gw, NULL, tap_init, ethernet_input);
+        netif_set_default(&tap_netif);
+        netif_set_up(&tap_netif);
+        netif_set_link_up(&tap_netif);
+        errors = run_bridge(&cfg);
+        tap_close();
+        return errors != 0;
+    }
+
+    IP4_ADDR(&addr, 10, 0, 0, 1);
+    netif_add(&wire_netif, &addr, &mask, &gw, NULL, wire_init, ip4_input);
+    netif_set_up(&wire_netif);
+    netif_set_link_up(&wire_netif);
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        errors += run(&scenarios[i]);
+    printf(errors ? "%d checks failed\n" : "all scenarios passed\n", errors);
+    return errors != 0;
+}
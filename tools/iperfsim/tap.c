@@ -0,0 +1,53 @@
+#include "tap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+static int fd = -1;
+
+int tap_open(const char *name)
+{
+    struct ifreq ifr;
+
+    fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        perror("/dev/net/tun");
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        perror(name);
+        tap_close();
+        return -1;
+    }
+    return 0;
+}
+
+int tap_read(void *frame, size_t size)
+{
+    ssize_t n = read(fd, frame, size);
+
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    return n;
+}
+
+int tap_write(const void *frame, size_t size)
+{
+    return write(fd, frame, size) == (ssize_t)size ? 0 : -1;
+}
+
+void tap_close(void)
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
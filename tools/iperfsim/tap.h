@@ -0,0 +1,20 @@
+/*
+ * A Linux TAP interface for the bridge mode of iperfsim: Ethernet frames between the lwIP stack and the host kernel,
+ * where a real iperf 2 runs. Kept out of main.c, the lwIP and the Linux network headers do not mix.
+ */
+#ifndef TAP_H
+#define TAP_H
+
+#include <stddef.h>
+
+/* an existing TAP interface (ip tuntap add), 0 or -1 */
+int tap_open(const char *name);
+
+/* a frame or 0 when none is waiting, does not block */
+int tap_read(void *frame, size_t size);
+
+int tap_write(const void *frame, size_t size);
+
+void tap_close(void);
+
+#endif
@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+"""
+Records of a datalog capture in a time window (format in Inc/datalog.h).
+
+A capture is a set of <prefix>NNNNN.log files made of 32K blocks: a header with
+the times of the first and last records, the records, and a trailer index of
+record offsets. Like the firmware's logcat command, the files and then the
+blocks are bisected on their times and the window is read from the trailer
+entry before it, so a window costs a few block reads whatever the capture size.
+
+    logcat.py log00003.log
+    logcat.py --from 3600 --to 3600.5 /media/sd/log
+    logcat.py --check /media/sd/log        every block and its CRC
+    logcat.py --from 10 --to 20 --data can.bin --source can /media/sd/log
+
+Times are seconds since the boot of the logging session.
+"""
+
+import argparse
+import glob
+import os
+import re
+import struct
+import sys
+import zlib
+
+BLOCK = 32 * 1024
+MAGIC = 0x31424C44  # "DLB1"
+HEADER = struct.Struct("<IIIIHHIII")
+RECORD = struct.Struct("<HBBI")
+INDEX = struct.Struct("<II")
+ENTRIES = 64
+TRAILER = ENTRIES * INDEX.size
+PAYLOAD = BLOCK - HEADER.size - TRAILER
+ALIGN = 8
+SOURCES = ["pad", "rs485", "can", "eth", "user"]
+
+
+class Block:
+    def __init__(self, raw):
+        (self.magic, self.seq, self.first, self.last, self.records, self.entries, self.used, self.crc,
+         _) = HEADER.unpack_from(raw)
+
+
+class LogFile:
+    def __init__(self, path):
+        self.path = path
+        self.f = open(path, "rb")
+        self.blocks = os.path.getsize(path) // BLOCK
+        self.reads = 0
+        self.seq0 = None
+        self._cache = {}
+
+    def header(self, i):
+        """header of block i, None past the end of the log"""
+        if i in self._cache:
+            return self._cache[i]
+        self.f.seek(i * BLOCK)
+        b = Block(self.f.read(HEADER.size))
+        self.reads += 1
+        if i == 0 and b.magic == MAGIC:
+            self.seq0 = b.seq
+        ok = (b.magic == MAGIC and b.records and b.used <= PAYLOAD and b.entries <= ENTRIES and
+              (i == 0 or (self.seq0 is not None and b.seq == self.seq0 + i)))
+        self._cache[i] = b if ok else None
+        return self._cache[i]
+
+    def first_time(self):
+        b = self.header(0) if self.blocks else None
+        return b.first if b else None
+
+    def block(self, i):
+        self.f.seek(i * BLOCK)
+        return self.f.read(BLOCK)
+
+    def close(self):
+        self.f.close()
+
+
+def records(raw, b, start=0):
+    payload = raw[HEADER.size:]
+    off = start
+    while off < b.used:
+        size, source, flags, time = RECORD.unpack_from(payload, off)
+        if size < RECORD.size or off + size > b.used:
+            raise ValueError("bad record at payload offset %d" % off)
+        yield time, source, payload[off + RECORD.size:off + size]
+        off += (size + ALIGN - 1) & ~(ALIGN - 1)
+
+
+def crc_ok(raw, b):
+    return zlib.crc32(raw[HEADER.size:HEADER.size + PAYLOAD + TRAILER]) == b.crc
+
+
+def start_offset(raw, b, start):
+    """payload offset of the last trailer entry before the window"""
+    off = 0
+    for e in range(b.entries):
+        time, offset = INDEX.unpack_from(raw, HEADER.size + PAYLOAD + e * INDEX.size)
+        if time >= start:
+            break
+        off = offset
+    return off if off < b.used else 0
+
+
+def window(lf, start, end, stats):
+    """records of a file with start <= time <= end, True once past the window"""
+    if not lf.blocks or lf.header(0) is None:
+        return False
+    if lf.header(0).first > end:
+        return True
+    lo, hi = 0, lf.blocks
+    while lo < hi:
+        mid = (lo + hi) // 2
+        b = lf.header(mid)
+        if b is not None and b.last < start:
+            lo = mid + 1
+        else:
+            hi = mid
+    for i in range(lo, lf.blocks):
+        b = lf.header(i)
+        if b is None:
+            return False
+        if b.first > end:
+            return True
+        raw = lf.block(i)
+        stats["blocks"] += 1
+        if not crc_ok(raw, b):
+            stats["bad"] += 1
+            print("%s: block %d: CRC error" % (lf.path, i), file=sys.stderr)
+            continue
+        for time, source, data in records(raw, b, start_offset(raw, b, start) if start > b.first else 0):
+            if time < start:
+                continue
+            if time > end:
+                return True
+            yield_record(time, source, data, stats)
+    return False
+
+
+def yield_record(time, source, data, stats):
+    if stats["source"] is not None and source != stats["source"]:
+        return
+    stats["records"] += 1
+    if stats["out"]:
+        stats["out"].write(data)
+    if not stats["quiet"]:
+        name = SOURCES[source] if source < len(SOURCES) else "?"
+        text = " ".join("%02x" % c for c in data[:16])
+        print("%6d.%03d %-5s %4d  %s%s" % (time // 1000, time % 1000, name, len(data), text,
+                                          " ..." if len(data) > 16 else ""))
+
+
+def files_of(name):
+    if name.endswith(".log"):
+        return [name]
+    found = []
+    for path in glob.glob(glob.escape(name) + "?????.log"):
+        m = re.search(r"(\d{5})\.log$", path)
+        if m:
+            found.append((int(m.group(1)), path))
+    return [p for _, p in sorted(found)]
+
+
+def check(paths):
+    bad = 0
+    for path in paths:
+        lf = LogFile(path)
+        n = 0
+        for i in range(lf.blocks):
+            b = lf.header(i)
+            if b is None:
+                break
+            raw = lf.block(i)
+            if not crc_ok(raw, b):
+                print("%s: block %d: CRC error" % (path, i))
+                bad += 1
+                continue
+            count = sum(1 for _ in records(raw, b))
+            if count != b.records:
+                print("%s: block %d: %d records, header says %d" % (path, i, count, b.records))
+                bad += 1
+            n += 1
+        print("%s: %d blocks of %d, seq %s" % (path, n, lf.blocks, lf.seq0))
+        lf.close()
+    return bad
+
+
+def parse_time(s):
+    return int(round(float(s) * 1000))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("name", help="a .log file or the path and prefix of a capture")
+    ap.add_argument("--from", dest="start", type=parse_time, default=0, help="seconds")
+    ap.add_argument("--to", dest="end", type=parse_time, default=0xFFFFFFFF, help="seconds")
+    ap.add_argument("--source", choices=SOURCES[1:], help="only the records of a source")
+    ap.add_argument("--data", help="write the record data to a file")
+    ap.add_argument("-q", "--quiet", action="store_true", help="count only")
+    ap.add_argument("--check", action="store_true", help="read every block and check its CRC")
+    args = ap.parse_args()
+
+    paths = files_of(args.name)
+    if not paths:
+        sys.exit("%s: no log files" % args.name)
+    if args.check:
+        sys.exit(1 if check(paths) else 0)
+
+    files = [LogFile(p) for p in paths]
+    # the last file starting before the window, one without a first block counts as later
+    lo, hi = 0, len(files) - 1
+    while lo < hi:
+        mid = (lo + hi + 1) // 2
+        t = files[mid].first_time()
+        if t is not None and t <= args.start:
+            lo = mid
+        else:
+            hi = mid - 1
+
+    stats = {"records": 0, "blocks": 0, "bad": 0, "quiet": args.quiet,
+             "source": SOURCES.index(args.source) if args.source else None,
+             "out": open(args.data, "wb") if args.data else None}
+    for lf in files[lo:]:
+        if window(lf, args.start, args.end, stats):
+            break
+    if stats["out"]:
+        stats["out"].close()
+    headers = sum(lf.reads for lf in files)
+    print("%d records: %d headers and %d blocks read in %d files%s" %
+          (stats["records"], headers, stats["blocks"], len(files),
+           ", %d bad blocks" % stats["bad"] if stats["bad"] else ""), file=sys.stderr)
+    for lf in files:
+        lf.close()
+    sys.exit(1 if stats["bad"] else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""
+Pick the code to copy to ITCM from a PC-sampling run.
+
+Maps every sampled PC (pcsample.tcl) to the input section holding it using the
+linker map of the same build, then writes the hottest sections to an
+itcm_hot.ld fragment until the ITCM budget is used. Sections are ranked by
+samples per byte, so a small hot function wins over a large warm one.
+
+    hotlist.py build/h7testbed.map pcs.txt -o itcm_hot.ld
+
+Interrupt handlers, memcpy and the CRC routines are kept whatever their sample
+count (--keep adds patterns, --no-default-keep drops these), they sit on
+latency-critical paths a sampling run rarely catches.
+"""
+
+import argparse
+import bisect
+import fnmatch
+import os
+import re
+import sys
+
+DEFAULT_KEEP = [".text.*_IRQHandler", ".text.SysTick_Handler", ".text.*memcpy*", "*memcpy*", ".text.crc32*"]
+
+SINGLE = re.compile(r"^ (\.\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+NAME = re.compile(r"^ (\.\S+)$")
+CONT = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+ARCHIVE = re.compile(r"^(.*\.a)\((.*)\)$")
+
+
+class Section:
+    def __init__(self, name, addr, size, origin):
+        self.name = name
+        self.addr = addr
+        self.size = size
+        self.origin = origin
+        self.samples = 0
+
+    def pattern(self):
+        """linker script input section description selecting this section only"""
+        m = ARCHIVE.match(self.origin)
+        if m:
+            return "*%s:%s(%s)" % (os.path.basename(m.group(1)), m.group(2), self.name)
+        if self.name in (".text", ".itcm"):
+            # no -ffunction-sections (assembly), qualify with the object
+            return "*%s(%s)" % (os.path.basename(self.origin), self.name)
+        return "*(%s)" % self.name
+
+
+def parse_map(path):
+    """code input sections (.text*, .itcm*) placed by the link"""
+    sections = []
+    pending = None
+    in_map = False
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("Linker script and memory map"):
+                in_map = True
+                continue
+            if not in_map:
+                continue
+            m = SINGLE.match(line)
+            if m:
+                name, addr, size, origin = m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)
+                pending = None
+            else:
+                m = NAME.match(line)
+                if m:
+                    pending = m.group(1)
+                    continue
+                m = CONT.match(line)
+                if not (m and pending):
+                    pending = None
+                    continue
+                name, addr, size, origin = pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3)
+                pending = None
+            if size and (name.startswith(".text") or name.startswith(".itcm")):
+                sections.append(Section(name, addr, size, origin))
+    sections.sort(key=lambda s: s.addr)
+    return sections
+
+
+def load_samples(paths):
+    pcs = []
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if line:
+                    pcs.append(int(line, 0) & ~1)
+    return pcs
+
+
+def assign(sections, pcs):
+    starts = [s.addr for s in sections]
+    unknown = 0
+    for pc in pcs:
+        i = bisect.bisect_right(starts, pc) - 1
+        if i >= 0 and pc < sections[i].addr + sections[i].size:
+            sections[i].samples += 1
+        else:
+            unknown += 1
+    return unknown
+
+
+def keep_match(section, patterns):
+    return any(fnmatch.fnmatch(section.name, p) or fnmatch.fnmatch(section.origin, p) for p in patterns)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("map", help="linker map of the profiled build")
+    ap.add_argument("samples", nargs="+", help="PC sample files from pcsample.tcl")
+    ap.add_argument("-o", "--output", default="-", help="itcm_hot.ld fragment to write (default stdout)")
+    ap.add_argument("--budget", type=int, default=56 * 1024,
+                    help="bytes of ITCM for the hot list, the rest is left to ITCM_FUNC (default 56K)")
+    ap.add_argument("--min-share", type=float, default=0.001,
+                    help="ignore sections with a smaller share of the samples (default 0.1%%)")
+    ap.add_argument("--keep", action="append", default=[], help="section or object pattern always kept")
+    ap.add_argument("--no-default-keep", action="store_true", help="do not keep ISRs, memcpy and CRC by default")
+    args = ap.parse_args()
+
+    sections = parse_map(args.map)
+    pcs = load_samples(args.samples)
+    if not pcs:
+        sys.exit("no samples")
+    unknown = assign(sections, pcs)
+
+    keep = args.keep + ([] if args.no_default_keep else DEFAULT_KEEP)
+    chosen = []
+    used = 0
+    seen = set()
+    for s in sections:
+        if keep_match(s, keep) and s.pattern() not in seen:
+            chosen.append(s)
+            seen.add(s.pattern())
+            used += s.size
+    hot = [s for s in sections if s.samples >= max(1, args.min_share * len(pcs)) and s.pattern() not in seen]
+    hot.sort(key=lambda s: s.samples / s.size, reverse=True)
+    for s in hot:
+        if used + s.size > args.budget or s.pattern() in seen:
+            continue
+        chosen.append(s)
+        seen.add(s.pattern())
+        used += s.size
+    if used > args.budget:
+        sys.stderr.write("warning: kept sections alone use %d of %d bytes\n" % (used, args.budget))
+
+    covered = sum(s.samples for s in chosen)
+    out = sys.stdout if args.output == "-" else open(args.output, "w")
+    out.write("/*\n")
+    out.write(" * Input sections copied to ITCM in XIP builds (STM32H750VBTx_QSPI.ld).\n")
+    out.write(" *\n")
+    out.write(" * Generated by tools/pcsample/hotlist.py from %d samples (%d outside code):\n" % (len(pcs), unknown))
+    out.write(" * %d sections, %d bytes, %.1f%% of the samples.\n" % (len(chosen), used, 100.0 * covered / len(pcs)))
+    out.write(" */\n\n")
+    for s in chosen:
+        out.write("%-60s /* %6d samples, %5d bytes */\n" % (s.pattern(), s.samples, s.size))
+    if out is not sys.stdout:
+        out.close()
+    sys.stderr.write("%d sections, %d bytes, %.1f%% of %d samples\n" % (len(chosen), used,
+                                                                         100.0 * covered / len(pcs), len(pcs)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,33 @@
+# Statistical profile of the running firmware: reads the DWT program counter
+# sample register without halting the core and writes one PC per line.
+#
+#   openocd -f interface/cmsis-dap.cfg -f target/stm32h7x.cfg \
+#           -c "set output pcs.txt" -c "set samples 20000" -f tools/pcsample/pcsample.tcl
+#
+# Feed the result to hotlist.py to regenerate itcm_hot.ld.
+
+if {![info exists output]} { set output pcs.txt }
+if {![info exists samples]} { set samples 20000 }
+
+set DEMCR 0xE000EDFC
+set DWT_PCSR 0xE000101C
+
+init
+
+# DWT reads as zero until trace is enabled (DEMCR.TRCENA)
+mww $DEMCR [expr {[mrw $DEMCR] | (1 << 24)}]
+
+set f [open $output w]
+set kept 0
+for {set i 0} {$i < $samples} {incr i} {
+    set pc [mrw $DWT_PCSR]
+    # 0xFFFFFFFF: core halted or sleeping
+    if {$pc != 0xFFFFFFFF} {
+        puts $f [format "0x%08X" $pc]
+        incr kept
+    }
+}
+close $f
+
+puts "$kept of $samples samples written to $output"
+shutdown
@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+"""
+Pack a QSPI image for qspiloader (format in Inc/qspipack.h).
+
+The image is cut in 64K chunks, the unit qspiloader erases and programs. A
+chunk made of a single byte value (erased flash, padding) is stored as a fill
+and costs nothing to transfer; other chunks are stored as an LZ4 block when it
+is smaller, raw otherwise.
+
+    qspipack.py build/h7testbed.bin build/h7testbed.qpk
+    qspipack.py --unpack build/h7testbed.qpk out.bin
+
+With --base, a table of CRC-32 per 4K sector of the flash (the loader's
+MAILBOX_HASH answer, little-endian words) makes a delta image: 4K chunks, and
+the ones the flash already holds are stored as skips, neither sent nor
+rewritten. Unpacking a delta image needs the image it was made against:
+
+    qspipack.py --base hashes.bin build/h7testbed.bin build/h7testbed.qpk
+    qspipack.py --unpack --base old.bin build/h7testbed.qpk out.bin
+
+Plain Python, no lz4 module needed: the compressor is a greedy single-probe
+hash matcher, worse than lz4 -9 but plenty for semihosting speeds.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = 0x314B5051  # "QPK1"
+RAW, LZ4, FILL, SKIP = 0, 1, 2, 3
+BASE_CHUNK_LOG2 = 12  # MAILBOX_HASH_SECTOR
+HEADER = struct.Struct("<IIIHHI")
+CHUNK = struct.Struct("<BBHII")
+
+MIN_MATCH = 4
+LAST_LITERALS = 5     # the last 5 bytes are always literals
+MF_LIMIT = 12         # no match starts in the last 12 bytes
+MAX_OFFSET = 65535
+HASH_BITS = 16
+
+
+def lz4_compress(data):
+    n = len(data)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+
+    def put_length(length):
+        while length >= 255:
+            out.append(255)
+            length -= 255
+        out.append(length)
+
+    def emit(literals_end, match_len, offset):
+        lit = literals_end - anchor
+        token = (min(lit, 15) << 4) | (min(match_len - MIN_MATCH, 15) if match_len else 0)
+        out.append(token)
+        if lit >= 15:
+            put_length(lit - 15)
+        out.extend(data[anchor:literals_end])
+        if match_len:
+            out.extend(struct.pack("<H", offset))
+            if match_len - MIN_MATCH >= 15:
+                put_length(match_len - MIN_MATCH - 15)
+
+    limit = n - MF_LIMIT
+    while i < limit:
+        key = data[i:i + 4]
+        cand = table.get(key)
+        table[key] = i
+        if cand is None or i - cand > MAX_OFFSET:
+            i += 1
+            continue
+        # extend the match, keeping the last literals out of it
+        end = n - LAST_LITERALS
+        m = i + MIN_MATCH
+        c = cand + MIN_MATCH
+        while m < end and data[m] == data[c]:
+            m += 1
+            c += 1
+        emit(i, m - i, i - cand)
+        i = m
+        anchor = m
+    # last literals
+    emit(n, 0, 0)
+    return bytes(out)
+
+
+def lz4_decompress(src, size):
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                b = src[i]
+                i += 1
+                lit += b
+                if b != 255:
+                    break
+        out += src[i:i + lit]
+        i += lit
+        if i >= len(src):
+            break
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+        length = token & 15
+        if length == 15:
+            while True:
+                b = src[i]
+                i += 1
+                length += b
+                if b != 255:
+                    break
+        length += MIN_MATCH
+        start = len(out) - offset
+        for k in range(length):
+            out.append(out[start + k])
+    if len(out) != size:
+        raise ValueError("LZ4 block decodes to %d bytes, expected %d" % (len(out), size))
+    return bytes(out)
+
+
+def crc32(data):
+    return zlib.crc32(data) & 0xFFFFFFFF
+
+
+def pack(image, chunk_log2, base=None):
+    chunk_size = 1 << chunk_log2
+    table = []
+    payload = bytearray()
+    for off in range(0, len(image), chunk_size):
+        chunk = image[off:off + chunk_size]
+        n = off >> chunk_log2
+        if base is not None and n < len(base) and base[n] == crc32(chunk):
+            table.append((SKIP, 0, 0, crc32(chunk)))
+            continue
+        if chunk.count(chunk[0]) == len(chunk):
+            table.append((FILL, chunk[0], 0, crc32(chunk)))
+            continue
+        packed = lz4_compress(chunk)
+        if len(packed) < len(chunk):
+            table.append((LZ4, 0, len(packed), crc32(chunk)))
+            payload += packed
+        else:
+            table.append((RAW, 0, len(chunk), crc32(chunk)))
+            payload += chunk
+    if len(table) > 0xFFFF:
+        raise ValueError("too many chunks")
+    entries = b"".join(CHUNK.pack(t, fill, 0, stored, crc) for t, fill, stored, crc in table)
+    header = HEADER.pack(MAGIC, len(image), crc32(image), chunk_log2, len(table), 0)
+    header = HEADER.pack(MAGIC, len(image), crc32(image), chunk_log2, len(table), crc32(header + entries))
+    return header + entries + bytes(payload), table
+
+
+def unpack(blob, base=None):
+    magic, size, image_crc, chunk_log2, count, header_crc = HEADER.unpack_from(blob)
+    if magic != MAGIC:
+        raise ValueError("not a packed image")
+    entries = blob[HEADER.size:HEADER.size + count * CHUNK.size]
+    if crc32(HEADER.pack(magic, size, image_crc, chunk_log2, count, 0) + entries) != header_crc:
+        raise ValueError("header CRC mismatch")
+    chunk_size = 1 << chunk_log2
+    out = bytearray()
+    pos = HEADER.size + len(entries)
+    for n in range(count):
+        t, fill, _, stored, crc = CHUNK.unpack_from(entries, n * CHUNK.size)
+        length = min(chunk_size, size - n * chunk_size)
+        data = blob[pos:pos + stored]
+        pos += stored
+        if t == FILL:
+            chunk = bytes([fill]) * length
+        elif t == SKIP:
+            if base is None:
+                raise ValueError("delta image, the base image is needed")
+            chunk = base[n * chunk_size:n * chunk_size + length]
+        elif t == LZ4:
+            chunk = lz4_decompress(data, length)
+        else:
+            chunk = data
+        if crc32(chunk) != crc:
+            raise ValueError("chunk %d CRC mismatch" % n)
+        out += chunk
+    if crc32(out) != image_crc:
+        raise ValueError("image CRC mismatch")
+    return bytes(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input")
+    ap.add_argument("output")
+    ap.add_argument("--chunk-log2", type=int, default=16, help="chunk size, must not exceed the loader's (default 16)")
+    ap.add_argument("--unpack", action="store_true", help="unpack a packed image")
+    ap.add_argument("--base", help="flash sector hashes to pack against, or the base image to unpack with")
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        blob = f.read()
+    base = None
+    if args.base:
+        with open(args.base, "rb") as f:
+            base = f.read()
+    if args.unpack:
+        image = unpack(blob, base)
+        with open(args.output, "wb") as f:
+            f.write(image)
+        return
+    if not blob:
+        sys.exit("empty image")
+
+    if base is not None:
+        if len(base) % 4:
+            sys.exit("%s: not a table of CRC-32 words" % args.base)
+        base = struct.unpack("<%dI" % (len(base) // 4), base)
+        args.chunk_log2 = BASE_CHUNK_LOG2
+    packed, table = pack(blob, args.chunk_log2, base)
+    # the loader trusts the table, check the packer against its own decoder (skipped chunks are the image's own)
+    if unpack(packed, blob) != blob:
+        sys.exit("internal error: packed image does not unpack")
+    with open(args.output, "wb") as f:
+        f.write(packed)
+    kinds = [sum(1 for t in table if t[0] == k) for k in (RAW, LZ4, FILL, SKIP)]
+    print("%s: %d -> %d bytes (%.1f%%), %d chunks: %d raw, %d lz4, %d fill, %d unchanged" %
+          (args.output, len(blob), len(packed), 100.0 * len(packed) / len(blob), len(table), *kinds))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""
+Send an XIP image to the testbed's in-application update (Inc/update.h).
+
+Start `update tcp` or `update usb` on the board console first, it tells the
+slot it writes; the image must be linked for it (make XIP=1 SLOT=a|b). The
+stream is a 12-byte header (magic, size, CRC-32) and the plain binary, the
+board answers one line once the slot is verified and selected:
+
+    qspiupdate.py --tcp 192.168.1.10 build-xip-b/h7testbed.bin
+    qspiupdate.py --serial /dev/ttyACM0 build-xip/h7testbed.bin
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = 0x44505551  # "QUPD"
+TCP_PORT = 5555
+HEADER = struct.Struct("<III")
+BLOCK = 4096
+REPLY_TIMEOUT = 60  # the slot is read back and the boot record written after the last byte
+
+
+def progress(pos, total, start):
+    sent = max(min(pos, total + HEADER.size) - HEADER.size, 0)
+    rate = sent / max(time.time() - start, 1e-3) / 1024
+    sys.stderr.write("\r%d/%d bytes, %.0f KiB/s" % (sent, total, rate))
+
+
+def send_tcp(target, stream, size):
+    host, _, port = target.partition(":")
+    sock = socket.create_connection((host, int(port) if port else TCP_PORT), timeout=10)
+    start = time.time()
+    for pos in range(0, len(stream), BLOCK):
+        sock.sendall(stream[pos:pos + BLOCK])
+        progress(pos + BLOCK, size, start)
+    sys.stderr.write("\n")
+    sock.settimeout(REPLY_TIMEOUT)
+    reply = b""
+    while not reply.endswith(b"\n"):
+        data = sock.recv(256)
+        if not data:
+            break
+        reply += data
+    sock.close()
+    return reply.decode(errors="replace").strip()
+
+
+def send_serial(device, stream, size):
+    # CDC ACM: no baud rate, the board holds the endpoint (NAK) while its buffers are full
+    fd = os.open(device, os.O_RDWR | os.O_NOCTTY)
+    try:
+        import termios
+        import tty
+        tty.setraw(fd)
+        termios.tcflush(fd, termios.TCIOFLUSH)
+    except (ImportError, OSError):
+        pass
+    start = time.time()
+    for pos in range(0, len(stream), BLOCK):
+        view = memoryview(stream)[pos:pos + BLOCK]
+        while view:
+            view = view[os.write(fd, view):]
+        progress(pos + BLOCK, size, start)
+    sys.stderr.write("\n")
+    reply = b""
+    deadline = time.time() + REPLY_TIMEOUT
+    os.set_blocking(fd, False)
+    while not reply.endswith(b"\n") and time.time() < deadline:
+        try:
+            reply += os.read(fd, 256)
+        except BlockingIOError:
+            time.sleep(0.05)
+    os.close(fd)
+    return reply.decode(errors="replace").strip()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("image", help="plain binary of the XIP image")
+    group = ap.add_mutually_exclusive_group(required=True)
+    group.add_argument("--tcp", metavar="HOST[:PORT]", help="board address, port %d by default" % TCP_PORT)
+    group.add_argument("--serial", metavar="DEVICE", help="USB CDC device of the board")
+    args = ap.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    if not image:
+        sys.exit("empty image")
+    stream = HEADER.pack(MAGIC, len(image), zlib.crc32(image) & 0xFFFFFFFF) + image
+    if args.tcp:
+        reply = send_tcp(args.tcp, stream, len(image))
+    else:
+        reply = send_serial(args.serial, stream, len(image))
+    print(reply or "no reply")
+    if not reply.startswith("OK"):
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()